@@ -6,40 +6,82 @@
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
 ../Src/aes.c \
+../Src/clock.c \
 ../Src/config.c \
+../Src/crc.c \
 ../Src/keypad.c \
+../Src/keypad_cal.c \
+../Src/led.c \
 ../Src/main.c \
+../Src/pin_entry.c \
+../Src/profile.c \
 ../Src/rfid.c \
+../Src/rfid_cal.c \
+../Src/rfid_health.c \
+../Src/rfid_poll.c \
+../Src/rfid_presence.c \
+../Src/scheduler.c \
 ../Src/secure_lock.c \
 ../Src/sha256.c \
+../Src/spi_dma.c \
+../Src/storage.c \
 ../Src/syscalls.c \
 ../Src/sysmem.c \
+../Src/trace.c \
 ../Src/utils.c \
 ../Src/wifi.c 
 
 OBJS += \
 ./Src/aes.o \
+./Src/clock.o \
 ./Src/config.o \
+./Src/crc.o \
 ./Src/keypad.o \
+./Src/keypad_cal.o \
+./Src/led.o \
 ./Src/main.o \
+./Src/pin_entry.o \
+./Src/profile.o \
 ./Src/rfid.o \
+./Src/rfid_cal.o \
+./Src/rfid_health.o \
+./Src/rfid_poll.o \
+./Src/rfid_presence.o \
+./Src/scheduler.o \
 ./Src/secure_lock.o \
 ./Src/sha256.o \
+./Src/spi_dma.o \
+./Src/storage.o \
 ./Src/syscalls.o \
 ./Src/sysmem.o \
+./Src/trace.o \
 ./Src/utils.o \
 ./Src/wifi.o 
 
 C_DEPS += \
 ./Src/aes.d \
+./Src/clock.d \
 ./Src/config.d \
+./Src/crc.d \
 ./Src/keypad.d \
+./Src/keypad_cal.d \
+./Src/led.d \
 ./Src/main.d \
+./Src/pin_entry.d \
+./Src/profile.d \
 ./Src/rfid.d \
+./Src/rfid_cal.d \
+./Src/rfid_health.d \
+./Src/rfid_poll.d \
+./Src/rfid_presence.d \
+./Src/scheduler.d \
 ./Src/secure_lock.d \
 ./Src/sha256.d \
+./Src/spi_dma.d \
+./Src/storage.d \
 ./Src/syscalls.d \
 ./Src/sysmem.d \
+./Src/trace.d \
 ./Src/utils.d \
 ./Src/wifi.d 
 
@@ -51,7 +93,7 @@ Src/%.o Src/%.su Src/%.cyclo: ../Src/%.c Src/subdir.mk
 clean: clean-Src
 
 clean-Src:
-	-$(RM) ./Src/aes.cyclo ./Src/aes.d ./Src/aes.o ./Src/aes.su ./Src/config.cyclo ./Src/config.d ./Src/config.o ./Src/config.su ./Src/keypad.cyclo ./Src/keypad.d ./Src/keypad.o ./Src/keypad.su ./Src/main.cyclo ./Src/main.d ./Src/main.o ./Src/main.su ./Src/rfid.cyclo ./Src/rfid.d ./Src/rfid.o ./Src/rfid.su ./Src/secure_lock.cyclo ./Src/secure_lock.d ./Src/secure_lock.o ./Src/secure_lock.su ./Src/sha256.cyclo ./Src/sha256.d ./Src/sha256.o ./Src/sha256.su ./Src/syscalls.cyclo ./Src/syscalls.d ./Src/syscalls.o ./Src/syscalls.su ./Src/sysmem.cyclo ./Src/sysmem.d ./Src/sysmem.o ./Src/sysmem.su ./Src/utils.cyclo ./Src/utils.d ./Src/utils.o ./Src/utils.su ./Src/wifi.cyclo ./Src/wifi.d ./Src/wifi.o ./Src/wifi.su
+	-$(RM) ./Src/aes.cyclo ./Src/aes.d ./Src/aes.o ./Src/aes.su ./Src/clock.cyclo ./Src/clock.d ./Src/clock.o ./Src/clock.su ./Src/config.cyclo ./Src/config.d ./Src/config.o ./Src/config.su ./Src/crc.cyclo ./Src/crc.d ./Src/crc.o ./Src/crc.su ./Src/keypad.cyclo ./Src/keypad.d ./Src/keypad.o ./Src/keypad.su ./Src/keypad_cal.cyclo ./Src/keypad_cal.d ./Src/keypad_cal.o ./Src/keypad_cal.su ./Src/led.cyclo ./Src/led.d ./Src/led.o ./Src/led.su ./Src/main.cyclo ./Src/main.d ./Src/main.o ./Src/main.su ./Src/pin_entry.cyclo ./Src/pin_entry.d ./Src/pin_entry.o ./Src/pin_entry.su ./Src/profile.cyclo ./Src/profile.d ./Src/profile.o ./Src/profile.su ./Src/rfid.cyclo ./Src/rfid.d ./Src/rfid.o ./Src/rfid.su ./Src/rfid_cal.cyclo ./Src/rfid_cal.d ./Src/rfid_cal.o ./Src/rfid_cal.su ./Src/rfid_health.cyclo ./Src/rfid_health.d ./Src/rfid_health.o ./Src/rfid_health.su ./Src/rfid_poll.cyclo ./Src/rfid_poll.d ./Src/rfid_poll.o ./Src/rfid_poll.su ./Src/rfid_presence.cyclo ./Src/rfid_presence.d ./Src/rfid_presence.o ./Src/rfid_presence.su ./Src/scheduler.cyclo ./Src/scheduler.d ./Src/scheduler.o ./Src/scheduler.su ./Src/secure_lock.cyclo ./Src/secure_lock.d ./Src/secure_lock.o ./Src/secure_lock.su ./Src/sha256.cyclo ./Src/sha256.d ./Src/sha256.o ./Src/sha256.su ./Src/spi_dma.cyclo ./Src/spi_dma.d ./Src/spi_dma.o ./Src/spi_dma.su ./Src/storage.cyclo ./Src/storage.d ./Src/storage.o ./Src/storage.su ./Src/syscalls.cyclo ./Src/syscalls.d ./Src/syscalls.o ./Src/syscalls.su ./Src/sysmem.cyclo ./Src/sysmem.d ./Src/sysmem.o ./Src/sysmem.su ./Src/trace.cyclo ./Src/trace.d ./Src/trace.o ./Src/trace.su ./Src/utils.cyclo ./Src/utils.d ./Src/utils.o ./Src/utils.su ./Src/wifi.cyclo ./Src/wifi.d ./Src/wifi.o ./Src/wifi.su
 
 .PHONY: clean-Src
 
@@ -0,0 +1,130 @@
+// Checks the firmware's CRC_A/CRC_B (Src/crc.c) against the worked
+// examples of ISO/IEC 14443-3 Annex B, the CRC catalogue check values and
+// a bit-at-a-time reference, then with -b times the table against the
+// reference. Cycles are TSC ticks on x86 hosts; elsewhere only ns/byte is
+// printed.
+//
+//   crc_test [-b]
+
+#include "crc.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#else
+#define HAVE_TSC 0
+#endif
+
+typedef struct {
+    const char *name;
+    uint8_t data[16];
+    size_t length;
+    uint8_t b;                  // CRC_B rather than CRC_A
+    uint16_t crc;
+} crc_vector_t;
+
+static const crc_vector_t vectors[] = {
+    {"Annex B CRC_A 00 00",       {0x00, 0x00}, 2, 0, 0x1EA0},
+    {"Annex B CRC_A 12 34",       {0x12, 0x34}, 2, 0, 0xCF26},
+    {"HLTA",                      {0x50, 0x00}, 2, 0, 0xCD57},
+    {"Annex B CRC_B 00 00 00",    {0x00, 0x00, 0x00}, 3, 1, 0xC6CC},
+    {"Annex B CRC_B 0F AA FF",    {0x0F, 0xAA, 0xFF}, 3, 1, 0xD1FC},
+    {"Annex B CRC_B 0A 12 34 56", {0x0A, 0x12, 0x34, 0x56}, 4, 1, 0xF62C},
+    {"CRC-16/ISO-IEC-14443-3-A check", "123456789", 9, 0, 0xBF05},
+    {"CRC-16/IBM-SDLC check",     "123456789", 9, 1, 0x906E},
+    {"empty CRC_A",               {0}, 0, 0, CRC_A_PRESET},
+};
+
+static int failures = 0;
+
+static void Check(const char *name, int ok) {
+    printf("%s %s\n", ok ? "PASS" : "FAIL", name);
+    if (!ok) failures++;
+}
+
+static uint16_t Reference(uint16_t crc, const uint8_t *data, size_t length) {
+    while (length--) {
+        crc ^= *data++;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+static uint64_t NowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t NowCycles(void) {
+#if HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static volatile uint16_t sink;
+
+static void Bench(const char *name, uint16_t (*crc)(uint16_t, const uint8_t *, size_t),
+                  const uint8_t *data, size_t length, uint32_t rounds) {
+    uint64_t ns = NowNs();
+    uint64_t cycles = NowCycles();
+    for (uint32_t i = 0; i < rounds; i++) {
+        sink = crc((uint16_t)i, data, length);
+    }
+    cycles = NowCycles() - cycles;
+    ns = NowNs() - ns;
+
+    double bytes = (double)length * rounds;
+    printf("%-10s %5zu-byte frames  %7.3f ns/byte", name, length, ns / bytes);
+    if (HAVE_TSC) printf("  %7.3f cycles/byte", cycles / bytes);
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+        const crc_vector_t *v = &vectors[i];
+        uint16_t crc = v->b ? CRC_CalculateB(v->data, v->length)
+                            : CRC_CalculateA(v->data, v->length);
+        Check(v->name, crc == v->crc);
+    }
+
+    // Table against bit-at-a-time over every length and start value
+    uint8_t data[256];
+    int agree = 1;
+    for (size_t i = 0; i < sizeof(data); i++) data[i] = (uint8_t)(i * 37 + 11);
+    for (size_t length = 0; length <= sizeof(data); length++) {
+        uint16_t preset = (uint16_t)(length * 0x0101 ^ CRC_A_PRESET);
+        if (CRC_Update(preset, data, length) != Reference(preset, data, length)) agree = 0;
+    }
+    Check("table matches bitwise reference", agree);
+
+    // A frame with its CRC_A appended checks out; any flipped bit does not
+    uint8_t frame[9] = {0x93, 0x70, 0xDE, 0xAD, 0xBE, 0xEF, 0x22};
+    size_t length = CRC_AppendA(frame, 7);
+    int detected = 1;
+    for (size_t bit = 0; bit < length * 8; bit++) {
+        frame[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+        if (CRC_CheckA(frame, length)) detected = 0;
+        frame[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+    }
+    Check("appended CRC_A checks", length == 9 && CRC_CheckA(frame, length));
+    Check("single-bit errors detected", detected);
+    Check("short frame rejected", !CRC_CheckA(frame, 1));
+
+    if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+        // SELECT-sized frames as the driver sends them, and a long buffer
+        Bench("table", CRC_Update, data, 7, 2000000);
+        Bench("bitwise", Reference, data, 7, 2000000);
+        Bench("table", CRC_Update, data, sizeof(data), 100000);
+        Bench("bitwise", Reference, data, sizeof(data), 100000);
+    }
+
+    printf("%d failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,95 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Host simulation internals. Virtual time is kept in nanoseconds; the
+// core advances it on every peripheral access and every PRIMASK toggle,
+// steps the models to their next event and dispatches interrupts in
+// between, the way the target would take them.
+
+#define SIM_NS_PER_US              1000ULL
+#define SIM_NS_PER_MS              1000000ULL
+#define SIM_NS_PER_S               1000000000ULL
+#define SIM_NEVER                  UINT64_MAX
+
+#define SIM_MS(ns)                 ((double)(ns) / (double)SIM_NS_PER_MS)
+
+// ==================== CORE (sim_core.c) ====================
+
+extern int sim_verbose;         // 0: summary only, 1: timeline, 2: firmware debug
+
+uint64_t Sim_Now(void);
+void Sim_Advance(uint64_t ns);
+void Sim_SetPending(uint8_t irqn);
+
+uint32_t Sim_GetHCLK(void);
+uint32_t Sim_GetPCLK1(void);
+uint32_t Sim_GetPCLK2(void);
+void Sim_SetHSEPresent(uint8_t present);
+void Sim_SetSpiLinkLimit(uint32_t hz);
+
+// Called by the ESP8266 model when a byte reaches the USART2 RX pin
+void Sim_UsartDeliver(uint8_t c);
+
+void Sim_Log(const char *format, ...) __attribute__((format(printf, 1, 2)));
+void Sim_Fail(const char *format, ...) __attribute__((format(printf, 1, 2), noreturn));
+void Sim_Report(FILE *out);
+
+// ==================== MFRC522 (sim_mfrc522.c) ====================
+
+#define SIM_RC522_MAX_CARDS        16
+#define SIM_RC522_MAX_UID          10
+#define SIM_RC522_MAX_FAULTS       8
+
+typedef enum {
+    SIM_RC522_BROWNOUT = 0,
+    SIM_RC522_LATCHUP
+} sim_rc522_fault_t;
+
+void SimRc522_Reset(void);
+void SimRc522_SetResetPin(uint8_t level);
+void SimRc522_SetSelect(uint8_t selected);
+int SimRc522_IrqPin(void);
+uint8_t SimRc522_Transfer(uint8_t mosi, uint32_t sck_hz);
+uint64_t SimRc522_NextEvent(void);
+void SimRc522_Update(uint64_t now);
+uint8_t SimRc522_AddCard(const uint8_t *uid, uint8_t uid_len, uint64_t enter, uint64_t leave);
+void SimRc522_SetLatency(uint32_t us);
+void SimRc522_SetRfLoss(int32_t db);
+uint8_t SimRc522_AddFault(uint64_t at, sim_rc522_fault_t type);
+void SimRc522_Report(FILE *out);
+
+// ==================== KEYPAD (sim_keypad.c) ====================
+
+#define SIM_KEYPAD_MAX_PRESSES     256
+
+uint8_t SimKeypad_Press(char key, uint64_t at, uint64_t hold);
+void SimKeypad_SetBounce(uint32_t us);
+uint8_t SimKeypad_RowsLow(uint64_t now, uint32_t moder, uint32_t odr);
+uint64_t SimKeypad_NextEvent(uint64_t now);
+void SimKeypad_Report(FILE *out);
+
+// ==================== ESP8266 (sim_esp8266.c) ====================
+
+void SimEsp_SetLatency(uint32_t us);
+void SimEsp_SetTracePath(const char *path);
+void SimEsp_Receive(uint8_t c);
+void SimEsp_SendLine(const char *text);
+uint64_t SimEsp_NextEvent(void);
+void SimEsp_Update(uint64_t now);
+void SimEsp_Report(FILE *out);
+
+// ==================== SCENARIO (sim_script.c) ====================
+
+uint8_t SimScript_Load(const char *path);
+uint64_t SimScript_NextEvent(uint64_t now);
+void SimScript_Update(uint64_t now);
+uint8_t SimScript_ButtonPressed(uint64_t now);
+void SimScript_RecordLog(uint64_t now, const char *text);
+void SimScript_RecordDetect(const uint8_t *uid, uint8_t uid_len, uint64_t latency);
+void SimScript_RecordAnticollision(uint64_t now);
+void SimScript_Finish(void) __attribute__((noreturn));
+
+#endif // SIM_H
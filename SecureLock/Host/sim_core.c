@@ -0,0 +1,1105 @@
+#include "stm32f407xx_registers.h"
+#include "sim.h"
+#include "config.h"
+#include "secure_lock.h"
+#include "utils.h"
+#include <signal.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Peripheral register blocks (see sim_periph.h)
+RCC_TypeDef       sim_rcc;
+GPIO_TypeDef      sim_gpio[8];
+SPI_TypeDef       sim_spi[3];
+USART_TypeDef     sim_usart[6];
+SysTick_TypeDef   sim_systick;
+NVIC_TypeDef      sim_nvic;
+SCB_TypeDef       sim_scb;
+DWT_TypeDef       sim_dwt;
+CoreDebug_TypeDef sim_coredebug;
+FLASH_TypeDef     sim_flash;
+EXTI_TypeDef      sim_exti;
+SYSCFG_TypeDef    sim_syscfg;
+DMA_TypeDef       sim_dma[2];
+TIM_TypeDef       sim_tim[4];          // TIM2-TIM5
+
+// Cost model, in core clock cycles
+#define SIM_BUS_CYCLES             4       // One peripheral register access
+#define SIM_PRIMASK_CYCLES         2       // cpsid/cpsie, mrs/msr
+#define SIM_EXCEPTION_CYCLES       12      // Exception entry
+#define SIM_SPIN_MAX_NS            250     // Step cap for reads repeated without a write
+#define SIM_WALLCLOCK_LIMIT_S      120     // Host time before a run is declared hung
+
+#define SIM_RC522_MAX_SCK_HZ       10000000UL // MFRC522 SPI limit, the default link limit
+#define SIM_UART_TOLERANCE_PCT     3
+
+#define SIM_IRQ_COUNT              (8 * 32)
+
+int sim_verbose = 1;
+
+static uint64_t now_ns = 0;
+static uint64_t cycle_frac = 0;        // ns * Hz carried below one core cycle
+static uint8_t hse_present = 1;
+static uint32_t spi_link_max_hz = SIM_RC522_MAX_SCK_HZ;   // Above this MISO reads garbage
+
+static uint32_t primask = 0;
+static uint8_t in_isr = 0;
+static uint8_t systick_pending = 0;
+static uint32_t nvic_enabled[8];
+static uint32_t nvic_pending[8];
+static uint32_t systick_current = 0;
+static uint32_t systick_shadow = 0;
+static uint8_t systick_countflag = 0;   // CTRL.COUNTFLAG, read-only to the firmware
+static uint8_t systick_ctrl_read = 0;   // COUNTFLAG clears once the read is done
+static uint32_t gpioe_odr_prev = 0;
+static uint32_t exti_pr = 0;            // Pending lines; PR is write-1-to-clear
+static uint32_t exti_levels = 0;        // Line inputs as last seen
+
+typedef struct {
+    uint64_t frac;                      // ns * Hz carried below one timer clock
+    uint32_t prescale;                  // Prescaler counter
+    uint32_t psc;                       // Active prescaler (PSC is preloaded)
+} sim_timer_t;
+
+static sim_timer_t timers[4];
+
+#define SIM_DMA_HANDLES            64
+#define SIM_DMA_HANDLE_BASE        0x20000000UL
+
+static const volatile void *dma_handles[SIM_DMA_HANDLES];
+static uint32_t dma_handle_next = 0;
+static uint8_t dma_enabled[8];              // DMA2 stream EN as last seen
+static uint32_t dma_total[8];               // NDTR when the stream was enabled
+static uint64_t dma_next_ns = SIM_NEVER;    // Next SPI1 byte under DMA
+
+static uint64_t spin_ns = 0;
+
+static uint64_t isr_count = 0;
+static uint64_t irq_count = 0;         // Interrupts other than SysTick
+static uint64_t spi_bytes = 0;
+static uint64_t dma_bytes = 0;             // Of spi_bytes, moved by DMA
+static uint64_t spi_overclocked = 0;
+static uint64_t uart_tx_bytes = 0;
+static uint64_t uart_rx_bytes = 0;
+static uint64_t uart_errors = 0;
+static uint64_t uart_overruns = 0;
+static uint64_t sleep_ns = 0;
+static struct timespec host_start;
+
+int firmware_main(void);
+
+// Firmware interrupt handlers; unresolved weak references stay NULL
+void SysTick_Handler(void);
+__attribute__((weak)) void EXTI0_IRQHandler(void);
+__attribute__((weak)) void EXTI4_IRQHandler(void);
+__attribute__((weak)) void EXTI9_5_IRQHandler(void);
+__attribute__((weak)) void EXTI15_10_IRQHandler(void);
+__attribute__((weak)) void TIM2_IRQHandler(void);
+__attribute__((weak)) void TIM3_IRQHandler(void);
+__attribute__((weak)) void TIM4_IRQHandler(void);
+__attribute__((weak)) void TIM5_IRQHandler(void);
+__attribute__((weak)) void SPI1_IRQHandler(void);
+__attribute__((weak)) void USART2_IRQHandler(void);
+__attribute__((weak)) void DMA2_Stream0_IRQHandler(void);
+__attribute__((weak)) void DMA2_Stream3_IRQHandler(void);
+
+static void (*Sim_IrqHandler(uint8_t irqn))(void) {
+    switch (irqn) {
+        case EXTI0_IRQn:        return EXTI0_IRQHandler;
+        case EXTI4_IRQn:        return EXTI4_IRQHandler;
+        case EXTI9_5_IRQn:      return EXTI9_5_IRQHandler;
+        case EXTI15_10_IRQn:    return EXTI15_10_IRQHandler;
+        case TIM2_IRQn:         return TIM2_IRQHandler;
+        case TIM3_IRQn:         return TIM3_IRQHandler;
+        case TIM4_IRQn:         return TIM4_IRQHandler;
+        case TIM5_IRQn:         return TIM5_IRQHandler;
+        case SPI1_IRQn:         return SPI1_IRQHandler;
+        case USART2_IRQn:       return USART2_IRQHandler;
+        case DMA2_Stream0_IRQn: return DMA2_Stream0_IRQHandler;
+        case DMA2_Stream3_IRQn: return DMA2_Stream3_IRQHandler;
+        default:                return NULL;
+    }
+}
+
+// ==================== CLOCK TREE ====================
+
+static uint32_t Sim_SysClock(void) {
+    uint32_t sws = sim_rcc.CFGR & RCC_CFGR_SWS;
+
+    if (sws == RCC_CFGR_SWS_HSE) return HSE_VALUE;
+    if (sws == RCC_CFGR_SWS_PLL) {
+        uint32_t cfg = sim_rcc.PLLCFGR;
+        uint32_t pllm = (cfg >> RCC_PLLCFGR_PLLM_POS) & 0x3F;
+        uint32_t plln = (cfg >> RCC_PLLCFGR_PLLN_POS) & 0x1FF;
+        uint32_t pllp = (((cfg >> RCC_PLLCFGR_PLLP_POS) & 3) + 1) * 2;
+        uint64_t input = (cfg & RCC_PLLCFGR_PLLSRC_HSE) ? HSE_VALUE : HSI_VALUE;
+        if (pllm == 0) Sim_Fail("PLLM of 0 selected");
+        return (uint32_t)(input / pllm * plln / pllp);
+    }
+    return HSI_VALUE;
+}
+
+uint32_t Sim_GetHCLK(void) {
+    static const uint16_t ahb_div[16] = {1, 1, 1, 1, 1, 1, 1, 1, 2, 4, 8, 16, 64, 128, 256, 512};
+    return Sim_SysClock() / ahb_div[(sim_rcc.CFGR & RCC_CFGR_HPRE) >> RCC_CFGR_HPRE_POS];
+}
+
+static uint32_t Sim_APBClock(uint32_t ppre) {
+    return Sim_GetHCLK() / ((ppre < 4) ? 1 : (1UL << (ppre - 3)));
+}
+
+uint32_t Sim_GetPCLK1(void) {
+    return Sim_APBClock((sim_rcc.CFGR & RCC_CFGR_PPRE1) >> RCC_CFGR_PPRE1_POS);
+}
+
+uint32_t Sim_GetPCLK2(void) {
+    return Sim_APBClock((sim_rcc.CFGR & RCC_CFGR_PPRE2) >> RCC_CFGR_PPRE2_POS);
+}
+
+// APB1 timers run at twice PCLK1 whenever the APB1 prescaler divides
+static uint32_t Sim_TimerClock(void) {
+    uint32_t ppre1 = (sim_rcc.CFGR & RCC_CFGR_PPRE1) >> RCC_CFGR_PPRE1_POS;
+    return Sim_GetPCLK1() * ((ppre1 < 4) ? 1 : 2);
+}
+
+void Sim_SetHSEPresent(uint8_t present) {
+    hse_present = present;
+}
+
+// Long or poor wiring: reads above hz come back corrupted
+void Sim_SetSpiLinkLimit(uint32_t hz) {
+    spi_link_max_hz = hz;
+}
+
+static uint64_t Sim_CyclesToNs(uint64_t cycles) {
+    uint64_t hz = Sim_GetHCLK();
+    return (cycles * SIM_NS_PER_S + hz - 1) / hz;
+}
+
+// Oscillators and the PLL lock instantly; the switch status follows SW
+static void Sim_SyncRCC(void) {
+    uint32_t cr = sim_rcc.CR & ~(RCC_CR_HSIRDY | RCC_CR_HSERDY | RCC_CR_PLLRDY);
+    if (cr & RCC_CR_HSION) cr |= RCC_CR_HSIRDY;
+    if ((cr & RCC_CR_HSEON) && hse_present) cr |= RCC_CR_HSERDY;
+    if (cr & RCC_CR_PLLON) {
+        uint8_t from_hse = (sim_rcc.PLLCFGR & RCC_PLLCFGR_PLLSRC_HSE) != 0;
+        if (from_hse ? (cr & RCC_CR_HSERDY) : (cr & RCC_CR_HSIRDY)) cr |= RCC_CR_PLLRDY;
+    }
+    sim_rcc.CR = cr;
+
+    uint32_t sw = sim_rcc.CFGR & RCC_CFGR_SW;
+    uint32_t ready = (sw == RCC_CFGR_SW_PLL) ? (cr & RCC_CR_PLLRDY) :
+                     (sw == RCC_CFGR_SW_HSE) ? (cr & RCC_CR_HSERDY) : (cr & RCC_CR_HSIRDY);
+    if (ready) {
+        sim_rcc.CFGR = (sim_rcc.CFGR & ~RCC_CFGR_SWS) | (sw << 2);
+    }
+}
+
+// ==================== SYSTICK AND DWT ====================
+
+static void Sim_ClearSysTick(void) {
+    systick_current = 0;
+    systick_shadow = sim_systick.VAL = 0;
+    systick_countflag = 0;
+}
+
+static void Sim_SyncSysTick(void) {
+    // Any write to VAL clears the counter and COUNTFLAG
+    if (sim_systick.VAL != systick_shadow) {
+        Sim_ClearSysTick();
+    }
+    if (systick_ctrl_read) {
+        systick_countflag = 0;
+        systick_ctrl_read = 0;
+    }
+
+    // A plain write to CTRL must not set or clear COUNTFLAG
+    if (systick_countflag) {
+        sim_systick.CTRL |= SYSTICK_CTRL_COUNTFLAG;
+    } else {
+        sim_systick.CTRL &= ~SYSTICK_CTRL_COUNTFLAG;
+    }
+
+    // ICSR.PENDSTSET shows a SysTick exception that has not been taken
+    if (systick_pending) {
+        sim_scb.ICSR |= SCB_ICSR_PENDSTSET;
+    } else {
+        sim_scb.ICSR &= ~SCB_ICSR_PENDSTSET;
+    }
+}
+
+static void Sim_CountSysTick(uint64_t cycles) {
+    if (!(sim_systick.CTRL & SYSTICK_CTRL_ENABLE)) return;
+
+    uint32_t load = sim_systick.LOAD & 0x00FFFFFFUL;
+    while (cycles) {
+        if (systick_current == 0) {
+            // Reload on the cycle after reaching zero
+            systick_current = load;
+            cycles--;
+            if (load == 0) break;
+            continue;
+        }
+        if (cycles < systick_current) {
+            systick_current -= (uint32_t)cycles;
+            break;
+        }
+        cycles -= systick_current;
+        systick_current = 0;
+        systick_countflag = 1;
+        sim_systick.CTRL |= SYSTICK_CTRL_COUNTFLAG;
+        if (sim_systick.CTRL & SYSTICK_CTRL_TICKINT) systick_pending = 1;
+    }
+    systick_shadow = sim_systick.VAL = systick_current;
+}
+
+static uint64_t Sim_SysTickNextEvent(void) {
+    if (!(sim_systick.CTRL & SYSTICK_CTRL_ENABLE) || !(sim_systick.CTRL & SYSTICK_CTRL_TICKINT)) {
+        return SIM_NEVER;
+    }
+
+    uint64_t cycles = systick_current ? systick_current : (uint64_t)(sim_systick.LOAD & 0x00FFFFFFUL) + 1;
+    uint64_t hz = Sim_GetHCLK();
+    uint64_t needed = cycles * SIM_NS_PER_S;
+    uint64_t ns = (needed > cycle_frac) ? (needed - cycle_frac + hz - 1) / hz : 0;
+    return now_ns + ns;
+}
+
+// ==================== TIM2-TIM5 ====================
+
+static const uint8_t timer_irqs[4] = {TIM2_IRQn, TIM3_IRQn, TIM4_IRQn, TIM5_IRQn};
+
+static uint8_t Sim_TimerRunning(uint8_t index) {
+    return (sim_rcc.APB1ENR & (RCC_APB1ENR_TIM2EN << index)) && (sim_tim[index].CR1 & TIM_CR1_CEN);
+}
+
+// TIM3/TIM4 are 16-bit; TIM2/TIM5 count the full 32 bits
+static uint64_t Sim_TimerPeriod(uint8_t index) {
+    uint32_t arr = sim_tim[index].ARR;
+    if (index == 1 || index == 2) arr &= 0xFFFF;
+    return (uint64_t)arr + 1;
+}
+
+// Up-counting only, with the prescaler preloaded on update events. The
+// interrupt is level-triggered on UIF & UIE, like the real NVIC input, and
+// outlives CEN so a one-pulse overflow still interrupts.
+static void Sim_SyncTimers(void) {
+    for (uint8_t i = 0; i < 4; i++) {
+        TIM_TypeDef *tim = &sim_tim[i];
+        sim_timer_t *state = &timers[i];
+
+        if (tim->EGR & TIM_EGR_UG) {
+            tim->EGR = 0;
+            tim->CNT = 0;
+            state->prescale = 0;
+            state->psc = tim->PSC & 0xFFFF;
+            if (!(tim->CR1 & TIM_CR1_URS)) tim->SR |= TIM_SR_UIF;
+        }
+
+        if ((tim->SR & tim->DIER & TIM_SR_UIF) && (sim_rcc.APB1ENR & (RCC_APB1ENR_TIM2EN << i))) {
+            Sim_SetPending(timer_irqs[i]);
+        }
+    }
+}
+
+static void Sim_CountTimers(uint64_t ns) {
+    uint64_t hz = Sim_TimerClock();
+
+    for (uint8_t i = 0; i < 4; i++) {
+        TIM_TypeDef *tim = &sim_tim[i];
+        sim_timer_t *state = &timers[i];
+        if (!Sim_TimerRunning(i)) continue;
+
+        uint64_t total = ns * hz + state->frac;
+        uint64_t ticks = total / SIM_NS_PER_S;
+        state->frac = total % SIM_NS_PER_S;
+
+        uint64_t counts = (state->prescale + ticks) / (state->psc + 1);
+        state->prescale = (uint32_t)((state->prescale + ticks) % (state->psc + 1));
+        if (counts == 0) continue;
+
+        uint64_t period = Sim_TimerPeriod(i);
+        uint64_t cnt = (tim->CNT % period) + counts;
+        if (cnt >= period) {
+            tim->SR |= TIM_SR_UIF;
+            state->psc = tim->PSC & 0xFFFF;
+            if (tim->CR1 & TIM_CR1_OPM) {
+                // One-pulse: stop at the update event
+                tim->CR1 &= ~TIM_CR1_CEN;
+                tim->CNT = 0;
+                state->prescale = 0;
+                continue;
+            }
+        }
+        tim->CNT = (uint32_t)(cnt % period);
+    }
+}
+
+static uint64_t Sim_TimersNextEvent(void) {
+    uint64_t next = SIM_NEVER;
+    uint64_t hz = Sim_TimerClock();
+
+    for (uint8_t i = 0; i < 4; i++) {
+        const sim_timer_t *state = &timers[i];
+        if (!Sim_TimerRunning(i) || !(sim_tim[i].DIER & TIM_DIER_UIE)) continue;
+
+        uint64_t counts = Sim_TimerPeriod(i) - (sim_tim[i].CNT % Sim_TimerPeriod(i));
+        uint64_t ticks = counts * (state->psc + 1) - state->prescale;
+        uint64_t needed = ticks * SIM_NS_PER_S;
+        uint64_t ns = (needed > state->frac) ? (needed - state->frac + hz - 1) / hz : 0;
+        if (now_ns + ns < next) next = now_ns + ns;
+    }
+    return next;
+}
+
+// ==================== NVIC ====================
+
+static void Sim_SyncNVIC(void) {
+    for (uint8_t i = 0; i < 8; i++) {
+        nvic_enabled[i] |= sim_nvic.ISER[i];
+        nvic_enabled[i] &= ~sim_nvic.ICER[i];
+        nvic_pending[i] |= sim_nvic.ISPR[i];
+        nvic_pending[i] &= ~sim_nvic.ICPR[i];
+        sim_nvic.ICER[i] = sim_nvic.ICPR[i] = 0;
+        sim_nvic.ISER[i] = nvic_enabled[i];
+        sim_nvic.ISPR[i] = nvic_pending[i];
+    }
+}
+
+void Sim_SetPending(uint8_t irqn) {
+    nvic_pending[irqn >> 5] |= 1UL << (irqn & 0x1F);
+    sim_nvic.ISPR[irqn >> 5] = nvic_pending[irqn >> 5];
+}
+
+static int Sim_NextIrq(void) {
+    int best = -1;
+
+    for (int word = 0; word < SIM_IRQ_COUNT / 32; word++) {
+        uint32_t active = nvic_pending[word] & nvic_enabled[word];
+        while (active) {
+            int irqn = word * 32 + __builtin_ctz(active);
+            active &= active - 1;
+            if (best < 0 || sim_nvic.IP[irqn] < sim_nvic.IP[best]) best = irqn;
+        }
+    }
+    return best;
+}
+
+static uint8_t Sim_InterruptPending(void) {
+    return systick_pending || Sim_NextIrq() >= 0;
+}
+
+static void Sim_Sync(void);
+
+// Take pending interrupts one at a time, highest priority first. There is
+// no pre-emption: an ISR always runs to completion.
+static void Sim_DispatchInterrupts(void) {
+    while (!primask && !in_isr) {
+        void (*handler)(void);
+        int irqn = -1;
+
+        if (systick_pending) {
+            systick_pending = 0;
+            handler = SysTick_Handler;
+        } else {
+            irqn = Sim_NextIrq();
+            if (irqn < 0) break;
+            nvic_pending[irqn >> 5] &= ~(1UL << (irqn & 0x1F));
+            sim_nvic.ISPR[irqn >> 5] = nvic_pending[irqn >> 5];
+            handler = Sim_IrqHandler((uint8_t)irqn);
+            if (handler == NULL) Sim_Fail("IRQ %d enabled without a handler", irqn);
+            irq_count++;
+        }
+
+        in_isr = 1;
+        isr_count++;
+        Sim_Advance(Sim_CyclesToNs(SIM_EXCEPTION_CYCLES));
+        handler();
+        in_isr = 0;
+
+        // Every peripheral source is level-triggered: it pends again at
+        // exception return only if the handler left its flag set
+        if (irqn >= 0) {
+            nvic_pending[irqn >> 5] &= ~(1UL << (irqn & 0x1F));
+            sim_nvic.ISPR[irqn >> 5] = nvic_pending[irqn >> 5];
+            Sim_Sync();
+        }
+    }
+}
+
+// ==================== GPIO ====================
+
+// Pin levels driven by the port itself: outputs follow ODR, inputs with a
+// pull-up read high
+static uint32_t Sim_GpioLevels(const GPIO_TypeDef *gpio) {
+    uint32_t idr = 0;
+
+    for (uint8_t pin = 0; pin < 16; pin++) {
+        uint32_t mode = (gpio->MODER >> (pin * 2)) & 3;
+        uint32_t pull = (gpio->PUPDR >> (pin * 2)) & 3;
+        if (mode == GPIO_MODER_OUTPUT) {
+            idr |= gpio->ODR & (1UL << pin);
+        } else if (mode == GPIO_MODER_INPUT && pull == GPIO_PUPDR_PU) {
+            idr |= 1UL << pin;
+        }
+    }
+    return idr;
+}
+
+static void Sim_SyncGPIO(void) {
+    static uint32_t cached_moder[8], cached_pupdr[8], cached_odr[8], cached_levels[8];
+    static uint8_t cached[8];
+
+    for (uint8_t port = 0; port < 8; port++) {
+        GPIO_TypeDef *gpio = &sim_gpio[port];
+
+        // BSRR: set wins over reset, the register itself reads as zero
+        uint32_t bsrr = gpio->BSRR;
+        if (bsrr) {
+            gpio->ODR = (gpio->ODR & ~(bsrr >> 16)) | (bsrr & 0xFFFF);
+            gpio->BSRR = 0;
+        }
+
+        if (!cached[port] || gpio->MODER != cached_moder[port] ||
+            gpio->PUPDR != cached_pupdr[port] || gpio->ODR != cached_odr[port]) {
+            cached_moder[port] = gpio->MODER;
+            cached_pupdr[port] = gpio->PUPDR;
+            cached_odr[port] = gpio->ODR;
+            cached_levels[port] = Sim_GpioLevels(gpio);
+            cached[port] = 1;
+        }
+        uint32_t idr = cached_levels[port];
+
+        if (gpio == USER_BUTTON_PORT && SimScript_ButtonPressed(now_ns)) {
+            idr &= ~(1UL << USER_BUTTON_PIN);
+        }
+        if (gpio == KEYPAD_PORT) {
+            uint8_t rows = SimKeypad_RowsLow(now_ns, gpio->MODER, gpio->ODR);
+            idr &= ~((uint32_t)rows << KEYPAD_ROW0_PIN);
+        }
+        if (gpio == RFID_IRQ_PORT &&
+            ((gpio->MODER >> (RFID_IRQ_PIN * 2)) & 3) == GPIO_MODER_INPUT) {
+            int level = SimRc522_IrqPin();
+            if (level == 0) idr &= ~(1UL << RFID_IRQ_PIN);
+            else if (level == 1) idr |= 1UL << RFID_IRQ_PIN;
+        }
+        gpio->IDR = idr;
+    }
+
+    // MFRC522 control lines
+    uint32_t odr = RFID_SS_PORT->ODR;
+    uint32_t changed = odr ^ gpioe_odr_prev;
+    gpioe_odr_prev = odr;
+    if (changed & (1UL << RFID_RST_PIN)) SimRc522_SetResetPin((odr >> RFID_RST_PIN) & 1);
+    if (changed & (1UL << RFID_SS_PIN)) SimRc522_SetSelect(!((odr >> RFID_SS_PIN) & 1));
+}
+
+// ==================== EXTI ====================
+
+// Edge detection on the pins SYSCFG routes to lines 0-15. A pending line
+// interrupts while it is unmasked, like the level the NVIC sees; lines 1-3
+// have no vector here.
+static void Sim_SyncExti(void) {
+    uint32_t levels = 0;
+    uint32_t lines = (sim_exti.RTSR | sim_exti.FTSR) & 0xFFFF;
+
+    for (uint8_t line = 0; lines; line++, lines >>= 1) {
+        if (!(lines & 1)) continue;
+        uint32_t port = 0;
+        if (sim_rcc.APB2ENR & RCC_APB2ENR_SYSCFGEN) {
+            port = (sim_syscfg.EXTICR[line >> 2] >> SYSCFG_EXTICR_SHIFT(line)) & 0x0F;
+        }
+        if (port < 8 && (sim_gpio[port].IDR & (1UL << line))) levels |= 1UL << line;
+    }
+
+    uint32_t rising = levels & ~exti_levels;
+    uint32_t falling = ~levels & exti_levels & 0xFFFF;
+    exti_levels = levels;
+    exti_pr |= (rising & sim_exti.RTSR) | (falling & sim_exti.FTSR) | sim_exti.SWIER;
+    sim_exti.SWIER = 0;
+    sim_exti.PR = exti_pr;
+
+    uint32_t active = exti_pr & sim_exti.IMR;
+    if (active & (1UL << 0)) Sim_SetPending(EXTI0_IRQn);
+    if (active & (1UL << 4)) Sim_SetPending(EXTI4_IRQn);
+    if (active & 0x03E0UL) Sim_SetPending(EXTI9_5_IRQn);
+    if (active & 0xFC00UL) Sim_SetPending(EXTI15_10_IRQn);
+}
+
+// ==================== SPI1 / USART2 ====================
+
+static uint32_t Sim_SpiClock(void) {
+    uint32_t br = (sim_spi[0].CR1 & SPI_CR1_BR) >> 3;
+    return Sim_GetPCLK2() >> (br + 1);
+}
+
+// One byte each way with the MFRC522, at the end of its 8 clocks
+static uint8_t Sim_SpiExchange(uint8_t mosi) {
+    uint32_t sck = Sim_SpiClock();
+
+    Sim_SyncGPIO();
+    uint8_t miso = SimRc522_Transfer(mosi, sck);
+    if (sck > spi_link_max_hz) {
+        // Beyond the MFRC522 or wiring timing the master samples garbage
+        spi_overclocked++;
+        miso = 0xFF;
+    }
+    spi_bytes++;
+    return miso;
+}
+
+static void Sim_SpiTransfer(void) {
+    SPI_TypeDef *spi = &sim_spi[0];
+    uint8_t mosi = (uint8_t)spi->DR;
+
+    if (!(spi->CR1 & SPI_CR1_SPE)) return;
+
+    Sim_Advance(8 * SIM_NS_PER_S / Sim_SpiClock());
+    spi->DR = Sim_SpiExchange(mosi);
+    spi->SR |= SPI_SR_RXNE | SPI_SR_TXE;
+}
+
+// ==================== FLASH (storage sectors) ====================
+
+// Sectors 10 and 11 only. Erase and program stall the core for their
+// duration, as fetching from the bank being written does on the target.
+#define SIM_FLASH_BASE             0x080C0000UL
+#define SIM_FLASH_SIZE             0x40000UL
+#define SIM_FLASH_SECTOR_SIZE      0x20000UL
+#define SIM_FLASH_FIRST_SECTOR     10
+#define SIM_FLASH_ERASE_NS         (1000ULL * SIM_NS_PER_MS)   // 128 KB, x32 typical
+#define SIM_FLASH_PROGRAM_NS       (16ULL * SIM_NS_PER_US)
+
+static uint32_t flash_cells[SIM_FLASH_SIZE / 4];
+static uint32_t flash_programmed[SIM_FLASH_SIZE / 4];  // Cells as of the last program or erase
+static uint8_t flash_keys = 0;          // KEYR sequence so far; 2 = unlocked
+static const char *flash_path = NULL;
+static uint64_t flash_erases = 0;
+static uint64_t flash_words = 0;
+
+volatile uint32_t *Sim_FlashWord(uint32_t address) {
+    if (address < SIM_FLASH_BASE || address >= SIM_FLASH_BASE + SIM_FLASH_SIZE || (address & 3)) {
+        Sim_Fail("flash access at 0x%08lX outside the storage sectors", (unsigned long)address);
+    }
+    return &flash_cells[(address - SIM_FLASH_BASE) / 4];
+}
+
+static void Sim_FlashKey(void) {
+    static const uint32_t keys[2] = {FLASH_KEY1, FLASH_KEY2};
+
+    if (flash_keys < 2 && sim_flash.KEYR == keys[flash_keys]) {
+        if (++flash_keys == 2) sim_flash.CR &= ~FLASH_CR_LOCK;
+    } else {
+        Sim_Fail("flash unlock sequence broken (KEYR 0x%08lX)", (unsigned long)sim_flash.KEYR);
+    }
+}
+
+static void Sim_FlashControl(void) {
+    uint32_t cr = sim_flash.CR;
+
+    if (cr & FLASH_CR_LOCK) {
+        flash_keys = 0;
+        return;
+    }
+    if (!(cr & FLASH_CR_STRT)) return;
+    if (flash_keys != 2) Sim_Fail("flash erase started while locked");
+
+    uint32_t sector = (cr & FLASH_CR_SNB) >> FLASH_CR_SNB_POS;
+    if (!(cr & FLASH_CR_SER) || sector < SIM_FLASH_FIRST_SECTOR ||
+        sector >= SIM_FLASH_FIRST_SECTOR + SIM_FLASH_SIZE / SIM_FLASH_SECTOR_SIZE) {
+        Sim_Fail("flash erase of sector %lu, outside the storage sectors", (unsigned long)sector);
+    }
+
+    uint32_t first = (sector - SIM_FLASH_FIRST_SECTOR) * SIM_FLASH_SECTOR_SIZE / 4;
+    memset(&flash_cells[first], 0xFF, SIM_FLASH_SECTOR_SIZE);
+    memcpy(&flash_programmed[first], &flash_cells[first], SIM_FLASH_SECTOR_SIZE);
+    flash_erases++;
+    Sim_Advance(SIM_FLASH_ERASE_NS);
+    sim_flash.CR &= ~FLASH_CR_STRT;
+    sim_flash.SR |= FLASH_SR_EOP;
+}
+
+// Programming can only clear bits: the cell keeps old AND new
+static void Sim_FlashProgram(uint32_t index) {
+    if (flash_keys != 2 || !(sim_flash.CR & FLASH_CR_PG)) {
+        Sim_Fail("flash word 0x%08lX written without PG set on unlocked flash",
+                 (unsigned long)(SIM_FLASH_BASE + index * 4));
+    }
+    if ((sim_flash.CR & (3 << 8)) != FLASH_CR_PSIZE_X32) {
+        sim_flash.SR |= FLASH_SR_PGPERR;
+        flash_cells[index] = flash_programmed[index];
+        return;
+    }
+
+    flash_cells[index] &= flash_programmed[index];
+    flash_programmed[index] = flash_cells[index];
+    flash_words++;
+    Sim_Advance(SIM_FLASH_PROGRAM_NS);
+    sim_flash.SR |= FLASH_SR_EOP;
+}
+
+static void Sim_FlashReset(void) {
+    memset(flash_cells, 0xFF, sizeof(flash_cells));
+    sim_flash.CR = FLASH_CR_LOCK;
+    flash_keys = 0;
+
+    if (flash_path != NULL) {
+        FILE *file = fopen(flash_path, "rb");
+        if (file != NULL) {
+            if (fread(flash_cells, 1, sizeof(flash_cells), file) != sizeof(flash_cells)) {
+                Sim_Fail("%s is not a %lu-byte flash image", flash_path, (unsigned long)SIM_FLASH_SIZE);
+            }
+            fclose(file);
+        }
+    }
+    memcpy(flash_programmed, flash_cells, sizeof(flash_cells));
+}
+
+// Keeps the storage sectors for the next run with the same -f image
+static void Sim_FlashSave(void) {
+    FILE *file = fopen(flash_path, "wb");
+
+    if (file == NULL || fwrite(flash_cells, 1, sizeof(flash_cells), file) != sizeof(flash_cells)) {
+        fprintf(stderr, "sim error: cannot write %s\n", flash_path);
+    }
+    if (file != NULL) fclose(file);
+}
+
+// ==================== DMA2 (SPI1 streams) ====================
+
+// Buffers are registered on their way into an address register and the
+// handle encodes the slot, leaving the low 16 bits for the stream's offset
+uint32_t Sim_DmaAddress(const volatile void *ptr) {
+    for (uint32_t i = 0; i < SIM_DMA_HANDLES; i++) {
+        if (dma_handles[i] == ptr) return SIM_DMA_HANDLE_BASE + (i << 16);
+    }
+
+    // Round robin: a handle is only live for one transfer
+    uint32_t slot = dma_handle_next;
+    dma_handle_next = (dma_handle_next + 1) % SIM_DMA_HANDLES;
+    dma_handles[slot] = ptr;
+    return SIM_DMA_HANDLE_BASE + (slot << 16);
+}
+
+static volatile uint8_t *Sim_DmaPointer(uint32_t address) {
+    uint32_t slot = (address - SIM_DMA_HANDLE_BASE) >> 16;
+
+    if (address < SIM_DMA_HANDLE_BASE || slot >= SIM_DMA_HANDLES || dma_handles[slot] == NULL) {
+        Sim_Fail("DMA address 0x%08lX was not taken with DMA_ADDRESS()", (unsigned long)address);
+    }
+    return (volatile uint8_t *)dma_handles[slot] + (address & 0xFFFF);
+}
+
+static uint32_t *Sim_DmaFlags(DMA_TypeDef *dma, uint8_t stream) {
+    return (uint32_t *)((stream < 4) ? &dma->LISR : &dma->HISR);
+}
+
+// Only the SPI1 pairing on DMA2 is modelled: RX on stream 0, TX on stream 3
+static uint8_t Sim_DmaStreamReady(uint8_t stream, uint32_t dir, uint32_t cr2_enable) {
+    const DMA_Stream_TypeDef *s = &sim_dma[1].STREAM[stream];
+
+    if (!(sim_rcc.AHB1ENR & RCC_AHB1ENR_DMA2EN) || !(s->CR & DMA_SxCR_EN)) return 0;
+    if (((s->CR & DMA_SxCR_CHSEL) >> DMA_SxCR_CHSEL_POS) != 3 || (s->CR & DMA_SxCR_DIR) != dir) {
+        Sim_Fail("DMA2 stream %u enabled with a configuration other than SPI1 channel 3", stream);
+    }
+    if (Sim_DmaPointer(s->PAR) != (volatile uint8_t *)&sim_spi[0].DR) {
+        Sim_Fail("DMA2 stream %u peripheral address is not SPI1->DR", stream);
+    }
+    return (sim_spi[0].CR2 & cr2_enable) && s->NDTR != 0;
+}
+
+static uint8_t Sim_DmaSpiActive(void) {
+    return (sim_spi[0].CR1 & SPI_CR1_SPE) &&
+           Sim_DmaStreamReady(3, DMA_SxCR_DIR_M2P, SPI_CR2_TXDMAEN);
+}
+
+// Rising EN latches NDTR, so the memory offset is the count moved so far
+static void Sim_SyncDma(void) {
+    for (uint8_t d = 0; d < 2; d++) {
+        sim_dma[d].LISR &= ~sim_dma[d].LIFCR;
+        sim_dma[d].HISR &= ~sim_dma[d].HIFCR;
+        sim_dma[d].LIFCR = sim_dma[d].HIFCR = 0;
+    }
+
+    static const uint8_t streams[2] = {0, 3};
+    for (uint8_t i = 0; i < 2; i++) {
+        uint8_t stream = streams[i];
+        DMA_Stream_TypeDef *s = &sim_dma[1].STREAM[stream];
+        uint8_t enabled = (s->CR & DMA_SxCR_EN) != 0;
+        if (enabled && !dma_enabled[stream]) dma_total[stream] = s->NDTR;
+        dma_enabled[stream] = enabled;
+
+        // Level-triggered on flag & enable, like the timers
+        uint32_t flags = *Sim_DmaFlags(&sim_dma[1], stream) >> DMA_FLAG_SHIFT(stream);
+        if (((flags & DMA_FLAG_TCIF) && (s->CR & DMA_SxCR_TCIE)) ||
+            ((flags & DMA_FLAG_TEIF) && (s->CR & DMA_SxCR_TEIE))) {
+            Sim_SetPending(stream == 0 ? DMA2_Stream0_IRQn : DMA2_Stream3_IRQn);
+        }
+    }
+
+    if (!Sim_DmaSpiActive()) {
+        dma_next_ns = SIM_NEVER;
+    } else if (dma_next_ns == SIM_NEVER) {
+        dma_next_ns = now_ns + 8 * SIM_NS_PER_S / Sim_SpiClock();
+    }
+}
+
+static void Sim_DmaStreamComplete(uint8_t stream) {
+    DMA_Stream_TypeDef *s = &sim_dma[1].STREAM[stream];
+    s->CR &= ~DMA_SxCR_EN;
+    dma_enabled[stream] = 0;
+    *Sim_DmaFlags(&sim_dma[1], stream) |= (uint32_t)DMA_FLAG_TCIF << DMA_FLAG_SHIFT(stream);
+}
+
+static void Sim_UpdateDma(void) {
+    while (dma_next_ns <= now_ns) {
+        DMA_Stream_TypeDef *tx = &sim_dma[1].STREAM[3];
+        DMA_Stream_TypeDef *rx = &sim_dma[1].STREAM[0];
+
+        uint32_t offset = (tx->CR & DMA_SxCR_MINC) ? dma_total[3] - tx->NDTR : 0;
+        uint8_t miso = Sim_SpiExchange(Sim_DmaPointer(tx->M0AR + offset)[0]);
+        if (--tx->NDTR == 0) Sim_DmaStreamComplete(3);
+
+        if (Sim_DmaStreamReady(0, DMA_SxCR_DIR_P2M, SPI_CR2_RXDMAEN)) {
+            offset = (rx->CR & DMA_SxCR_MINC) ? dma_total[0] - rx->NDTR : 0;
+            Sim_DmaPointer(rx->M0AR + offset)[0] = miso;
+            if (--rx->NDTR == 0) Sim_DmaStreamComplete(0);
+        } else {
+            sim_spi[0].DR = miso;
+            sim_spi[0].SR |= SPI_SR_RXNE;
+        }
+
+        dma_bytes++;
+        dma_next_ns = Sim_DmaSpiActive() ? dma_next_ns + 8 * SIM_NS_PER_S / Sim_SpiClock() : SIM_NEVER;
+    }
+}
+
+static uint32_t Sim_UsartBaud(const USART_TypeDef *usart) {
+    return usart->BRR ? Sim_GetPCLK1() / usart->BRR : 0;
+}
+
+static uint8_t Sim_UsartBaudMatches(const USART_TypeDef *usart) {
+    uint32_t baud = Sim_UsartBaud(usart);
+    uint32_t error = (baud > WIFI_BAUDRATE) ? baud - WIFI_BAUDRATE : WIFI_BAUDRATE - baud;
+    return error * 100 <= (uint32_t)WIFI_BAUDRATE * SIM_UART_TOLERANCE_PCT;
+}
+
+static void Sim_UsartTransmit(void) {
+    USART_TypeDef *usart = &sim_usart[1];
+    uint8_t c = (uint8_t)usart->DR;
+
+    if (!(usart->CR1 & USART_CR1_UE) || !(usart->CR1 & USART_CR1_TE)) return;
+
+    uint32_t baud = Sim_UsartBaud(usart);
+    if (baud == 0) Sim_Fail("USART2 transmit with BRR of 0");
+
+    // Hold the CPU for one character time (8N1) so TXE polling is realistic
+    usart->SR &= ~(USART_SR_TXE | USART_SR_TC);
+    Sim_Advance(10 * SIM_NS_PER_S / baud);
+    usart->SR |= USART_SR_TXE | USART_SR_TC;
+
+    if (!Sim_UsartBaudMatches(usart)) {
+        uart_errors++;
+        return;
+    }
+    uart_tx_bytes++;
+    SimEsp_Receive(c);
+}
+
+void Sim_UsartDeliver(uint8_t c) {
+    USART_TypeDef *usart = &sim_usart[1];
+
+    if (!(usart->CR1 & USART_CR1_UE) || !(usart->CR1 & USART_CR1_RE)) return;
+    if (!Sim_UsartBaudMatches(usart)) {
+        usart->SR |= USART_SR_FE;
+        uart_errors++;
+        return;
+    }
+
+    if (usart->SR & USART_SR_RXNE) {
+        usart->SR |= USART_SR_ORE;  // New byte lost, DR keeps the old one
+        uart_overruns++;
+    } else {
+        usart->DR = c;
+        usart->SR |= USART_SR_RXNE;
+        uart_rx_bytes++;
+    }
+    if (usart->CR1 & USART_CR1_RXNEIE) Sim_SetPending(USART2_IRQn);
+}
+
+// ==================== VIRTUAL TIME ====================
+
+uint64_t Sim_Now(void) {
+    return now_ns;
+}
+
+static void Sim_Sync(void) {
+    Sim_SyncRCC();
+    Sim_SyncSysTick();
+    Sim_SyncTimers();
+    Sim_SyncDma();
+    Sim_SyncNVIC();
+    Sim_SyncGPIO();
+    Sim_SyncExti();
+}
+
+static uint64_t Sim_NextEvent(void) {
+    uint64_t next = Sim_SysTickNextEvent();
+    uint64_t t;
+
+    if ((t = Sim_TimersNextEvent()) < next) next = t;
+    if (dma_next_ns < next) next = dma_next_ns;
+    if ((t = SimRc522_NextEvent()) < next) next = t;
+    if ((t = SimKeypad_NextEvent(now_ns)) < next) next = t;
+    if ((t = SimEsp_NextEvent()) < next) next = t;
+    if ((t = SimScript_NextEvent(now_ns)) < next) next = t;
+    return next;
+}
+
+static void Sim_Step(uint64_t ns) {
+    uint64_t hz = Sim_GetHCLK();
+
+    // At most one second per step keeps ns * Hz within 64 bits
+    while (ns) {
+        uint64_t step = (ns > SIM_NS_PER_S) ? SIM_NS_PER_S : ns;
+        uint64_t total = step * hz + cycle_frac;
+        uint64_t cycles = total / SIM_NS_PER_S;
+        cycle_frac = total % SIM_NS_PER_S;
+
+        if ((sim_coredebug.DEMCR & COREDEBUG_DEMCR_TRCENA) && (sim_dwt.CTRL & DWT_CTRL_CYCCNTENA)) {
+            sim_dwt.CYCCNT += (uint32_t)cycles;
+        }
+        Sim_CountSysTick(cycles);
+        Sim_CountTimers(step);
+        now_ns += step;
+        ns -= step;
+    }
+}
+
+void Sim_Advance(uint64_t ns) {
+    uint64_t target = now_ns + ns;
+
+    Sim_Sync();
+    while (now_ns < target) {
+        uint64_t next = Sim_NextEvent();
+        if (next > target) next = target;
+        if (next < now_ns) next = now_ns;
+
+        Sim_Step(next - now_ns);
+        Sim_UpdateDma();
+        SimRc522_Update(now_ns);
+        SimEsp_Update(now_ns);
+        SimScript_Update(now_ns);
+        Sim_Sync();
+    }
+
+    Sim_DispatchInterrupts();
+}
+
+// Reads and PRIMASK toggles with no write in between are a busy wait
+// (a flag, CYCCNT or the tick count): stretch the step so the wait costs
+// host time in proportion to its length, not its iteration count
+static void Sim_Poll(uint64_t ns) {
+    Sim_Advance(ns + spin_ns);
+    spin_ns = spin_ns ? spin_ns * 2 : ns;
+    if (spin_ns > SIM_SPIN_MAX_NS) spin_ns = SIM_SPIN_MAX_NS;
+}
+
+void Sim_RegisterRead(const volatile void *reg) {
+    Sim_Poll(Sim_CyclesToNs(SIM_BUS_CYCLES));
+
+    // Reading DR clears RXNE (and ORE after an SR read); the value itself
+    // is still in the register for the read that follows
+    if (reg == &sim_usart[1].DR) {
+        sim_usart[1].SR &= ~(USART_SR_RXNE | USART_SR_ORE | USART_SR_FE);
+    } else if (reg == &sim_systick.CTRL) {
+        systick_ctrl_read = 1;
+    }
+}
+
+void Sim_RegisterWrite(const volatile void *reg) {
+    spin_ns = 0;
+
+    // Taken before the sync republishes the pending lines
+    if (reg == &sim_exti.PR) {
+        exti_pr &= ~sim_exti.PR;
+        sim_exti.PR = exti_pr;
+    } else if (reg == &sim_systick.VAL) {
+        Sim_ClearSysTick(); // Also when the value written matches the count
+    }
+    Sim_Sync();
+
+    if (reg == &sim_spi[0].DR) {
+        Sim_SpiTransfer();
+    } else if (reg == &sim_usart[1].DR) {
+        Sim_UsartTransmit();
+    } else if (reg == &sim_flash.KEYR) {
+        Sim_FlashKey();
+    } else if (reg == &sim_flash.CR) {
+        Sim_FlashControl();
+    } else if ((const volatile uint32_t *)reg >= flash_cells &&
+               (const volatile uint32_t *)reg < flash_cells + SIM_FLASH_SIZE / 4) {
+        Sim_FlashProgram((uint32_t)((const volatile uint32_t *)reg - flash_cells));
+    }
+    Sim_Advance(Sim_CyclesToNs(SIM_BUS_CYCLES));
+}
+
+// ==================== PORT LAYER ====================
+
+// utils.c leaves these to the host build
+
+void enable_irq(void) {
+    primask = 0;
+    Sim_Advance(Sim_CyclesToNs(SIM_PRIMASK_CYCLES));
+}
+
+void disable_irq(void) {
+    primask = 1;
+}
+
+uint32_t irq_save(void) {
+    uint32_t saved = primask;
+    primask = 1;
+    return saved;
+}
+
+void irq_restore(uint32_t saved) {
+    primask = saved;
+    Sim_Poll(Sim_CyclesToNs(SIM_PRIMASK_CYCLES));
+}
+
+// Sleep until an interrupt is pending; with PRIMASK set it stays pending
+void wait_for_interrupt(void) {
+    uint64_t start = now_ns;
+    uint64_t taken = isr_count;
+
+    while (isr_count == taken && !Sim_InterruptPending()) {
+        uint64_t next = Sim_NextEvent();
+        Sim_Advance((next != SIM_NEVER && next > now_ns) ? next - now_ns : SIM_NS_PER_MS);
+    }
+    sleep_ns += now_ns - start;
+}
+
+void debug_printf(const char *format, ...) {
+    static uint8_t line_start = 1;
+    va_list args;
+
+    if (sim_verbose < 2) return;
+    if (line_start) printf("[%10.3f] fw  ", SIM_MS(now_ns));
+
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    line_start = format[0] != '\0' && format[strlen(format) - 1] == '\n';
+}
+
+// ==================== REPORTING ====================
+
+void Sim_Log(const char *format, ...) {
+    va_list args;
+
+    if (sim_verbose < 1) return;
+    printf("[%10.3f] ", SIM_MS(now_ns));
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    putchar('\n');
+}
+
+void Sim_Fail(const char *format, ...) {
+    va_list args;
+
+    fflush(stdout);
+    fprintf(stderr, "[%10.3f] sim error: ", SIM_MS(now_ns));
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+    exit(2);
+}
+
+void Sim_Report(FILE *out) {
+    struct timespec host_end;
+    clock_gettime(CLOCK_MONOTONIC, &host_end);
+    double host_s = (double)(host_end.tv_sec - host_start.tv_sec) +
+                    (double)(host_end.tv_nsec - host_start.tv_nsec) / 1e9;
+
+    fprintf(out, "  time     %.3f ms virtual in %.3f s host, %.1f%% asleep\n",
+            SIM_MS(now_ns), host_s, now_ns ? 100.0 * (double)sleep_ns / (double)now_ns : 0.0);
+    fprintf(out, "  core     %lu Hz at exit, %lu interrupts (%lu peripheral)\n",
+            (unsigned long)Sim_GetHCLK(), (unsigned long)isr_count, (unsigned long)irq_count);
+    fprintf(out, "  spi1     %lu bytes (%lu by DMA), %lu above the link clock limit\n",
+            (unsigned long)spi_bytes, (unsigned long)dma_bytes, (unsigned long)spi_overclocked);
+    fprintf(out, "  usart2   %lu bytes out, %lu in, %lu framing errors, %lu overruns\n",
+            (unsigned long)uart_tx_bytes, (unsigned long)uart_rx_bytes,
+            (unsigned long)uart_errors, (unsigned long)uart_overruns);
+    fprintf(out, "  flash    %lu sector erases, %lu words programmed\n",
+            (unsigned long)flash_erases, (unsigned long)flash_words);
+    SimRc522_Report(out);
+    SimKeypad_Report(out);
+    SimEsp_Report(out);
+}
+
+// ==================== ENTRY ====================
+
+static void Sim_ResetPeripherals(void) {
+    sim_rcc.CR = RCC_CR_HSION | RCC_CR_HSIRDY;
+    sim_rcc.PLLCFGR = 0x24003010UL;
+    sim_gpio[0].MODER = 0xA8000000UL;
+    sim_gpio[1].MODER = 0x00000280UL;
+    sim_spi[0].SR = SPI_SR_TXE;
+    for (uint8_t i = 0; i < 6; i++) {
+        sim_usart[i].SR = USART_SR_TXE | USART_SR_TC;
+    }
+    sim_scb.CPUID = 0x410FC241UL;     // Cortex-M4 r0p1
+    Sim_FlashReset();
+    SimRc522_Reset();
+}
+
+static void Sim_WallClockExpired(int signal) {
+    (void)signal;
+    static const char message[] = "sim error: host time limit exceeded (firmware hung?)\n";
+    if (write(STDERR_FILENO, message, sizeof(message) - 1) < 0) {
+        // Nothing more to do on the way out
+    }
+    _exit(3);
+}
+
+static void Sim_Usage(const char *name) {
+    fprintf(stderr, "usage: %s [-q|-v] [-t file] [-f file] scenario\n"
+                    "  -q       summary and expectation results only\n"
+                    "  -v       also show the firmware debug output\n"
+                    "  -t file  write TRACE dumps to file (see trace_decode)\n"
+                    "  -f file  flash image: storage sectors loaded at start, saved at exit\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *scenario = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-q") == 0) sim_verbose = 0;
+        else if (strcmp(argv[i], "-v") == 0) sim_verbose = 2;
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) SimEsp_SetTracePath(argv[++i]);
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) flash_path = argv[++i];
+        else if (argv[i][0] == '-' || scenario != NULL) Sim_Usage(argv[0]);
+        else scenario = argv[i];
+    }
+    if (scenario == NULL) Sim_Usage(argv[0]);
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    Sim_ResetPeripherals();
+    if (!SimScript_Load(scenario)) return 2;
+    if (flash_path != NULL) atexit(Sim_FlashSave);
+
+    clock_gettime(CLOCK_MONOTONIC, &host_start);
+    signal(SIGALRM, Sim_WallClockExpired);
+    alarm(SIM_WALLCLOCK_LIMIT_S);
+
+    // Runs until the scenario's end time, where SimScript_Finish() exits
+    firmware_main();
+    Sim_Fail("firmware returned from main()");
+}
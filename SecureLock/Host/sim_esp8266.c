@@ -0,0 +1,210 @@
+#include "sim.h"
+#include "config.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+
+// ESP8266 AT firmware as seen from USART2: command lines in, canned
+// responses out after a configurable latency, paced at 115200 baud.
+// Payloads sent with AT+CIPSEND are decoded and handed to the scenario
+// as log lines; binary trace dumps go to the file given with -t.
+
+#define ESP_LINE_SIZE              256
+#define ESP_PAYLOAD_SIZE           2048    // AT firmware limit for one CIPSEND
+#define ESP_QUEUE_SIZE             4096
+#define ESP_DEFAULT_LATENCY_US     1000
+#define ESP_CHAR_NS                (10ULL * SIM_NS_PER_S / 115200)
+
+static const uint8_t esp_key[16] = DEFAULT_AES_KEY;
+
+static char line[ESP_LINE_SIZE];
+static uint16_t line_len = 0;
+static char host[64] = "";
+
+static uint8_t payload[ESP_PAYLOAD_SIZE];
+static uint16_t payload_len = 0;
+static uint16_t payload_expected = 0;   // Non-zero while in CIPSEND data mode
+
+static uint8_t queue[ESP_QUEUE_SIZE];
+static uint16_t queue_head = 0;
+static uint16_t queue_tail = 0;
+static uint64_t next_out = SIM_NEVER;
+static uint64_t latency_ns = ESP_DEFAULT_LATENCY_US * SIM_NS_PER_US;
+
+static const char *trace_path = NULL;
+
+static uint64_t stat_commands = 0;
+static uint64_t stat_payloads = 0;
+static uint64_t stat_errors = 0;
+
+// ==================== OUTPUT ====================
+
+static void Esp_Queue(const char *text) {
+    uint8_t was_empty = (queue_head == queue_tail);
+
+    while (*text) {
+        uint16_t next = (queue_head + 1) % ESP_QUEUE_SIZE;
+        if (next == queue_tail) Sim_Fail("esp8266: response queue full");
+        queue[queue_head] = (uint8_t)*text++;
+        queue_head = next;
+    }
+    if (was_empty) next_out = Sim_Now() + latency_ns;
+}
+
+// ==================== PAYLOADS ====================
+
+// Trace_Dump: header and records as raw bytes, see trace.h
+static void Esp_TraceDump(void) {
+    char text[64];
+    const trace_dump_header_t *header = (const trace_dump_header_t *)payload;
+
+    if (trace_path != NULL) {
+        FILE *file = fopen(trace_path, "wb");
+        if (file == NULL || fwrite(payload, 1, payload_len, file) != payload_len) {
+            Sim_Fail("esp8266: cannot write trace dump to %s", trace_path);
+        }
+        fclose(file);
+    }
+
+    snprintf(text, sizeof(text), "trace dump %u records", header->count);
+    Sim_Log("esp8266: %s", text);
+    SimScript_RecordLog(Sim_Now(), text);
+}
+
+static void Esp_Payload(void) {
+    char text[ESP_PAYLOAD_SIZE + 1];
+    uint16_t length = 0;
+
+    stat_payloads++;
+
+    if (payload_len >= sizeof(trace_dump_header_t) &&
+        memcmp(payload, TRACE_DUMP_MAGIC, 4) == 0) {
+        Esp_TraceDump();
+        return;
+    }
+
+    if (strstr(host, "your-server") != NULL) {
+        // WIFI_SendEncryptedLog: the firmware's XOR cipher with the default key
+        for (uint16_t i = 0; i < payload_len; i++) {
+            text[length++] = (char)(payload[i] ^ esp_key[i % 16]);
+        }
+        text[length] = '\0';
+    } else {
+        // WIFI_SendLog: GET /update?...&field1=<message>
+        memcpy(text, payload, payload_len);
+        text[payload_len] = '\0';
+        char *field = strstr(text, "field1=");
+        if (field != NULL) {
+            memmove(text, field + 7, strlen(field + 7) + 1);
+        }
+        length = (uint16_t)strcspn(text, "\r\n");
+        text[length] = '\0';
+    }
+
+    Sim_Log("esp8266: log \"%s\"", text);
+    SimScript_RecordLog(Sim_Now(), text);
+}
+
+// ==================== COMMANDS ====================
+
+static void Esp_Command(void) {
+    stat_commands++;
+
+    if (line_len == 0) {
+        return;
+    } else if (strcmp(line, "AT") == 0 || strncmp(line, "AT+CWMODE", 9) == 0 ||
+               strncmp(line, "AT+CIPMUX", 9) == 0 || strncmp(line, "AT+CWJAP", 8) == 0 ||
+               strncmp(line, "AT+CIPSERVER", 12) == 0) {
+        Esp_Queue("\r\nOK\r\n");
+    } else if (strcmp(line, "AT+CIPSTATUS") == 0) {
+        Esp_Queue("STATUS:2\r\n\r\nOK\r\n");
+    } else if (strncmp(line, "AT+CIPSTART=", 12) == 0) {
+        // AT+CIPSTART="TCP","host",port
+        const char *start = strchr(line + 12, ',');
+        host[0] = '\0';
+        if (start != NULL && start[1] == '"') {
+            size_t n = strcspn(start + 2, "\"");
+            if (n >= sizeof(host)) n = sizeof(host) - 1;
+            memcpy(host, start + 2, n);
+            host[n] = '\0';
+        }
+        Esp_Queue("CONNECT\r\n\r\nOK\r\n");
+    } else if (strncmp(line, "AT+CIPSEND=", 11) == 0) {
+        int length = atoi(line + 11);
+        if (length <= 0 || length > ESP_PAYLOAD_SIZE) {
+            stat_errors++;
+            Esp_Queue("\r\nERROR\r\n");
+            return;
+        }
+        payload_expected = (uint16_t)length;
+        payload_len = 0;
+        Esp_Queue("\r\nOK\r\n> ");
+    } else if (strcmp(line, "AT+CIPCLOSE") == 0) {
+        host[0] = '\0';
+        Esp_Queue("CLOSED\r\n\r\nOK\r\n");
+    } else {
+        stat_errors++;
+        Esp_Queue("\r\nERROR\r\n");
+        Sim_Log("esp8266: unknown command \"%s\"", line);
+    }
+}
+
+// ==================== INTERFACE ====================
+
+void SimEsp_SetTracePath(const char *path) {
+    trace_path = path;
+}
+
+void SimEsp_SetLatency(uint32_t us) {
+    latency_ns = (uint64_t)us * SIM_NS_PER_US;
+}
+
+void SimEsp_Receive(uint8_t c) {
+    if (payload_expected) {
+        payload[payload_len++] = c;
+        if (payload_len == payload_expected) {
+            payload_expected = 0;
+            Esp_Queue("\r\nRecv ");
+            char count[16];
+            snprintf(count, sizeof(count), "%u bytes\r\n", payload_len);
+            Esp_Queue(count);
+            Esp_Queue("\r\nSEND OK\r\n");
+            Esp_Payload();
+        }
+        return;
+    }
+
+    if (c == '\n') {
+        line[line_len] = '\0';
+        Esp_Command();
+        line_len = 0;
+    } else if (c >= 0x20 && c < 0x7F && line_len < ESP_LINE_SIZE - 1) {
+        line[line_len++] = (char)c;   // '\r' and the trailing Ctrl+Z are dropped
+    }
+}
+
+// Remote command from the server side, e.g. "UNLOCK"; the leading line
+// break keeps it apart from unread tails of earlier responses ("> ")
+void SimEsp_SendLine(const char *text) {
+    Esp_Queue("\r\n");
+    Esp_Queue(text);
+    Esp_Queue("\r\n");
+}
+
+uint64_t SimEsp_NextEvent(void) {
+    return next_out;
+}
+
+void SimEsp_Update(uint64_t now) {
+    while (next_out <= now) {
+        Sim_UsartDeliver(queue[queue_tail]);
+        queue_tail = (queue_tail + 1) % ESP_QUEUE_SIZE;
+        next_out = (queue_tail == queue_head) ? SIM_NEVER : next_out + ESP_CHAR_NS;
+    }
+}
+
+void SimEsp_Report(FILE *out) {
+    fprintf(out, "  esp8266  %lu commands, %lu payloads, %lu errors\n",
+            (unsigned long)stat_commands, (unsigned long)stat_payloads,
+            (unsigned long)stat_errors);
+}
@@ -0,0 +1,106 @@
+#include "sim.h"
+#include "config.h"
+#include "stm32f407xx_registers.h"
+
+// 4x4 membrane keypad: a pressed key connects its column to its row, so a
+// row reads low while a pressed key's column is driven low. With bounce
+// set, the contact chatters every SIM_KEYPAD_CHATTER_NS for that long
+// after each press and release before it settles.
+
+#define SIM_KEYPAD_CHATTER_NS      400000ULL
+
+typedef struct {
+    uint8_t row;
+    uint8_t col;
+    uint64_t at;
+    uint64_t release;
+} sim_press_t;
+
+static const char keypad_layout[4][4] = {
+    {'1', '2', '3', 'A'},
+    {'4', '5', '6', 'B'},
+    {'7', '8', '9', 'C'},
+    {'*', '0', '#', 'D'}
+};
+
+static sim_press_t presses[SIM_KEYPAD_MAX_PRESSES];
+static uint16_t press_count = 0;
+static uint8_t rows_prev = 0;
+static uint64_t stat_row_falls = 0;     // A row pulled low: wake-up edges and scan hits
+static uint64_t bounce_ns = 0;
+
+uint8_t SimKeypad_Press(char key, uint64_t at, uint64_t hold) {
+    if (press_count >= SIM_KEYPAD_MAX_PRESSES) return 0;
+
+    for (uint8_t row = 0; row < 4; row++) {
+        for (uint8_t col = 0; col < 4; col++) {
+            if (keypad_layout[row][col] == key) {
+                presses[press_count++] = (sim_press_t){row, col, at, at + hold};
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+void SimKeypad_SetBounce(uint32_t us) {
+    bounce_ns = us * 1000ULL;
+}
+
+// Contact closed, chatter included
+static uint8_t SimKeypad_Closed(const sim_press_t *press, uint64_t now) {
+    if (now < press->at) return 0;
+    if (now < press->at + bounce_ns) return ((now - press->at) / SIM_KEYPAD_CHATTER_NS) % 2 == 0;
+    if (now < press->release) return 1;
+    if (now < press->release + bounce_ns) return ((now - press->release) / SIM_KEYPAD_CHATTER_NS) % 2 == 1;
+    return 0;
+}
+
+// Next flip of a contact chattering after `edge`
+static uint64_t SimKeypad_NextFlip(uint64_t edge, uint64_t now) {
+    if (now < edge || now >= edge + bounce_ns) return SIM_NEVER;
+
+    uint64_t next = edge + ((now - edge) / SIM_KEYPAD_CHATTER_NS + 1) * SIM_KEYPAD_CHATTER_NS;
+    return next < edge + bounce_ns ? next : edge + bounce_ns;
+}
+
+uint8_t SimKeypad_RowsLow(uint64_t now, uint32_t moder, uint32_t odr) {
+    uint8_t rows = 0;
+
+    for (uint16_t i = 0; i < press_count; i++) {
+        const sim_press_t *press = &presses[i];
+        uint8_t pin = KEYPAD_COL0_PIN + press->col;
+
+        if (!SimKeypad_Closed(press, now)) continue;
+        if (((moder >> (pin * 2)) & 3) != GPIO_MODER_OUTPUT) continue;
+        if (odr & (1UL << pin)) continue;
+
+        rows |= 1 << press->row;
+    }
+
+    for (uint8_t changed = rows & ~rows_prev; changed; changed &= changed - 1) {
+        stat_row_falls++;
+    }
+    rows_prev = rows;
+    return rows;
+}
+
+uint64_t SimKeypad_NextEvent(uint64_t now) {
+    uint64_t next = SIM_NEVER;
+
+    for (uint16_t i = 0; i < press_count; i++) {
+        if (presses[i].at > now && presses[i].at < next) next = presses[i].at;
+        if (presses[i].release > now && presses[i].release < next) next = presses[i].release;
+
+        uint64_t flip = SimKeypad_NextFlip(presses[i].at, now);
+        if (flip < next) next = flip;
+        flip = SimKeypad_NextFlip(presses[i].release, now);
+        if (flip < next) next = flip;
+    }
+    return next;
+}
+
+void SimKeypad_Report(FILE *out) {
+    fprintf(out, "  keypad   %u presses, %lu row falls\n",
+            press_count, (unsigned long)stat_row_falls);
+}
@@ -0,0 +1,730 @@
+#include "sim.h"
+#include "rfid.h"
+#include <string.h>
+
+// MFRC522 behind SPI1 with ISO 14443-3 type A cards in its field. Timing
+// follows the chip: 106 kbit/s frames, the card's frame delay time plus a
+// configurable extra latency, and the TAuto receive timeout. With a path
+// loss set, each card answer gets through with a probability that follows
+// the receiver gain, carrier drive and MinLevel threshold in use.
+// Scripted faults: a brown-out puts every register back to its reset
+// value; a latch-up stops the chip answering on SPI or its IRQ line until
+// NRSTPD is pulsed.
+
+#define RC522_FIFO_SIZE            64
+#define RC522_VERSION              0x92
+#define RC522_VERSION_REG          0x37
+#define RC522_FC_HZ                13560000ULL
+#define RC522_BIT_NS               9440ULL    // 128 / fc
+#define RC522_FDT_NS               86000ULL   // Card frame delay time
+#define RC522_STARTUP_NS           37740ULL   // Oscillator start after reset
+#define RC522_CRC_NS_PER_BYTE      600ULL
+#define RC522_FRAME_BITS           (SIM_RC522_MAX_UID + 8) * 8
+
+// ComIrqReg / DivIrqReg / ErrorReg bits
+#define RC522_IRQ_SET              0x80
+#define RC522_IRQ_TX               0x40
+#define RC522_IRQ_RX               0x20
+#define RC522_IRQ_IDLE             0x10
+#define RC522_IRQ_TIMER            0x01
+#define RC522_DIVIRQ_CRC           0x04
+#define RC522_ERR_BUFFER_OVFL      0x10
+#define RC522_ERR_COLL             0x08
+#define RC522_ERR_CRC              0x04
+#define RC522_COMMAND_RCV_OFF      0x20
+#define RC522_COMIEN_IRQ_INV       0x80
+#define RC522_DIVIEN_PUSH_PULL     0x80
+
+typedef enum {
+    CARD_OFF = 0,   // Outside the field or antenna off
+    CARD_IDLE,
+    CARD_READY,
+    CARD_ACTIVE,
+    CARD_HALT
+} card_state_t;
+
+typedef struct {
+    uint8_t uid[SIM_RC522_MAX_UID];
+    uint8_t uid_len;
+    uint64_t enter;
+    uint64_t leave;
+    card_state_t state;
+    uint8_t level;              // Cascade level being selected (0-2)
+    uint8_t detected;           // Anticollision answered during this presentation
+} sim_card_t;
+
+typedef struct {
+    uint64_t at;
+    sim_rc522_fault_t type;
+} sim_fault_t;
+
+typedef struct {
+    uint8_t data[RC522_FRAME_BITS / 8 + 2];
+    uint16_t bits;
+} frame_t;
+
+static uint8_t regs[64];
+static uint8_t fifo[RC522_FIFO_SIZE];
+static uint8_t fifo_len;
+
+static uint8_t in_reset = 1;
+static uint8_t latched = 0;             // Latched up: deaf until a hard reset
+static uint8_t spi_selected = 0;
+static uint8_t spi_first = 0;
+static uint8_t spi_write = 0;
+static uint8_t spi_reg = 0;
+
+static uint64_t powerup_at = SIM_NEVER;
+static uint64_t tx_done_at = SIM_NEVER;
+static uint64_t rx_done_at = SIM_NEVER;
+static uint64_t timer_at = SIM_NEVER;
+static uint64_t crc_done_at = SIM_NEVER;
+static uint8_t transmit_only = 0;       // Transmit command: no reception, idle once sent
+static uint16_t crc_result = 0;
+
+static frame_t rx_frame;
+static uint16_t rx_collision;   // First collided bit (1-based), 0 = none
+static uint8_t rx_align;
+
+static sim_card_t cards[SIM_RC522_MAX_CARDS];
+static uint8_t card_count = 0;
+static sim_fault_t faults[SIM_RC522_MAX_FAULTS];
+static uint8_t fault_count = 0;
+static uint8_t fault_next = 0;
+static uint64_t latency_ns = 0;
+static int32_t rf_loss_db = 0;
+static uint32_t rf_seed = 1;            // Answer loss rolls, deterministic per run
+
+static uint64_t stat_transceives = 0;
+static uint64_t stat_timeouts = 0;
+static uint64_t stat_collisions = 0;
+static uint64_t stat_reg_reads = 0;
+static uint64_t stat_reg_writes = 0;
+static uint64_t stat_frames = 0;
+static uint64_t stat_lost = 0;
+static uint64_t stat_hard_resets = 0;
+static uint64_t antenna_on_ns = 0;
+static uint64_t antenna_since = SIM_NEVER;
+
+// ==================== HELPERS ====================
+
+static uint16_t Rc522_CrcA(const uint8_t *data, uint16_t length, uint16_t preset) {
+    uint16_t crc = preset;
+    for (uint16_t i = 0; i < length; i++) {
+        uint8_t ch = data[i] ^ (uint8_t)crc;
+        ch ^= ch << 4;
+        crc = (crc >> 8) ^ ((uint16_t)ch << 8) ^ ((uint16_t)ch << 3) ^ (ch >> 4);
+    }
+    return crc;
+}
+
+static uint8_t Frame_Bit(const uint8_t *data, uint16_t bit) {
+    return (data[bit >> 3] >> (bit & 7)) & 1;
+}
+
+static void Frame_SetBit(uint8_t *data, uint16_t bit, uint8_t value) {
+    if (value) data[bit >> 3] |= 1 << (bit & 7);
+    else data[bit >> 3] &= ~(1 << (bit & 7));
+}
+
+static void Frame_Append(frame_t *frame, const uint8_t *data, uint16_t bits) {
+    for (uint16_t i = 0; i < bits; i++) {
+        Frame_SetBit(frame->data, frame->bits++, Frame_Bit(data, i));
+    }
+}
+
+// Air time of a frame: start bit, parity per full byte, end of frame
+static uint64_t Frame_AirTime(uint16_t bits) {
+    return (uint64_t)(bits + bits / 8 + 2) * RC522_BIT_NS;
+}
+
+static uint8_t Rc522_AntennaOn(void) {
+    return !in_reset && (regs[MFRC522_TX_CONTROL_REG] & 0x03);
+}
+
+static uint64_t Rc522_TimerPeriod(void) {
+    uint64_t prescaler = ((uint64_t)(regs[MFRC522_T_MODE_REG] & 0x0F) << 8) | regs[MFRC522_T_PRESCALER_REG];
+    uint64_t reload = ((uint64_t)regs[MFRC522_T_RELOAD_H_REG] << 8) | regs[MFRC522_T_RELOAD_L_REG];
+    return (2 * prescaler + 1) * (reload + 1) * SIM_NS_PER_S / RC522_FC_HZ;
+}
+
+static uint16_t Rc522_CrcPreset(void) {
+    static const uint16_t presets[4] = {0x0000, 0x6363, 0xA671, 0xFFFF};
+    return presets[regs[MFRC522_MODE_REG] & 0x03];
+}
+
+static void Rc522_Log(const char *what, const sim_card_t *card) {
+    char uid[SIM_RC522_MAX_UID * 2 + 1];
+    for (uint8_t i = 0; i < card->uid_len; i++) {
+        snprintf(&uid[i * 2], 3, "%02X", card->uid[i]);
+    }
+    Sim_Log("card %s %s", uid, what);
+}
+
+// ==================== CARDS ====================
+
+// Cascade level bytes: up to three UID bytes behind the cascade tag, then BCC
+static void Card_Level(const sim_card_t *card, uint8_t level, uint8_t out[5]) {
+    uint8_t levels = (card->uid_len == 4) ? 1 : (card->uid_len == 7) ? 2 : 3;
+    uint8_t offset = level * 3;
+
+    if (level + 1 < levels) {
+        out[0] = PICC_CMD_CT;
+        memcpy(&out[1], &card->uid[offset], 3);
+    } else {
+        memcpy(out, &card->uid[offset], 4);
+    }
+    out[4] = out[0] ^ out[1] ^ out[2] ^ out[3];
+}
+
+static uint8_t Card_Levels(const sim_card_t *card) {
+    return (card->uid_len == 4) ? 1 : (card->uid_len == 7) ? 2 : 3;
+}
+
+static uint8_t Card_CrcOk(const frame_t *frame) {
+    if (frame->bits % 8 || frame->bits < 24) return 0;
+    uint16_t length = frame->bits / 8;
+    uint16_t crc = Rc522_CrcA(frame->data, length - 2, 0x6363);
+    return frame->data[length - 2] == (uint8_t)crc && frame->data[length - 1] == (uint8_t)(crc >> 8);
+}
+
+// Returns 1 and fills response when the card answers the frame
+static uint8_t Card_Handle(sim_card_t *card, const frame_t *tx, frame_t *response) {
+    response->bits = 0;
+
+    // Short frames: REQA / WUPA
+    if (tx->bits == 7) {
+        uint8_t cmd = tx->data[0] & 0x7F;
+        uint8_t wake = (cmd == PICC_CMD_REQA && card->state == CARD_IDLE) ||
+                       (cmd == PICC_CMD_WUPA && (card->state == CARD_IDLE || card->state == CARD_HALT));
+        if (!wake) {
+            if (card->state == CARD_READY || card->state == CARD_ACTIVE) card->state = CARD_IDLE;
+            return 0;
+        }
+        uint8_t atqa[2] = {card->uid_len == 4 ? 0x04 : card->uid_len == 7 ? 0x44 : 0x84, 0x00};
+        Frame_Append(response, atqa, 16);
+        card->state = CARD_READY;
+        card->level = 0;
+        return 1;
+    }
+
+    if (tx->bits < 16) {
+        card->state = (card->state == CARD_HALT) ? CARD_HALT : CARD_IDLE;
+        return 0;
+    }
+
+    uint8_t cmd = tx->data[0];
+
+    if (card->state == CARD_READY &&
+        (cmd == PICC_CMD_SEL_CL1 || cmd == PICC_CMD_SEL_CL2 || cmd == PICC_CMD_SEL_CL3)) {
+        uint8_t level = (cmd - PICC_CMD_SEL_CL1) / 2;
+        uint8_t nvb = tx->data[1];
+        uint16_t known = (uint16_t)(((nvb >> 4) - 2) * 8 + (nvb & 0x0F));
+        uint8_t cl[5];
+
+        if (level != card->level || (nvb >> 4) < 2 || known > 40) {
+            card->state = CARD_IDLE;
+            return 0;
+        }
+        Card_Level(card, level, cl);
+
+        // Only cards whose UID starts with the bits sent take part
+        for (uint16_t i = 0; i < known; i++) {
+            if (Frame_Bit(&tx->data[2], i) != Frame_Bit(cl, i)) return 0;
+        }
+
+        if (known < 40) {
+            // Anticollision: answer with the rest of the level
+            SimScript_RecordAnticollision(Sim_Now());
+            for (uint16_t i = known; i < 40; i++) {
+                Frame_SetBit(response->data, response->bits++, Frame_Bit(cl, i));
+            }
+            if (!card->detected) {
+                card->detected = 1;
+                SimScript_RecordDetect(card->uid, card->uid_len, Sim_Now() - card->enter);
+            }
+            return 1;
+        }
+
+        // SELECT: all 40 bits plus CRC_A
+        if (tx->bits != 72 || !Card_CrcOk(tx)) return 0;
+
+        uint8_t sak[3];
+        uint8_t last = (level + 1 == Card_Levels(card));
+        sak[0] = last ? 0x08 : 0x04;
+        uint16_t crc = Rc522_CrcA(sak, 1, 0x6363);
+        sak[1] = (uint8_t)crc;
+        sak[2] = (uint8_t)(crc >> 8);
+        Frame_Append(response, sak, 24);
+
+        if (last) {
+            card->state = CARD_ACTIVE;
+            Rc522_Log("selected", card);
+        } else {
+            card->level++;
+        }
+        return 1;
+    }
+
+    if (card->state == CARD_ACTIVE && cmd == PICC_CMD_HLTA && tx->bits == 32 && tx->data[1] == 0x00) {
+        if (Card_CrcOk(tx)) {
+            card->state = CARD_HALT;
+            Rc522_Log("halted", card);
+        }
+        return 0;
+    }
+
+    // Anything unexpected sends the card back to IDLE (HALT stays halted)
+    if (card->state != CARD_HALT) card->state = CARD_IDLE;
+    return 0;
+}
+
+static void Rc522_UpdateCards(uint64_t now) {
+    uint8_t field = Rc522_AntennaOn();
+
+    for (uint8_t i = 0; i < card_count; i++) {
+        sim_card_t *card = &cards[i];
+        uint8_t powered = field && now >= card->enter && now < card->leave;
+
+        if (powered && card->state == CARD_OFF) {
+            card->state = CARD_IDLE;
+            card->level = 0;
+            if (now < card->enter + 1000) Rc522_Log("enters the field", card);
+        } else if (!powered && card->state != CARD_OFF) {
+            card->state = CARD_OFF;
+            if (now >= card->leave) {
+                Rc522_Log("leaves the field", card);
+                card->detected = 0;
+            }
+        }
+    }
+
+    if (field && antenna_since == SIM_NEVER) {
+        antenna_since = now;
+    } else if (!field && antenna_since != SIM_NEVER) {
+        antenna_on_ns += now - antenna_since;
+        antenna_since = SIM_NEVER;
+    }
+}
+
+// ==================== COMMANDS ====================
+
+static void Rc522_Stop(void) {
+    tx_done_at = rx_done_at = timer_at = crc_done_at = SIM_NEVER;
+    transmit_only = 0;
+}
+
+static void Rc522_ResetRegisters(void) {
+    memset(regs, 0, sizeof(regs));
+    regs[MFRC522_COMMAND_REG] = RC522_COMMAND_RCV_OFF;
+    regs[MFRC522_COMIEN_REG] = 0x80;
+    regs[MFRC522_COMIRQ_REG] = 0x14;
+    regs[MFRC522_STATUS1_REG] = 0x21;
+    regs[MFRC522_WATER_LEVEL_REG] = 0x08;
+    regs[MFRC522_CONTROL_REG] = 0x10;
+    regs[MFRC522_COLL_REG] = 0x80;
+    regs[MFRC522_MODE_REG] = 0x3F;
+    regs[MFRC522_TX_CONTROL_REG] = 0x80;
+    regs[MFRC522_TX_SEL_REG] = 0x10;
+    regs[MFRC522_RX_SEL_REG] = 0x84;
+    regs[MFRC522_RX_THRESHOLD_REG] = 0x84;
+    regs[MFRC522_DEMOD_REG] = 0x4D;
+    regs[MFRC522_SERIAL_SPEED_REG] = 0xEB;
+    regs[MFRC522_CRC_RESULT_H_REG] = 0xFF;
+    regs[MFRC522_CRC_RESULT_L_REG] = 0xFF;
+    regs[MFRC522_MOD_WIDTH_REG] = 0x26;
+    regs[MFRC522_RF_CFG_REG] = 0x48;
+    regs[MFRC522_GS_N_REG] = 0x88;
+    regs[MFRC522_CW_GS_P_REG] = 0x20;
+    regs[MFRC522_MOD_GS_P_REG] = 0x20;
+    regs[RC522_VERSION_REG] = RC522_VERSION;
+    fifo_len = 0;
+    Rc522_Stop();
+}
+
+// Chance in 1/12ths that a card answer is decoded: sure with 6 dB of
+// margin over the threshold, never 6 dB below it, and halved when a
+// high gain under a low MinLevel lets noise through as well
+static int32_t Rc522_AnswerOdds(void) {
+    static const int32_t gains_db[8] = {18, 23, 18, 23, 33, 38, 43, 48};
+    int32_t gain_db = gains_db[(regs[MFRC522_RF_CFG_REG] >> 4) & 0x07];
+    int32_t drive_db = ((int32_t)(regs[MFRC522_CW_GS_P_REG] & 0x3F) - 32) * 6 / 31;
+    int32_t min_level = regs[MFRC522_RX_THRESHOLD_REG] >> 4;
+    int32_t margin = gain_db + drive_db - rf_loss_db - 3 * (min_level - 8) - 24;
+    int32_t odds = margin + 6;
+
+    if (odds < 0) odds = 0;
+    if (odds > 12) odds = 12;
+    if (gain_db - 3 * min_level > 18) odds /= 2;
+    return odds;
+}
+
+static uint8_t Rc522_AnswerHeard(void) {
+    if (rf_loss_db == 0) return 1;
+
+    rf_seed = rf_seed * 1103515245u + 12345u;
+    if ((int32_t)((rf_seed >> 16) % 12) < Rc522_AnswerOdds()) return 1;
+    stat_lost++;
+    return 0;
+}
+
+static void Rc522_StartTransmit(uint64_t now) {
+    frame_t tx = {0};
+    uint8_t last_bits = regs[MFRC522_BIT_FRAMING_REG] & 0x07;
+
+    if (fifo_len == 0) return;
+    tx.bits = (uint16_t)(last_bits ? (fifo_len - 1) * 8 + last_bits : fifo_len * 8);
+    memcpy(tx.data, fifo, fifo_len);
+    fifo_len = 0;
+
+    if ((regs[MFRC522_TX_MODE_REG] & 0x80) && last_bits == 0) {
+        uint16_t crc = Rc522_CrcA(tx.data, tx.bits / 8, Rc522_CrcPreset());
+        uint8_t bytes[2] = {(uint8_t)crc, (uint8_t)(crc >> 8)};
+        Frame_Append(&tx, bytes, 16);
+    }
+
+    stat_transceives++;
+    tx_done_at = now + Frame_AirTime(tx.bits);
+    rx_align = (regs[MFRC522_BIT_FRAMING_REG] >> 4) & 0x07;
+
+    // Every card in the field answers at once; differing bits collide
+    frame_t merged = {0};
+    uint8_t responders = 0;
+    rx_collision = 0;
+    Rc522_UpdateCards(now);
+    for (uint8_t i = 0; i < card_count && Rc522_AntennaOn(); i++) {
+        frame_t response;
+        if (cards[i].state == CARD_OFF || !Card_Handle(&cards[i], &tx, &response)) continue;
+        if (transmit_only || !Rc522_AnswerHeard()) continue;
+
+        if (responders++ == 0) {
+            merged = response;
+            continue;
+        }
+        for (uint16_t bit = 0; bit < response.bits; bit++) {
+            uint8_t value = Frame_Bit(response.data, bit);
+            if (bit >= merged.bits) {
+                Frame_SetBit(merged.data, bit, value);
+            } else if (Frame_Bit(merged.data, bit) != value) {
+                if (!rx_collision) rx_collision = bit + 1;
+                Frame_SetBit(merged.data, bit, 1);
+            }
+        }
+        if (response.bits > merged.bits) merged.bits = response.bits;
+    }
+
+    if (responders) {
+        rx_frame = merged;
+        rx_done_at = tx_done_at + RC522_FDT_NS + latency_ns + Frame_AirTime(merged.bits);
+        if (rx_collision) stat_collisions++;
+    } else if (regs[MFRC522_T_MODE_REG] & 0x80) {
+        // TAuto: the timer starts at the end of the transmission
+        timer_at = tx_done_at + Rc522_TimerPeriod();
+    }
+}
+
+static void Rc522_Receive(void) {
+    uint16_t total = rx_align + rx_frame.bits;
+    uint8_t bytes = (uint8_t)((total + 7) / 8);
+    uint8_t buffer[sizeof(rx_frame.data) + 1] = {0};
+
+    for (uint16_t i = 0; i < rx_frame.bits; i++) {
+        Frame_SetBit(buffer, rx_align + i, Frame_Bit(rx_frame.data, i));
+    }
+
+    for (uint8_t i = 0; i < bytes; i++) {
+        if (fifo_len < RC522_FIFO_SIZE) fifo[fifo_len++] = buffer[i];
+        else regs[MFRC522_ERROR_REG] |= RC522_ERR_BUFFER_OVFL;
+    }
+
+    regs[MFRC522_CONTROL_REG] = (regs[MFRC522_CONTROL_REG] & ~0x07) | (total % 8);
+    if (rx_collision) {
+        regs[MFRC522_ERROR_REG] |= RC522_ERR_COLL;
+        regs[MFRC522_COLL_REG] = (regs[MFRC522_COLL_REG] & 0x80) | ((rx_align + rx_collision) & 0x1F);
+    } else {
+        regs[MFRC522_COLL_REG] = (regs[MFRC522_COLL_REG] & 0x80) | 0x20; // CollPosNotValid
+    }
+    regs[MFRC522_COMIRQ_REG] |= RC522_IRQ_RX;
+    timer_at = SIM_NEVER;
+}
+
+static void Rc522_Command(uint8_t value, uint64_t now) {
+    uint8_t cmd = value & 0x0F;
+
+    regs[MFRC522_COMMAND_REG] = value & (RC522_COMMAND_RCV_OFF | MFRC522_COMMAND_POWER_DOWN | 0x0F);
+
+    switch (cmd) {
+        case MFRC522_CMD_IDLE:
+            Rc522_Stop();
+            break;
+
+        case MFRC522_CMD_CALC_CRC:
+            Rc522_Stop();
+            crc_result = Rc522_CrcA(fifo, fifo_len, Rc522_CrcPreset());
+            crc_done_at = now + RC522_CRC_NS_PER_BYTE * (fifo_len + 1);
+            fifo_len = 0;
+            break;
+
+        case MFRC522_CMD_TRANSMIT:
+            // Sends the FIFO straight away and ends by itself
+            Rc522_Stop();
+            regs[MFRC522_ERROR_REG] = 0;
+            transmit_only = 1;
+            Rc522_StartTransmit(now);
+            if (tx_done_at == SIM_NEVER) tx_done_at = now;
+            break;
+
+        case MFRC522_CMD_TRANSCEIVE:
+            Rc522_Stop();
+            regs[MFRC522_ERROR_REG] = 0;
+            break;
+
+        case MFRC522_CMD_SOFT_RESET:
+            Rc522_ResetRegisters();
+            regs[MFRC522_COMMAND_REG] = RC522_COMMAND_RCV_OFF | MFRC522_COMMAND_POWER_DOWN;
+            powerup_at = now + RC522_STARTUP_NS;
+            break;
+
+        default:
+            Sim_Log("rc522: command 0x%02X not modelled", cmd);
+            regs[MFRC522_COMMAND_REG] &= ~0x0F;
+            break;
+    }
+}
+
+// ==================== REGISTERS ====================
+
+static uint8_t Rc522_Read(uint8_t reg) {
+    stat_reg_reads++;
+
+    switch (reg) {
+        case MFRC522_FIFO_DATA_REG: {
+            if (fifo_len == 0) return 0;
+            uint8_t value = fifo[0];
+            memmove(fifo, fifo + 1, --fifo_len);
+            return value;
+        }
+        case MFRC522_FIFO_LEVEL_REG:
+            return fifo_len;
+        default:
+            return regs[reg];
+    }
+}
+
+static void Rc522_Write(uint8_t reg, uint8_t value) {
+    uint64_t now = Sim_Now();
+    stat_reg_writes++;
+
+    switch (reg) {
+        case MFRC522_COMMAND_REG:
+            Rc522_Command(value, now);
+            break;
+        case MFRC522_COMIRQ_REG:
+            if (value & RC522_IRQ_SET) regs[reg] |= value & 0x7F;
+            else regs[reg] &= ~(value & 0x7F);
+            break;
+        case MFRC522_DIVIRQ_REG:
+            if (value & RC522_IRQ_SET) regs[reg] |= value & 0x14;
+            else regs[reg] &= ~(value & 0x14);
+            break;
+        case MFRC522_FIFO_DATA_REG:
+            if (fifo_len < RC522_FIFO_SIZE) fifo[fifo_len++] = value;
+            else regs[MFRC522_ERROR_REG] |= RC522_ERR_BUFFER_OVFL;
+            break;
+        case MFRC522_FIFO_LEVEL_REG:
+            if (value & 0x80) {
+                fifo_len = 0;
+                regs[MFRC522_ERROR_REG] &= ~RC522_ERR_BUFFER_OVFL;
+            }
+            break;
+        case MFRC522_BIT_FRAMING_REG:
+            regs[reg] = value & 0x7F;
+            if ((value & 0x80) && (regs[MFRC522_COMMAND_REG] & 0x0F) == MFRC522_CMD_TRANSCEIVE) {
+                Rc522_StartTransmit(now);
+            }
+            break;
+        case MFRC522_ERROR_REG:
+        case MFRC522_STATUS1_REG:
+        case MFRC522_CRC_RESULT_H_REG:
+        case MFRC522_CRC_RESULT_L_REG:
+        case RC522_VERSION_REG:
+            break;  // Read-only
+        case MFRC522_TX_CONTROL_REG:
+            regs[reg] = value;
+            Rc522_UpdateCards(now);
+            break;
+        default:
+            regs[reg] = value;
+            break;
+    }
+}
+
+// ==================== INTERFACE ====================
+
+void SimRc522_Reset(void) {
+    Rc522_ResetRegisters();
+    in_reset = 1;
+    powerup_at = SIM_NEVER;
+}
+
+// NRSTPD: low holds the chip in hard power-down
+void SimRc522_SetResetPin(uint8_t level) {
+    if (!level) {
+        if (!in_reset) stat_hard_resets++;
+        latched = 0;
+        SimRc522_Reset();
+        Rc522_UpdateCards(Sim_Now());
+    } else if (in_reset) {
+        in_reset = 0;
+        regs[MFRC522_COMMAND_REG] = RC522_COMMAND_RCV_OFF | MFRC522_COMMAND_POWER_DOWN;
+        powerup_at = Sim_Now() + RC522_STARTUP_NS;
+    }
+}
+
+void SimRc522_SetSelect(uint8_t selected) {
+    if (selected && !spi_selected) stat_frames++;
+    spi_selected = selected;
+    spi_first = selected;
+}
+
+// IRQ output: 0 or 1 when driven, -1 when released. It follows the
+// enabled ComIrqReg/DivIrqReg bits, inverted by IRqInv; an open-drain
+// output only ever pulls low.
+int SimRc522_IrqPin(void) {
+    if (in_reset || latched) return -1;
+
+    uint8_t active = (regs[MFRC522_COMIRQ_REG] & regs[MFRC522_COMIEN_REG] & 0x7F) ||
+                     (regs[MFRC522_DIVIRQ_REG] & regs[MFRC522_DIVIEN_REG] & 0x14);
+    uint8_t level = (regs[MFRC522_COMIEN_REG] & RC522_COMIEN_IRQ_INV) ? !active : active;
+
+    if (!(regs[MFRC522_DIVIEN_REG] & RC522_DIVIEN_PUSH_PULL) && level) return -1;
+    return level;
+}
+
+// One SPI byte: the first byte of a frame is the address, then data bytes
+// for a write, or the next address for a read (MISO carries the previous one)
+uint8_t SimRc522_Transfer(uint8_t mosi, uint32_t sck_hz) {
+    (void)sck_hz;
+    if (!spi_selected || in_reset || latched) return 0xFF;
+
+    if (spi_first) {
+        spi_first = 0;
+        spi_reg = (mosi >> 1) & 0x3F;
+        spi_write = !(mosi & 0x80);
+        return 0x00;
+    }
+
+    if (spi_write) {
+        Rc522_Write(spi_reg, mosi);
+        return 0x00;
+    }
+
+    uint8_t value = Rc522_Read(spi_reg);
+    spi_reg = (mosi >> 1) & 0x3F;
+    return value;
+}
+
+uint64_t SimRc522_NextEvent(void) {
+    uint64_t next = powerup_at;
+    uint64_t now = Sim_Now();
+
+    if (fault_next < fault_count && faults[fault_next].at < next) next = faults[fault_next].at;
+    if (tx_done_at < next) next = tx_done_at;
+    if (rx_done_at < next) next = rx_done_at;
+    if (timer_at < next) next = timer_at;
+    if (crc_done_at < next) next = crc_done_at;
+
+    for (uint8_t i = 0; i < card_count; i++) {
+        if (cards[i].enter > now && cards[i].enter < next) next = cards[i].enter;
+        if (cards[i].leave > now && cards[i].leave < next) next = cards[i].leave;
+    }
+    return next;
+}
+
+void SimRc522_Update(uint64_t now) {
+    while (fault_next < fault_count && faults[fault_next].at <= now) {
+        if (faults[fault_next].type == SIM_RC522_BROWNOUT) {
+            Sim_Log("mfrc522 brown-out, registers reset");
+            Rc522_ResetRegisters();
+        } else {
+            Sim_Log("mfrc522 latched up");
+            Rc522_Stop();
+            latched = 1;
+        }
+        fault_next++;
+    }
+    if (powerup_at <= now) {
+        powerup_at = SIM_NEVER;
+        regs[MFRC522_COMMAND_REG] &= ~MFRC522_COMMAND_POWER_DOWN;
+    }
+    if (tx_done_at <= now) {
+        tx_done_at = SIM_NEVER;
+        regs[MFRC522_COMIRQ_REG] |= RC522_IRQ_TX;
+        if (transmit_only) {
+            transmit_only = 0;
+            regs[MFRC522_COMIRQ_REG] |= RC522_IRQ_IDLE;
+            regs[MFRC522_COMMAND_REG] &= ~0x0F;
+        }
+    }
+    if (rx_done_at <= now) {
+        rx_done_at = SIM_NEVER;
+        Rc522_Receive();
+    }
+    if (timer_at <= now) {
+        timer_at = SIM_NEVER;
+        regs[MFRC522_COMIRQ_REG] |= RC522_IRQ_TIMER;
+        stat_timeouts++;
+    }
+    if (crc_done_at <= now) {
+        crc_done_at = SIM_NEVER;
+        regs[MFRC522_CRC_RESULT_H_REG] = (uint8_t)(crc_result >> 8);
+        regs[MFRC522_CRC_RESULT_L_REG] = (uint8_t)crc_result;
+        regs[MFRC522_DIVIRQ_REG] |= RC522_DIVIRQ_CRC;
+    }
+    Rc522_UpdateCards(now);
+}
+
+uint8_t SimRc522_AddCard(const uint8_t *uid, uint8_t uid_len, uint64_t enter, uint64_t leave) {
+    if (card_count >= SIM_RC522_MAX_CARDS) return 0;
+    if (uid_len != 4 && uid_len != 7 && uid_len != 10) return 0;
+
+    sim_card_t *card = &cards[card_count++];
+    memset(card, 0, sizeof(*card));
+    memcpy(card->uid, uid, uid_len);
+    card->uid_len = uid_len;
+    card->enter = enter;
+    card->leave = leave;
+    return 1;
+}
+
+void SimRc522_SetLatency(uint32_t us) {
+    latency_ns = (uint64_t)us * SIM_NS_PER_US;
+}
+
+// Faults in time order
+uint8_t SimRc522_AddFault(uint64_t at, sim_rc522_fault_t type) {
+    if (fault_count >= SIM_RC522_MAX_FAULTS) return 0;
+    if (fault_count && faults[fault_count - 1].at > at) return 0;
+
+    faults[fault_count].at = at;
+    faults[fault_count].type = type;
+    fault_count++;
+    return 1;
+}
+
+// Extra attenuation between antenna and cards; 0 for a perfect link
+void SimRc522_SetRfLoss(int32_t db) {
+    rf_loss_db = db;
+}
+
+void SimRc522_Report(FILE *out) {
+    uint64_t on_ns = antenna_on_ns;
+    if (antenna_since != SIM_NEVER) on_ns += Sim_Now() - antenna_since;
+
+    fprintf(out, "  mfrc522  %lu transceives, %lu timeouts, %lu collisions, %lu/%lu reg reads/writes "
+                 "in %lu frames, %lu answers lost, %lu hard resets, antenna on %.1f ms\n",
+            (unsigned long)stat_transceives, (unsigned long)stat_timeouts,
+            (unsigned long)stat_collisions, (unsigned long)stat_reg_reads,
+            (unsigned long)stat_reg_writes, (unsigned long)stat_frames,
+            (unsigned long)stat_lost, (unsigned long)stat_hard_resets, SIM_MS(on_ns));
+}
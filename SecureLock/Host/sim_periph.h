@@ -0,0 +1,108 @@
+#ifndef SIM_PERIPH_H
+#define SIM_PERIPH_H
+
+// Included at the end of stm32f407xx_registers.h in the host build. Every
+// peripheral instance is redirected to a RAM copy that sim_core.c keeps in
+// step with the models; the register layouts are the target's own.
+
+extern RCC_TypeDef       sim_rcc;
+extern GPIO_TypeDef      sim_gpio[8];
+extern SPI_TypeDef       sim_spi[3];
+extern USART_TypeDef     sim_usart[6];
+extern SysTick_TypeDef   sim_systick;
+extern NVIC_TypeDef      sim_nvic;
+extern SCB_TypeDef       sim_scb;
+extern DWT_TypeDef       sim_dwt;
+extern CoreDebug_TypeDef sim_coredebug;
+extern FLASH_TypeDef     sim_flash;
+extern EXTI_TypeDef      sim_exti;
+extern SYSCFG_TypeDef    sim_syscfg;
+extern DMA_TypeDef       sim_dma[2];
+extern TIM_TypeDef       sim_tim[4];
+
+#undef RCC
+#undef GPIOA
+#undef GPIOB
+#undef GPIOC
+#undef GPIOD
+#undef GPIOE
+#undef GPIOF
+#undef GPIOG
+#undef GPIOH
+#undef SPI1
+#undef SPI2
+#undef SPI3
+#undef USART1
+#undef USART2
+#undef USART3
+#undef UART4
+#undef UART5
+#undef USART6
+#undef SysTick
+#undef NVIC
+#undef SCB
+#undef DWT
+#undef CoreDebug
+#undef FLASH
+#undef EXTI
+#undef SYSCFG
+#undef DMA1
+#undef DMA2
+#undef TIM2
+#undef TIM3
+#undef TIM4
+#undef TIM5
+
+#define RCC                (&sim_rcc)
+#define GPIOA              (&sim_gpio[0])
+#define GPIOB              (&sim_gpio[1])
+#define GPIOC              (&sim_gpio[2])
+#define GPIOD              (&sim_gpio[3])
+#define GPIOE              (&sim_gpio[4])
+#define GPIOF              (&sim_gpio[5])
+#define GPIOG              (&sim_gpio[6])
+#define GPIOH              (&sim_gpio[7])
+#define SPI1               (&sim_spi[0])
+#define SPI2               (&sim_spi[1])
+#define SPI3               (&sim_spi[2])
+#define USART1             (&sim_usart[0])
+#define USART2             (&sim_usart[1])
+#define USART3             (&sim_usart[2])
+#define UART4              (&sim_usart[3])
+#define UART5              (&sim_usart[4])
+#define USART6             (&sim_usart[5])
+#define SysTick            (&sim_systick)
+#define NVIC               (&sim_nvic)
+#define SCB                (&sim_scb)
+#define DWT                (&sim_dwt)
+#define CoreDebug          (&sim_coredebug)
+#define FLASH              (&sim_flash)
+#define EXTI               (&sim_exti)
+#define SYSCFG             (&sim_syscfg)
+#define DMA1               (&sim_dma[0])
+#define DMA2               (&sim_dma[1])
+#define TIM2               (&sim_tim[0])
+#define TIM3               (&sim_tim[1])
+#define TIM4               (&sim_tim[2])
+#define TIM5               (&sim_tim[3])
+
+// Bus access hooks: advance virtual time by one peripheral access and let
+// the models react to the register
+void Sim_RegisterRead(const volatile void *reg);
+void Sim_RegisterWrite(const volatile void *reg);
+
+#define REG_SYNC_READ(reg)    Sim_RegisterRead(&(reg))
+#define REG_SYNC_WRITE(reg)   Sim_RegisterWrite(&(reg))
+
+// DMA address registers hold 32-bit handles that the DMA model maps back
+// to host pointers
+uint32_t Sim_DmaAddress(const volatile void *ptr);
+
+#define DMA_ADDRESS(ptr)      Sim_DmaAddress(ptr)
+
+// Flash memory lives in a RAM array; only the storage sectors are mapped
+volatile uint32_t *Sim_FlashWord(uint32_t address);
+
+#define FLASH_WORD(address)   (*Sim_FlashWord(address))
+
+#endif // SIM_PERIPH_H
@@ -0,0 +1,366 @@
+#include "sim.h"
+#include "secure_lock.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Scenario files: one directive per line, times in milliseconds of
+// virtual time since reset. A line whose first character other than a
+// blank is '#' is a comment; elsewhere '#' is the keypad's enter key.
+//
+//   end T                          stop the run at T
+//   card AT HOLD UIDHEX            present a 4/7/10-byte UID for HOLD ms
+//   key AT HOLD C                  press one key
+//   type AT INTERVAL HOLD KEYS     press KEYS one after another
+//   key_bounce_us N                key contacts chatter for N us on every edge
+//   button AT HOLD                 hold the user button (PA0)
+//   remote AT TEXT                 server sends TEXT to the ESP8266
+//   rfid_latency_us N              extra card response latency
+//   esp_latency_us N               ESP8266 response latency
+//   hse absent                     no crystal on the board
+//   spi_link_hz N                  RC522 reads fail above N Hz (long cable)
+//   rf_loss_db N                   card answers attenuated by N dB (weak antenna)
+//   rfid_fault AT brownout|latchup RC522 registers reset, or deaf until NRSTPD
+//   expect_unlock FROM TO          the lock opens within [FROM, TO]
+//   expect_locked FROM TO          the lock stays closed throughout [FROM, TO]
+//   expect_log FROM TO TEXT        a log line containing TEXT is sent in [FROM, TO]
+//   expect_no_log FROM TO TEXT     no such log line in [FROM, TO]
+//   expect_anticollisions FROM TO N  cards answer at most N anticollision frames in [FROM, TO]
+
+#define SCRIPT_MAX_EVENTS          64
+#define SCRIPT_MAX_EXPECTS         32
+#define SCRIPT_MAX_LOGS            128
+#define SCRIPT_MAX_OPENINGS        32
+#define SCRIPT_MAX_DETECTS         32
+#define SCRIPT_TEXT_SIZE           96
+#define SCRIPT_LOG_SIZE            256     // A whole STATUS report
+
+typedef enum {
+    EXPECT_UNLOCK = 0,
+    EXPECT_LOCKED,
+    EXPECT_LOG,
+    EXPECT_NO_LOG,
+    EXPECT_ANTICOLLISIONS
+} expect_type_t;
+
+typedef struct {
+    expect_type_t type;
+    uint64_t from;
+    uint64_t to;
+    char text[SCRIPT_TEXT_SIZE];
+    uint32_t limit;             // EXPECT_ANTICOLLISIONS: at most this many
+    uint32_t count;             // and this many seen
+    unsigned line;
+} script_expect_t;
+
+typedef struct {
+    uint64_t at;
+    uint64_t release;
+} script_hold_t;
+
+typedef struct {
+    uint64_t at;
+    char text[SCRIPT_TEXT_SIZE];
+} script_remote_t;
+
+typedef struct {
+    uint64_t at;
+    char text[SCRIPT_LOG_SIZE];
+} script_log_t;
+
+typedef struct {
+    uint64_t open;
+    uint64_t close;
+} script_opening_t;
+
+static uint64_t end_time = SIM_NEVER;
+static script_hold_t buttons[SCRIPT_MAX_EVENTS];
+static uint8_t button_count = 0;
+static script_remote_t remotes[SCRIPT_MAX_EVENTS];
+static uint8_t remote_count = 0;
+static uint8_t remote_next = 0;
+static script_expect_t expects[SCRIPT_MAX_EXPECTS];
+static uint8_t expect_count = 0;
+
+static script_log_t logs[SCRIPT_MAX_LOGS];
+static uint16_t log_count = 0;
+static script_opening_t openings[SCRIPT_MAX_OPENINGS];
+static uint8_t opening_count = 0;
+static uint8_t lock_open = 0;
+static uint64_t detects[SCRIPT_MAX_DETECTS];
+static uint8_t detect_count = 0;
+
+// ==================== PARSER ====================
+
+static uint8_t Script_Time(const char *text, uint64_t *ns) {
+    char *end;
+    double ms = strtod(text, &end);
+    if (end == text || ms < 0) return 0;
+    *ns = (uint64_t)(ms * (double)SIM_NS_PER_MS + 0.5);
+    return 1;
+}
+
+static uint8_t Script_Uid(const char *text, uint8_t *uid, uint8_t *uid_len) {
+    size_t digits = strlen(text);
+    if (digits % 2 || digits / 2 > SIM_RC522_MAX_UID) return 0;
+
+    for (size_t i = 0; i < digits; i += 2) {
+        char byte[3] = {text[i], text[i + 1], '\0'};
+        if (!isxdigit((unsigned char)byte[0]) || !isxdigit((unsigned char)byte[1])) return 0;
+        uid[i / 2] = (uint8_t)strtoul(byte, NULL, 16);
+    }
+    *uid_len = (uint8_t)(digits / 2);
+    return 1;
+}
+
+// Remainder of the line after the first n fields, for free-text arguments
+static const char *Script_Rest(const char *line, uint8_t fields) {
+    while (fields--) {
+        line += strspn(line, " \t");
+        line += strcspn(line, " \t");
+    }
+    return line + strspn(line, " \t");
+}
+
+static uint8_t Script_Line(char *line, unsigned number) {
+    char copy[256];
+    char *argv[8];
+    int argc = 0;
+    uint64_t a = 0, b = 0, c = 0;
+
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[strspn(line, " \t")] == '#') return 1;
+    snprintf(copy, sizeof(copy), "%s", line);
+    for (char *token = strtok(copy, " \t"); token != NULL && argc < 8; token = strtok(NULL, " \t")) {
+        argv[argc++] = token;
+    }
+    if (argc == 0) return 1;
+
+    const char *cmd = argv[0];
+
+    if (strcmp(cmd, "end") == 0 && argc == 2 && Script_Time(argv[1], &a)) {
+        end_time = a;
+    } else if (strcmp(cmd, "card") == 0 && argc == 4 &&
+               Script_Time(argv[1], &a) && Script_Time(argv[2], &b)) {
+        uint8_t uid[SIM_RC522_MAX_UID];
+        uint8_t uid_len;
+        if (!Script_Uid(argv[3], uid, &uid_len) || !SimRc522_AddCard(uid, uid_len, a, a + b)) return 0;
+    } else if (strcmp(cmd, "key") == 0 && argc == 4 &&
+               Script_Time(argv[1], &a) && Script_Time(argv[2], &b)) {
+        if (strlen(argv[3]) != 1 || !SimKeypad_Press(argv[3][0], a, b)) return 0;
+    } else if (strcmp(cmd, "type") == 0 && argc == 5 && Script_Time(argv[1], &a) &&
+               Script_Time(argv[2], &b) && Script_Time(argv[3], &c)) {
+        for (const char *key = argv[4]; *key; key++) {
+            if (!SimKeypad_Press(*key, a, c)) return 0;
+            a += b;
+        }
+    } else if (strcmp(cmd, "button") == 0 && argc == 3 &&
+               Script_Time(argv[1], &a) && Script_Time(argv[2], &b)) {
+        if (button_count >= SCRIPT_MAX_EVENTS) return 0;
+        buttons[button_count++] = (script_hold_t){a, a + b};
+    } else if (strcmp(cmd, "remote") == 0 && argc >= 3 && Script_Time(argv[1], &a)) {
+        if (remote_count >= SCRIPT_MAX_EVENTS) return 0;
+        if (remote_count && remotes[remote_count - 1].at > a) return 0;   // Keep them in order
+        remotes[remote_count].at = a;
+        snprintf(remotes[remote_count].text, SCRIPT_TEXT_SIZE, "%s", Script_Rest(line, 2));
+        remote_count++;
+    } else if (strcmp(cmd, "key_bounce_us") == 0 && argc == 2) {
+        SimKeypad_SetBounce((uint32_t)strtoul(argv[1], NULL, 10));
+    } else if (strcmp(cmd, "rfid_latency_us") == 0 && argc == 2) {
+        SimRc522_SetLatency((uint32_t)strtoul(argv[1], NULL, 10));
+    } else if (strcmp(cmd, "esp_latency_us") == 0 && argc == 2) {
+        SimEsp_SetLatency((uint32_t)strtoul(argv[1], NULL, 10));
+    } else if (strcmp(cmd, "spi_link_hz") == 0 && argc == 2) {
+        Sim_SetSpiLinkLimit((uint32_t)strtoul(argv[1], NULL, 10));
+    } else if (strcmp(cmd, "rfid_fault") == 0 && argc == 3 && Script_Time(argv[1], &a)) {
+        if (strcmp(argv[2], "brownout") == 0) {
+            if (!SimRc522_AddFault(a, SIM_RC522_BROWNOUT)) return 0;
+        } else if (strcmp(argv[2], "latchup") == 0) {
+            if (!SimRc522_AddFault(a, SIM_RC522_LATCHUP)) return 0;
+        } else {
+            return 0;
+        }
+    } else if (strcmp(cmd, "rf_loss_db") == 0 && argc == 2) {
+        SimRc522_SetRfLoss((int32_t)strtol(argv[1], NULL, 10));
+    } else if (strcmp(cmd, "hse") == 0 && argc == 2 && strcmp(argv[1], "absent") == 0) {
+        Sim_SetHSEPresent(0);
+    } else if (strncmp(cmd, "expect_", 7) == 0 && argc >= 3 &&
+               Script_Time(argv[1], &a) && Script_Time(argv[2], &b)) {
+        script_expect_t *expect = &expects[expect_count];
+        if (expect_count >= SCRIPT_MAX_EXPECTS) return 0;
+
+        if (strcmp(cmd, "expect_unlock") == 0 && argc == 3) expect->type = EXPECT_UNLOCK;
+        else if (strcmp(cmd, "expect_locked") == 0 && argc == 3) expect->type = EXPECT_LOCKED;
+        else if (strcmp(cmd, "expect_log") == 0 && argc >= 4) expect->type = EXPECT_LOG;
+        else if (strcmp(cmd, "expect_no_log") == 0 && argc >= 4) expect->type = EXPECT_NO_LOG;
+        else if (strcmp(cmd, "expect_anticollisions") == 0 && argc == 4) expect->type = EXPECT_ANTICOLLISIONS;
+        else return 0;
+
+        expect->from = a;
+        expect->to = b;
+        expect->line = number;
+        snprintf(expect->text, SCRIPT_TEXT_SIZE, "%s", Script_Rest(line, 3));
+        expect->limit = (uint32_t)strtoul(argv[3], NULL, 10);
+        expect->count = 0;
+        expect_count++;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+uint8_t SimScript_Load(const char *path) {
+    char line[256];
+    unsigned number = 0;
+    FILE *file = fopen(path, "r");
+
+    if (file == NULL) {
+        fprintf(stderr, "sim error: cannot open %s\n", path);
+        return 0;
+    }
+    while (fgets(line, sizeof(line), file) != NULL) {
+        number++;
+        if (!Script_Line(line, number)) {
+            fprintf(stderr, "%s:%u: invalid directive: %s", path, number, line);
+            fclose(file);
+            return 0;
+        }
+    }
+    fclose(file);
+
+    if (end_time == SIM_NEVER) {
+        fprintf(stderr, "%s: missing 'end'\n", path);
+        return 0;
+    }
+    return 1;
+}
+
+// ==================== RUNTIME ====================
+
+uint64_t SimScript_NextEvent(uint64_t now) {
+    uint64_t next = end_time;
+
+    if (remote_next < remote_count && remotes[remote_next].at < next) next = remotes[remote_next].at;
+    for (uint8_t i = 0; i < button_count; i++) {
+        if (buttons[i].at > now && buttons[i].at < next) next = buttons[i].at;
+        if (buttons[i].release > now && buttons[i].release < next) next = buttons[i].release;
+    }
+    return next;
+}
+
+void SimScript_Update(uint64_t now) {
+    uint8_t open = SecureLock_IsUnlocked();
+
+    if (open && !lock_open) {
+        Sim_Log("lock opens");
+        if (opening_count < SCRIPT_MAX_OPENINGS) openings[opening_count++] = (script_opening_t){now, SIM_NEVER};
+    } else if (!open && lock_open) {
+        Sim_Log("lock closes");
+        if (opening_count) openings[opening_count - 1].close = now;
+    }
+    lock_open = open;
+
+    while (remote_next < remote_count && remotes[remote_next].at <= now) {
+        Sim_Log("server sends \"%s\"", remotes[remote_next].text);
+        SimEsp_SendLine(remotes[remote_next].text);
+        remote_next++;
+    }
+
+    if (now >= end_time) SimScript_Finish();
+}
+
+uint8_t SimScript_ButtonPressed(uint64_t now) {
+    for (uint8_t i = 0; i < button_count; i++) {
+        if (now >= buttons[i].at && now < buttons[i].release) return 1;
+    }
+    return 0;
+}
+
+void SimScript_RecordLog(uint64_t now, const char *text) {
+    if (log_count >= SCRIPT_MAX_LOGS) return;
+    logs[log_count].at = now;
+    snprintf(logs[log_count].text, SCRIPT_LOG_SIZE, "%s", text);
+    log_count++;
+}
+
+void SimScript_RecordDetect(const uint8_t *uid, uint8_t uid_len, uint64_t latency) {
+    (void)uid;
+    (void)uid_len;
+    if (detect_count < SCRIPT_MAX_DETECTS) detects[detect_count++] = latency;
+}
+
+// ==================== RESULTS ====================
+
+static uint8_t Script_Check(const script_expect_t *expect) {
+    switch (expect->type) {
+        case EXPECT_UNLOCK:
+            for (uint8_t i = 0; i < opening_count; i++) {
+                if (openings[i].open >= expect->from && openings[i].open <= expect->to) return 1;
+            }
+            return 0;
+
+        case EXPECT_LOCKED:
+            for (uint8_t i = 0; i < opening_count; i++) {
+                if (openings[i].open <= expect->to && openings[i].close >= expect->from) return 0;
+            }
+            return 1;
+
+        case EXPECT_LOG:
+        case EXPECT_NO_LOG:
+            for (uint16_t i = 0; i < log_count; i++) {
+                if (logs[i].at >= expect->from && logs[i].at <= expect->to &&
+                    strstr(logs[i].text, expect->text) != NULL) {
+                    return expect->type == EXPECT_LOG;
+                }
+            }
+            return expect->type == EXPECT_NO_LOG;
+
+        case EXPECT_ANTICOLLISIONS:
+            return expect->count <= expect->limit;
+    }
+    return 0;
+}
+
+// A card answered an anticollision frame
+void SimScript_RecordAnticollision(uint64_t now) {
+    for (uint8_t i = 0; i < expect_count; i++) {
+        if (expects[i].type == EXPECT_ANTICOLLISIONS && now >= expects[i].from && now <= expects[i].to) {
+            expects[i].count++;
+        }
+    }
+}
+
+void SimScript_Finish(void) {
+    static const char *names[] = {"expect_unlock", "expect_locked", "expect_log", "expect_no_log",
+                                  "expect_anticollisions"};
+    uint8_t failed = 0;
+
+    if (lock_open && opening_count) openings[opening_count - 1].close = Sim_Now();
+
+    printf("summary\n");
+    Sim_Report(stdout);
+
+    if (detect_count) {
+        uint64_t worst = 0, total = 0;
+        for (uint8_t i = 0; i < detect_count; i++) {
+            total += detects[i];
+            if (detects[i] > worst) worst = detects[i];
+        }
+        printf("  detect   %u cards, latency avg %.3f ms, max %.3f ms\n",
+               detect_count, SIM_MS(total / detect_count), SIM_MS(worst));
+    }
+    for (uint8_t i = 0; i < opening_count; i++) {
+        printf("  unlock   %.3f ms - %.3f ms\n", SIM_MS(openings[i].open), SIM_MS(openings[i].close));
+    }
+
+    for (uint8_t i = 0; i < expect_count; i++) {
+        const script_expect_t *expect = &expects[i];
+        uint8_t pass = Script_Check(expect);
+        failed += !pass;
+        printf("%s line %u: %s %.0f %.0f %s\n", pass ? "PASS" : "FAIL", expect->line,
+               names[expect->type], SIM_MS(expect->from), SIM_MS(expect->to), expect->text);
+    }
+
+    fflush(stdout);
+    exit(failed ? 1 : 0);
+}
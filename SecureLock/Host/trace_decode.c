@@ -0,0 +1,168 @@
+// Decodes a binary dump from the firmware's TRACE command (see trace.h)
+// into a timeline. Record timestamps are 32-bit microsecond counts that
+// wrap; the dump header anchors the newest time to the uptime, and the
+// decoder walks back from there one modular delta at a time. SYNC records
+// keep every delta well inside the wrap.
+//
+//   trace_decode dump.bin
+
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *const event_names[TRACE_EV_COUNT] = {
+    [TRACE_EV_NONE]          = "none",
+    [TRACE_EV_BOOT]          = "boot",
+    [TRACE_EV_SYNC]          = "sync",
+    [TRACE_EV_CLOCK]         = "clock",
+    [TRACE_EV_STATE]         = "state",
+    [TRACE_EV_RFID_START]    = "rfid_start",
+    [TRACE_EV_RFID_END]      = "rfid_end",
+    [TRACE_EV_KEY]           = "key",
+    [TRACE_EV_UART_CMD]      = "uart_cmd",
+    [TRACE_EV_UART_OVERFLOW] = "uart_overflow",
+    [TRACE_EV_ACCESS]        = "access",
+    [TRACE_EV_ERROR]         = "error",
+    [TRACE_EV_CARD]          = "card",
+};
+
+// system_state_t order in config.h
+static const char *const state_names[] = {
+    "IDLE", "RFID_SCANNING", "PIN_ENTRY", "AUTHENTICATING", "ACCESS_GRANTED",
+    "ACCESS_DENIED", "LOCKOUT", "MAINTENANCE", "ERROR"
+};
+
+// error_code_t order in config.h
+static const char *const error_names[] = {
+    "NONE", "RFID_COMM", "KEYPAD_READ", "WIFI_CONNECT", "SERVER_COMM",
+    "AUTH_FAILED", "MEMORY_FULL", "INVALID_PIN", "SYSTEM_FAULT", "HARDWARE_FAIL"
+};
+
+#define NAME(table, index) \
+    ((index) < sizeof(table) / sizeof(table[0]) ? table[index] : "?")
+
+static char Printable(uint8_t c) {
+    return (c >= 0x20 && c < 0x7F) ? (char)c : '.';
+}
+
+static void Describe(const trace_record_t *record, char *text, size_t size) {
+    switch (record->event) {
+    case TRACE_EV_BOOT:
+        snprintf(text, size, "dump format %u", record->arg16);
+        break;
+    case TRACE_EV_SYNC:
+        snprintf(text, size, "uptime %lus",
+                 ((unsigned long)record->arg8 << 16) | record->arg16);
+        break;
+    case TRACE_EV_CLOCK:
+        snprintf(text, size, "HCLK %u MHz", record->arg16);
+        break;
+    case TRACE_EV_STATE:
+        snprintf(text, size, "%s -> %s", NAME(state_names, record->arg16),
+                 NAME(state_names, record->arg8));
+        break;
+    case TRACE_EV_RFID_START:
+        snprintf(text, size, "cmd 0x%02X, %u bits", record->arg8, record->arg16);
+        break;
+    case TRACE_EV_RFID_END:
+        if (record->arg8 == 0) snprintf(text, size, "ok, %u bits", record->arg16);
+        else snprintf(text, size, "%s", record->arg8 == 0xFF ? "timeout" : "error");
+        break;
+    case TRACE_EV_KEY:
+        snprintf(text, size, "'%c'", Printable(record->arg8));
+        break;
+    case TRACE_EV_UART_CMD:
+        snprintf(text, size, "\"%c%c%c\"", Printable(record->arg8),
+                 Printable(record->arg16 & 0xFF), Printable(record->arg16 >> 8));
+        break;
+    case TRACE_EV_UART_OVERFLOW:
+        snprintf(text, size, "%u overflows", record->arg16);
+        break;
+    case TRACE_EV_ACCESS:
+        if (record->arg8 == 0xFF) snprintf(text, size, "system");
+        else snprintf(text, size, "user %u %s", record->arg8,
+                      record->arg16 ? "granted" : "denied");
+        break;
+    case TRACE_EV_ERROR:
+        snprintf(text, size, "%s", NAME(error_names, record->arg8));
+        break;
+    case TRACE_EV_CARD:
+        snprintf(text, size, "%04X... %s", record->arg16, record->arg8 ? "entered" : "left");
+        break;
+    default:
+        snprintf(text, size, "arg8 0x%02X arg16 0x%04X", record->arg8, record->arg16);
+        break;
+    }
+}
+
+int main(int argc, char **argv) {
+    trace_dump_header_t header;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s dump.bin\n", argv[0]);
+        return 2;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (file == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, TRACE_DUMP_MAGIC, sizeof(header.magic)) != 0) {
+        fprintf(stderr, "%s: not a trace dump\n", argv[1]);
+        return 1;
+    }
+    if (header.version != TRACE_DUMP_VERSION || header.record_size != sizeof(trace_record_t)) {
+        fprintf(stderr, "%s: dump format %u with %u-byte records, expected %u with %zu\n",
+                argv[1], header.version, header.record_size, TRACE_DUMP_VERSION,
+                sizeof(trace_record_t));
+        return 1;
+    }
+
+    trace_record_t *records = calloc(header.count ? header.count : 1, sizeof(trace_record_t));
+    if (records == NULL || fread(records, sizeof(trace_record_t), header.count, file) != header.count) {
+        fprintf(stderr, "%s: truncated, header promises %u records\n", argv[1], header.count);
+        return 1;
+    }
+    fclose(file);
+
+    // Microseconds before the dump, newest record first
+    uint64_t *age_us = calloc(header.count ? header.count : 1, sizeof(uint64_t));
+    if (age_us == NULL) return 1;
+    uint32_t later = header.time_us;
+    uint64_t age = 0;
+    for (int i = header.count - 1; i >= 0; i--) {
+        age += (uint32_t)(later - records[i].time_us);
+        age_us[i] = age;
+        later = records[i].time_us;
+    }
+
+    printf("%u records (%lu written, %lu lost), dump at uptime %lu.%03lus\n",
+           header.count, (unsigned long)header.written,
+           (unsigned long)(header.written - header.count),
+           (unsigned long)(header.uptime_ms / 1000), (unsigned long)(header.uptime_ms % 1000));
+
+    int64_t anchor_us = (int64_t)header.uptime_ms * 1000;
+    int64_t previous_us = 0;
+    for (uint16_t i = 0; i < header.count; i++) {
+        char stamp[24];
+        char text[64];
+        int64_t at_us = anchor_us - (int64_t)age_us[i];
+        const char *name = records[i].event < TRACE_EV_COUNT ? event_names[records[i].event] : "?";
+
+        // Slightly negative for records taken before the first SysTick
+        snprintf(stamp, sizeof(stamp), "%s%lld.%06lld", at_us < 0 ? "-" : "",
+                 llabs(at_us) / 1000000, llabs(at_us) % 1000000);
+        Describe(&records[i], text, sizeof(text));
+        printf("%14s  %+10lldus  %-14s %s\n", stamp,
+               (long long)(i ? at_us - previous_us : 0), name, text);
+        previous_us = at_us;
+    }
+
+    free(age_us);
+    free(records);
+    return 0;
+}
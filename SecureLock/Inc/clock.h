@@ -0,0 +1,58 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+#include "stm32f407xx_registers.h"
+
+// Clock sources for the main PLL
+#define CLOCK_SOURCE_HSI           0
+#define CLOCK_SOURCE_HSE           1
+
+// Oscillator frequencies
+#define HSI_VALUE                  16000000UL
+#define HSE_VALUE                  8000000UL   // Discovery board crystal
+
+// Bus limits (STM32F407, VOS scale 1)
+#define CLOCK_HCLK_MAX_HZ          168000000UL
+#define CLOCK_PCLK1_MAX_HZ         42000000UL
+#define CLOCK_PCLK2_MAX_HZ         84000000UL
+#define CLOCK_FLASH_HZ_PER_WS      30000000UL  // 2.7-3.6 V supply
+
+// Runtime clock profiles
+typedef enum {
+    CLOCK_PROFILE_PERFORMANCE = 0,  // PLL at SYSTEM_CLOCK_FREQ
+    CLOCK_PROFILE_LOW_POWER,        // HSI at 16MHz, PLL stopped
+    CLOCK_PROFILE_COUNT
+} clock_profile_t;
+
+// Called around every clock change so drivers can finish an ongoing
+// transfer and hold off new ones (CLOCK_CHANGE_PRE, interrupts enabled),
+// then re-derive their dividers (CLOCK_CHANGE_POST, interrupts masked)
+#define CLOCK_CHANGE_PRE           0
+#define CLOCK_CHANGE_POST          1
+#define CLOCK_MAX_CALLBACKS        4
+
+typedef void (*clock_change_cb_t)(uint8_t phase);
+
+// Clock tree configuration
+uint8_t Clock_ConfigurePLL(uint8_t source, uint32_t sysclk_hz);
+void Clock_ConfigureHSI(void);
+
+// Current bus frequencies, derived from the RCC registers
+uint32_t Clock_GetHCLK(void);
+uint32_t Clock_GetPCLK1(void);
+uint32_t Clock_GetPCLK2(void);
+uint32_t Clock_GetAPB1TimerClock(void);
+void Clock_SetMicrosecondTimer(TIM_TypeDef *timer);
+
+// Profile switching
+uint8_t Clock_RegisterChangeCallback(clock_change_cb_t callback);
+uint8_t Clock_SetProfile(clock_profile_t profile);
+clock_profile_t Clock_GetProfile(void);
+void Clock_SetIdleProfile(clock_profile_t profile);
+void Clock_BeginBurst(void);
+void Clock_EndBurst(void);
+uint64_t Clock_GetProfileTime(clock_profile_t profile);
+uint32_t Clock_GetSwitchCount(void);
+
+#endif // CLOCK_H
@@ -2,10 +2,18 @@
 #define CONFIG_H
 
 #include <stdint.h>
+#include "clock.h"
 
 // ==================== SYSTEM CONFIGURATION ====================
-#define SYSTEM_CLOCK_FREQ          16000000UL  // 16MHz HSI
-#define SYSTICK_FREQ               1000UL      // 1kHz systick frequency
+#define SYSTEM_CLOCK_FREQ          168000000UL // PLL target frequency
+#define CLOCK_PLL_ENABLED          1           // 0: stay on the 16MHz HSI
+#define CLOCK_PLL_SOURCE           CLOCK_SOURCE_HSE // CLOCK_SOURCE_HSI or CLOCK_SOURCE_HSE
+#define CLOCK_IDLE_PROFILE         CLOCK_PROFILE_LOW_POWER // Profile outside crypto bursts
+#define SYSTICK_FREQ               1000UL      // 1kHz systick frequency (must divide 1000)
+#define TICKLESS_IDLE_ENABLED      1           // Suppress ticks while idle
+#define SYSTEM_MAX_IDLE_MS         1000        // Longest main loop sleep
+#define DELAY_SELFTEST_ENABLED     1           // Check DWT delays against SysTick at boot
+#define DELAY_SELFTEST_TOLERANCE_PCT 2
 
 // ==================== HARDWARE PIN CONFIGURATION ====================
 
@@ -22,13 +30,18 @@
 
 // RFID Pins (RC522 - SPI1)
 #define RFID_SPI                   SPI1
+#define RFID_SPI_CLOCK_HZ          1000000UL   // Start-up SPI clock, known safe on any cable
+#define RFID_SPI_CLOCK_MAX_HZ      10000000UL  // RC522 datasheet limit, the ceiling for tuning
 #define RFID_SS_PIN                3   // PE3
 #define RFID_RST_PIN               2   // PE2
 #define RFID_SCK_PIN               5   // PA5
 #define RFID_MISO_PIN              6   // PA6
 #define RFID_MOSI_PIN              7   // PA7
+#define RFID_IRQ_PIN               4   // PE4, EXTI4
 #define RFID_SS_PORT               GPIOE
 #define RFID_RST_PORT              GPIOE
+#define RFID_IRQ_PORT              GPIOE
+#define RFID_IRQ_EXTICR_PORT       SYSCFG_EXTICR_PORTE
 
 // WiFi Pins (ESP8266 - USART2)
 #define WIFI_UART                  USART2
@@ -56,13 +69,16 @@
 // Authentication Settings
 #define MAX_PIN_LENGTH             6
 #define MIN_PIN_LENGTH             4
-#define MAX_RFID_UID_LENGTH        4
+#define PIN_KEY_TIMEOUT_MS         5000    // Longest wait for the next key of a PIN
+#define PIN_ENTRY_TIMEOUT_MS       20000   // Longest whole PIN entry
+#define PIN_SALT_SIZE              64      // One SHA-256 block, hashed when the card is read
+#define MAX_RFID_UID_LENGTH        10  // ISO 14443A triple size
 
 // Security Limits
 #define MAX_FAILED_ATTEMPTS        3
 #define LOCKOUT_TIME_MS            30000   // 30 seconds
 #define SESSION_TIMEOUT_MS         10000   // 10 seconds
-#define RFID_SCAN_INTERVAL_MS      500     // 500ms between RFID scans
+#define RFID_SCAN_INTERVAL_MS      100     // Latency target: longest gap between probes of an empty field
 
 // Encryption Settings
 #define AES_KEY_SIZE               16      // 128-bit AES
@@ -80,6 +96,10 @@
 #define WIFI_BAUDRATE              115200
 #define WIFI_CONNECT_TIMEOUT_MS    10000
 #define WIFI_RESPONSE_TIMEOUT_MS   2000
+#define WIFI_TX_QUEUE_SIZE         2048    // Log payloads waiting for the wifi task
+#define WIFI_TX_CHUNK              32      // Payload bytes sent per wifi task run (~3 ms)
+#define WIFI_LINE_SIZE             64      // Longest module line kept; the rest is cut
+#define WIFI_CMD_QUEUE_SIZE        4       // Server commands waiting for the wifi task
 
 // Server Configuration
 #define SERVER_HOST                "api.thingspeak.com"
@@ -99,8 +119,32 @@
 
 // Lock Control
 #define UNLOCK_DURATION_MS         3000    // 3 seconds
+#define UNLOCK_EXTEND_ENABLED      1       // Valid credential while open extends the window
+#define UNLOCK_MAX_DURATION_MS     15000   // Upper bound on an extended unlock
 #define LOCK_STATUS_POLL_MS        100
 
+// RFID presence polling (see rfid_poll.h); the latency target is
+// RFID_SCAN_INTERVAL_MS
+#define RFID_POLL_POWER_TARGET     80      // Antenna duty budget with the field empty, per mille
+#define RFID_POLL_FAST_MS          50      // Probe period after a card
+#define RFID_POLL_HOLD_MS          2000    // Antenna kept on after a card
+#define RFID_POLL_SETTLE_MS        5       // Field on before a probe (ISO 14443-3 PICC ready time)
+
+// RC522 health monitor (see rfid_health.h)
+#define RFID_HEALTH_CHECK_MS       1000    // Register read-back period
+#define RFID_HEALTH_FAULT_LIMIT    3       // Failed transceives in a row that bring a read-back forward
+#define RFID_HEALTH_RETRY_MS       1000    // First re-init retry while the chip stays down
+#define RFID_HEALTH_RETRY_MAX_MS   30000
+
+// Scheduler task periods
+#define TASK_HEARTBEAT_PERIOD_MS   1000
+#define TASK_WIFI_PERIOD_MS        10
+#define TASK_BUTTON_PERIOD_MS      50
+#define TASK_SESSION_PERIOD_MS     100
+#define TASK_RFID_PERIOD_MS        50
+#define TASK_KEYPAD_PERIOD_MS      10      // Deadline; the task runs on key events
+#define TASK_RFID_HEALTH_PERIOD_MS 100
+
 // Debug and Logging
 #define DEBUG_ENABLED              1
 #define SERIAL_DEBUG_BAUDRATE      115200
@@ -113,6 +157,9 @@
 #define FEATURE_ENCRYPTION         1
 #define FEATURE_REMOTE_ACCESS      1
 #define FEATURE_ACCESS_LOGS        1
+#define RFID_SOFTWARE_CRC          1       // CRC_A on the MCU (crc.h); 0 leaves it to the RC522
+#define PROFILING_ENABLED          1       // DWT hot-path probes (PROFILE command)
+#define TRACE_ENABLED              1       // Binary event trace (TRACE command)
 
 // ==================== ERROR CODES ====================
 typedef enum {
@@ -154,8 +201,10 @@ typedef enum {
 
 // User structure
 typedef struct {
-    uint8_t uid[4];             // RFID UID
-    uint8_t pin_hash[32];       // SHA-256 hash of PIN
+    uint8_t uid[MAX_RFID_UID_LENGTH]; // RFID UID
+    uint8_t uid_size;           // 4, 7 or 10 bytes
+    uint8_t pin_salt[PIN_SALT_SIZE];
+    uint8_t pin_hash[32];       // SHA-256 of the salt followed by the PIN
     uint8_t privileges;         // User privileges bitmask
     uint8_t user_id;            // Unique user ID
     char name[16];              // User name
@@ -176,10 +225,19 @@ static const user_config_t default_users[] = {
     // Admin user (UID: 12 34 56 78, PIN: 1234)
     {
         .uid = {0x12, 0x34, 0x56, 0x78},
-        .pin_hash = {0x5e, 0x88, 0x48, 0x98, 0xd6, 0xbd, 0x08, 0x84,
-                    0xe3, 0x03, 0xcb, 0xbc, 0x4c, 0x3f, 0x9a, 0x5b,
-                    0x1f, 0x3d, 0x5b, 0x8a, 0x9a, 0x2f, 0x4a, 0x7d,
-                    0x8f, 0x8f, 0x3c, 0x5c, 0x3d, 0x3a, 0x1c, 0xcc},
+        .uid_size = 4,
+        .pin_salt = {0x45, 0xfd, 0x90, 0x11, 0x90, 0x4e, 0x22, 0xcc,
+                    0x88, 0xed, 0x14, 0x4b, 0xce, 0x49, 0xd5, 0x6c,
+                    0x76, 0x2f, 0x6e, 0x68, 0x54, 0x86, 0xb0, 0x75,
+                    0x98, 0x71, 0xea, 0x82, 0xb7, 0x12, 0x9d, 0x21,
+                    0xff, 0xe8, 0x50, 0xef, 0xc1, 0xf4, 0xfe, 0x59,
+                    0xef, 0xdb, 0x21, 0xa5, 0x9c, 0x0b, 0x98, 0xe4,
+                    0xf4, 0x64, 0x49, 0x23, 0xca, 0x0b, 0xc8, 0x8d,
+                    0x6c, 0x9a, 0xf0, 0x45, 0x7e, 0xbc, 0x72, 0x2e},
+        .pin_hash = {0x0f, 0xa9, 0xa5, 0x74, 0x95, 0x7e, 0xd0, 0x5c,
+                    0x26, 0x73, 0xb1, 0x7b, 0x8b, 0x18, 0xfb, 0xc0,
+                    0xa2, 0xf6, 0x45, 0xae, 0x7b, 0x26, 0x91, 0x1e,
+                    0xec, 0x4f, 0xb3, 0x2e, 0xf0, 0x3f, 0x48, 0x5d},
         .privileges = PRIVILEGE_UNLOCK | PRIVILEGE_ADMIN | PRIVILEGE_REMOTE |
                      PRIVILEGE_ADD_USERS | PRIVILEGE_DELETE_USERS | PRIVILEGE_VIEW_LOGS,
         .user_id = 0,
@@ -188,10 +246,19 @@ static const user_config_t default_users[] = {
     // Regular user (UID: AB CD EF 01, PIN: 0000)
     {
         .uid = {0xAB, 0xCD, 0xEF, 0x01},
-        .pin_hash = {0x03, 0xac, 0x67, 0x42, 0x16, 0xf3, 0xe1, 0x5c,
-                    0x76, 0x1e, 0xe1, 0x88, 0x4b, 0xfd, 0x97, 0x7c,
-                    0x4c, 0x17, 0x73, 0xb3, 0xbb, 0x04, 0x3e, 0x8f,
-                    0x66, 0xcb, 0x7f, 0x8e, 0xfe, 0x1f, 0x7c, 0x8a},
+        .uid_size = 4,
+        .pin_salt = {0xda, 0xab, 0x82, 0x6e, 0xf8, 0xba, 0x0e, 0xf1,
+                    0x5b, 0x82, 0xaa, 0x2f, 0x3d, 0xe3, 0x39, 0x59,
+                    0x69, 0xcf, 0x5c, 0x24, 0x75, 0x5d, 0x21, 0x49,
+                    0xc3, 0x5a, 0x2d, 0xba, 0x34, 0xaf, 0x2b, 0x97,
+                    0x39, 0x49, 0x1a, 0x12, 0xfe, 0xd1, 0x9d, 0xc8,
+                    0xb5, 0x12, 0xd4, 0xfa, 0x6f, 0x1c, 0x10, 0xe0,
+                    0xad, 0x8b, 0xc2, 0xd1, 0x97, 0x94, 0x67, 0xc7,
+                    0x4b, 0x8a, 0xb6, 0xc9, 0xff, 0x1d, 0x91, 0xe5},
+        .pin_hash = {0xb8, 0x0a, 0xf4, 0x06, 0x43, 0x38, 0xf3, 0x52,
+                    0xdb, 0x54, 0x26, 0xea, 0x5b, 0x31, 0xda, 0xeb,
+                    0xa6, 0x8e, 0x87, 0x3b, 0x57, 0x53, 0x4c, 0x60,
+                    0xc5, 0x1c, 0x3c, 0x8a, 0xa6, 0xc5, 0x49, 0xda},
         .privileges = PRIVILEGE_UNLOCK,
         .user_id = 1,
         .name = "User"
@@ -242,7 +309,7 @@ uint8_t Config_ValidateSettings(void);
 
 // Security check macros
 #define IS_VALID_PIN_LENGTH(len) ((len) >= MIN_PIN_LENGTH && (len) <= MAX_PIN_LENGTH)
-#define IS_VALID_UID_LENGTH(len) ((len) == MAX_RFID_UID_LENGTH)
+#define IS_VALID_UID_LENGTH(len) ((len) == 4 || (len) == 7 || (len) == MAX_RFID_UID_LENGTH)
 
 // Feature enable macros
 #if FEATURE_ENCRYPTION
@@ -0,0 +1,21 @@
+#ifndef CRC_H
+#define CRC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ISO 14443-3 CRCs on the MCU, one table lookup per byte. Both use the
+// CCITT polynomial x^16 + x^12 + x^5 + 1, LSB first; CRC_A starts at
+// 0x6363, CRC_B at 0xFFFF and is inverted at the end. The result goes on
+// the air low byte first.
+
+#define CRC_A_PRESET               0x6363
+#define CRC_B_PRESET               0xFFFF
+
+uint16_t CRC_Update(uint16_t crc, const uint8_t *data, size_t length);
+uint16_t CRC_CalculateA(const uint8_t *data, size_t length);
+uint16_t CRC_CalculateB(const uint8_t *data, size_t length);
+size_t CRC_AppendA(uint8_t *frame, size_t length);
+uint8_t CRC_CheckA(const uint8_t *frame, size_t length);
+
+#endif // CRC_H
@@ -3,8 +3,41 @@
 
 #include <stdint.h>
 
+typedef enum {
+    KEYPAD_EVENT_PRESS = 0,
+    KEYPAD_EVENT_RELEASE,
+    KEYPAD_EVENT_LONG_PRESS     // Held KEYPAD_LONG_PRESS_MS, once per press
+} keypad_event_type_t;
+
+typedef struct {
+    uint8_t type;               // keypad_event_type_t
+    char key;
+    uint32_t time;              // get_tick_count() at the debounced edge
+} keypad_event_t;
+
+typedef struct {
+    uint16_t debounce_ms;       // An edge has to hold this long to count
+    uint16_t repeat_ms;         // Same key pressed again any sooner is chatter
+} keypad_timing_t;
+
+typedef void (*keypad_monitor_cb_t)(uint16_t down, uint64_t time_us);
+
+typedef struct {
+    uint32_t wakeups;           // Row line interrupts
+    uint32_t ghost_scans;       // Scans skipped, keys down in a rectangle
+    uint32_t dropped_events;    // Events lost to a full queue
+} keypad_stats_t;
+
 // Keypad initialization and control
 void Keypad_Init(void);
+void Keypad_SetTask(uint8_t task_id);
+void Keypad_SetTiming(const keypad_timing_t *timing);
+void Keypad_GetTiming(keypad_timing_t *timing);
+void Keypad_SetScanPeriod(uint32_t period_us);
+void Keypad_SetMonitor(keypad_monitor_cb_t callback);
+char Keypad_KeyChar(uint8_t index);
+void Keypad_GetStats(keypad_stats_t *stats);
+uint8_t Keypad_GetEvent(keypad_event_t *event);
 char Keypad_GetKey(void);
 int Keypad_GetPIN(char *buffer, int max_length, uint32_t timeout_ms);
 int Keypad_GetString(char *buffer, int max_length, uint32_t timeout_ms);
@@ -19,7 +52,10 @@ uint8_t Keypad_GetMultiKey(uint8_t *keys, uint8_t max_keys);
 void Keypad_EnableInterrupt(void);
 void Keypad_DisableInterrupt(void);
 void Keypad_Test(void);
-void Keypad_Calibrate(void);
+void EXTI9_5_IRQHandler(void);
+void EXTI15_10_IRQHandler(void);
+void TIM5_IRQHandler(void);
+void Keypad_ClockChanged(uint8_t phase);
 
 // Keypad special key definitions
 #define KEYPAD_ENTER '#'
@@ -30,8 +66,13 @@ void Keypad_Calibrate(void);
 #define KEYPAD_FUNCTION_D 'D'
 
 // Keypad timing constants
-#define KEYPAD_DEBOUNCE_MS 20
+#define KEYPAD_DEBOUNCE_MS 20             // Defaults until calibrated (keypad_cal.h)
 #define KEYPAD_REPEAT_MS 200
+#define KEYPAD_SETTLE_NS 500
+#define KEYPAD_SCAN_MS 5                  // Scan timer period while a key is down
+#define KEYPAD_LONG_PRESS_MS 1000
+#define KEYPAD_EVENT_QUEUE_SIZE 16        // Events, power of two
+#define KEYPAD_SCAN_TIMER TIM5
 #define KEYPAD_PIN_TIMEOUT_MS 10000
 #define KEYPAD_STRING_TIMEOUT_MS 30000
 
@@ -0,0 +1,47 @@
+#ifndef KEYPAD_CAL_H
+#define KEYPAD_CAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "keypad.h"
+
+// Debounce calibration for the keypad fitted, started by the KEYCAL
+// command in maintenance mode. The matrix is then sampled every
+// KEYPAD_CAL_SCAN_US and the contact chatter of every key is timed: flips
+// closer together than KEYPAD_CAL_QUIET_MS make up one press or release.
+// The technician taps every key a few times, as quickly as a user would,
+// and ends with a long press on '#'. The debounce time becomes
+// KEYPAD_CAL_MARGIN times the worst chatter seen and the repeat time half
+// the quickest deliberate second press of a key, but at least twice the
+// debounce time; both are stored and applied at every later boot.
+
+#define KEYPAD_CAL_SCAN_US         500     // Sample period while calibrating
+#define KEYPAD_CAL_QUIET_MS        20      // No flip for this long: the edge is over
+#define KEYPAD_CAL_MARGIN          2       // Debounce time over the worst chatter
+#define KEYPAD_CAL_MIN_PRESSES     20      // Presses needed for a result
+#define KEYPAD_DEBOUNCE_MIN_MS     10      // Two scans
+#define KEYPAD_DEBOUNCE_MAX_MS     40
+
+typedef enum {
+    KEYPAD_CAL_RUNNING = 0,
+    KEYPAD_CAL_DONE,                // Timings in use and stored
+    KEYPAD_CAL_FAILED               // Too few presses; timings unchanged
+} keypad_cal_status_t;
+
+typedef struct {
+    keypad_timing_t timing;
+    uint16_t bounce_us;         // Worst chatter seen
+    uint16_t interval_ms;       // Quickest second press of a key, 0 if none
+    uint16_t presses;
+    char worst_key;             // Key with the worst chatter, '-' if none chattered
+    uint8_t keys;               // Keys pressed at least once
+} keypad_cal_record_t;
+
+void KeypadCal_Init(void);
+void KeypadCal_Start(void);
+void KeypadCal_Stop(void);
+uint8_t KeypadCal_IsActive(void);
+keypad_cal_status_t KeypadCal_Event(const keypad_event_t *event);
+int KeypadCal_Format(char *buffer, size_t size);
+
+#endif // KEYPAD_CAL_H
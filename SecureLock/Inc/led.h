@@ -0,0 +1,33 @@
+#ifndef LED_H
+#define LED_H
+
+#include <stdint.h>
+
+// Background LED pattern engine. Patterns are queued per LED and played
+// from the SysTick interrupt; a pattern of higher priority pre-empts the
+// one playing and the pre-empted pattern resumes once it has finished.
+
+#define LED_COUNT                  4
+#define LED_QUEUE_DEPTH            4
+#define LED_REPEAT_FOREVER         0
+
+typedef enum {
+    LED_PRIORITY_STATUS = 0,    // Long-running status indication
+    LED_PRIORITY_FEEDBACK,      // User feedback (key press, card read)
+    LED_PRIORITY_ERROR,         // Error and fault indication
+    LED_PRIORITY_LEVELS
+} led_priority_t;
+
+void LED_Init(void);
+uint8_t LED_Play(uint8_t led, uint16_t on_ms, uint16_t off_ms, uint8_t count,
+                 led_priority_t priority);
+void LED_Stop(uint8_t led, led_priority_t priority);
+void LED_StopAll(uint8_t led);
+void LED_SetBase(uint8_t led, uint8_t on);
+uint8_t LED_IsBusy(uint8_t led);
+
+// Engine service, called from SysTick_Handler
+void LED_Tick(uint64_t now);
+uint64_t LED_NextDeadline(void);
+
+#endif // LED_H
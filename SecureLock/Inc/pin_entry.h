@@ -0,0 +1,35 @@
+#ifndef PIN_ENTRY_H
+#define PIN_ENTRY_H
+
+#include <stdint.h>
+
+// PIN collection for an open session, fed one key press at a time so the
+// main loop never waits for the next key. Digits are buffered up to
+// MAX_PIN_LENGTH, '*' takes the last one back and '#' submits once there
+// are at least MIN_PIN_LENGTH. The entry expires PIN_KEY_TIMEOUT_MS after
+// the last key or PIN_ENTRY_TIMEOUT_MS after it started, whichever comes
+// first.
+//
+// The digits are never stored. The user's salt goes into a SHA-256
+// context when the entry starts and each digit is hashed as it is typed,
+// into a copy of the context for the digits before it, so '*' just goes
+// back one copy. '#' then only costs the final block and the compare.
+
+typedef enum {
+    PIN_ENTRY_DIGIT = 0,        // Digit added
+    PIN_ENTRY_ERASED,           // '*' took a digit back
+    PIN_ENTRY_IGNORED,          // Function key, '*' with nothing to erase, digit past the maximum
+    PIN_ENTRY_TOO_SHORT,        // '#' before MIN_PIN_LENGTH digits; the entry starts over
+    PIN_ENTRY_SUBMIT,           // '#' with a complete PIN
+    PIN_ENTRY_INACTIVE          // No entry open
+} pin_entry_result_t;
+
+void PinEntry_Start(const uint8_t *salt);
+void PinEntry_Clear(void);
+pin_entry_result_t PinEntry_Feed(char key);
+uint8_t PinEntry_Verify(const uint8_t *pin_hash);
+uint8_t PinEntry_IsActive(void);
+uint8_t PinEntry_Expired(void);
+uint8_t PinEntry_GetLength(void);
+
+#endif // PIN_ENTRY_H
@@ -0,0 +1,67 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "config.h"
+#include "stm32f407xx_registers.h"
+
+// Cycle-accurate hot-path probes on the DWT cycle counter. Each probe keeps
+// min/max/mean and a log2 histogram of its run time in cycles. With
+// PROFILING_ENABLED set to 0 the probes compile to nothing.
+
+typedef enum {
+    PROF_LOCK_RFID = 0,         // SecureLock_ServiceRFID
+    PROF_LOCK_KEYPAD,           // SecureLock_ServiceKeypad
+    PROF_LOCK_SESSION,          // SecureLock_ServiceTimeouts
+    PROF_RFID_TRANSCEIVE,       // Card check, RFID_StartCardCheck to its end
+    PROF_SHA256_TRANSFORM,      // sha256_transform
+    PROF_LOG_ACCESS,            // SecureLock_LogAccess
+    PROF_WIFI_SEND_COMMAND,     // WIFI_SendCommand
+    PROF_TRACE_RECORD_PLL,      // Trace_Record, performance profile
+    PROF_TRACE_RECORD_HSI,      // Trace_Record, low-power profile
+    PROF_PROBE_COUNT
+} profile_probe_t;
+
+// Bucket n counts runs of [2^n, 2^(n+1)) cycles; the last bucket is open-ended
+#define PROFILE_HISTOGRAM_BUCKETS  24
+
+typedef struct {
+    uint32_t count;
+    uint32_t min_cycles;
+    uint32_t max_cycles;
+    uint64_t total_cycles;
+    uint32_t histogram[PROFILE_HISTOGRAM_BUCKETS];
+} profile_stats_t;
+
+#if PROFILING_ENABLED
+
+typedef struct {
+    uint8_t probe;
+    uint32_t start;
+} profile_scope_t;
+
+void Profile_Record(uint8_t probe, uint32_t cycles);
+
+static inline void Profile_ScopeEnd(profile_scope_t *scope) {
+    Profile_Record(scope->probe, DWT->CYCCNT - scope->start);
+}
+
+// Times the rest of the enclosing block, including every return path
+#define PROFILE_SCOPE(probe) \
+    profile_scope_t profile_scope_ __attribute__((cleanup(Profile_ScopeEnd))) = \
+        { (probe), DWT->CYCCNT }
+
+void Profile_Reset(void);
+void Profile_Snapshot(profile_stats_t *snapshot);
+const profile_stats_t *Profile_GetStats(uint8_t probe);
+const char *Profile_GetName(uint8_t probe);
+int Profile_Format(uint8_t probe, const profile_stats_t *stats, char *buffer, size_t size);
+
+#else
+
+#define PROFILE_SCOPE(probe) do { } while (0)
+
+#endif // PROFILING_ENABLED
+
+#endif // PROFILE_H
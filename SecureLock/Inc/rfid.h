@@ -65,6 +65,114 @@
 #define MFRC522_CMD_MF_AUTHENT      0x0E
 #define MFRC522_CMD_SOFT_RESET      0x0F
 
+// MFRC522 CommandReg bits
+#define MFRC522_COMMAND_POWER_DOWN  0x10
+
+// MFRC522 TxControlReg bits
+#define MFRC522_TX_CONTROL_ANTENNA  0x03    // Tx1RFEn | Tx2RFEn
+
+// MFRC522 ComIEnReg/ComIrqReg and DivIEnReg/DivIrqReg bits
+#define MFRC522_COMIEN_IRQ_INV      0x80    // IRQ pin active low
+#define MFRC522_IRQ_TX              0x40
+#define MFRC522_IRQ_RX              0x20
+#define MFRC522_IRQ_IDLE            0x10
+#define MFRC522_IRQ_ERR             0x02
+#define MFRC522_IRQ_TIMER           0x01
+#define MFRC522_DIVIEN_PUSH_PULL    0x80    // IRQ pin push-pull rather than open drain
+#define MFRC522_DIVIRQ_CRC          0x04
+
+// SPI address byte: bits 6-1 register, MSB set for a read
+#define RFID_WRITE_ADDRESS(reg)     (((reg) << 1) & 0x7E)
+#define RFID_READ_ADDRESS(reg)      ((((reg) << 1) & 0x7E) | 0x80)
+
+// Reset timing
+#define RFID_RESET_PULSE_NS         200     // NRSTPD low time (datasheet min 100 ns)
+#define RFID_STARTUP_US             50      // Oscillator start-up after reset
+#define RFID_RESET_TIMEOUT_MS       50      // Upper bound on soft reset completion
+
+// SPI clock tuning at start-up: from RFID_SPI_CLOCK_HZ the prescaler steps
+// up while every write/read-back round at the new rate comes back intact
+#define RFID_SPI_TUNE_ROUNDS        8       // Pattern rounds per rate
+#define RFID_SPI_TUNE_BURST         32      // FIFO bytes written and read back per round
+#define RFID_SPI_TUNE_MARGIN        1       // Halvings below the fastest rate that passed, after a failure
+
+// Transceive completion comes on the IRQ line (EXTI4); the chip timer ends
+// a wait with no answer and a one-pulse guard timer a wait with no IRQ
+#define RFID_COM_IRQS               (MFRC522_IRQ_RX | MFRC522_IRQ_IDLE | MFRC522_IRQ_TIMER)
+#define RFID_GUARD_TIMER            TIM4
+#define RFID_TRANSCEIVE_TIMEOUT_US  25000   // Well beyond the 1.5 ms chip timer
+#define RFID_CRC_TIMEOUT_MS         5
+
+#define RFID_FIFO_SIZE              64      // MFRC522 FIFO bytes
+
+// Transceive framing: BitFramingReg RxAlign/TxLastBits, plus TxCRCEn
+#define RFID_FRAMING(rx_align, tx_last_bits) ((uint8_t)((((rx_align) & 0x07) << 4) | ((tx_last_bits) & 0x07)))
+#define RFID_FRAMING_CRC            0x80    // Append CRC_A to the frame
+
+// MFRC522 ErrorReg and CollReg bits
+#define MFRC522_ERROR_COLL          0x08
+#define MFRC522_COLL_POS_NOT_VALID  0x20
+#define MFRC522_COLL_POS_MASK       0x1F
+
+// ISO 14443A UIDs: 4, 7 or 10 bytes over one to three cascade levels
+#define RFID_UID_MAX_SIZE           10
+#define RFID_MAX_CASCADE_LEVELS     3
+#define RFID_MAX_CARDS              4       // Enumerated per card check
+#define PICC_SAK_CASCADE            0x04    // UID not complete yet
+
+typedef struct {
+    uint8_t uid[RFID_UID_MAX_SIZE];
+    uint8_t size;
+    uint8_t sak;
+} rfid_card_t;
+
+// RF front end: receiver gain (RFCfgReg RxGain), carrier driver
+// conductance (CWGsPReg, GsNReg CWGsN) and receiver thresholds
+// (RxThresholdReg MinLevel, CollLevel). The defaults are the reset values.
+typedef struct {
+    uint8_t rf_cfg;             // RFCfgReg
+    uint8_t gs_n;               // GsNReg
+    uint8_t cw_gs_p;            // CWGsPReg
+    uint8_t rx_threshold;       // RxThresholdReg
+} rfid_rf_config_t;
+
+#define RFID_RF_CONFIG_DEFAULT      {0x48, 0x88, 0x20, 0x84}
+#define RFID_RX_GAIN(rf_cfg)        (((rf_cfg) >> 4) & 0x07)
+#define RFID_MIN_LEVEL(rx_threshold) ((rx_threshold) >> 4)
+
+// Card checks in which a card answered the first request, and those of
+// them that read a card through to SELECT
+typedef struct {
+    uint32_t answered;
+    uint32_t read;
+} rfid_read_stats_t;
+
+// Transceives the chip never ended (no IRQ before the guard timer, SPI
+// failure) and those it ended with ErrorReg bits, since boot
+typedef struct {
+    uint32_t faults;
+    uint32_t errors;
+    uint8_t consecutive;        // Faults and errors since the last clean end
+} rfid_link_stats_t;
+
+typedef enum {
+    RFID_XFER_IDLE = 0,
+    RFID_XFER_BUSY,
+    RFID_XFER_OK,
+    RFID_XFER_TIMEOUT,
+    RFID_XFER_ERROR
+} rfid_xfer_status_t;
+
+typedef enum {
+    RFID_CHECK_IDLE = 0,
+    RFID_CHECK_BUSY,
+    RFID_CHECK_NO_CARD,
+    RFID_CHECK_CARD
+} rfid_check_t;
+
+typedef void (*rfid_done_cb_t)(rfid_xfer_status_t status);
+typedef void (*rfid_check_cb_t)(void);
+
 // PICC Commands
 #define PICC_CMD_REQA               0x26
 #define PICC_CMD_WUPA               0x52
@@ -77,15 +185,44 @@
 
 // RFID functions
 void RFID_Init(void);
-uint8_t RFID_Transfer(uint8_t data);
+void RFID_WaitForPowerUp(void);
+void RFID_UpdateSpiClock(void);
+void RFID_ClockChanged(uint8_t phase);
+void RFID_SetAntenna(uint8_t on);
+uint8_t RFID_IsAntennaOn(void);
+void RFID_SetRfConfig(const rfid_rf_config_t *config);
+void RFID_GetRfConfig(rfid_rf_config_t *config);
+uint8_t RFID_RxGainDb(uint8_t rf_cfg);
 void RFID_WriteRegister(uint8_t reg, uint8_t value);
 uint8_t RFID_ReadRegister(uint8_t reg);
+void RFID_WriteRegisterBurst(uint8_t reg, const uint8_t *values, uint8_t count);
+void RFID_ReadRegisters(const uint8_t *regs, uint8_t *values, uint8_t count);
+void RFID_ReadRegisterBurst(uint8_t reg, uint8_t *values, uint8_t count);
+uint32_t RFID_GetSpiTransactions(void);
+uint32_t RFID_GetSpiClock(void);
+uint32_t RFID_GetSpiRejectedClock(void);
 int RFID_CheckForCard(uint8_t *uid, uint8_t *uid_size);
 uint8_t RFID_TransceiveData(uint8_t *send_data, uint8_t send_len,
                            uint8_t *back_data, uint8_t *back_len);
+uint8_t RFID_TransceiveFrame(uint8_t *send_data, uint8_t send_len, uint8_t framing,
+                            uint8_t *back_data, uint8_t *back_len);
+uint8_t RFID_StartTransceive(const uint8_t *send_data, uint8_t send_len, uint8_t framing,
+                             uint8_t *back_data, uint8_t back_size, rfid_done_cb_t done);
+rfid_xfer_status_t RFID_GetTransceiveStatus(void);
+void RFID_GetLinkStats(rfid_link_stats_t *stats);
+uint8_t RFID_IsIdle(void);
+uint8_t RFID_CheckRegisters(void);
+uint8_t RFID_Recover(void);
+uint8_t RFID_StartCardCheck(rfid_check_cb_t done, uint8_t wake);
+rfid_check_t RFID_GetCardCheck(rfid_card_t *cards, uint8_t *count);
+rfid_check_t RFID_WaitCardCheck(rfid_card_t *cards, uint8_t *count);
+void RFID_GetReadStats(rfid_read_stats_t *stats);
 void RFID_Halt(void);
 uint8_t RFID_CalculateCRC(uint8_t *data, uint8_t length, uint8_t *result);
+uint8_t RFID_CalculateCRCChip(uint8_t *data, uint8_t length, uint8_t *result);
 int RFID_IsNewCardPresent(void);
 int RFID_ReadCardSerial(uint8_t *uid, uint8_t *uid_size);
+void EXTI4_IRQHandler(void);
+void TIM4_IRQHandler(void);
 
 #endif // RFID_H
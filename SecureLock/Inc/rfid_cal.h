@@ -0,0 +1,45 @@
+#ifndef RFID_CAL_H
+#define RFID_CAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "rfid.h"
+
+// RF front-end calibration against a reference card resting on the reader,
+// started by the CALIBRATE command in maintenance mode. Each candidate
+// setting of receiver gain, MinLevel threshold and carrier drive gets
+// RFID_CAL_READS cold reads, each starting the way a tap does: field off,
+// field on, RFID_POLL_SETTLE_MS, card check. The sweep runs a step at a
+// time from the rfid task in place of the poller, so the other tasks carry
+// on through its few seconds. The setting that read the
+// reference card most often wins; on a tie, the one whose gain and
+// MinLevel neighbours read it most, then the defaults. It is stored for
+// every later boot.
+
+#define RFID_CAL_READS             10      // Cold reads per candidate
+#define RFID_CAL_OFF_MS            2       // Field off before a read; cards lose power
+#define RFID_CAL_GS_P_STRONG       0x3F    // CWGsPReg at full conductance
+#define RFID_CAL_GS_N_STRONG       0xF8    // GsNReg: CWGsN full, ModGsN at reset
+
+typedef struct {
+    rfid_rf_config_t config;
+    uint8_t reads;              // Cold reads per candidate
+    uint8_t best;               // Reference card reads with `config`
+    uint8_t baseline;           // Reference card reads with the defaults
+    uint8_t candidates;
+} rfid_cal_record_t;
+
+typedef enum {
+    RFID_CAL_RUNNING = 0,
+    RFID_CAL_DONE,                  // Best setting in use and stored
+    RFID_CAL_FAILED                 // No card in the field; settings unchanged
+} rfid_cal_status_t;
+
+void RfidCal_Init(void);
+void RfidCal_SetTask(uint8_t task_id);
+uint8_t RfidCal_Start(void);
+uint8_t RfidCal_IsActive(void);
+rfid_cal_status_t RfidCal_Service(void);
+int RfidCal_Format(char *buffer, size_t size);
+
+#endif // RFID_CAL_H
@@ -0,0 +1,27 @@
+#ifndef RFID_HEALTH_H
+#define RFID_HEALTH_H
+
+#include <stdint.h>
+#include "rfid.h"
+
+// RC522 health monitor. Every RFID_HEALTH_CHECK_MS, or sooner after
+// RFID_HEALTH_FAULT_LIMIT transceives in a row the chip did not end
+// cleanly, registers the set-up configured are read back. A wrong value
+// means the chip was reset by a brown-out or stopped answering (ESD
+// latch-up): it gets a hard reset and its set-up again while the MCU
+// carries on. If it still reads back wrong the reader is down, and the
+// re-init is retried with the wait doubling up to RFID_HEALTH_RETRY_MAX_MS.
+
+typedef struct {
+    uint32_t checks;            // Register read-backs
+    uint32_t failures;          // Read-backs that found the chip wrong
+    uint32_t recoveries;        // Re-inits that brought it back
+    uint32_t faults;            // Transceives the chip never ended
+    uint32_t errors;            // Ended with ErrorReg bits
+    uint8_t down;               // Re-init has not helped yet
+} rfid_health_stats_t;
+
+uint8_t RfidHealth_Service(void);
+void RfidHealth_GetStats(rfid_health_stats_t *stats);
+
+#endif // RFID_HEALTH_H
@@ -0,0 +1,33 @@
+#ifndef RFID_POLL_H
+#define RFID_POLL_H
+
+#include <stdint.h>
+#include "rfid.h"
+
+// Adaptive card-presence polling. With the field empty the antenna is only
+// on for short probes: it comes on, a card gets RFID_POLL_SETTLE_MS to power
+// up, then a card check runs (a single REQA when nobody answers) and the
+// field goes off again. After a new card the antenna stays on and probes
+// come every RFID_POLL_FAST_MS for RFID_POLL_HOLD_MS, for a second card or
+// one taken away and back; after that the interval doubles with every
+// probe that finds nothing new, up to the idle interval. The idle interval
+// is the shortest that keeps the measured probe pulses within the
+// RFID_POLL_POWER_TARGET duty budget, but never longer than the latency
+// target RFID_SCAN_INTERVAL_MS, which wins when both cannot be met.
+
+typedef struct {
+    uint32_t probes;
+    uint32_t hits;
+    uint32_t latency_avg_ms;    // Estimated: half the gap since the last empty probe, plus the probe
+    uint32_t interval_ms;       // Current gap between probes
+    uint32_t duty_permille;     // Antenna on-time since boot
+} rfid_poll_stats_t;
+
+void RfidPoll_Init(uint8_t task_id);
+void RfidPoll_Service(rfid_check_cb_t done, uint8_t wake);
+void RfidPoll_CheckDone(uint8_t hit);
+void RfidPoll_Suspend(void);
+void RfidPoll_Reset(void);
+void RfidPoll_GetStats(rfid_poll_stats_t *stats);
+
+#endif // RFID_POLL_H
@@ -0,0 +1,36 @@
+#ifndef RFID_PRESENCE_H
+#define RFID_PRESENCE_H
+
+#include <stdint.h>
+#include "rfid.h"
+
+// Cards in the field across card checks. A check reads every card it
+// wakes and halts each again; the tracker turns those reads into one ENTER
+// event when a UID first shows up and one LEAVE event once it has been
+// missing from RFID_PRESENCE_MISSES waking checks in a row, so a card held
+// against the reader is handled once. Routine checks leave halted cards
+// asleep; RfidPresence_WakeDue asks for a waking one every
+// RFID_PRESENCE_CONFIRM_CHECKS checks while cards are present, and for
+// every check once one has gone missing.
+
+#define RFID_PRESENCE_MISSES       2       // Waking checks without the card before it has left
+#define RFID_PRESENCE_CONFIRM_CHECKS 4     // Checks per waking check while cards are present
+#define RFID_PRESENCE_QUEUE_SIZE   8       // Events, power of two
+
+typedef enum {
+    RFID_EVENT_ENTER = 0,
+    RFID_EVENT_LEAVE
+} rfid_event_type_t;
+
+typedef struct {
+    uint8_t type;               // rfid_event_type_t
+    rfid_card_t card;
+} rfid_event_t;
+
+void RfidPresence_Init(void);
+uint8_t RfidPresence_WakeDue(void);
+void RfidPresence_Update(const rfid_card_t *cards, uint8_t count);
+uint8_t RfidPresence_GetEvent(rfid_event_t *event);
+uint8_t RfidPresence_GetCount(void);
+
+#endif // RFID_PRESENCE_H
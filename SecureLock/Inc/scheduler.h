@@ -0,0 +1,59 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Cooperative run-to-completion scheduler. Every task runs on its own
+// period; when several are due the highest priority runs first, ties are
+// broken by the earliest absolute deadline.
+
+#define SCHEDULER_MAX_TASKS        12
+#define SCHEDULER_INVALID_TASK     0xFF
+
+typedef void (*task_fn_t)(void);
+
+typedef enum {
+    TASK_PRIORITY_HIGH = 0,
+    TASK_PRIORITY_NORMAL,
+    TASK_PRIORITY_LOW
+} task_priority_t;
+
+typedef struct {
+    const char *name;
+    task_fn_t function;
+    uint32_t period_ms;         // 0 = run only when triggered
+    uint32_t deadline_ms;       // Relative to release, 0 = same as period
+    task_priority_t priority;
+    uint8_t enabled;
+    uint64_t next_release;      // Absolute release time (ms)
+
+    // Statistics
+    uint32_t run_count;
+    uint32_t last_run_us;       // Execution time of the last run
+    uint32_t max_run_us;        // Worst-case execution time
+    uint64_t total_run_us;
+    uint32_t max_latency_us;    // Worst release-to-completion time
+    uint32_t deadline_misses;
+} task_t;
+
+void Scheduler_Init(void);
+uint8_t Scheduler_AddTask(const char *name, task_fn_t function, uint32_t period_ms,
+                          uint32_t deadline_ms, task_priority_t priority);
+void Scheduler_RunPending(void);
+uint64_t Scheduler_NextRelease(void);
+
+// Task control
+void Scheduler_SetEnabled(uint8_t task_id, uint8_t enabled);
+void Scheduler_Trigger(uint8_t task_id);
+void Scheduler_TriggerFromISR(uint8_t task_id);
+void Scheduler_Delay(uint8_t task_id, uint32_t delay_ms);
+void Scheduler_SetPeriod(uint8_t task_id, uint32_t period_ms);
+
+// Statistics
+uint8_t Scheduler_GetTaskCount(void);
+const task_t *Scheduler_GetTask(uint8_t task_id);
+void Scheduler_ResetStats(void);
+int Scheduler_FormatStats(uint8_t task_id, char *buffer, size_t size);
+
+#endif // SCHEDULER_H
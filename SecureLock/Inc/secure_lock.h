@@ -10,23 +10,32 @@
 
 // User database structure
 typedef struct {
-    uint8_t uid[4];         // RFID UID
-    uint8_t pin_hash[32];   // SHA-256 hash of PIN
+    uint8_t uid[MAX_RFID_UID_LENGTH]; // RFID UID
+    uint8_t uid_size;       // 4, 7 or 10 bytes
+    uint8_t pin_salt[PIN_SALT_SIZE];
+    uint8_t pin_hash[32];   // SHA-256 of the salt followed by the PIN
     uint8_t privileges;     // User privileges
 } user_t;
 
 // Function prototypes
 void SecureLock_Init(void);
 void SecureLock_Run(void);
-void SecureLock_ProcessRFID(uint8_t *uid);
-void SecureLock_ProcessPIN(char *pin);
+void SecureLock_ServiceTimeouts(void);
+void SecureLock_ServiceRFID(void);
+void SecureLock_CardCheckDone(void);
+void SecureLock_ServiceCard(void);
+void SecureLock_ServiceKeypad(void);
+void SecureLock_ProcessRFID(const uint8_t *uid, uint8_t uid_size);
+void SecureLock_ProcessPIN(void);
 void SecureLock_GrantAccess(void);
+void SecureLock_ExtendUnlock(void);
+void SecureLock_ReleaseLock(void);
 void SecureLock_DenyAccess(void);
 void SecureLock_ResetSession(void);
 
 // Security functions
-uint8_t SecureLock_ValidateRFID(uint8_t *uid);
-uint8_t SecureLock_ValidatePIN(char *pin, uint8_t *stored_hash);
+uint8_t SecureLock_ValidateRFID(const uint8_t *uid, uint8_t uid_size);
+uint8_t SecureLock_ValidatePIN(const char *pin, uint8_t user_id);
 void SecureLock_LogAccess(uint8_t user_id, uint8_t granted, const char *reason);
 
 // Remote control
@@ -35,6 +44,7 @@ void SecureLock_SendAccessLogs(void);
 
 // Getters
 uint8_t SecureLock_GetFailedAttempts(void);
+uint8_t SecureLock_IsUnlocked(void);
 error_code_t SecureLock_GetLastError(void);
 
 #endif // SECURE_LOCK_H
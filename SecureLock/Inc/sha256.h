@@ -10,7 +10,7 @@ typedef struct {
 } SHA256_CTX;
 
 void sha256_init(SHA256_CTX *ctx);
-void sha256_update(SHA256_CTX *ctx, uint8_t *data, uint32_t len);
+void sha256_update(SHA256_CTX *ctx, const uint8_t *data, uint32_t len);
 void sha256_final(SHA256_CTX *ctx, uint8_t *digest);
 
 #endif // SHA256_H
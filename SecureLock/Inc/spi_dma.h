@@ -0,0 +1,46 @@
+#ifndef SPI_DMA_H
+#define SPI_DMA_H
+
+#include <stdint.h>
+
+// SPI1 master transfers driven by DMA2: stream 3 feeds TX and stream 0
+// drains RX, both on channel 3. Frames are queued and run back to back,
+// each with the RC522 chip select held low for its whole length. A frame's
+// callback runs from the DMA interrupt after its last byte has arrived and
+// may queue further frames.
+
+#define SPI_DMA_QUEUE_SIZE         8       // Frames, power of two
+#define SPI_DMA_RX_STREAM          0
+#define SPI_DMA_TX_STREAM          3
+#define SPI_DMA_CHANNEL            3
+
+typedef enum {
+    SPI_FRAME_QUEUED = 0,
+    SPI_FRAME_DONE,
+    SPI_FRAME_ERROR
+} spi_frame_status_t;
+
+typedef struct spi_frame spi_frame_t;
+typedef void (*spi_frame_cb_t)(spi_frame_t *frame);
+
+// Owned by the caller and left untouched until the frame completes
+struct spi_frame {
+    const uint8_t *tx;                  // `length` bytes out
+    uint8_t *rx;                        // `length` bytes in, NULL to discard
+    uint16_t length;
+    spi_frame_cb_t callback;            // Interrupt context, NULL for none
+    volatile uint8_t status;            // spi_frame_status_t
+};
+
+void SpiDma_Init(void);
+uint8_t SpiDma_Submit(spi_frame_t *frame);
+void SpiDma_Wait(const spi_frame_t *frame);
+uint8_t SpiDma_Transfer(spi_frame_t *frame);
+uint8_t SpiDma_IsIdle(void);
+void SpiDma_Quiesce(void);
+void SpiDma_Hold(void);
+void SpiDma_Release(void);
+uint32_t SpiDma_GetFrameCount(void);
+void DMA2_Stream0_IRQHandler(void);
+
+#endif // SPI_DMA_H
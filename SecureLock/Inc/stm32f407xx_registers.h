@@ -179,6 +179,34 @@ typedef struct {
 
 #define SCB                ((SCB_TypeDef *)SCB_BASE)
 
+// ==================== DWT (Data Watchpoint and Trace) ====================
+#define DWT_BASE           (0xE0001000U)
+
+typedef struct {
+    volatile uint32_t CTRL;          // Control register
+    volatile uint32_t CYCCNT;        // Cycle count register
+    volatile uint32_t CPICNT;        // CPI count register
+    volatile uint32_t EXCCNT;        // Exception overhead count register
+    volatile uint32_t SLEEPCNT;      // Sleep count register
+    volatile uint32_t LSUCNT;        // LSU count register
+    volatile uint32_t FOLDCNT;       // Folded-instruction count register
+    volatile uint32_t PCSR;          // Program counter sample register
+} DWT_TypeDef;
+
+#define DWT                ((DWT_TypeDef *)DWT_BASE)
+
+// ==================== CoreDebug ====================
+#define COREDEBUG_BASE     (0xE000EDF0U)
+
+typedef struct {
+    volatile uint32_t DHCSR;         // Debug halting control and status register
+    volatile uint32_t DCRSR;         // Debug core register selector register
+    volatile uint32_t DCRDR;         // Debug core register data register
+    volatile uint32_t DEMCR;         // Debug exception and monitor control register
+} CoreDebug_TypeDef;
+
+#define CoreDebug          ((CoreDebug_TypeDef *)COREDEBUG_BASE)
+
 // ==================== FLASH Memory Interface ====================
 #define FLASH_BASE         (AHB1PERIPH_BASE + 0x3C00U)
 
@@ -208,6 +236,19 @@ typedef struct {
 
 #define EXTI               ((EXTI_TypeDef *)EXTI_BASE)
 
+// ==================== SYSCFG (System Configuration Controller) ====================
+#define SYSCFG_BASE        (APB2PERIPH_BASE + 0x3800U)
+
+typedef struct {
+    volatile uint32_t MEMRMP;        // Memory remap register
+    volatile uint32_t PMC;           // Peripheral mode configuration register
+    volatile uint32_t EXTICR[4];     // External interrupt configuration registers
+    uint32_t RESERVED[2];
+    volatile uint32_t CMPCR;         // Compensation cell control register
+} SYSCFG_TypeDef;
+
+#define SYSCFG             ((SYSCFG_TypeDef *)SYSCFG_BASE)
+
 // ==================== DMA (Direct Memory Access) ====================
 #define DMA1_BASE          (AHB1PERIPH_BASE + 0x6000U)
 #define DMA2_BASE          (AHB1PERIPH_BASE + 0x6400U)
@@ -232,6 +273,52 @@ typedef struct {
 #define DMA1               ((DMA_TypeDef *)DMA1_BASE)
 #define DMA2               ((DMA_TypeDef *)DMA2_BASE)
 
+// ==================== TIM (General-purpose timers 2-5) ====================
+#define TIM2_BASE          (APB1PERIPH_BASE + 0x0000U)
+#define TIM3_BASE          (APB1PERIPH_BASE + 0x0400U)
+#define TIM4_BASE          (APB1PERIPH_BASE + 0x0800U)
+#define TIM5_BASE          (APB1PERIPH_BASE + 0x0C00U)
+
+typedef struct {
+    volatile uint32_t CR1;           // Control register 1
+    volatile uint32_t CR2;           // Control register 2
+    volatile uint32_t SMCR;          // Slave mode control register
+    volatile uint32_t DIER;          // DMA/interrupt enable register
+    volatile uint32_t SR;            // Status register
+    volatile uint32_t EGR;           // Event generation register
+    volatile uint32_t CCMR1;         // Capture/compare mode register 1
+    volatile uint32_t CCMR2;         // Capture/compare mode register 2
+    volatile uint32_t CCER;          // Capture/compare enable register
+    volatile uint32_t CNT;           // Counter (32-bit on TIM2 and TIM5)
+    volatile uint32_t PSC;           // Prescaler
+    volatile uint32_t ARR;           // Auto-reload register
+    volatile uint32_t RESERVED0;
+    volatile uint32_t CCR[4];        // Capture/compare registers 1-4
+    volatile uint32_t RESERVED1;
+    volatile uint32_t DCR;           // DMA control register
+    volatile uint32_t DMAR;          // DMA address for full transfer
+    volatile uint32_t OR;            // Option register
+} TIM_TypeDef;
+
+#define TIM2               ((TIM_TypeDef *)TIM2_BASE)
+#define TIM3               ((TIM_TypeDef *)TIM3_BASE)
+#define TIM4               ((TIM_TypeDef *)TIM4_BASE)
+#define TIM5               ((TIM_TypeDef *)TIM5_BASE)
+
+// ==================== INTERRUPT NUMBERS ====================
+#define EXTI0_IRQn         6
+#define EXTI4_IRQn         10
+#define EXTI9_5_IRQn       23
+#define TIM2_IRQn          28
+#define TIM3_IRQn          29
+#define TIM4_IRQn          30
+#define EXTI15_10_IRQn     40
+#define SPI1_IRQn          35
+#define USART2_IRQn        38
+#define TIM5_IRQn          50
+#define DMA2_Stream0_IRQn  56
+#define DMA2_Stream3_IRQn  59
+
 // ==================== BIT DEFINITIONS ====================
 
 // RCC CR register bits
@@ -242,6 +329,29 @@ typedef struct {
 #define RCC_CR_PLLON       (1 << 24) // PLL enable
 #define RCC_CR_PLLRDY      (1 << 25) // PLL clock ready flag
 
+// RCC PLLCFGR register fields
+#define RCC_PLLCFGR_PLLM_POS  0      // Division factor for the PLL input
+#define RCC_PLLCFGR_PLLN_POS  6      // Multiplication factor for the VCO
+#define RCC_PLLCFGR_PLLP_POS  16     // Division factor for the main system clock
+#define RCC_PLLCFGR_PLLSRC_HSE (1 << 22) // HSE as PLL input
+#define RCC_PLLCFGR_PLLQ_POS  24     // Division factor for USB/SDIO clocks
+
+// RCC CFGR register fields
+#define RCC_CFGR_SW           (3 << 0)  // System clock switch
+#define RCC_CFGR_SW_HSI       (0 << 0)
+#define RCC_CFGR_SW_HSE       (1 << 0)
+#define RCC_CFGR_SW_PLL       (2 << 0)
+#define RCC_CFGR_SWS          (3 << 2)  // System clock switch status
+#define RCC_CFGR_SWS_HSI      (0 << 2)
+#define RCC_CFGR_SWS_HSE      (1 << 2)
+#define RCC_CFGR_SWS_PLL      (2 << 2)
+#define RCC_CFGR_HPRE_POS     4      // AHB prescaler
+#define RCC_CFGR_HPRE         (0xF << 4)
+#define RCC_CFGR_PPRE1_POS    10     // APB1 prescaler
+#define RCC_CFGR_PPRE1        (7 << 10)
+#define RCC_CFGR_PPRE2_POS    13     // APB2 prescaler
+#define RCC_CFGR_PPRE2        (7 << 13)
+
 // RCC AHB1ENR register bits (GPIO clocks)
 #define RCC_AHB1ENR_GPIOAEN (1 << 0)  // GPIOA clock enable
 #define RCC_AHB1ENR_GPIOBEN (1 << 1)  // GPIOB clock enable
@@ -251,8 +361,13 @@ typedef struct {
 #define RCC_AHB1ENR_GPIOFEN (1 << 5)  // GPIOF clock enable
 #define RCC_AHB1ENR_GPIOGEN (1 << 6)  // GPIOG clock enable
 #define RCC_AHB1ENR_GPIOHEN (1 << 7)  // GPIOH clock enable
+#define RCC_AHB1ENR_DMA2EN  (1 << 22) // DMA2 clock enable
 
 // RCC APB1ENR register bits
+#define RCC_APB1ENR_TIM2EN  (1 << 0)   // TIM2 clock enable
+#define RCC_APB1ENR_TIM3EN  (1 << 1)   // TIM3 clock enable
+#define RCC_APB1ENR_TIM4EN  (1 << 2)   // TIM4 clock enable
+#define RCC_APB1ENR_TIM5EN  (1 << 3)   // TIM5 clock enable
 #define RCC_APB1ENR_USART2EN (1 << 17) // USART2 clock enable
 #define RCC_APB1ENR_SPI2EN  (1 << 14)  // SPI2 clock enable
 #define RCC_APB1ENR_SPI3EN  (1 << 15)  // SPI3 clock enable
@@ -263,6 +378,39 @@ typedef struct {
 #define RCC_APB2ENR_USART6EN (1 << 5)  // USART6 clock enable
 #define RCC_APB2ENR_SYSCFGEN (1 << 14) // SYSCFG clock enable
 
+// SYSCFG_EXTICR: four bits per EXTI line select the port (0 = A ... 7 = H)
+#define SYSCFG_EXTICR_PORTD 3
+#define SYSCFG_EXTICR_PORTE 4
+#define SYSCFG_EXTICR_SHIFT(line) (((line) & 3) * 4)
+
+// FLASH ACR register bits
+#define FLASH_ACR_LATENCY  (7 << 0)  // Wait states
+#define FLASH_ACR_PRFTEN   (1 << 8)  // Prefetch enable
+#define FLASH_ACR_ICEN     (1 << 9)  // Instruction cache enable
+#define FLASH_ACR_DCEN     (1 << 10) // Data cache enable
+#define FLASH_ACR_ICRST    (1 << 11) // Instruction cache reset
+#define FLASH_ACR_DCRST    (1 << 12) // Data cache reset
+
+// FLASH KEYR unlock sequence, SR and CR register bits
+#define FLASH_KEY1         0x45670123U
+#define FLASH_KEY2         0xCDEF89ABU
+#define FLASH_SR_EOP       (1 << 0)  // End of operation
+#define FLASH_SR_OPERR     (1 << 1)  // Operation error
+#define FLASH_SR_WRPERR    (1 << 4)  // Write protection error
+#define FLASH_SR_PGAERR    (1 << 5)  // Programming alignment error
+#define FLASH_SR_PGPERR    (1 << 6)  // Programming parallelism error
+#define FLASH_SR_PGSERR    (1 << 7)  // Programming sequence error
+#define FLASH_SR_ERRORS    (FLASH_SR_OPERR | FLASH_SR_WRPERR | FLASH_SR_PGAERR | \
+                            FLASH_SR_PGPERR | FLASH_SR_PGSERR)
+#define FLASH_SR_BSY       (1 << 16) // Busy
+#define FLASH_CR_PG        (1 << 0)  // Programming
+#define FLASH_CR_SER       (1 << 1)  // Sector erase
+#define FLASH_CR_SNB_POS   3         // Sector number
+#define FLASH_CR_SNB       (0xF << 3)
+#define FLASH_CR_PSIZE_X32 (2 << 8)  // 32-bit program size (2.7-3.6 V)
+#define FLASH_CR_STRT      (1 << 16) // Start erase
+#define FLASH_CR_LOCK      (1U << 31)
+
 // GPIO MODER register values
 #define GPIO_MODER_INPUT   0x00U     // Input mode
 #define GPIO_MODER_OUTPUT  0x01U     // General purpose output mode
@@ -311,6 +459,34 @@ typedef struct {
 #define SPI_SR_BSY         (1 << 7)  // Busy flag
 #define SPI_SR_FRE         (1 << 8)  // Frame format error
 
+// SPI CR2 register bits
+#define SPI_CR2_RXDMAEN    (1 << 0)  // RX buffer DMA enable
+#define SPI_CR2_TXDMAEN    (1 << 1)  // TX buffer DMA enable
+
+// DMA stream CR register bits
+#define DMA_SxCR_EN        (1 << 0)  // Stream enable
+#define DMA_SxCR_DMEIE     (1 << 1)  // Direct mode error interrupt enable
+#define DMA_SxCR_TEIE      (1 << 2)  // Transfer error interrupt enable
+#define DMA_SxCR_HTIE      (1 << 3)  // Half transfer interrupt enable
+#define DMA_SxCR_TCIE      (1 << 4)  // Transfer complete interrupt enable
+#define DMA_SxCR_DIR_P2M   (0 << 6)  // Peripheral to memory
+#define DMA_SxCR_DIR_M2P   (1 << 6)  // Memory to peripheral
+#define DMA_SxCR_DIR       (3 << 6)
+#define DMA_SxCR_MINC      (1 << 10) // Memory increment
+#define DMA_SxCR_PL_HIGH   (2 << 16) // Priority level high
+#define DMA_SxCR_CHSEL_POS 25        // Channel selection
+#define DMA_SxCR_CHSEL     (7 << 25)
+
+// DMA interrupt flags of one stream; LISR/LIFCR hold streams 0-3 and
+// HISR/HIFCR streams 4-7, each group at DMA_FLAG_SHIFT(stream)
+#define DMA_FLAG_FEIF      (1 << 0)  // FIFO error
+#define DMA_FLAG_DMEIF     (1 << 2)  // Direct mode error
+#define DMA_FLAG_TEIF      (1 << 3)  // Transfer error
+#define DMA_FLAG_HTIF      (1 << 4)  // Half transfer
+#define DMA_FLAG_TCIF      (1 << 5)  // Transfer complete
+#define DMA_FLAG_ALL       0x3DU
+#define DMA_FLAG_SHIFT(stream) ((((stream) & 1) * 6) + (((stream) & 2) * 8))
+
 // USART CR1 register bits
 #define USART_CR1_SBK      (1 << 0)  // Send break
 #define USART_CR1_RWU      (1 << 1)  // Receiver wakeup
@@ -340,12 +516,31 @@ typedef struct {
 #define USART_SR_LBD       (1 << 8)  // LIN break detection flag
 #define USART_SR_CTS       (1 << 9)  // CTS flag
 
+// TIM register bits
+#define TIM_CR1_CEN        (1 << 0)  // Counter enable
+#define TIM_CR1_UDIS       (1 << 1)  // Update disable
+#define TIM_CR1_URS        (1 << 2)  // Update request source
+#define TIM_CR1_OPM        (1 << 3)  // One-pulse mode
+#define TIM_CR1_DIR        (1 << 4)  // Direction (down-counting)
+#define TIM_CR1_ARPE       (1 << 7)  // Auto-reload preload enable
+#define TIM_DIER_UIE       (1 << 0)  // Update interrupt enable
+#define TIM_SR_UIF         (1 << 0)  // Update interrupt flag
+#define TIM_EGR_UG         (1 << 0)  // Update generation
+
 // SYSTICK CTRL register bits
 #define SYSTICK_CTRL_ENABLE (1 << 0)  // Counter enable
 #define SYSTICK_CTRL_TICKINT (1 << 1) // Tick interrupt enable
 #define SYSTICK_CTRL_CLKSOURCE (1 << 2) // Clock source selection
 #define SYSTICK_CTRL_COUNTFLAG (1 << 16) // Count flag
 
+// DWT and CoreDebug register bits
+#define DWT_CTRL_CYCCNTENA (1 << 0)  // Cycle counter enable
+#define COREDEBUG_DEMCR_TRCENA (1 << 24) // Trace (DWT/ITM) enable
+
+// SCB ICSR register bits
+#define SCB_ICSR_PENDSTCLR (1 << 25) // SysTick exception clear-pending
+#define SCB_ICSR_PENDSTSET (1 << 26) // SysTick exception set-pending
+
 // ==================== DISCOVERY BOARD SPECIFIC DEFINITIONS ====================
 #define LED_GREEN_PIN      12  // PD12
 #define LED_ORANGE_PIN     13  // PD13
@@ -360,4 +555,22 @@ typedef struct {
 #define MODIFY_REG(REG, CLEARMASK, SETMASK)  \
     ((REG) = (((REG) & (~(CLEARMASK))) | (SETMASK)))
 
+// ==================== HOST SIMULATION ====================
+// REG_SYNC_READ/REG_SYNC_WRITE mark the accesses a peripheral has to see as
+// they happen: data registers, chip selects and polled status flags. They
+// compile to nothing on the target; the host build (Host/, SECURELOCK_SIM)
+// maps the instances above onto simulated peripherals and runs its models
+// from these points. DMA_ADDRESS gives the bus address of a buffer for the
+// DMA address registers, which the host build cannot fill with a pointer,
+// and FLASH_WORD the flash word at a bus address; a word written while
+// programming is followed by REG_SYNC_WRITE.
+#ifdef SECURELOCK_SIM
+#include "sim_periph.h"
+#else
+#define REG_SYNC_READ(reg)    ((void)0)
+#define REG_SYNC_WRITE(reg)   ((void)0)
+#define DMA_ADDRESS(ptr)      ((uint32_t)(uintptr_t)(ptr))
+#define FLASH_WORD(address)   (*(volatile uint32_t *)(uintptr_t)(address))
+#endif
+
 #endif // STM32F407XX_REGISTERS_H
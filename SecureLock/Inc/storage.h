@@ -0,0 +1,33 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <stdint.h>
+
+// Settings that survive a reset, kept in the last two 128 KB flash sectors
+// (10 and 11), which the linker script leaves out of its FLASH region.
+// Records are appended to the active sector and the newest intact record
+// of an id wins. When the active sector is full the newest record of every
+// id moves to the other one, whose header goes in last; only then is the
+// old sector erased, so a reset at any point leaves one complete copy.
+//
+// Erasing a sector takes about a second and programming about 16 us a
+// word, with the core stalled on instruction fetches from the same bank
+// throughout: interrupts wait too. Save from maintenance paths only.
+
+#define STORAGE_SECTOR_FIRST       10
+#define STORAGE_SECTOR_BASE        0x080C0000UL    // Sector 10
+#define STORAGE_SECTOR_SIZE        0x20000UL
+#define STORAGE_RECORD_MAX         128     // Data bytes per record
+
+typedef enum {
+    STORAGE_ID_NONE = 0,
+    STORAGE_ID_RFID_CAL,            // rfid_cal_record_t
+    STORAGE_ID_KEYPAD_CAL,          // keypad_cal_record_t
+    STORAGE_ID_COUNT
+} storage_id_t;
+
+uint8_t Storage_Init(void);
+uint8_t Storage_Load(uint8_t id, void *data, uint16_t length);
+uint8_t Storage_Save(uint8_t id, const void *data, uint16_t length);
+
+#endif // STORAGE_H
@@ -0,0 +1,92 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include "config.h"
+#include "stm32f407xx_registers.h"
+
+// Binary event trace: fixed 8-byte records in a RAM ring, timestamped in
+// microseconds by a free-running TIM2. TIM2 keeps counting through WFI
+// sleep, unlike the DWT cycle counter. A record costs one timer read, one
+// LDREX/STREX slot reservation and the stores, so ISRs and the main loop
+// can both write without locking. The clock-change record is timed at
+// each profile; PROFILE reports it as trace_record_pll/trace_record_hsi.
+// The TRACE command sends the ring as one binary dump; Host/trace_decode
+// turns the dump into a timeline.
+
+#define TRACE_BUFFER_SIZE          128     // Records, power of two
+#define TRACE_SYNC_PERIOD_S        60      // Uptime marker, well inside the 71 min timer wrap
+#define TRACE_TIMER                TIM2
+
+#define TRACE_DUMP_MAGIC           "SLTR"
+#define TRACE_DUMP_VERSION         1
+
+typedef enum {
+    TRACE_EV_NONE = 0,
+    TRACE_EV_BOOT,              // arg16: TRACE_DUMP_VERSION
+    TRACE_EV_SYNC,              // arg8:arg16 = uptime in seconds
+    TRACE_EV_CLOCK,             // arg16: new HCLK in MHz
+    TRACE_EV_STATE,             // arg8: new system_state_t, arg16: previous
+    TRACE_EV_RFID_START,        // arg8: first byte sent, arg16: bits sent
+    TRACE_EV_RFID_END,          // arg8: status (0 = ok), arg16: bits received
+    TRACE_EV_KEY,               // arg8: key character
+    TRACE_EV_UART_CMD,          // arg8, arg16: first three characters of the command
+    TRACE_EV_UART_OVERFLOW,     // arg16: USART2 RX overflows so far
+    TRACE_EV_ACCESS,            // arg8: user id (0xFF = system), arg16: granted
+    TRACE_EV_ERROR,             // arg8: error_code_t
+    TRACE_EV_CARD,              // arg8: 1 = entered the field, 0 = left, arg16: first two UID bytes
+    TRACE_EV_COUNT
+} trace_event_t;
+
+typedef struct {
+    uint32_t time_us;           // TRACE_TIMER count, wraps after ~71 minutes
+    uint8_t event;
+    uint8_t arg8;
+    uint16_t arg16;
+} trace_record_t;
+
+// Dump layout: this header, then `count` records oldest first, all
+// little-endian as in RAM
+typedef struct {
+    char magic[4];              // TRACE_DUMP_MAGIC
+    uint8_t version;
+    uint8_t record_size;
+    uint16_t count;             // Records that follow
+    uint32_t written;           // Records written since boot (count < written: older ones lost)
+    uint32_t time_us;           // TRACE_TIMER count when the dump was taken
+    uint32_t uptime_ms;         // get_tick_count() at the same moment
+} trace_dump_header_t;
+
+#if TRACE_ENABLED
+
+extern trace_record_t trace_buffer[TRACE_BUFFER_SIZE];
+extern volatile uint32_t trace_head;
+extern volatile uint8_t trace_paused;
+
+static inline void Trace_Record(uint8_t event, uint8_t arg8, uint16_t arg16) {
+    if (trace_paused) return;
+
+    REG_SYNC_READ(TRACE_TIMER->CNT);
+    uint32_t time_us = TRACE_TIMER->CNT;
+    uint32_t slot = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED) & (TRACE_BUFFER_SIZE - 1);
+
+    trace_buffer[slot].time_us = time_us;
+    trace_buffer[slot].event = event;
+    trace_buffer[slot].arg8 = arg8;
+    trace_buffer[slot].arg16 = arg16;
+}
+
+#define TRACE(event, arg8, arg16)  Trace_Record((event), (uint8_t)(arg8), (uint16_t)(arg16))
+
+void Trace_Init(void);
+void Trace_ClockChanged(uint8_t phase);
+void Trace_Sync(uint32_t uptime_s);
+void Trace_Dump(void);
+
+#else
+
+#define TRACE(event, arg8, arg16)  do { } while (0)
+
+#endif // TRACE_ENABLED
+
+#endif // TRACE_H
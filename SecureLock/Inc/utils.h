@@ -10,15 +10,28 @@
 #define LED_RED      2
 #define LED_BLUE     3
 
-// Delay functions
+// Delay functions (DWT cycle counter, call DWT_Init() first)
+void DWT_Init(void);
+uint32_t get_cycle_count(void);
+void delay_cycles(uint32_t cycles);
+void delay_ns(uint32_t nanoseconds);
 void delay_ms(uint32_t milliseconds);
 void delay_us(uint32_t microseconds);
 void delay_ms_precise(uint32_t milliseconds);
+uint8_t delay_selftest(void);
 void SysTick_Init(uint32_t ticks);
+void SysTick_UpdateClock(void);
 
 // Time functions
+// get_tick_count() wraps after ~49 days; compare with deadline_reached()
+// or use the 64-bit variants for long intervals
 uint32_t get_tick_count(void);
+uint64_t get_tick_count64(void);
+uint64_t get_time_us(void);
 uint8_t delay_elapsed(uint32_t start_time, uint32_t delay_ms);
+uint8_t deadline_reached(uint32_t deadline);
+uint8_t deadline_reached64(uint64_t deadline);
+void tick_idle_until(uint64_t deadline);
 
 // String functions
 size_t strlen(const char *str);
@@ -31,6 +44,8 @@ void *memcpy(void *dest, const void *src, size_t n);
 void *memset(void *s, int c, size_t n);
 int memcmp(const void *s1, const void *s2, size_t n);
 void *memmove(void *dest, const void *src, size_t n);
+uint8_t secure_memeq(const void *s1, const void *s2, size_t n);
+void secure_wipe(void *s, size_t n);
 
 // Conversion functions
 char *itoa(int value, char *str, int base);
@@ -51,7 +66,7 @@ long map(long x, long in_min, long in_max, long out_min, long out_max);
 uint8_t crc8(const uint8_t *data, size_t length);
 
 // Debug functions
-void debug_printf(const char *format, ...);
+void debug_printf(const char *format, ...) __attribute__((format(printf, 1, 2)));
 void hex_dump(const uint8_t *data, size_t length);
 
 // System functions
@@ -60,6 +75,11 @@ void system_reset(void);
 void enable_irq(void);
 void disable_irq(void);
 void wait_for_interrupt(void);
+uint32_t irq_save(void);
+void irq_restore(uint32_t primask);
+void nvic_enable_irq(uint8_t irqn);
+void nvic_disable_irq(uint8_t irqn);
+void nvic_set_priority(uint8_t irqn, uint8_t priority);
 
 // LED functions (Discovery board)
 void led_on(uint8_t led);
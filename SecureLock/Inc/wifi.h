@@ -3,15 +3,26 @@
 
 #include <stdint.h>
 
+// Streamed payload source, see WIFI_SendStream
+typedef void (*wifi_stream_fn)(uint16_t offset, uint16_t count);
+
 // WiFi functions
 void WIFI_Init(void);
+void WIFI_UpdateBaudRate(void);
+void WIFI_ClockChanged(uint8_t phase);
 void WIFI_SendChar(char c);
 char WIFI_ReceiveChar(void);
 void WIFI_SendString(const char *str);
 int WIFI_SendCommand(const char *cmd, uint32_t timeout);
 void WIFI_SendLog(const char *message);
 void WIFI_SendEncryptedLog(const char *encrypted_data, uint16_t length);
+uint8_t WIFI_SendStream(uint16_t length, wifi_stream_fn write);
+uint8_t WIFI_IsStreaming(void);
+void WIFI_SendBytes(const uint8_t *data, uint16_t length);
+void WIFI_Service(void);
+uint32_t WIFI_GetTxDropped(void);
 uint8_t WIFI_HasCommand(void);
+uint32_t WIFI_GetRxOverflows(void);
 void WIFI_GetCommand(char *buffer, uint16_t max_length);
 void WIFI_ConnectToAP(const char *ssid, const char *password);
 uint8_t WIFI_IsConnected(void);
@@ -0,0 +1,318 @@
+#include "clock.h"
+#include "stm32f407xx_registers.h"
+#include "config.h"
+#include "utils.h"
+
+// PLL limits (RM0090 6.3.2)
+#define PLL_INPUT_HZ               2000000UL   // VCO input, 1-2 MHz
+#define PLL_VCO_MIN_HZ             100000000UL
+#define PLL_VCO_MAX_HZ             432000000UL
+#define PLL_USB_HZ                 48000000UL
+
+#define CLOCK_READY_TIMEOUT        0x20000UL   // Polling iterations
+
+static clock_change_cb_t change_callbacks[CLOCK_MAX_CALLBACKS];
+static uint8_t callback_count = 0;
+
+static clock_profile_t current_profile = CLOCK_PROFILE_PERFORMANCE;
+static clock_profile_t idle_profile = CLOCK_PROFILE_PERFORMANCE;
+static uint8_t burst_depth = 0;
+static uint64_t profile_enter_time = 0;
+static uint64_t profile_time_ms[CLOCK_PROFILE_COUNT];
+static uint32_t switch_count = 0;
+static uint8_t hse_failed = 0;         // Latched: the crystal did not start
+
+static uint8_t Clock_WaitFlag(volatile uint32_t *reg, uint32_t mask, uint32_t value) {
+    for (uint32_t i = 0; i < CLOCK_READY_TIMEOUT; i++) {
+        REG_SYNC_READ(*reg);
+        if ((*reg & mask) == value) return 1;
+    }
+    return 0;
+}
+
+static uint32_t Clock_APBDivider(uint32_t ppre) {
+    return (ppre < 4) ? 1 : (1UL << (ppre - 3));
+}
+
+// Smallest APB prescaler that keeps the bus at or below max_hz
+static uint32_t Clock_APBPrescaler(uint32_t hclk, uint32_t max_hz) {
+    uint32_t ppre = 0;
+    while (hclk / Clock_APBDivider(ppre) > max_hz && ppre < 7) {
+        ppre = (ppre == 0) ? 4 : ppre + 1;
+    }
+    return ppre;
+}
+
+static void Clock_SetFlashLatency(uint32_t hclk) {
+    uint32_t wait_states = (hclk - 1) / CLOCK_FLASH_HZ_PER_WS;
+
+    // Reset the ART caches once, before they are first enabled
+    if (!(FLASH->ACR & FLASH_ACR_ICEN)) {
+        FLASH->ACR |= FLASH_ACR_ICRST | FLASH_ACR_DCRST;
+        FLASH->ACR &= ~(FLASH_ACR_ICRST | FLASH_ACR_DCRST);
+    }
+
+    FLASH->ACR = wait_states | FLASH_ACR_PRFTEN | FLASH_ACR_ICEN | FLASH_ACR_DCEN;
+    Clock_WaitFlag(&FLASH->ACR, FLASH_ACR_LATENCY, wait_states);
+}
+
+static void Clock_SwitchSystemClock(uint32_t sw, uint32_t sws) {
+    RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_SW) | sw;
+    Clock_WaitFlag(&RCC->CFGR, RCC_CFGR_SWS, sws);
+}
+
+// Move SYSCLK to the HSI with the bus prescalers at 1 so the PLL can be
+// reprogrammed or switched off
+static void Clock_RunFromHSI(void) {
+    RCC->CR |= RCC_CR_HSION;
+    Clock_WaitFlag(&RCC->CR, RCC_CR_HSIRDY, RCC_CR_HSIRDY);
+
+    // Keep enough wait states for whichever clock is faster
+    uint32_t hclk = Clock_GetHCLK();
+    Clock_SetFlashLatency(hclk > HSI_VALUE ? hclk : HSI_VALUE);
+
+    Clock_SwitchSystemClock(RCC_CFGR_SW_HSI, RCC_CFGR_SWS_HSI);
+    RCC->CFGR &= ~(RCC_CFGR_HPRE | RCC_CFGR_PPRE1 | RCC_CFGR_PPRE2);
+    SystemCoreClock = HSI_VALUE;
+}
+
+// Program and lock the PLL while SYSCLK stays where it is; only the lock
+// wait is long, so this runs with interrupts enabled. A crystal that did
+// not start is not tried again: the HSE timeout would stall every burst.
+static uint8_t Clock_StartPLL(uint8_t source, uint32_t sysclk_hz, uint32_t *hclk) {
+    uint8_t status = 1;
+    uint32_t input_hz = HSI_VALUE;
+
+    if (sysclk_hz > CLOCK_HCLK_MAX_HZ) sysclk_hz = CLOCK_HCLK_MAX_HZ;
+
+    if (source == CLOCK_SOURCE_HSE && !hse_failed) {
+        RCC->CR |= RCC_CR_HSEON;
+        if (!Clock_WaitFlag(&RCC->CR, RCC_CR_HSERDY, RCC_CR_HSERDY)) {
+            RCC->CR &= ~RCC_CR_HSEON;
+            hse_failed = 1;
+        }
+    }
+    if (source == CLOCK_SOURCE_HSE && hse_failed) {
+        // No crystal: fall back to the internal oscillator
+        source = CLOCK_SOURCE_HSI;
+        status = 0;
+    }
+    if (source == CLOCK_SOURCE_HSE) {
+        input_hz = HSE_VALUE;
+    }
+
+    // The PLL can only be reprogrammed while nothing runs from it
+    if ((RCC->CFGR & RCC_CFGR_SWS) == RCC_CFGR_SWS_PLL) {
+        uint32_t primask = irq_save();
+        Clock_RunFromHSI();
+        irq_restore(primask);
+    }
+
+    RCC->CR &= ~RCC_CR_PLLON;
+    Clock_WaitFlag(&RCC->CR, RCC_CR_PLLRDY, 0);
+
+    // Smallest PLLP that keeps the VCO in range
+    uint32_t pllp = 2;
+    while (sysclk_hz * pllp < PLL_VCO_MIN_HZ && pllp < 8) {
+        pllp += 2;
+    }
+    uint32_t vco_hz = sysclk_hz * pllp;
+    if (vco_hz > PLL_VCO_MAX_HZ) vco_hz = PLL_VCO_MAX_HZ;
+
+    uint32_t pllm = input_hz / PLL_INPUT_HZ;
+    uint32_t plln = vco_hz / PLL_INPUT_HZ;
+    uint32_t pllq = (vco_hz + PLL_USB_HZ - 1) / PLL_USB_HZ;
+    if (pllq < 2) pllq = 2;
+    if (pllq > 15) pllq = 15;
+
+    RCC->PLLCFGR = (pllm << RCC_PLLCFGR_PLLM_POS) |
+                   (plln << RCC_PLLCFGR_PLLN_POS) |
+                   (((pllp / 2) - 1) << RCC_PLLCFGR_PLLP_POS) |
+                   (source == CLOCK_SOURCE_HSE ? RCC_PLLCFGR_PLLSRC_HSE : 0) |
+                   (pllq << RCC_PLLCFGR_PLLQ_POS);
+
+    RCC->CR |= RCC_CR_PLLON;
+    if (!Clock_WaitFlag(&RCC->CR, RCC_CR_PLLRDY, RCC_CR_PLLRDY)) {
+        *hclk = 0;
+        return 0; // Stay on the HSI
+    }
+
+    *hclk = vco_hz / pllp;
+    return status;
+}
+
+// Dividers, wait states and the SW switch onto a locked PLL; the caller
+// masks interrupts so none runs with half-updated dividers
+static void Clock_SwitchToPLL(uint32_t hclk) {
+    uint32_t ppre1 = Clock_APBPrescaler(hclk, CLOCK_PCLK1_MAX_HZ);
+    uint32_t ppre2 = Clock_APBPrescaler(hclk, CLOCK_PCLK2_MAX_HZ);
+    RCC->CFGR = (RCC->CFGR & ~(RCC_CFGR_PPRE1 | RCC_CFGR_PPRE2)) |
+                (ppre1 << RCC_CFGR_PPRE1_POS) | (ppre2 << RCC_CFGR_PPRE2_POS);
+
+    // Raise the wait states before the faster clock arrives
+    Clock_SetFlashLatency(hclk > HSI_VALUE ? hclk : HSI_VALUE);
+    Clock_SwitchSystemClock(RCC_CFGR_SW_PLL, RCC_CFGR_SWS_PLL);
+    Clock_SetFlashLatency(hclk);
+
+    SystemCoreClock = hclk;
+}
+
+// The PLL is not needed any more; a running HSE is left on so the next
+// switch to the PLL does not wait for the crystal
+static void Clock_StopPLL(void) {
+    RCC->CR &= ~RCC_CR_PLLON;
+    Clock_SetFlashLatency(HSI_VALUE);
+}
+
+uint8_t Clock_ConfigurePLL(uint8_t source, uint32_t sysclk_hz) {
+    uint32_t hclk;
+    uint8_t status = Clock_StartPLL(source, sysclk_hz, &hclk);
+
+    if (hclk == 0) return 0;
+
+    uint32_t primask = irq_save();
+    Clock_SwitchToPLL(hclk);
+    irq_restore(primask);
+    return status;
+}
+
+void Clock_ConfigureHSI(void) {
+    uint32_t primask = irq_save();
+    Clock_RunFromHSI();
+    irq_restore(primask);
+
+    Clock_StopPLL();
+}
+
+uint32_t Clock_GetHCLK(void) {
+    return SystemCoreClock;
+}
+
+uint32_t Clock_GetPCLK1(void) {
+    uint32_t ppre1 = (RCC->CFGR & RCC_CFGR_PPRE1) >> RCC_CFGR_PPRE1_POS;
+    return SystemCoreClock / Clock_APBDivider(ppre1);
+}
+
+uint32_t Clock_GetPCLK2(void) {
+    uint32_t ppre2 = (RCC->CFGR & RCC_CFGR_PPRE2) >> RCC_CFGR_PPRE2_POS;
+    return SystemCoreClock / Clock_APBDivider(ppre2);
+}
+
+// TIM2-TIM7 and TIM12-14 run at twice PCLK1 whenever APB1 is divided
+uint32_t Clock_GetAPB1TimerClock(void) {
+    uint32_t ppre1 = (RCC->CFGR & RCC_CFGR_PPRE1) >> RCC_CFGR_PPRE1_POS;
+    return Clock_GetPCLK1() * ((ppre1 < 4) ? 1 : 2);
+}
+
+// Prescales an APB1 timer to 1 MHz at the current clock. PSC only takes
+// effect on an update event, so one is forced; it clears CNT, and with
+// URS set it does not raise the update interrupt.
+void Clock_SetMicrosecondTimer(TIM_TypeDef *timer) {
+    timer->PSC = Clock_GetAPB1TimerClock() / 1000000UL - 1;
+    timer->EGR = TIM_EGR_UG;
+    REG_SYNC_WRITE(timer->EGR);
+}
+
+// ==================== CLOCK PROFILES ====================
+
+uint8_t Clock_RegisterChangeCallback(clock_change_cb_t callback) {
+    for (uint8_t i = 0; i < callback_count; i++) {
+        if (change_callbacks[i] == callback) return 1;
+    }
+    if (callback_count >= CLOCK_MAX_CALLBACKS) return 0;
+
+    change_callbacks[callback_count++] = callback;
+    return 1;
+}
+
+static void Clock_NotifyChange(uint8_t phase) {
+    for (uint8_t i = 0; i < callback_count; i++) {
+        change_callbacks[i](phase);
+    }
+}
+
+// The PLL locks and drivers finish their transfers with interrupts
+// enabled; only the switch itself, SysTick and the peripheral dividers are
+// updated with them masked, so nothing runs against a half-changed tree
+uint8_t Clock_SetProfile(clock_profile_t profile) {
+    if (profile >= CLOCK_PROFILE_COUNT) return 0;
+    if (profile == current_profile) return 1;
+
+    uint8_t status = 1;
+    uint32_t hclk = 0;
+    uint8_t to_pll = (profile == CLOCK_PROFILE_PERFORMANCE && CLOCK_PLL_ENABLED);
+
+    if (to_pll) {
+        status = Clock_StartPLL(CLOCK_PLL_SOURCE, SYSTEM_CLOCK_FREQ, &hclk);
+    }
+
+    Clock_NotifyChange(CLOCK_CHANGE_PRE);
+
+    uint32_t primask = irq_save();
+    uint64_t now = get_tick_count64();
+
+    if (hclk != 0) {
+        Clock_SwitchToPLL(hclk);
+    } else {
+        Clock_RunFromHSI();
+    }
+
+    SysTick_UpdateClock();
+    Clock_NotifyChange(CLOCK_CHANGE_POST);
+
+    profile_time_ms[current_profile] += now - profile_enter_time;
+    profile_enter_time = now;
+    current_profile = profile;
+    switch_count++;
+
+    irq_restore(primask);
+
+    if (!to_pll) {
+        Clock_StopPLL();
+    }
+    return status;
+}
+
+clock_profile_t Clock_GetProfile(void) {
+    return current_profile;
+}
+
+// Profile used outside bursts
+void Clock_SetIdleProfile(clock_profile_t profile) {
+    if (profile >= CLOCK_PROFILE_COUNT) return;
+
+    idle_profile = profile;
+    if (burst_depth == 0) {
+        Clock_SetProfile(idle_profile);
+    }
+}
+
+// Bursts nest; the clock drops back to the idle profile when the outermost
+// burst ends
+void Clock_BeginBurst(void) {
+    if (burst_depth++ == 0) {
+        Clock_SetProfile(CLOCK_PROFILE_PERFORMANCE);
+    }
+}
+
+void Clock_EndBurst(void) {
+    if (burst_depth == 0) return;
+
+    if (--burst_depth == 0) {
+        Clock_SetProfile(idle_profile);
+    }
+}
+
+uint64_t Clock_GetProfileTime(clock_profile_t profile) {
+    if (profile >= CLOCK_PROFILE_COUNT) return 0;
+
+    uint64_t total = profile_time_ms[profile];
+    if (profile == current_profile) {
+        total += get_tick_count64() - profile_enter_time;
+    }
+    return total;
+}
+
+uint32_t Clock_GetSwitchCount(void) {
+    return switch_count;
+}
@@ -1,8 +1,26 @@
 #include "keypad.h"
 #include "stm32f407xx_registers.h"
+#include "config.h"
+#include "clock.h"
+#include "scheduler.h"
+#include "trace.h"
 #include "utils.h"
 #include <string.h>
 
+// Between key presses all four columns are driven low and the rows
+// (pulled up) sit on falling-edge EXTI lines, so a press pulls its row low
+// and interrupts. The interrupt masks the row lines and starts the scan
+// timer, which reads the whole matrix every KEYPAD_SCAN_MS and runs every
+// key through its own debounce state machine. Presses, releases and long
+// presses go into an event queue, filled only by the timer interrupt and
+// emptied only by the caller of Keypad_GetEvent, and trigger the keypad
+// task. Once every key is back up the timer stops and the lines are armed
+// again.
+
+#define KEYPAD_ROW_LINES           (0xFUL << KEYPAD_ROW0_PIN)
+#define KEYPAD_COL_PINS            (0xFUL << KEYPAD_COL0_PIN)
+#define KEYPAD_KEYS                16      // Bit row * 4 + col of a key mask
+
 // Keypad matrix definition
 static const char keypad_matrix[4][4] = {
     {'1', '2', '3', 'A'},
@@ -11,12 +29,264 @@ static const char keypad_matrix[4][4] = {
     {'*', '0', '#', 'D'}
 };
 
+typedef enum {
+    KEY_UP = 0,
+    KEY_PRESSING,               // Down, not yet for the debounce time
+    KEY_DOWN,
+    KEY_RELEASING               // Up again, not yet for the debounce time
+} key_state_t;
+
+typedef struct {
+    uint8_t state;              // key_state_t
+    uint8_t quiet;              // Press taken as chatter: no events until it is up
+    uint8_t long_sent;
+    uint32_t since;             // Edge that started the press or release
+    uint32_t last_press;        // Time of the last PRESS event
+} key_track_t;
+
 // Keypad state variables
-static uint8_t keypad_debounce_counter = 0;
-static char last_key = '\0';
-static uint32_t last_key_time = 0;
-static const uint32_t DEBOUNCE_TIME_MS = 20;
-static const uint32_t KEY_REPEAT_TIME_MS = 200;
+static keypad_timing_t timing = {KEYPAD_DEBOUNCE_MS, KEYPAD_REPEAT_MS};
+static key_track_t tracks[KEYPAD_KEYS];
+static volatile uint16_t held = 0;               // Debounced keys down
+
+static volatile keypad_event_t events[KEYPAD_EVENT_QUEUE_SIZE];
+static volatile uint8_t event_head = 0;          // Written by the scan only
+static volatile uint8_t event_tail = 0;          // Written by Keypad_GetEvent only
+
+static uint8_t keypad_task = SCHEDULER_INVALID_TASK;
+static uint8_t irq_enabled = 0;
+static volatile uint8_t scanning = 0;
+static uint32_t wakeups = 0;
+static uint32_t ghost_scans = 0;
+static uint32_t dropped_events = 0;
+static uint32_t scan_period_us = KEYPAD_SCAN_MS * 1000UL;
+static keypad_monitor_cb_t monitor = 0;
+
+static void Keypad_Post(uint8_t type, uint8_t key, uint32_t time) {
+    uint8_t next = (event_head + 1) & (KEYPAD_EVENT_QUEUE_SIZE - 1);
+    char ch = keypad_matrix[key >> 2][key & 3];
+
+    // The tail belongs to the reader, so a full queue drops the new event
+    if (next == event_tail) {
+        dropped_events++;
+        return;
+    }
+    events[event_head].type = type;
+    events[event_head].key = ch;
+    events[event_head].time = time;
+    event_head = next;
+
+    if (type == KEYPAD_EVENT_PRESS) {
+        TRACE(TRACE_EV_KEY, ch, 0);
+    }
+    if (keypad_task != SCHEDULER_INVALID_TASK) {
+        Scheduler_TriggerFromISR(keypad_task);
+    }
+}
+
+// One key's debounce: an edge has to hold for the debounce time before it
+// counts, and a level that flips back within it was bounce
+static void Keypad_Track(uint8_t key, uint8_t down, uint32_t now) {
+    key_track_t *k = &tracks[key];
+
+    switch (k->state) {
+        case KEY_UP:
+            if (down) {
+                k->state = KEY_PRESSING;
+                k->since = now;
+            }
+            break;
+
+        case KEY_PRESSING:
+            if (!down) {
+                k->state = KEY_UP;
+            } else if (now - k->since >= timing.debounce_ms) {
+                k->state = KEY_DOWN;
+                k->long_sent = 0;
+                k->quiet = k->since - k->last_press < timing.repeat_ms;
+                if (!k->quiet) {
+                    k->last_press = k->since;
+                    Keypad_Post(KEYPAD_EVENT_PRESS, key, k->since);
+                }
+                held |= 1 << key;
+            }
+            break;
+
+        case KEY_DOWN:
+            if (!down) {
+                k->state = KEY_RELEASING;
+                k->since = now;
+            } else if (!k->long_sent && !k->quiet && now - k->last_press >= KEYPAD_LONG_PRESS_MS) {
+                k->long_sent = 1;
+                Keypad_Post(KEYPAD_EVENT_LONG_PRESS, key, now);
+            }
+            break;
+
+        case KEY_RELEASING:
+            if (down) {
+                k->state = KEY_DOWN;
+            } else if (now - k->since >= timing.debounce_ms) {
+                k->state = KEY_UP;
+                held &= ~(1 << key);
+                if (!k->quiet) {
+                    Keypad_Post(KEYPAD_EVENT_RELEASE, key, k->since);
+                }
+            }
+            break;
+    }
+}
+
+// Three keys at the corners of a rectangle also pull the fourth corner's
+// row low, and with no diodes in the matrix the scan cannot tell which
+// one is real: two rows sharing two columns
+static uint8_t Keypad_Ambiguous(uint16_t down) {
+    for (uint8_t r1 = 0; r1 < 3; r1++) {
+        for (uint8_t r2 = r1 + 1; r2 < 4; r2++) {
+            uint8_t shared = (down >> (r1 * 4)) & (down >> (r2 * 4)) & 0xF;
+            if (shared & (shared - 1)) return 1;
+        }
+    }
+    return 0;
+}
+
+// Every column low: any key pulls its row down
+static void Keypad_IdleColumns(void) {
+    KEYPAD_PORT->BSRR = KEYPAD_COL_PINS << 16;
+    REG_SYNC_WRITE(KEYPAD_PORT->BSRR);
+    delay_ns(KEYPAD_SETTLE_NS);
+}
+
+// All keys down, one column at a time
+static uint16_t Keypad_ReadMatrix(void) {
+    uint16_t down = 0;
+
+    for (uint8_t col = 0; col < 4; col++) {
+        uint32_t pin = 1UL << (KEYPAD_COL0_PIN + col);
+
+        // One store: the other columns high, this one low
+        KEYPAD_PORT->BSRR = (KEYPAD_COL_PINS & ~pin) | (pin << 16);
+        REG_SYNC_WRITE(KEYPAD_PORT->BSRR);
+
+        // Let the row lines settle after the column change
+        delay_ns(KEYPAD_SETTLE_NS);
+
+        REG_SYNC_READ(KEYPAD_PORT->IDR);
+        uint32_t rows = ~KEYPAD_PORT->IDR >> KEYPAD_ROW0_PIN;
+        for (uint8_t row = 0; row < 4; row++) {
+            if (rows & (1 << row)) down |= 1 << (row * 4 + col);
+        }
+    }
+
+    Keypad_IdleColumns();
+    return down;
+}
+
+static void Keypad_StartScan(void) {
+    if (scanning) return;
+
+    scanning = 1;
+    KEYPAD_SCAN_TIMER->CNT = 0;
+    KEYPAD_SCAN_TIMER->CR1 |= TIM_CR1_CEN;
+    REG_SYNC_WRITE(KEYPAD_SCAN_TIMER->CR1);
+}
+
+static void Keypad_StopScan(void) {
+    KEYPAD_SCAN_TIMER->CR1 &= ~TIM_CR1_CEN;
+    KEYPAD_SCAN_TIMER->SR = 0;
+    REG_SYNC_WRITE(KEYPAD_SCAN_TIMER->SR);
+    scanning = 0;
+}
+
+// Row lines off until the keys are released; the scan timer takes over
+static void Keypad_Wake(void) {
+    EXTI->IMR &= ~KEYPAD_ROW_LINES;
+    wakeups++;
+    Keypad_StartScan();
+}
+
+// Back to waiting for an edge; a key already down wakes at once
+static void Keypad_Arm(void) {
+    uint32_t primask = irq_save();
+
+    EXTI->PR = KEYPAD_ROW_LINES;
+    REG_SYNC_WRITE(EXTI->PR);
+    EXTI->IMR |= KEYPAD_ROW_LINES;
+    REG_SYNC_WRITE(EXTI->IMR);
+    REG_SYNC_READ(KEYPAD_PORT->IDR);
+    if ((KEYPAD_PORT->IDR & KEYPAD_ROW_LINES) != KEYPAD_ROW_LINES) {
+        Keypad_Wake();
+    }
+    irq_restore(primask);
+}
+
+static void Keypad_Scan(void) {
+    uint16_t down = Keypad_ReadMatrix();
+    uint32_t now = get_tick_count();
+    uint8_t busy = down != 0;
+
+    if (Keypad_Ambiguous(down)) {
+        ghost_scans++;
+        return;
+    }
+    if (monitor) {
+        monitor(down, get_time_us());
+    }
+
+    for (uint8_t key = 0; key < KEYPAD_KEYS; key++) {
+        Keypad_Track(key, (down >> key) & 1, now);
+        if (tracks[key].state != KEY_UP) busy = 1;
+    }
+
+    if (!busy && irq_enabled) {
+        Keypad_StopScan();
+        Keypad_Arm();
+    }
+}
+
+// Rows 8 and 9 share a vector with lines 5-7, 10 and 11 with 12-15; none
+// of the others is in use
+static void Keypad_RowIrq(void) {
+    uint32_t pending = EXTI->PR & KEYPAD_ROW_LINES;
+
+    EXTI->PR = pending;
+    REG_SYNC_WRITE(EXTI->PR);
+    if (pending) {
+        Keypad_Wake();
+    }
+}
+
+void EXTI9_5_IRQHandler(void) {
+    Keypad_RowIrq();
+}
+
+void EXTI15_10_IRQHandler(void) {
+    Keypad_RowIrq();
+}
+
+void TIM5_IRQHandler(void) {
+    KEYPAD_SCAN_TIMER->SR = ~TIM_SR_UIF;
+    REG_SYNC_WRITE(KEYPAD_SCAN_TIMER->SR);
+    Keypad_Scan();
+}
+
+void Keypad_ClockChanged(uint8_t phase) {
+    if (phase == CLOCK_CHANGE_POST) {
+        Clock_SetMicrosecondTimer(KEYPAD_SCAN_TIMER);
+    }
+}
+
+static void Keypad_InitScanTimer(void) {
+    RCC->APB1ENR |= RCC_APB1ENR_TIM5EN;
+
+    KEYPAD_SCAN_TIMER->CR1 = TIM_CR1_URS;
+    KEYPAD_SCAN_TIMER->ARR = scan_period_us - 1;   // Microsecond ticks
+    Clock_SetMicrosecondTimer(KEYPAD_SCAN_TIMER);
+    KEYPAD_SCAN_TIMER->SR = 0;
+    KEYPAD_SCAN_TIMER->DIER = TIM_DIER_UIE;
+    scanning = 0;
+    Clock_RegisterChangeCallback(Keypad_ClockChanged);
+    nvic_enable_irq(TIM5_IRQn);
+}
 
 void Keypad_Init(void) {
     // Enable GPIOD clock
@@ -31,72 +301,90 @@ void Keypad_Init(void) {
     GPIOD->MODER &= ~(0xFF << 24);    // Clear mode bits for PD12-PD15
     GPIOD->MODER |= (0x55 << 24);     // Set output mode for PD12-PD15 (01 = output)
 
-    // Set all columns high initially
-    GPIOD->ODR |= (0xF << 12);
-
     // Initialize keypad state
-    keypad_debounce_counter = 0;
-    last_key = '\0';
-    last_key_time = 0;
+    timing.debounce_ms = KEYPAD_DEBOUNCE_MS;
+    timing.repeat_ms = KEYPAD_REPEAT_MS;
+    memset(tracks, 0, sizeof(tracks));
+    for (uint8_t key = 0; key < KEYPAD_KEYS; key++) {
+        tracks[key].last_press = 0 - (uint32_t)UINT16_MAX;
+    }
+    held = 0;
+    event_head = event_tail = 0;
+
+    Keypad_InitScanTimer();
+    Keypad_EnableInterrupt();
+}
+
+// Debounce and repeat times; Keypad_Init puts the defaults back
+void Keypad_SetTiming(const keypad_timing_t *new_timing) {
+    uint32_t primask = irq_save();
+    timing = *new_timing;
+    irq_restore(primask);
+}
+
+void Keypad_GetTiming(keypad_timing_t *current) {
+    *current = timing;
 }
 
+// Scan period, KEYPAD_SCAN_MS unless calibration needs finer samples
+void Keypad_SetScanPeriod(uint32_t period_us) {
+    scan_period_us = period_us;
+    KEYPAD_SCAN_TIMER->ARR = period_us - 1;
+    KEYPAD_SCAN_TIMER->CNT = 0;
+    REG_SYNC_WRITE(KEYPAD_SCAN_TIMER->CNT);
+}
+
+// `callback` sees every unambiguous scan from interrupt context: the keys
+// down and get_time_us(); NULL to stop
+void Keypad_SetMonitor(keypad_monitor_cb_t callback) {
+    monitor = callback;
+}
+
+// `task_id` is triggered whenever an event is queued; it has to read them
+void Keypad_SetTask(uint8_t task_id) {
+    keypad_task = task_id;
+}
+
+void Keypad_GetStats(keypad_stats_t *stats) {
+    stats->wakeups = wakeups;
+    stats->ghost_scans = ghost_scans;
+    stats->dropped_events = dropped_events;
+}
+
+// Next event, oldest first; 0 when there is none
+uint8_t Keypad_GetEvent(keypad_event_t *event) {
+    uint8_t tail = event_tail;
+
+    if (tail == event_head) return 0;
+
+    event->type = events[tail].type;
+    event->key = events[tail].key;
+    event->time = events[tail].time;
+    event_tail = (tail + 1) & (KEYPAD_EVENT_QUEUE_SIZE - 1);
+    return 1;
+}
+
+// Next key pressed, '\0' when there is none; other events are dropped
 char Keypad_GetKey(void) {
-    static char prev_key = '\0';
-    static uint32_t prev_key_time = 0;
-    char current_key = '\0';
-
-    // Scan all columns
-    for (int col = 0; col < 4; col++) {
-        // Set current column low, others high
-        GPIOD->ODR &= ~(0xF << 12);          // Clear all columns
-        GPIOD->ODR |= (0xF << 12);           // Set all columns high
-        GPIOD->ODR &= ~(1 << (col + 12));    // Set current column low
-
-        // Small delay for settling
-        delay_us(10);
-
-        // Read all rows
-        for (int row = 0; row < 4; row++) {
-            if (!(GPIOD->IDR & (1 << (row + 8)))) {
-                current_key = keypad_matrix[row][col];
-                break;
-            }
-        }
+    keypad_event_t event;
 
-        // If key found, break out of column loop
-        if (current_key != '\0') {
-            break;
+    while (Keypad_GetEvent(&event)) {
+        if (event.type == KEYPAD_EVENT_PRESS) {
+            return event.key;
         }
     }
+    return '\0';
+}
 
-    // Reset all columns to high
-    GPIOD->ODR |= (0xF << 12);
-
-    // Debounce logic
-    if (current_key != '\0') {
-        if (current_key == prev_key) {
-            // Same key pressed - check if debounce time has passed
-            if ((get_tick_count() - prev_key_time) > DEBOUNCE_TIME_MS) {
-                // Check for key repeat
-                if ((get_tick_count() - last_key_time) > KEY_REPEAT_TIME_MS || last_key != current_key) {
-                    last_key = current_key;
-                    last_key_time = get_tick_count();
-                    prev_key_time = get_tick_count();
-                    return current_key;
-                }
-            }
-        } else {
-            // New key pressed
-            prev_key = current_key;
-            prev_key_time = get_tick_count();
-        }
-    } else {
-        // No key pressed
-        prev_key = '\0';
-        prev_key_time = 0;
+// Sleep until the scan queues an event or `deadline`
+static void Keypad_WaitEvent(uint32_t deadline) {
+    uint32_t primask = irq_save();
+    while (event_tail == event_head && !deadline_reached(deadline)) {
+        wait_for_interrupt();
+        irq_restore(primask);
+        primask = irq_save();
     }
-
-    return '\0';
+    irq_restore(primask);
 }
 
 int Keypad_GetPIN(char *buffer, int max_length, uint32_t timeout_ms) {
@@ -145,13 +433,9 @@ int Keypad_GetPIN(char *buffer, int max_length, uint32_t timeout_ms) {
                 // For now, just ignore or provide feedback
                 led_blink(LED_ORANGE, 100, 1);
             }
-
-            // Small delay to prevent key bouncing
-            delay_ms(50);
+        } else {
+            Keypad_WaitEvent(start_time + timeout_ms);
         }
-
-        // Small delay to reduce CPU usage
-        delay_ms(10);
     }
 
     // Buffer full
@@ -199,13 +483,9 @@ int Keypad_GetString(char *buffer, int max_length, uint32_t timeout_ms) {
                     led_blink(LED_BLUE, 50, 1);
                 }
             }
-
-            // Small delay to prevent key bouncing
-            delay_ms(50);
+        } else {
+            Keypad_WaitEvent(start_time + timeout_ms);
         }
-
-        // Small delay to reduce CPU usage
-        delay_ms(10);
     }
 
     // Buffer full
@@ -213,128 +493,109 @@ int Keypad_GetString(char *buffer, int max_length, uint32_t timeout_ms) {
     return length;
 }
 
+// Key at bit `index` of a key mask
+char Keypad_KeyChar(uint8_t index) {
+    return keypad_matrix[(index >> 2) & 3][index & 3];
+}
+
+static uint16_t Keypad_KeyMask(char key) {
+    for (uint8_t row = 0; row < 4; row++) {
+        for (uint8_t col = 0; col < 4; col++) {
+            if (keypad_matrix[row][col] == key) return 1 << (row * 4 + col);
+        }
+    }
+    return 0;
+}
+
 uint8_t Keypad_IsKeyPressed(char expected_key) {
-    char key = Keypad_GetKey();
-    return (key == expected_key);
+    return (held & Keypad_KeyMask(expected_key)) != 0;
 }
 
 uint8_t Keypad_AnyKeyPressed(void) {
-    return (Keypad_GetKey() != '\0');
+    return held != 0;
 }
 
 void Keypad_WaitForRelease(void) {
     while (Keypad_AnyKeyPressed()) {
-        delay_ms(10);
+        delay_ms(KEYPAD_SCAN_MS);
     }
 }
 
+// Every key down as of the last scan, up to max_keys of them
 uint8_t Keypad_GetMultiKey(uint8_t *keys, uint8_t max_keys) {
+    uint16_t down = held;
     uint8_t count = 0;
     memset(keys, 0, max_keys);
 
-    // Scan all columns
-    for (int col = 0; col < 4; col++) {
-        // Set current column low, others high
-        GPIOD->ODR &= ~(0xF << 12);          // Clear all columns
-        GPIOD->ODR |= (0xF << 12);           // Set all columns high
-        GPIOD->ODR &= ~(1 << (col + 12));    // Set current column low
-
-        // Small delay for settling
-        delay_us(10);
-
-        // Read all rows
-        for (int row = 0; row < 4; row++) {
-            if (!(GPIOD->IDR & (1 << (row + 8)))) {
-                if (count < max_keys) {
-                    keys[count++] = keypad_matrix[row][col];
-                }
-            }
+    for (uint8_t key = 0; key < KEYPAD_KEYS && count < max_keys; key++) {
+        if (down & (1 << key)) {
+            keys[count++] = keypad_matrix[key >> 2][key & 3];
         }
     }
 
-    // Reset all columns to high
-    GPIOD->ODR |= (0xF << 12);
-
     return count;
 }
 
 void Keypad_Test(void) {
-    char key;
-    uint32_t last_display_time = 0;
+    static const char *const names[] = {"pressed", "released", "long press"};
+    keypad_event_t event;
 
-    // Test mode - display pressed keys via debug output
+    // Test mode - display key events via debug output
     while (1) {
-        key = Keypad_GetKey();
-
-        if (key != '\0') {
-            // Display key with rate limiting
-            if ((get_tick_count() - last_display_time) > 100) {
-                debug_printf("Key pressed: %c\n", key);
-                last_display_time = get_tick_count();
-
-                // Visual feedback
-                switch (key) {
-                    case '0'...'9':
-                        led_blink(LED_BLUE, 100, 1);
-                        break;
-                    case 'A'...'D':
-                        led_blink(LED_ORANGE, 100, 1);
-                        break;
-                    case '*':
-                    case '#':
-                        led_blink(LED_RED, 100, 1);
-                        break;
-                }
-            }
+        if (!Keypad_GetEvent(&event)) {
+            Keypad_WaitEvent(get_tick_count() + 1000);
+            continue;
         }
 
-        delay_ms(10);
+        debug_printf("Key %c %s at %lu ms\n", event.key, names[event.type],
+                     (unsigned long)event.time);
+        if (event.type != KEYPAD_EVENT_PRESS) continue;
+
+        // Visual feedback
+        switch (event.key) {
+            case '0'...'9':
+                led_blink(LED_BLUE, 100, 1);
+                break;
+            case 'A'...'D':
+                led_blink(LED_ORANGE, 100, 1);
+                break;
+            case '*':
+            case '#':
+                led_blink(LED_RED, 100, 1);
+                break;
+        }
     }
 }
 
-// Advanced keypad scanning with interrupt capability (optional)
+// Falling edges on the row lines PD8-PD11 wake the keypad
 void Keypad_EnableInterrupt(void) {
-    // Configure row pins for interrupt on falling edge
-    // This is optional and requires EXTI configuration
-
-    // Enable SYSCFG clock
     RCC->APB2ENR |= RCC_APB2ENR_SYSCFGEN;
 
-    // Configure EXTI for rows (PD8-PD11)
-    // This would need to be implemented based on specific requirements
+    for (uint8_t pin = KEYPAD_ROW0_PIN; pin <= KEYPAD_ROW3_PIN; pin++) {
+        SYSCFG->EXTICR[pin >> 2] &= ~(0xFUL << SYSCFG_EXTICR_SHIFT(pin));
+        SYSCFG->EXTICR[pin >> 2] |= (uint32_t)SYSCFG_EXTICR_PORTD << SYSCFG_EXTICR_SHIFT(pin);
+    }
+    EXTI->RTSR &= ~KEYPAD_ROW_LINES;
+    EXTI->FTSR |= KEYPAD_ROW_LINES;
+
+    Keypad_IdleColumns();
+    irq_enabled = 1;
+    nvic_enable_irq(EXTI9_5_IRQn);
+    nvic_enable_irq(EXTI15_10_IRQn);
+
+    // A running scan arms the lines itself once the keys are up
+    uint32_t primask = irq_save();
+    if (!scanning) {
+        Keypad_Arm();
+    }
+    irq_restore(primask);
 }
 
+// Scan all the time rather than from a wake-up
 void Keypad_DisableInterrupt(void) {
-    // Disable keypad interrupts
-    // Implementation depends on interrupt configuration
-}
-
-// Keypad calibration function (optional)
-void Keypad_Calibrate(void) {
-    // This function could be used to calibrate keypress detection
-    // thresholds or debounce times based on hardware characteristics
-
-    debug_printf("Keypad calibration started...\n");
-
-    // Simple calibration - measure typical keypress duration
-    uint32_t start_time, end_time;
-    char key;
-
-    while (1) {
-        key = Keypad_GetKey();
-        if (key != '\0') {
-            start_time = get_tick_count();
-            Keypad_WaitForRelease();
-            end_time = get_tick_count();
-
-            debug_printf("Key %c duration: %lu ms\n", key, end_time - start_time);
-
-            if (key == '#') {
-                break; // Exit calibration with # key
-            }
-        }
-        delay_ms(10);
-    }
-
-    debug_printf("Keypad calibration complete.\n");
+    EXTI->IMR &= ~KEYPAD_ROW_LINES;
+    EXTI->PR = KEYPAD_ROW_LINES;
+    REG_SYNC_WRITE(EXTI->PR);
+    irq_enabled = 0;
+    Keypad_StartScan();
 }
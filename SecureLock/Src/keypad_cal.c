@@ -0,0 +1,173 @@
+#include "keypad_cal.h"
+#include "storage.h"
+#include "config.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+
+typedef struct {
+    uint64_t flip;              // Last change of the contact
+    uint64_t edge;              // First change of the press or release under way
+    uint64_t press;             // Start of the last press
+    uint32_t bounce_us;         // Longest press or release
+    uint32_t interval_us;       // Shortest press to press
+    uint16_t presses;
+} key_cal_t;
+
+static key_cal_t keys[16];
+static uint16_t contacts = 0;
+static uint8_t active = 0;
+
+static keypad_cal_record_t cal;
+static uint8_t calibrated = 0;
+
+// Scan interrupt: every change of a contact, chatter included
+static void KeypadCal_Sample(uint16_t down, uint64_t now) {
+    uint16_t changed = down ^ contacts;
+
+    contacts = down;
+    for (uint8_t key = 0; changed; key++, changed >>= 1) {
+        key_cal_t *k = &keys[key];
+
+        if (!(changed & 1)) continue;
+
+        if (k->flip == 0 || now - k->flip >= KEYPAD_CAL_QUIET_MS * 1000ULL) {
+            k->edge = now;
+            if (down & (1 << key)) {
+                if (k->presses && now - k->press < k->interval_us) {
+                    k->interval_us = (uint32_t)(now - k->press);
+                }
+                k->press = now;
+                k->presses++;
+            }
+        } else if (now - k->edge > k->bounce_us) {
+            k->bounce_us = (uint32_t)(now - k->edge);
+        }
+        k->flip = now;
+    }
+}
+
+// Back to normal scanning
+static void KeypadCal_End(void) {
+    Keypad_SetMonitor(NULL);
+    Keypad_SetScanPeriod(KEYPAD_SCAN_MS * 1000UL);
+    Keypad_EnableInterrupt();
+    active = 0;
+}
+
+// Timings from the statistics; 0 with too few presses to go by
+static uint8_t KeypadCal_Derive(keypad_cal_record_t *result) {
+    uint32_t bounce_us = 0;
+    uint32_t interval_us = UINT32_MAX;
+    uint32_t debounce_ms;
+    uint32_t repeat_ms = KEYPAD_REPEAT_MS;
+
+    memset(result, 0, sizeof(*result));
+    result->worst_key = '-';
+    for (uint8_t key = 0; key < 16; key++) {
+        if (keys[key].presses == 0) continue;
+
+        result->keys++;
+        result->presses += keys[key].presses;
+        if (keys[key].bounce_us > bounce_us) {
+            bounce_us = keys[key].bounce_us;
+            result->worst_key = Keypad_KeyChar(key);
+        }
+        if (keys[key].presses > 1 && keys[key].interval_us < interval_us) {
+            interval_us = keys[key].interval_us;
+        }
+    }
+    if (result->presses < KEYPAD_CAL_MIN_PRESSES) return 0;
+
+    debounce_ms = (bounce_us * KEYPAD_CAL_MARGIN + 999) / 1000;
+    if (debounce_ms < KEYPAD_DEBOUNCE_MIN_MS) debounce_ms = KEYPAD_DEBOUNCE_MIN_MS;
+    if (debounce_ms > KEYPAD_DEBOUNCE_MAX_MS) debounce_ms = KEYPAD_DEBOUNCE_MAX_MS;
+
+    if (interval_us != UINT32_MAX) {
+        result->interval_ms = (uint16_t)(interval_us / 1000);
+        if (result->interval_ms / 2 < repeat_ms) repeat_ms = result->interval_ms / 2;
+    }
+    if (repeat_ms < 2 * debounce_ms) repeat_ms = 2 * debounce_ms;
+
+    result->timing.debounce_ms = (uint16_t)debounce_ms;
+    result->timing.repeat_ms = (uint16_t)repeat_ms;
+    result->bounce_us = (uint16_t)(bounce_us < UINT16_MAX ? bounce_us : UINT16_MAX);
+    return 1;
+}
+
+// Stored timings, if any, replace the defaults; after Keypad_Init
+void KeypadCal_Init(void) {
+    active = 0;
+    calibrated = Storage_Load(STORAGE_ID_KEYPAD_CAL, &cal, sizeof(cal));
+    if (calibrated) {
+        Keypad_SetTiming(&cal.timing);
+    }
+}
+
+// Keys keep working with the timings in use until the result is in
+void KeypadCal_Start(void) {
+    if (active) return;
+
+    memset(keys, 0, sizeof(keys));
+    for (uint8_t key = 0; key < 16; key++) {
+        keys[key].interval_us = UINT32_MAX;
+    }
+    contacts = 0;
+    active = 1;
+
+    // Sample all the time, wake-up or not
+    Keypad_DisableInterrupt();
+    Keypad_SetScanPeriod(KEYPAD_CAL_SCAN_US);
+    Keypad_SetMonitor(KeypadCal_Sample);
+}
+
+// Abandon a calibration; the timings stay as they were
+void KeypadCal_Stop(void) {
+    if (active) {
+        KeypadCal_End();
+    }
+}
+
+uint8_t KeypadCal_IsActive(void) {
+    return active;
+}
+
+// Key events while calibrating; a long press on '#' ends it
+keypad_cal_status_t KeypadCal_Event(const keypad_event_t *event) {
+    keypad_cal_record_t result;
+
+    if (!active || event->type != KEYPAD_EVENT_LONG_PRESS || event->key != KEYPAD_ENTER) {
+        return KEYPAD_CAL_RUNNING;
+    }
+
+    KeypadCal_End();
+    if (!KeypadCal_Derive(&result)) {
+        return KEYPAD_CAL_FAILED;
+    }
+
+    cal = result;
+    calibrated = 1;
+    Keypad_SetTiming(&cal.timing);
+    if (!Storage_Save(STORAGE_ID_KEYPAD_CAL, &cal, sizeof(cal))) {
+        LOG_WARNING("Keypad calibration not stored\n");
+    }
+    return KEYPAD_CAL_DONE;
+}
+
+// Timings in use and the statistics behind them, for the KEYPAD command
+int KeypadCal_Format(char *buffer, size_t size) {
+    keypad_timing_t timing;
+
+    Keypad_GetTiming(&timing);
+    int len = snprintf(buffer, size, "Debounce: %ums, Repeat: %ums, ",
+                       timing.debounce_ms, timing.repeat_ms);
+    if (len < 0 || (size_t)len >= size) return len;
+
+    if (!calibrated) {
+        return len + snprintf(buffer + len, size - len, "Cal: none");
+    }
+    return len + snprintf(buffer + len, size - len,
+                          "Cal: bounce %u.%ums (%c), re-press %ums, %u presses on %u keys",
+                          cal.bounce_us / 1000, (cal.bounce_us % 1000) / 100, cal.worst_key,
+                          cal.interval_ms, cal.presses, cal.keys);
+}
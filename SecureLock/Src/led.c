@@ -0,0 +1,170 @@
+#include "led.h"
+#include "utils.h"
+#include <string.h>
+
+typedef struct {
+    uint16_t on_ms;
+    uint16_t off_ms;
+    uint8_t count;              // Cycles left, LED_REPEAT_FOREVER = until stopped
+} led_pattern_t;
+
+typedef struct {
+    led_pattern_t queue[LED_PRIORITY_LEVELS][LED_QUEUE_DEPTH];
+    uint8_t head[LED_PRIORITY_LEVELS];
+    uint8_t length[LED_PRIORITY_LEVELS];
+    int8_t active_level;        // -1 when no pattern is playing
+    uint8_t phase_on;
+    uint8_t base_on;            // State shown between patterns
+    uint64_t next_change;
+} led_channel_t;
+
+static led_channel_t channels[LED_COUNT];
+
+static int8_t LED_HighestLevel(const led_channel_t *ch) {
+    for (int8_t level = LED_PRIORITY_LEVELS - 1; level >= 0; level--) {
+        if (ch->length[level]) return level;
+    }
+    return -1;
+}
+
+static void LED_ApplyBase(uint8_t led, led_channel_t *ch) {
+    ch->active_level = -1;
+    ch->next_change = UINT64_MAX;
+    if (ch->base_on) led_on(led);
+    else led_off(led);
+}
+
+static void LED_StartPattern(uint8_t led, led_channel_t *ch, int8_t level, uint64_t now) {
+    const led_pattern_t *pattern = &ch->queue[level][ch->head[level]];
+
+    ch->active_level = level;
+    ch->phase_on = 1;
+    ch->next_change = now + pattern->on_ms;
+    led_on(led);
+}
+
+static void LED_Pop(led_channel_t *ch, int8_t level) {
+    ch->head[level] = (ch->head[level] + 1) % LED_QUEUE_DEPTH;
+    ch->length[level]--;
+}
+
+// Re-evaluate one LED: switch to a higher-priority pattern, advance the
+// current one, or fall back to the base state
+static void LED_Service(uint8_t led, uint64_t now) {
+    led_channel_t *ch = &channels[led];
+    int8_t level = LED_HighestLevel(ch);
+
+    if (level != ch->active_level) {
+        if (level < 0) LED_ApplyBase(led, ch);
+        else LED_StartPattern(led, ch, level, now);
+        return;
+    }
+
+    if (level < 0 || now < ch->next_change) return;
+
+    led_pattern_t *pattern = &ch->queue[level][ch->head[level]];
+    if (ch->phase_on) {
+        ch->phase_on = 0;
+        ch->next_change = now + pattern->off_ms;
+        led_off(led);
+        return;
+    }
+
+    // One on/off cycle complete
+    if (pattern->count != LED_REPEAT_FOREVER && --pattern->count == 0) {
+        LED_Pop(ch, level);
+        level = LED_HighestLevel(ch);
+        if (level < 0) LED_ApplyBase(led, ch);
+        else LED_StartPattern(led, ch, level, now);
+        return;
+    }
+
+    ch->phase_on = 1;
+    ch->next_change = now + pattern->on_ms;
+    led_on(led);
+}
+
+void LED_Init(void) {
+    memset(channels, 0, sizeof(channels));
+    for (uint8_t led = 0; led < LED_COUNT; led++) {
+        LED_ApplyBase(led, &channels[led]);
+    }
+}
+
+uint8_t LED_Play(uint8_t led, uint16_t on_ms, uint16_t off_ms, uint8_t count,
+                 led_priority_t priority) {
+    if (led >= LED_COUNT || priority >= LED_PRIORITY_LEVELS) return 0;
+
+    uint32_t primask = irq_save();
+    led_channel_t *ch = &channels[led];
+
+    if (ch->length[priority] >= LED_QUEUE_DEPTH) {
+        irq_restore(primask);
+        return 0;
+    }
+
+    uint8_t slot = (ch->head[priority] + ch->length[priority]) % LED_QUEUE_DEPTH;
+    ch->queue[priority][slot].on_ms = on_ms;
+    ch->queue[priority][slot].off_ms = off_ms;
+    ch->queue[priority][slot].count = count;
+    ch->length[priority]++;
+
+    LED_Service(led, get_tick_count64());
+    irq_restore(primask);
+    return 1;
+}
+
+void LED_Stop(uint8_t led, led_priority_t priority) {
+    if (led >= LED_COUNT || priority >= LED_PRIORITY_LEVELS) return;
+
+    uint32_t primask = irq_save();
+    channels[led].length[priority] = 0;
+    if (channels[led].active_level == (int8_t)priority) {
+        // Show the base state, then restart whatever is left underneath
+        LED_ApplyBase(led, &channels[led]);
+    }
+    LED_Service(led, get_tick_count64());
+    irq_restore(primask);
+}
+
+void LED_StopAll(uint8_t led) {
+    for (uint8_t level = 0; level < LED_PRIORITY_LEVELS; level++) {
+        LED_Stop(led, level);
+    }
+}
+
+void LED_SetBase(uint8_t led, uint8_t on) {
+    if (led >= LED_COUNT) return;
+
+    uint32_t primask = irq_save();
+    channels[led].base_on = on;
+    if (channels[led].active_level < 0) {
+        LED_ApplyBase(led, &channels[led]);
+    }
+    irq_restore(primask);
+}
+
+uint8_t LED_IsBusy(uint8_t led) {
+    return (led < LED_COUNT) && channels[led].active_level >= 0;
+}
+
+void LED_Tick(uint64_t now) {
+    for (uint8_t led = 0; led < LED_COUNT; led++) {
+        if (now >= channels[led].next_change) {
+            LED_Service(led, now);
+        }
+    }
+}
+
+uint64_t LED_NextDeadline(void) {
+    uint64_t next = UINT64_MAX;
+
+    uint32_t primask = irq_save();
+    for (uint8_t led = 0; led < LED_COUNT; led++) {
+        if (channels[led].next_change < next) {
+            next = channels[led].next_change;
+        }
+    }
+    irq_restore(primask);
+    return next;
+}
@@ -3,8 +3,18 @@
 #include "config.h"
 #include "secure_lock.h"
 #include "keypad.h"
+#include "keypad_cal.h"
 #include "rfid.h"
+#include "rfid_poll.h"
+#include "rfid_cal.h"
+#include "rfid_health.h"
+#include "storage.h"
 #include "wifi.h"
+#include "scheduler.h"
+#include "led.h"
+#include "clock.h"
+#include "profile.h"
+#include "trace.h"
 #include "utils.h"
 #include <stdio.h>
 
@@ -17,9 +27,13 @@ static uint8_t maintenance_mode = 0;
 void SystemClock_Config(void);
 void GPIO_Init(void);
 void System_Init(void);
+void System_RegisterTasks(void);
 void System_Run(void);
 void System_HandleEvents(void);
 void System_ProcessCommands(void);
+void System_SendTaskStats(void);
+void System_CheckRfid(void);
+void System_SendProfile(void);
 void System_Heartbeat(void);
 void System_ErrorHandler(error_code_t error);
 void Enter_MaintenanceMode(void);
@@ -43,7 +57,7 @@ int main(void) {
 
     LOG_INFO("SecureLock System Started\n");
     LOG_INFO("Firmware Version: %s\n", SECURELOCK_VERSION);
-    LOG_INFO("System Clock: %lu Hz\n", SYSTEM_CLOCK_FREQ);
+    LOG_INFO("System Clock: %lu Hz\n", (unsigned long)SystemCoreClock);
 
     // Main application loop
     while (1) {
@@ -55,8 +69,28 @@ void System_Init(void) {
     // Configure system clock
     SystemClock_Config();
 
+    // Start the millisecond time base and the cycle counter used for delays
+    SysTick_Init(SystemCoreClock / SYSTICK_FREQ);
+    DWT_Init();
+#if TRACE_ENABLED
+    Trace_Init();
+#endif
+    Scheduler_Init();
+
+#if DELAY_SELFTEST_ENABLED
+    if (!delay_selftest()) {
+        LOG_WARNING("Delay self-calibration out of tolerance\n");
+    }
+#endif
+
     // Initialize GPIO
     GPIO_Init();
+    LED_Init();
+
+    // Stored settings before the drivers that apply them
+    if (!Storage_Init()) {
+        LOG_WARNING("Settings storage unavailable\n");
+    }
 
     // Initialize peripherals
     Keypad_Init();
@@ -76,6 +110,12 @@ void System_Init(void) {
     // Copy default AES key
     memcpy(system_config.aes_key, default_aes_key, AES_KEY_SIZE);
 
+    // Register periodic tasks
+    System_RegisterTasks();
+
+    // Drop to the idle clock profile; crypto bursts raise it on demand
+    Clock_SetIdleProfile(CLOCK_IDLE_PROFILE);
+
     LOG_INFO("System initialization complete\n");
 
     // Visual boot complete indication
@@ -84,16 +124,17 @@ void System_Init(void) {
 }
 
 void SystemClock_Config(void) {
-    // Enable HSI (16MHz internal oscillator)
-    RCC->CR |= (1 << 0); // HSION
-    while (!(RCC->CR & (1 << 1))); // Wait for HSIRDY
-
-    // Use HSI as system clock
-    RCC->CFGR &= ~(3 << 0); // Clear SW bits
-    RCC->CFGR |= (0 << 0);  // Select HSI as system clock
-    while ((RCC->CFGR & (3 << 2)) != (0 << 2)); // Wait for HSI
+#if CLOCK_PLL_ENABLED
+    // PLL with flash wait states, prefetch and ART caches set for the target
+    if (!Clock_ConfigurePLL(CLOCK_PLL_SOURCE, SYSTEM_CLOCK_FREQ)) {
+        LOG_WARNING("PLL source unavailable, running from HSI\n");
+    }
+#else
+    // Use HSI (16MHz internal oscillator) as system clock
+    Clock_ConfigureHSI();
+#endif
 
-    LOG_DEBUG("System clock configured to 16MHz HSI\n");
+    LOG_DEBUG("System clock configured to %lu Hz\n", (unsigned long)SystemCoreClock);
 }
 
 void GPIO_Init(void) {
@@ -121,39 +162,54 @@ void GPIO_Init(void) {
     LOG_DEBUG("GPIO initialization complete\n");
 }
 
-void System_Run(void) {
-    // System heartbeat
-    System_Heartbeat();
-
-    // Process any incoming commands
-    System_ProcessCommands();
-
-    // Check for maintenance mode trigger
-    Check_MaintenanceModeTrigger();
-
-    // Run the main security state machine
-    SecureLock_Run();
+void System_RegisterTasks(void) {
+    // Card and key handling first, so a tap is never queued behind logging
+    uint8_t rfid_task = Scheduler_AddTask("rfid", SecureLock_ServiceRFID,
+                                          TASK_RFID_PERIOD_MS, 0, TASK_PRIORITY_HIGH);
+    RfidPoll_Init(rfid_task);
+    RfidCal_SetTask(rfid_task);
+    // Keypad: run when the scan timer queues a key event (keypad.c)
+    Keypad_SetTask(Scheduler_AddTask("keypad", SecureLock_ServiceKeypad,
+                                     0, TASK_KEYPAD_PERIOD_MS, TASK_PRIORITY_HIGH));
+    Scheduler_AddTask("session", SecureLock_ServiceTimeouts,
+                      TASK_SESSION_PERIOD_MS, 0, TASK_PRIORITY_NORMAL);
+    Scheduler_AddTask("wifi", System_ProcessCommands,
+                      TASK_WIFI_PERIOD_MS, 0, TASK_PRIORITY_NORMAL);
+    Scheduler_AddTask("rfid_health", System_CheckRfid,
+                      TASK_RFID_HEALTH_PERIOD_MS, 0, TASK_PRIORITY_LOW);
+    Scheduler_AddTask("button", Check_MaintenanceModeTrigger,
+                      TASK_BUTTON_PERIOD_MS, 0, TASK_PRIORITY_LOW);
+    Scheduler_AddTask("heartbeat", System_Heartbeat,
+                      TASK_HEARTBEAT_PERIOD_MS, 0, TASK_PRIORITY_LOW);
+}
 
-    // Small delay to prevent CPU hogging
-    delay_ms(10);
+void System_Run(void) {
+    // Run every task whose release time has passed
+    Scheduler_RunPending();
+
+    // Sleep until the next task is due or an LED pattern needs to step
+    uint64_t wake_time = get_tick_count64() + SYSTEM_MAX_IDLE_MS;
+    uint64_t next_release = Scheduler_NextRelease();
+    uint64_t next_led = LED_NextDeadline();
+    if (next_release < wake_time) wake_time = next_release;
+    if (next_led < wake_time) wake_time = next_led;
+    tick_idle_until(wake_time);
 }
 
 void System_Heartbeat(void) {
-    static uint32_t last_heartbeat = 0;
-    uint32_t current_time = get_tick_count();
+    system_heartbeat++;
 
-    if (current_time - last_heartbeat >= 1000) {
-        system_heartbeat++;
-        last_heartbeat = current_time;
+#if TRACE_ENABLED
+    Trace_Sync(system_heartbeat);
+#endif
 
-        // Periodic system tasks
-        if (system_heartbeat % 10 == 0) {
-            LOG_DEBUG("System heartbeat: %lu\n", system_heartbeat);
+    // Periodic system tasks
+    if (system_heartbeat % 10 == 0) {
+        LOG_DEBUG("System heartbeat: %lu\n", (unsigned long)system_heartbeat);
 
-            // Send periodic status update if WiFi connected
-            if (WIFI_IsConnected()) {
-                WIFI_SendLog("System heartbeat OK");
-            }
+        // Send periodic status update if WiFi connected
+        if (WIFI_IsConnected()) {
+            WIFI_SendLog("System heartbeat OK");
         }
     }
 }
@@ -161,19 +217,89 @@ void System_Heartbeat(void) {
 void System_ProcessCommands(void) {
     char command[32];
 
+    // Queued logs go out from here, a step per module response
+    WIFI_Service();
+
     if (WIFI_HasCommand()) {
         WIFI_GetCommand(command, sizeof(command));
         LOG_DEBUG("Received command: %s\n", command);
+#if TRACE_ENABLED
+        // First three characters, zero past the end of a shorter command
+        uint8_t tag[3] = {0};
+        for (uint8_t i = 0; i < sizeof(tag) && command[i] != '\0'; i++) {
+            tag[i] = (uint8_t)command[i];
+        }
+        TRACE(TRACE_EV_UART_CMD, tag[0], tag[1] | (tag[2] << 8));
+#endif
 
         if (strcmp(command, "UNLOCK") == 0 && REMOTE_UNLOCK_ENABLED) {
             SecureLock_RemoteUnlock();
         } else if (strcmp(command, "STATUS") == 0) {
             // Send system status
-            char status[128];
+            char status[224];
+            rfid_poll_stats_t poll;
+            RfidPoll_GetStats(&poll);
             snprintf(status, sizeof(status),
-                    "Uptime: %lus, Failures: %d",
-                    system_heartbeat, SecureLock_GetFailedAttempts());
+                    "Uptime: %lus, Failures: %d, Lock: %s, Perf: %lums, LowPower: %lums, Switches: %lu, "
+                    "RFID SPI: %lu @ %lukHz, Rejected: %lukHz, Probes: %lu, Hits: %lu, Latency: %lums, Poll: %lums, RF: %lu.%lu%%",
+                    (unsigned long)system_heartbeat, SecureLock_GetFailedAttempts(),
+                    SecureLock_IsUnlocked() ? "OPEN" : "CLOSED",
+                    (unsigned long)Clock_GetProfileTime(CLOCK_PROFILE_PERFORMANCE),
+                    (unsigned long)Clock_GetProfileTime(CLOCK_PROFILE_LOW_POWER),
+                    (unsigned long)Clock_GetSwitchCount(),
+                    (unsigned long)RFID_GetSpiTransactions(),
+                    (unsigned long)(RFID_GetSpiClock() / 1000),
+                    (unsigned long)(RFID_GetSpiRejectedClock() / 1000),
+                    (unsigned long)poll.probes, (unsigned long)poll.hits,
+                    (unsigned long)poll.latency_avg_ms, (unsigned long)poll.interval_ms,
+                    (unsigned long)(poll.duty_permille / 10),
+                    (unsigned long)(poll.duty_permille % 10));
             WIFI_SendLog(status);
+        } else if (strcmp(command, "PROFILE") == 0) {
+            System_SendProfile();
+        } else if (strcmp(command, "TASKS") == 0) {
+            System_SendTaskStats();
+        } else if (strcmp(command, "RFID") == 0) {
+            char line[192];
+            rfid_health_stats_t health;
+            RfidHealth_GetStats(&health);
+            int len = RfidCal_Format(line, sizeof(line));
+            if (len < 0 || (size_t)len >= sizeof(line)) len = 0;
+            snprintf(line + len, sizeof(line) - len,
+                     ", Faults: %lu, Errors: %lu, Checks: %lu, Failures: %lu, Recoveries: %lu%s",
+                     (unsigned long)health.faults, (unsigned long)health.errors,
+                     (unsigned long)health.checks, (unsigned long)health.failures,
+                     (unsigned long)health.recoveries, health.down ? ", DOWN" : "");
+            WIFI_SendLog(line);
+        } else if (strcmp(command, "KEYPAD") == 0) {
+            char line[192];
+            keypad_stats_t keypad;
+            Keypad_GetStats(&keypad);
+            int len = snprintf(line, sizeof(line), "Keypad wake-ups: %lu, Ghost scans: %lu, Dropped events: %lu, ",
+                               (unsigned long)keypad.wakeups, (unsigned long)keypad.ghost_scans,
+                               (unsigned long)keypad.dropped_events);
+            if (len < 0 || (size_t)len >= sizeof(line)) len = 0;
+            KeypadCal_Format(line + len, sizeof(line) - len);
+            WIFI_SendLog(line);
+        } else if (strcmp(command, "KEYCAL") == 0) {
+            // Needs someone at the keypad, so only on site
+            if (!maintenance_mode) {
+                WIFI_SendLog("KEYCAL needs maintenance mode");
+            } else {
+                KeypadCal_Start();
+                WIFI_SendLog("Keypad calibration: tap every key a few times, then hold #");
+            }
+        } else if (strcmp(command, "CALIBRATE") == 0) {
+            // Needs a card resting on the reader, so only on site
+            if (!maintenance_mode) {
+                WIFI_SendLog("CALIBRATE needs maintenance mode");
+            } else if (!RfidCal_Start()) {
+                WIFI_SendLog("RF calibration already running");
+            }
+#if TRACE_ENABLED
+        } else if (strcmp(command, "TRACE") == 0) {
+            Trace_Dump();
+#endif
         } else if (strcmp(command, "REBOOT") == 0) {
             system_reset();
         } else {
@@ -182,6 +308,43 @@ void System_ProcessCommands(void) {
     }
 }
 
+// A failed reader is reported once; the monitor keeps retrying quietly
+void System_CheckRfid(void) {
+    if (RfidHealth_Service()) {
+        System_ErrorHandler(ERROR_RFID_COMM);
+    }
+}
+
+void System_SendTaskStats(void) {
+    char line[96];
+
+    // One log line per task: run time, worst latency and deadline misses
+    for (uint8_t i = 0; i < Scheduler_GetTaskCount(); i++) {
+        if (Scheduler_FormatStats(i, line, sizeof(line)) > 0) {
+            WIFI_SendLog(line);
+        }
+    }
+    Scheduler_ResetStats();
+}
+
+void System_SendProfile(void) {
+#if PROFILING_ENABLED
+    char line[192];
+
+    // Snapshot first so the sends below are not measured into the dump
+    static profile_stats_t snapshot[PROF_PROBE_COUNT];
+    Profile_Snapshot(snapshot);
+
+    for (uint8_t i = 0; i < PROF_PROBE_COUNT; i++) {
+        if (Profile_Format(i, &snapshot[i], line, sizeof(line)) > 0) {
+            WIFI_SendLog(line);
+        }
+    }
+#else
+    WIFI_SendLog("Profiling disabled");
+#endif
+}
+
 void Check_MaintenanceModeTrigger(void) {
     static uint32_t button_press_time = 0;
     static uint8_t button_was_pressed = 0;
@@ -215,6 +378,7 @@ void Enter_MaintenanceMode(void) {
 
 void Exit_MaintenanceMode(void) {
     maintenance_mode = 0;
+    KeypadCal_Stop();
     LOG_INFO("Exiting maintenance mode\n");
 
     // Visual indication
@@ -223,6 +387,7 @@ void Exit_MaintenanceMode(void) {
 
 void System_ErrorHandler(error_code_t error) {
     system_config.last_error = error;
+    TRACE(TRACE_EV_ERROR, error, 0);
 
     LOG_ERROR("System error: %d\n", error);
 
@@ -233,8 +398,8 @@ void System_ErrorHandler(error_code_t error) {
         WIFI_SendLog(error_msg);
     }
 
-    // Blink red LED to indicate error
-    led_blink(LED_RED, 200, 10);
+    // Blink red LED to indicate error, pre-empting any status pattern
+    LED_Play(LED_RED, 200, 200, 10, LED_PRIORITY_ERROR);
 }
 
 // System reset handler
@@ -280,12 +445,6 @@ __attribute__((weak)) void PendSV_Handler(void) {
     // Pendable service handler
 }
 
-__attribute__((weak)) void SysTick_Handler(void) {
-    // Systick interrupt handler
-    static uint32_t tick_count = 0;
-    tick_count++;
-}
-
 // Default interrupt handler
 __attribute__((weak)) void Default_Handler(void) {
     while (1);
@@ -0,0 +1,100 @@
+#include "pin_entry.h"
+#include "config.h"
+#include "sha256.h"
+#include "utils.h"
+
+// prefix[i]: the salt and the first i digits
+static SHA256_CTX prefix[MAX_PIN_LENGTH + 1];
+static uint8_t length = 0;
+static uint8_t active = 0;
+static uint32_t started = 0;
+static uint32_t last_key = 0;
+
+// Back to the salt alone
+static void PinEntry_Restart(void) {
+    secure_wipe(&prefix[1], sizeof(prefix) - sizeof(prefix[0]));
+    length = 0;
+}
+
+// A new session; anything typed before is dropped
+void PinEntry_Start(const uint8_t *salt) {
+    sha256_init(&prefix[0]);
+    sha256_update(&prefix[0], salt, PIN_SALT_SIZE);
+    PinEntry_Restart();
+
+    active = 1;
+    started = get_tick_count();
+    last_key = started;
+}
+
+// Ends the entry and wipes what was typed
+void PinEntry_Clear(void) {
+    secure_wipe(prefix, sizeof(prefix));
+    length = 0;
+    active = 0;
+}
+
+pin_entry_result_t PinEntry_Feed(char key) {
+    if (!active) return PIN_ENTRY_INACTIVE;
+
+    last_key = get_tick_count();
+
+    if (key >= '0' && key <= '9') {
+        uint8_t digit = (uint8_t)key;
+
+        if (length >= MAX_PIN_LENGTH) return PIN_ENTRY_IGNORED;
+        prefix[length + 1] = prefix[length];
+        sha256_update(&prefix[length + 1], &digit, 1);
+        length++;
+        return PIN_ENTRY_DIGIT;
+    }
+
+    if (key == '*') {
+        if (length == 0) return PIN_ENTRY_IGNORED;
+        secure_wipe(&prefix[length], sizeof(prefix[0]));
+        length--;
+        return PIN_ENTRY_ERASED;
+    }
+
+    if (key == '#') {
+        if (!IS_VALID_PIN_LENGTH(length)) {
+            PinEntry_Restart();
+            return PIN_ENTRY_TOO_SHORT;
+        }
+        return PIN_ENTRY_SUBMIT;
+    }
+
+    return PIN_ENTRY_IGNORED;
+}
+
+// 1 when the digits typed hash, after the salt, to `pin_hash`
+uint8_t PinEntry_Verify(const uint8_t *pin_hash) {
+    SHA256_CTX ctx = prefix[length];
+    uint8_t digest[32];
+    uint8_t match;
+
+    if (!active) return 0;
+
+    // One or two compressions; a clock burst would take as long starting the PLL
+    sha256_final(&ctx, digest);
+
+    match = secure_memeq(digest, pin_hash, sizeof(digest));
+    secure_wipe(&ctx, sizeof(ctx));
+    secure_wipe(digest, sizeof(digest));
+    return match;
+}
+
+uint8_t PinEntry_IsActive(void) {
+    return active;
+}
+
+uint8_t PinEntry_Expired(void) {
+    if (!active) return 0;
+
+    return deadline_reached(last_key + PIN_KEY_TIMEOUT_MS) ||
+           deadline_reached(started + PIN_ENTRY_TIMEOUT_MS);
+}
+
+uint8_t PinEntry_GetLength(void) {
+    return length;
+}
@@ -0,0 +1,82 @@
+#include "profile.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+
+#if PROFILING_ENABLED
+
+static const char *const probe_names[PROF_PROBE_COUNT] = {
+    "lock_rfid",
+    "lock_keypad",
+    "lock_session",
+    "rfid_transceive",
+    "sha256_transform",
+    "log_access",
+    "wifi_send_command",
+    "trace_record_pll",
+    "trace_record_hsi"
+};
+
+static profile_stats_t probes[PROF_PROBE_COUNT];
+
+// Also called from interrupts (the card check ends in one), so the update
+// is masked against a recording ISR and against Profile_Snapshot
+void Profile_Record(uint8_t probe, uint32_t cycles) {
+    if (probe >= PROF_PROBE_COUNT) return;
+
+    uint32_t bucket = cycles ? 31 - __builtin_clz(cycles) : 0;
+    if (bucket >= PROFILE_HISTOGRAM_BUCKETS) bucket = PROFILE_HISTOGRAM_BUCKETS - 1;
+
+    profile_stats_t *stats = &probes[probe];
+    uint32_t primask = irq_save();
+    if (stats->count == 0 || cycles < stats->min_cycles) stats->min_cycles = cycles;
+    if (cycles > stats->max_cycles) stats->max_cycles = cycles;
+    stats->count++;
+    stats->total_cycles += cycles;
+    stats->histogram[bucket]++;
+    irq_restore(primask);
+}
+
+void Profile_Reset(void) {
+    uint32_t primask = irq_save();
+    memset(probes, 0, sizeof(probes));
+    irq_restore(primask);
+}
+
+// Every probe copied into `snapshot` (PROF_PROBE_COUNT entries) and reset
+// in one step, so no sample is torn or lost in between
+void Profile_Snapshot(profile_stats_t *snapshot) {
+    uint32_t primask = irq_save();
+    memcpy(snapshot, probes, sizeof(probes));
+    memset(probes, 0, sizeof(probes));
+    irq_restore(primask);
+}
+
+const profile_stats_t *Profile_GetStats(uint8_t probe) {
+    return (probe < PROF_PROBE_COUNT) ? &probes[probe] : NULL;
+}
+
+const char *Profile_GetName(uint8_t probe) {
+    return (probe < PROF_PROBE_COUNT) ? probe_names[probe] : "?";
+}
+
+// "name n=.. min=.. avg=.. max=.. h=bucket:count,..." with only the
+// non-empty histogram buckets listed. stats may be a snapshot of the probe.
+int Profile_Format(uint8_t probe, const profile_stats_t *stats, char *buffer, size_t size) {
+    if (probe >= PROF_PROBE_COUNT || stats == NULL || size == 0) return 0;
+
+    uint32_t avg = stats->count ? (uint32_t)(stats->total_cycles / stats->count) : 0;
+    int len = snprintf(buffer, size, "%s n=%lu min=%lu avg=%lu max=%lu h=",
+                       probe_names[probe], (unsigned long)stats->count,
+                       (unsigned long)stats->min_cycles, (unsigned long)avg,
+                       (unsigned long)stats->max_cycles);
+
+    for (uint8_t i = 0; i < PROFILE_HISTOGRAM_BUCKETS && len > 0 && (size_t)len < size; i++) {
+        if (stats->histogram[i] == 0) continue;
+        len += snprintf(buffer + len, size - len, "%u:%lu,", i,
+                        (unsigned long)stats->histogram[i]);
+    }
+    return len;
+}
+
+#endif // PROFILING_ENABLED
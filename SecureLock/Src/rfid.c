@@ -1,8 +1,31 @@
 #include "rfid.h"
 #include "stm32f407xx_registers.h"
+#include "config.h"
+#include "clock.h"
+#include "crc.h"
+#include "spi_dma.h"
+#include "profile.h"
+#include "trace.h"
 #include "utils.h"
 #include <string.h>
 
+static void RFID_InitGuardTimer(void);
+static void RFID_InitIrq(void);
+
+#define MFRC522_TX_CRC_EN          0x80    // TxModeReg
+#define MFRC522_MOD_WIDTH_RESET    0x26
+#define RFID_T_MODE                0x8D    // TAuto, prescaler high nibble
+#define RFID_COM_IEN               (MFRC522_COMIEN_IRQ_INV | RFID_COM_IRQS)
+
+static uint8_t tx_mode = 0x00;         // Last TxModeReg value written
+static uint8_t tx_control = 0x00;      // Last TxControlReg value written
+static rfid_rf_config_t rf_config = RFID_RF_CONFIG_DEFAULT;
+static uint32_t spi_max_hz = RFID_SPI_CLOCK_HZ;    // Fastest SPI clock the link passed
+static uint32_t spi_rejected_hz = 0;    // Slowest clock that failed, 0 if none did
+
+static void RFID_TuneSpiClock(void);
+static void RFID_ResetChip(void);
+
 void RFID_Init(void) {
     // Enable SPI1 clock
     RCC->APB2ENR |= (1 << 12); // SPI1EN
@@ -21,240 +44,971 @@ void RFID_Init(void) {
     GPIOE->ODR |= (1 << 3); // SS high initially
     GPIOE->ODR |= (1 << 2); // RST high
 
-    // Configure SPI1
-    SPI1->CR1 = (1 << 2) | (1 << 1) | (1 << 0); // BR[2:0] = 011 (fPCLK/16)
-    SPI1->CR1 |= (1 << 9) | (1 << 8);           // SSM=1, SSI=1
-    SPI1->CR1 |= (1 << 6);                      // SPI enable
+    // Configure SPI1: master, mode 0, software slave select
+    SPI1->CR1 = SPI_CR1_MSTR | SPI_CR1_SSM | SPI_CR1_SSI;
+    RFID_UpdateSpiClock();
+    SPI1->CR1 |= SPI_CR1_SPE;                   // SPI enable
+    SpiDma_Init();
+    RFID_InitGuardTimer();
+    RFID_InitIrq();
+    Clock_RegisterChangeCallback(RFID_ClockChanged);
+
+    RFID_ResetChip();
+    RFID_SetAntenna(1);
+}
 
-    // Reset RC522
+// Hard reset, SPI tuning and the chip set-up; the antenna is left off
+static void RFID_ResetChip(void) {
+    // Reset RC522 (NRSTPD low for at least 100 ns)
     GPIOE->ODR &= ~(1 << 2); // RST low
-    delay_ms(10);
+    delay_ns(RFID_RESET_PULSE_NS);
     GPIOE->ODR |= (1 << 2);  // RST high
-    delay_ms(10);
+    delay_us(RFID_STARTUP_US);
 
     // Initialize MFRC522
     RFID_WriteRegister(MFRC522_COMMAND_REG, MFRC522_CMD_SOFT_RESET);
-    delay_ms(50);
-
-    // Configure MFRC522
-    RFID_WriteRegister(MFRC522_T_MODE_REG, 0x8D);
+    RFID_WaitForPowerUp();
+    RFID_TuneSpiClock();
+    tx_mode = 0x00;                             // Reset value
+    RFID_SetRfConfig(&rf_config);
+
+    // Configure MFRC522. TAuto starts the timer at the end of every
+    // transmission: 3390 prescaler, 3 reloads = 1.5 ms without an answer.
+    // Activation frames are answered within about 100 us, and every card
+    // check ends on a REQA nobody answers, so this is on the critical path.
+    RFID_WriteRegister(MFRC522_T_MODE_REG, RFID_T_MODE);
     RFID_WriteRegister(MFRC522_T_PRESCALER_REG, 0x3E);
-    RFID_WriteRegister(MFRC522_T_RELOAD_L_REG, 30);
+    RFID_WriteRegister(MFRC522_T_RELOAD_L_REG, 2);
     RFID_WriteRegister(MFRC522_T_RELOAD_H_REG, 0);
     RFID_WriteRegister(MFRC522_TX_AUTO_REG, 0x40);
     RFID_WriteRegister(MFRC522_MODE_REG, 0x3D);
 
-    // Enable antenna
-    uint8_t value = RFID_ReadRegister(MFRC522_TX_CONTROL_REG);
-    if (!(value & 0x03)) {
-        RFID_WriteRegister(MFRC522_TX_CONTROL_REG, value | 0x03);
+    // Active-low push-pull IRQ for reception, command end, timer and CRC
+    RFID_WriteRegister(MFRC522_COMIEN_REG, RFID_COM_IEN);
+    RFID_WriteRegister(MFRC522_DIVIEN_REG, MFRC522_DIVIEN_PUSH_PULL | MFRC522_DIVIRQ_CRC);
+
+    tx_control = RFID_ReadRegister(MFRC522_TX_CONTROL_REG);
+}
+
+// Drive the 13.56 MHz field on TX1/TX2. Blocking; not while a transceive
+// is in progress.
+void RFID_SetAntenna(uint8_t on) {
+    uint8_t value = on ? (tx_control | MFRC522_TX_CONTROL_ANTENNA)
+                       : (tx_control & ~MFRC522_TX_CONTROL_ANTENNA);
+
+    if (value != tx_control) {
+        tx_control = value;
+        RFID_WriteRegister(MFRC522_TX_CONTROL_REG, value);
     }
 }
 
-uint8_t RFID_Transfer(uint8_t data) {
-    // Wait for TX buffer empty
-    while (!(SPI1->SR & (1 << 1))); // Wait for TXE
+uint8_t RFID_IsAntennaOn(void) {
+    return (tx_control & MFRC522_TX_CONTROL_ANTENNA) != 0;
+}
+
+// Blocking, not while a transceive is in progress. Kept across RFID_Init.
+void RFID_SetRfConfig(const rfid_rf_config_t *config) {
+    rf_config = *config;
+    RFID_WriteRegister(MFRC522_RF_CFG_REG, config->rf_cfg);
+    RFID_WriteRegister(MFRC522_GS_N_REG, config->gs_n);
+    RFID_WriteRegister(MFRC522_CW_GS_P_REG, config->cw_gs_p);
+    RFID_WriteRegister(MFRC522_RX_THRESHOLD_REG, config->rx_threshold);
+}
+
+void RFID_GetRfConfig(rfid_rf_config_t *config) {
+    *config = rf_config;
+}
 
-    // Send data
-    SPI1->DR = data;
+// RxGain codes 0-7; 0-3 repeat 18 and 23 dB
+uint8_t RFID_RxGainDb(uint8_t rf_cfg) {
+    static const uint8_t gain_db[8] = {18, 23, 18, 23, 33, 38, 43, 48};
+    return gain_db[RFID_RX_GAIN(rf_cfg)];
+}
 
-    // Wait for RX buffer not empty
-    while (!(SPI1->SR & (1 << 0))); // Wait for RXNE
+// Wait for the soft reset to finish: the PowerDown bit in CommandReg
+// stays set until the oscillator is running again
+void RFID_WaitForPowerUp(void) {
+    uint32_t start = get_tick_count();
 
-    // Return received data
-    return SPI1->DR;
+    while (RFID_ReadRegister(MFRC522_COMMAND_REG) & MFRC522_COMMAND_POWER_DOWN) {
+        if ((get_tick_count() - start) > RFID_RESET_TIMEOUT_MS) {
+            break;
+        }
+        delay_us(RFID_STARTUP_US);
+    }
 }
 
-void RFID_WriteRegister(uint8_t reg, uint8_t value) {
-    GPIOE->ODR &= ~(1 << 3); // SS low
+// Fastest SPI1 prescaler (fPCLK2/2..256) that stays at or below max_hz
+static uint32_t RFID_SpiPrescaler(uint32_t max_hz) {
+    uint32_t pclk2 = Clock_GetPCLK2();
+    uint32_t br = 0;
+
+    while ((pclk2 >> (br + 1)) > max_hz && br < 7) {
+        br++;
+    }
+    return br;
+}
+
+// SPI1 is briefly disabled while BR changes
+static void RFID_SetSpiPrescaler(uint32_t br) {
+    uint32_t enabled = SPI1->CR1 & SPI_CR1_SPE;
+    SPI1->CR1 &= ~SPI_CR1_SPE;
+    SPI1->CR1 = (SPI1->CR1 & ~SPI_CR1_BR) | (br << 3) | enabled;
+}
+
+// Keep SPI1 at or below the clock the link was verified at
+void RFID_UpdateSpiClock(void) {
+    RFID_SetSpiPrescaler(RFID_SpiPrescaler(spi_max_hz));
+}
+
+// The tuned ceiling; slower clock profiles run SPI1 below it
+uint32_t RFID_GetSpiClock(void) {
+    return spi_max_hz;
+}
+
+uint32_t RFID_GetSpiRejectedClock(void) {
+    return spi_rejected_hz;
+}
+
+// Patterns through ModWidthReg, which holds any byte, then a FIFO burst the
+// way transceives move data. Leaves ModWidthReg at its reset value.
+static uint8_t RFID_VerifyLink(void) {
+    static const uint8_t patterns[] = {0x55, 0xAA, 0x00, 0xFF, 0x0F, 0xF0};
+    uint8_t burst[RFID_SPI_TUNE_BURST];
+    uint8_t back[RFID_SPI_TUNE_BURST];
+    uint8_t ok = 1;
+
+    for (uint8_t round = 0; round < RFID_SPI_TUNE_ROUNDS && ok; round++) {
+        for (uint8_t i = 0; i < sizeof(patterns); i++) {
+            uint8_t value = patterns[i] ^ round;
+            RFID_WriteRegister(MFRC522_MOD_WIDTH_REG, value);
+            if (RFID_ReadRegister(MFRC522_MOD_WIDTH_REG) != value) ok = 0;
+        }
+
+        for (uint8_t i = 0; i < sizeof(burst); i++) {
+            burst[i] = (uint8_t)(i * 37 + round * 11);
+        }
+        RFID_WriteRegister(MFRC522_FIFO_LEVEL_REG, 0x80);
+        RFID_WriteRegisterBurst(MFRC522_FIFO_DATA_REG, burst, sizeof(burst));
+        if ((RFID_ReadRegister(MFRC522_FIFO_LEVEL_REG) & 0x7F) != sizeof(burst)) ok = 0;
+        RFID_ReadRegisterBurst(MFRC522_FIFO_DATA_REG, back, sizeof(back));
+        if (memcmp(burst, back, sizeof(burst)) != 0) ok = 0;
+    }
+
+    RFID_WriteRegister(MFRC522_FIFO_LEVEL_REG, 0x80);
+    RFID_WriteRegister(MFRC522_MOD_WIDTH_REG, MFRC522_MOD_WIDTH_RESET);
+    return ok;
+}
+
+// Step the SPI clock up from RFID_SPI_CLOCK_HZ, one prescaler halving at a
+// time up to RFID_SPI_CLOCK_MAX_HZ, verifying the link at each rate. Cable
+// length and wiring set where reads start to go wrong; after a failure the
+// clock settles RFID_SPI_TUNE_MARGIN halvings below the fastest rate that
+// passed, but not below the start-up rate. Right after a soft reset only.
+static void RFID_TuneSpiClock(void) {
+    uint32_t br = RFID_SpiPrescaler(RFID_SPI_CLOCK_HZ);
+    uint32_t start_hz = Clock_GetPCLK2() >> (br + 1);
+    uint32_t passed_hz = 0;
+
+    spi_rejected_hz = 0;
+    for (;;) {
+        uint32_t hz = Clock_GetPCLK2() >> (br + 1);
+
+        RFID_SetSpiPrescaler(br);
+        if (!RFID_VerifyLink()) {
+            spi_rejected_hz = hz;
+            break;
+        }
+        passed_hz = hz;
+        if (br == 0 || (Clock_GetPCLK2() >> br) > RFID_SPI_CLOCK_MAX_HZ) break;
+        br--;
+    }
+
+    if (spi_rejected_hz != 0) {
+        passed_hz >>= RFID_SPI_TUNE_MARGIN;
+        if (passed_hz < start_hz) passed_hz = start_hz;
+    }
+    spi_max_hz = passed_hz ? passed_hz : RFID_SPI_CLOCK_HZ;
+    RFID_UpdateSpiClock();
+
+    if (spi_rejected_hz != 0) {
+        // Writes at the rejected rate may have landed anywhere
+        RFID_WriteRegister(MFRC522_COMMAND_REG, MFRC522_CMD_SOFT_RESET);
+        RFID_WaitForPowerUp();
+    }
+}
+
+// A frame on the wire finishes at the old SPI clock. PRE runs with
+// interrupts enabled, so the card check's interrupts may queue frames until
+// the switch; they are held, and start at the new clock in POST.
+void RFID_ClockChanged(uint8_t phase) {
+    if (phase == CLOCK_CHANGE_PRE) {
+        SpiDma_Hold();
+    } else {
+        SpiDma_Quiesce();
+        RFID_UpdateSpiClock();
+        Clock_SetMicrosecondTimer(RFID_GUARD_TIMER);
+        SpiDma_Release();
+    }
+}
 
-    RFID_Transfer((reg << 1) & 0x7E); // MSB = 0 for write, bits 1-6 = register address
-    RFID_Transfer(value);
+// One-pulse microsecond timer that ends a transceive whose IRQ never comes
+static void RFID_InitGuardTimer(void) {
+    RCC->APB1ENR |= RCC_APB1ENR_TIM4EN;
 
-    GPIOE->ODR |= (1 << 3); // SS high
+    RFID_GUARD_TIMER->CR1 = TIM_CR1_OPM | TIM_CR1_URS;
+    RFID_GUARD_TIMER->ARR = RFID_TRANSCEIVE_TIMEOUT_US - 1;
+    Clock_SetMicrosecondTimer(RFID_GUARD_TIMER);
+    RFID_GUARD_TIMER->SR = 0;
+    RFID_GUARD_TIMER->DIER = TIM_DIER_UIE;
+    nvic_enable_irq(TIM4_IRQn);
+}
+
+static void RFID_ArmGuardTimer(void) {
+    RFID_GUARD_TIMER->CNT = 0;
+    RFID_GUARD_TIMER->CR1 |= TIM_CR1_CEN;
+    REG_SYNC_WRITE(RFID_GUARD_TIMER->CR1);
+}
+
+static void RFID_StopGuardTimer(void) {
+    RFID_GUARD_TIMER->CR1 &= ~TIM_CR1_CEN;
+    RFID_GUARD_TIMER->SR = 0;
+    REG_SYNC_WRITE(RFID_GUARD_TIMER->SR);
+}
+
+// RC522 IRQ output on a falling-edge EXTI line, pulled up for the time
+// before the chip drives it
+static void RFID_InitIrq(void) {
+    RCC->APB2ENR |= RCC_APB2ENR_SYSCFGEN;
+
+    RFID_IRQ_PORT->MODER &= ~(3 << (RFID_IRQ_PIN * 2));        // Input
+    RFID_IRQ_PORT->PUPDR &= ~(3 << (RFID_IRQ_PIN * 2));
+    RFID_IRQ_PORT->PUPDR |= (1 << (RFID_IRQ_PIN * 2));         // Pull-up
+
+    SYSCFG->EXTICR[RFID_IRQ_PIN >> 2] &= ~(0xFUL << SYSCFG_EXTICR_SHIFT(RFID_IRQ_PIN));
+    SYSCFG->EXTICR[RFID_IRQ_PIN >> 2] |= (uint32_t)RFID_IRQ_EXTICR_PORT << SYSCFG_EXTICR_SHIFT(RFID_IRQ_PIN);
+    EXTI->RTSR &= ~(1 << RFID_IRQ_PIN);
+    EXTI->FTSR |= (1 << RFID_IRQ_PIN);
+    EXTI->PR = (1 << RFID_IRQ_PIN);
+    REG_SYNC_WRITE(EXTI->PR);
+    EXTI->IMR |= (1 << RFID_IRQ_PIN);
+    nvic_enable_irq(EXTI4_IRQn);
+}
+
+static uint8_t RFID_IrqAsserted(void) {
+    REG_SYNC_READ(RFID_IRQ_PORT->IDR);
+    return !(RFID_IRQ_PORT->IDR & (1 << RFID_IRQ_PIN));
+}
+
+// Blocking register access, one DMA frame each. Not for use from
+// interrupts or while a transceive is in progress.
+void RFID_WriteRegister(uint8_t reg, uint8_t value) {
+    RFID_WriteRegisterBurst(reg, &value, 1);
 }
 
 uint8_t RFID_ReadRegister(uint8_t reg) {
     uint8_t value;
 
-    GPIOE->ODR &= ~(1 << 3); // SS low
+    RFID_ReadRegisters(&reg, &value, 1);
+    return value;
+}
+
+// While SS stays low the RC522 writes every data byte to the addressed
+// register, so one frame fills the FIFO
+void RFID_WriteRegisterBurst(uint8_t reg, const uint8_t *values, uint8_t count) {
+    uint8_t tx[RFID_FIFO_SIZE + 1];
 
-    RFID_Transfer(((reg << 1) & 0x7E) | 0x80); // MSB = 1 for read
-    value = RFID_Transfer(0x00);
+    if (count == 0) return;
+    if (count > RFID_FIFO_SIZE) count = RFID_FIFO_SIZE;
 
-    GPIOE->ODR |= (1 << 3); // SS high
+    tx[0] = RFID_WRITE_ADDRESS(reg);
+    memcpy(&tx[1], values, count);
 
-    return value;
+    spi_frame_t frame = {.tx = tx, .rx = NULL, .length = count + 1};
+    SpiDma_Transfer(&frame);
 }
 
-int RFID_CheckForCard(uint8_t *uid, uint8_t *uid_size) {
-    uint8_t buffer[10];
+// In a read frame each MOSI byte addresses the next read while MISO returns
+// the previous one, so any list of registers costs count + 1 bytes
+static uint8_t RFID_BuildReadFrame(uint8_t *tx, const uint8_t *regs, uint8_t reg, uint8_t count) {
+    if (count > RFID_FIFO_SIZE) count = RFID_FIFO_SIZE;
+
+    for (uint8_t i = 0; i < count; i++) {
+        tx[i] = RFID_READ_ADDRESS(regs ? regs[i] : reg);
+    }
+    tx[count] = 0x00;
+    return count + 1;
+}
+
+void RFID_ReadRegisters(const uint8_t *regs, uint8_t *values, uint8_t count) {
+    uint8_t tx[RFID_FIFO_SIZE + 1];
+    uint8_t rx[RFID_FIFO_SIZE + 1];
+
+    if (count == 0) return;
+
+    spi_frame_t frame = {.tx = tx, .rx = rx, .length = RFID_BuildReadFrame(tx, regs, 0, count)};
+    SpiDma_Transfer(&frame);
+    memcpy(values, &rx[1], frame.length - 1);
+}
+
+// Same register `count` times, e.g. draining the FIFO
+void RFID_ReadRegisterBurst(uint8_t reg, uint8_t *values, uint8_t count) {
+    uint8_t tx[RFID_FIFO_SIZE + 1];
+    uint8_t rx[RFID_FIFO_SIZE + 1];
+
+    if (count == 0) return;
+
+    spi_frame_t frame = {.tx = tx, .rx = rx, .length = RFID_BuildReadFrame(tx, NULL, reg, count)};
+    SpiDma_Transfer(&frame);
+    memcpy(values, &rx[1], frame.length - 1);
+}
+
+// Chip-select frames since boot, one per register access or burst
+uint32_t RFID_GetSpiTransactions(void) {
+    return SpiDma_GetFrameCount();
+}
+
+// ==================== Asynchronous transceive ====================
+//
+// A transceive is a chain of DMA frames: up to seven setup writes queued
+// at once, then nothing until the RC522 pulls its IRQ line, then one ComIrq
+// read, one frame for the error, FIFO level and collision registers and one
+// to drain the FIFO. A reception, or the chip timer when no card answers,
+// ends the wait. Without a receive buffer the frame goes out with the
+// Transmit command instead, which ends on its own once sent. Every step is
+// started from the previous interrupt.
+
+#define RFID_WAIT_IRQ              (MFRC522_IRQ_RX | MFRC522_IRQ_IDLE)
+#define RFID_ERROR_MASK            0x13    // BufferOvfl | ParityErr | ProtocolErr
+
+typedef enum {
+    RFID_PHASE_SETUP = 0,
+    RFID_PHASE_WAIT,                    // For the IRQ line, no SPI traffic
+    RFID_PHASE_IRQ_READ,                // ComIrq read in flight
+    RFID_PHASE_RESULT
+} rfid_phase_t;
+
+static struct {
+    volatile uint8_t status;            // rfid_xfer_status_t
+    volatile uint8_t phase;             // rfid_phase_t
+    volatile uint8_t expired;           // Guard timer ran out during a ComIrq read
+    uint8_t *back;
+    uint8_t back_size;
     uint8_t back_len;
+    uint8_t rx_align;                   // First received bit lands at this bit of back[0]
+    uint8_t error;                      // ErrorReg and CollReg at the end
+    uint8_t coll;
+    rfid_done_cb_t done;
+} xfer;
+
+static volatile uint8_t irq_seen = 0;  // IRQ edges outside a transceive (CRC)
+static rfid_link_stats_t link_stats;
+
+static uint8_t setup_tx[6][2];
+static uint8_t fifo_tx[RFID_FIFO_SIZE + 1];
+static const uint8_t irq_tx[2] = {RFID_READ_ADDRESS(MFRC522_COMIRQ_REG), 0x00};
+static uint8_t irq_rx[2];
+static const uint8_t result_tx[4] = {RFID_READ_ADDRESS(MFRC522_ERROR_REG),
+                               RFID_READ_ADDRESS(MFRC522_FIFO_LEVEL_REG),
+                               RFID_READ_ADDRESS(MFRC522_COLL_REG), 0x00};
+static uint8_t result_rx[4];
+static uint8_t drain_tx[RFID_FIFO_SIZE + 1];
+static uint8_t drain_rx[RFID_FIFO_SIZE + 1];
+static spi_frame_t setup_frames[6];
+static spi_frame_t fifo_frame;
+static spi_frame_t irq_frame;
+static spi_frame_t result_frame;
+static spi_frame_t drain_frame;
+
+static void RFID_SetFrame(spi_frame_t *frame, const uint8_t *tx, uint8_t *rx,
+                          uint16_t length, spi_frame_cb_t callback) {
+    frame->tx = tx;
+    frame->rx = rx;
+    frame->length = length;
+    frame->callback = callback;
+}
 
-    // Send request command
-    buffer[0] = PICC_CMD_REQA;
-    buffer[1] = 0x20;
+// The chip ended the transceive itself, with a reception or its timer
+static void RFID_LinkOk(void) {
+    link_stats.consecutive = 0;
+}
 
-    if (RFID_TransceiveData(buffer, 2, buffer, &back_len) != 0) {
-        return 0; // No card found
+// It never did (no IRQ, SPI failure), or reported ErrorReg bits
+static void RFID_LinkFault(uint8_t error_bits) {
+    if (error_bits) {
+        link_stats.errors++;
+    } else {
+        link_stats.faults++;
     }
+    if (link_stats.consecutive < 0xFF) link_stats.consecutive++;
+}
 
-    // Anti-collision
-    buffer[0] = PICC_CMD_SEL_CL1;
-    buffer[1] = 0x20;
+static void RFID_FinishTransceive(rfid_xfer_status_t status) {
+    if (status == RFID_XFER_OK) {
+        TRACE(TRACE_EV_RFID_END, 0, xfer.back_len * 8);
+    } else {
+        TRACE(TRACE_EV_RFID_END, status == RFID_XFER_TIMEOUT ? 0xFF : 0xFE, 0);
+    }
 
-    if (RFID_TransceiveData(buffer, 2, buffer, &back_len) == 0 && back_len >= 5) {
-        if (uid != NULL) {
-            // Copy UID (bytes 1-4 of the response)
-            for (uint8_t i = 0; i < 4; i++) {
-                uid[i] = buffer[i + 1];
-            }
-        }
-        if (uid_size != NULL) {
-            *uid_size = 4; // Standard 4-byte UID
+    // Status first: the callback may start the next transceive
+    xfer.phase = RFID_PHASE_SETUP;
+    xfer.status = status;
+    if (xfer.done != NULL) {
+        xfer.done(status);
+    }
+}
+
+static void RFID_OnDrain(spi_frame_t *frame) {
+    if (frame->status != SPI_FRAME_DONE) {
+        RFID_LinkFault(0);
+        RFID_FinishTransceive(RFID_XFER_ERROR);
+        return;
+    }
+    // Bits below RxAlign in the first byte are the caller's own
+    uint8_t mask = (uint8_t)(0xFF << xfer.rx_align);
+    xfer.back[0] = (xfer.back[0] & ~mask) | (drain_rx[1] & mask);
+    memcpy(&xfer.back[1], &drain_rx[2], xfer.back_len - 1);
+    RFID_FinishTransceive(RFID_XFER_OK);
+}
+
+static void RFID_OnResult(spi_frame_t *frame) {
+    if (frame->status != SPI_FRAME_DONE || (result_rx[1] & RFID_ERROR_MASK)) {
+        RFID_LinkFault(frame->status == SPI_FRAME_DONE);
+        RFID_FinishTransceive(RFID_XFER_ERROR);
+        return;
+    }
+    RFID_LinkOk();
+    xfer.error = result_rx[1];
+    xfer.coll = result_rx[3];
+
+    uint8_t level = result_rx[2] & 0x7F;
+    xfer.back_len = (level < xfer.back_size) ? level : xfer.back_size;
+    if (xfer.back_len == 0) {
+        RFID_FinishTransceive(RFID_XFER_OK);
+        return;
+    }
+
+    RFID_SetFrame(&drain_frame, drain_tx, drain_rx,
+                  RFID_BuildReadFrame(drain_tx, NULL, MFRC522_FIFO_DATA_REG, xfer.back_len),
+                  RFID_OnDrain);
+    SpiDma_Submit(&drain_frame);
+}
+
+static void RFID_OnIrqRead(spi_frame_t *frame) {
+    uint8_t irqs = (frame->status == SPI_FRAME_DONE) ? irq_rx[1] : 0;
+
+    if (irqs & RFID_WAIT_IRQ) {
+        RFID_StopGuardTimer();
+        xfer.phase = RFID_PHASE_RESULT;
+        SpiDma_Submit(&result_frame);
+    } else if ((irqs & MFRC522_IRQ_TIMER) || xfer.expired) {
+        RFID_StopGuardTimer();
+        if (irqs & MFRC522_IRQ_TIMER) {
+            RFID_LinkOk();
+        } else {
+            RFID_LinkFault(0);
         }
-        return 1;
+        RFID_FinishTransceive(RFID_XFER_TIMEOUT);
+    } else if (RFID_IrqAsserted()) {
+        // The edge came while this read was on the wire
+        SpiDma_Submit(&irq_frame);
+    } else {
+        xfer.phase = RFID_PHASE_WAIT;
+    }
+}
+
+// StartSend or Transmit is out; from here the chip reports back on its IRQ line
+static void RFID_OnStarted(spi_frame_t *frame) {
+    if (frame->status != SPI_FRAME_DONE) {
+        RFID_LinkFault(0);
+        RFID_FinishTransceive(RFID_XFER_ERROR);
+        return;
+    }
+    xfer.expired = 0;
+    xfer.phase = RFID_PHASE_WAIT;
+    RFID_ArmGuardTimer();
+
+    // An answer faster than the last setup frame's interrupt left no edge
+    if (RFID_IrqAsserted()) {
+        xfer.phase = RFID_PHASE_IRQ_READ;
+        SpiDma_Submit(&irq_frame);
     }
+}
+
+void EXTI4_IRQHandler(void) {
+    EXTI->PR = (1 << RFID_IRQ_PIN);
+    REG_SYNC_WRITE(EXTI->PR);
+
+    if (xfer.phase == RFID_PHASE_WAIT) {
+        xfer.phase = RFID_PHASE_IRQ_READ;
+        SpiDma_Submit(&irq_frame);
+    } else {
+        irq_seen = 1;
+    }
+}
+
+// Backstop for a reader that never raises its IRQ line
+void TIM4_IRQHandler(void) {
+    RFID_GUARD_TIMER->SR = ~TIM_SR_UIF;
+    REG_SYNC_WRITE(RFID_GUARD_TIMER->SR);
+
+    if (xfer.status != RFID_XFER_BUSY) return;
+    if (xfer.phase == RFID_PHASE_WAIT) {
+        RFID_LinkFault(0);
+        RFID_FinishTransceive(RFID_XFER_TIMEOUT);
+    } else if (xfer.phase == RFID_PHASE_IRQ_READ) {
+        xfer.expired = 1;
+    }
+}
+
+// Queue one register write of the setup; `index` picks its frame
+static void RFID_QueueSetup(uint8_t index, uint8_t reg, uint8_t value, spi_frame_cb_t callback) {
+    setup_tx[index][0] = RFID_WRITE_ADDRESS(reg);
+    setup_tx[index][1] = value;
+    RFID_SetFrame(&setup_frames[index], setup_tx[index], NULL, 2, callback);
+    SpiDma_Submit(&setup_frames[index]);
+}
+
+// Queue a transceive and return at once; `done` runs from interrupt context
+// when it ends. `framing` is RFID_FRAMING(rx_align, tx_last_bits), where
+// tx_last_bits is the number of bits sent from the last byte (0 = all 8),
+// optionally with RFID_FRAMING_CRC. Up to back_size received bytes land in
+// back_data; with back_data NULL the frame is only transmitted. Returns 0
+// if a transceive is already in progress.
+uint8_t RFID_StartTransceive(const uint8_t *send_data, uint8_t send_len, uint8_t framing,
+                             uint8_t *back_data, uint8_t back_size, rfid_done_cb_t done) {
+    uint8_t tx_last_bits = framing & 0x07;
+    uint8_t crc = (framing & RFID_FRAMING_CRC) ? 1 : 0;
+    uint8_t mode = (crc && !RFID_SOFTWARE_CRC) ? MFRC522_TX_CRC_EN : 0x00;
+    uint8_t index = 0;
+
+    uint32_t primask = irq_save();
+    if (xfer.status == RFID_XFER_BUSY) {
+        irq_restore(primask);
+        return 0;
+    }
+    xfer.status = RFID_XFER_BUSY;
+    xfer.phase = RFID_PHASE_SETUP;
+    irq_restore(primask);
+
+    if (send_len > RFID_FIFO_SIZE - 2) send_len = RFID_FIFO_SIZE - 2;
+    xfer.back = back_data;
+    xfer.back_size = back_data ? back_size : 0;
+    xfer.back_len = 0;
+    xfer.rx_align = (framing >> 4) & 0x07;
+    xfer.error = 0;
+    xfer.coll = 0;
+    xfer.done = done;
+
+    TRACE(TRACE_EV_RFID_START, send_len ? send_data[0] : 0,
+          tx_last_bits ? (send_len - 1) * 8 + tx_last_bits : send_len * 8);
+
+    fifo_tx[0] = RFID_WRITE_ADDRESS(MFRC522_FIFO_DATA_REG);
+    memcpy(&fifo_tx[1], send_data, send_len);
+#if RFID_SOFTWARE_CRC
+    // The CRC_A goes into the FIFO with the frame, so TxModeReg never changes
+    if (crc) send_len = (uint8_t)CRC_AppendA(&fifo_tx[1], send_len);
+#endif
+    RFID_SetFrame(&fifo_frame, fifo_tx, NULL, send_len + 1, NULL);
+    RFID_SetFrame(&irq_frame, irq_tx, irq_rx, sizeof(irq_tx), RFID_OnIrqRead);
+    RFID_SetFrame(&result_frame, result_tx, result_rx, sizeof(result_tx), RFID_OnResult);
+
+    // Idle, clear interrupts, flush the FIFO and fill it. The transceive
+    // owns the bus, so the whole setup fits the queue.
+    RFID_QueueSetup(index++, MFRC522_COMMAND_REG, MFRC522_CMD_IDLE, NULL);
+    RFID_QueueSetup(index++, MFRC522_COMIRQ_REG, 0x7F, NULL);
+    RFID_QueueSetup(index++, MFRC522_FIFO_LEVEL_REG, 0x80, NULL);
+    if (send_len > 0) {
+        SpiDma_Submit(&fifo_frame);
+    }
+    if (mode != tx_mode) {
+        tx_mode = mode;
+        RFID_QueueSetup(index++, MFRC522_TX_MODE_REG, mode, NULL);
+    }
+
+    if (back_data == NULL) {
+        // Transmit starts sending as soon as it is the command
+        RFID_QueueSetup(index++, MFRC522_BIT_FRAMING_REG, framing & 0x77, NULL);
+        RFID_QueueSetup(index++, MFRC522_COMMAND_REG, MFRC522_CMD_TRANSMIT, RFID_OnStarted);
+    } else {
+        RFID_QueueSetup(index++, MFRC522_COMMAND_REG, MFRC522_CMD_TRANSCEIVE, NULL);
+        RFID_QueueSetup(index++, MFRC522_BIT_FRAMING_REG, 0x80 | (framing & 0x77), RFID_OnStarted);
+    }
+    return 1;
+}
 
-    return 0;
+rfid_xfer_status_t RFID_GetTransceiveStatus(void) {
+    return (rfid_xfer_status_t)xfer.status;
 }
 
+void RFID_GetLinkStats(rfid_link_stats_t *stats) {
+    uint32_t primask = irq_save();
+    *stats = link_stats;
+    irq_restore(primask);
+}
+
+// On entry *back_len is the size of back_data, on success the bytes received.
+// With back_data NULL the frame is only transmitted.
 uint8_t RFID_TransceiveData(uint8_t *send_data, uint8_t send_len,
                            uint8_t *back_data, uint8_t *back_len) {
-    uint8_t status;
-    uint8_t irq_en = 0x00;
-    uint8_t wait_irq = 0x30;
+    return RFID_TransceiveFrame(send_data, send_len, 0, back_data, back_len);
+}
 
-    // Prepare for data transfer
-    RFID_WriteRegister(MFRC522_COMMAND_REG, MFRC522_CMD_IDLE);
+// Blocking transceive: sleeps until the chain completes
+uint8_t RFID_TransceiveFrame(uint8_t *send_data, uint8_t send_len, uint8_t framing,
+                            uint8_t *back_data, uint8_t *back_len) {
+    uint8_t back_size = (back_data != NULL && back_len != NULL) ? *back_len : 0;
+    if (!RFID_StartTransceive(send_data, send_len, framing, back_data, back_size, NULL)) {
+        return 0xFF;
+    }
 
-    // Clear interrupts
-    RFID_WriteRegister(MFRC522_COMIRQ_REG, 0x7F);
+    uint32_t primask = irq_save();
+    while (xfer.status == RFID_XFER_BUSY) {
+        wait_for_interrupt();
+        irq_restore(primask);
+        primask = irq_save();
+    }
+    irq_restore(primask);
 
-    // Set FIFO level
-    RFID_WriteRegister(MFRC522_FIFO_LEVEL_REG, 0x80);
+    if (xfer.status != RFID_XFER_OK) {
+        return 0xFF; // Timeout or error
+    }
+    if (back_len != NULL) {
+        *back_len = xfer.back_len;
+    }
+    return 0x00; // Success
+}
 
-    // Write data to FIFO
-    for (uint8_t i = 0; i < send_len; i++) {
-        RFID_WriteRegister(MFRC522_FIFO_DATA_REG, send_data[i]);
+// ==================== Asynchronous card check ====================
+//
+// ISO 14443A enumeration, every step started from the previous one's
+// completion: WUPA, then per cascade level anticollision frames until all
+// 40 bits (UID or cascade tag, BCC) are settled, then SELECT. On a
+// collision the search follows the cards with a 1 at the first collided
+// bit; the others drop out and wait for the next round. A selected card is
+// halted so the REQA that follows only wakes those still unread, until one
+// goes unanswered. The check itself starts with REQA, so cards halted by an
+// earlier check stay silent and a card held at the reader costs a single
+// unanswered frame; with `wake` it starts with WUPA and reads them again.
+
+static volatile uint8_t check_state = RFID_CHECK_IDLE;
+static rfid_check_cb_t check_done;
+static rfid_card_t check_cards[RFID_MAX_CARDS];
+static uint8_t check_count;
+static uint64_t check_start_us;
+
+static rfid_read_stats_t read_stats;
+
+static struct {
+    uint8_t answered;                   // Some card answered the first request
+    uint8_t request;                    // REQA or WUPA
+    uint8_t buffer[7];                  // SEL, NVB, UID bytes (or CT + three) and BCC
+    uint8_t answer[3];                  // ATQA, or SAK and its CRC_A
+    uint8_t known;                      // Bits of this level settled so far
+    uint8_t level;
+    rfid_card_t card;                   // UID so far of the card being selected
+} check;
+
+static uint8_t RFID_CheckRequest(uint8_t command);
+static void RFID_CheckAnticollision(void);
+
+// No more cards to read, or the field went wrong: report what is in
+static void RFID_FinishCardCheck(void) {
+    if (check.answered) {
+        read_stats.answered++;
+        if (check_count) read_stats.read++;
     }
+#if PROFILING_ENABLED
+    // Start to finish, sleep included, in cycles of the clock now running;
+    // CYCCNT itself stops in WFI
+    Profile_Record(PROF_RFID_TRANSCEIVE,
+                   (uint32_t)((get_time_us() - check_start_us) * (Clock_GetHCLK() / 1000000UL)));
+#endif
+    check_state = check_count ? RFID_CHECK_CARD : RFID_CHECK_NO_CARD;
+    if (check_done != NULL) {
+        check_done();
+    }
+}
 
-    // Execute the command
-    RFID_WriteRegister(MFRC522_COMMAND_REG, MFRC522_CMD_TRANSCEIVE);
-    RFID_WriteRegister(MFRC522_BIT_FRAMING_REG, 0x80);
+static void RFID_OnHalt(rfid_xfer_status_t status) {
+    if (status != RFID_XFER_OK || check_count >= RFID_MAX_CARDS ||
+        !RFID_CheckRequest(PICC_CMD_REQA)) {
+        RFID_FinishCardCheck();
+    }
+}
 
-    // Wait for completion
-    uint16_t i = 2000; // Timeout counter
-    do {
-        status = RFID_ReadRegister(MFRC522_COMMAND_REG);
-        if ((--i == 0) || (status & 0x01)) {
-            break;
+static void RFID_OnSelect(rfid_xfer_status_t status) {
+    static const uint8_t halt[2] = {PICC_CMD_HLTA, 0x00};
+    const uint8_t *cl = &check.buffer[2];
+
+    if (status != RFID_XFER_OK || xfer.back_len != sizeof(check.answer) ||
+        !CRC_CheckA(check.answer, sizeof(check.answer))) {
+        RFID_FinishCardCheck();
+        return;
+    }
+
+    uint8_t sak = check.answer[0];
+    if (sak & PICC_SAK_CASCADE) {
+        // Three UID bytes behind the cascade tag, the rest a level down
+        if (cl[0] != PICC_CMD_CT || check.level + 1 >= RFID_MAX_CASCADE_LEVELS) {
+            RFID_FinishCardCheck();
+            return;
         }
-    } while (!(RFID_ReadRegister(MFRC522_COMIRQ_REG) & wait_irq));
+        memcpy(&check.card.uid[check.card.size], &cl[1], 3);
+        check.card.size += 3;
+        check.level++;
+        check.buffer[0] = PICC_CMD_SEL_CL1 + 2 * check.level;
+        check.known = 0;
+        RFID_CheckAnticollision();
+        return;
+    }
+
+    memcpy(&check.card.uid[check.card.size], cl, 4);
+    check.card.size += 4;
+    check.card.sak = sak;
+    check_cards[check_count++] = check.card;
 
-    // Check for errors
-    if (i == 0) {
-        return 0xFF; // Timeout
+    if (!RFID_StartTransceive(halt, sizeof(halt), RFID_FRAMING_CRC, NULL, 0, RFID_OnHalt)) {
+        RFID_FinishCardCheck();
     }
+}
 
-    if (RFID_ReadRegister(MFRC522_ERROR_REG) & 0x13) {
-        return 0xFF; // Error
+static void RFID_OnAnticollision(rfid_xfer_status_t status) {
+    uint8_t bytes = check.known / 8;
+    uint8_t *cl = &check.buffer[2];
+
+    if (status != RFID_XFER_OK || xfer.back_len != 5 - bytes) {
+        RFID_FinishCardCheck();
+        return;
     }
 
-    // Read received data
-    if (back_data != NULL && back_len != NULL) {
-        *back_len = RFID_ReadRegister(MFRC522_FIFO_LEVEL_REG);
-        if (*back_len > 0) {
-            for (uint8_t i = 0; i < *back_len; i++) {
-                back_data[i] = RFID_ReadRegister(MFRC522_FIFO_DATA_REG);
-            }
+    if (xfer.error & MFRC522_ERROR_COLL) {
+        // CollPos counts from the first byte received, 0 meaning 32
+        uint8_t position = xfer.coll & MFRC522_COLL_POS_MASK;
+        if (position == 0) position = 32;
+        position += bytes * 8;
+
+        if ((xfer.coll & MFRC522_COLL_POS_NOT_VALID) || position <= check.known || position >= 40) {
+            RFID_FinishCardCheck();
+            return;
         }
+        cl[(position - 1) / 8] |= (uint8_t)(1 << ((position - 1) % 8));
+        check.known = position;
+        RFID_CheckAnticollision();
+        return;
     }
 
-    return 0x00; // Success
+    if ((cl[0] ^ cl[1] ^ cl[2] ^ cl[3]) != cl[4]) {
+        RFID_FinishCardCheck();
+        return;
+    }
+
+    // SELECT: all 40 bits plus CRC_A
+    check.buffer[1] = 0x70;
+    if (!RFID_StartTransceive(check.buffer, sizeof(check.buffer), RFID_FRAMING_CRC,
+                              check.answer, sizeof(check.answer), RFID_OnSelect)) {
+        RFID_FinishCardCheck();
+    }
+}
+
+// Send the settled bits of this level; the cards answer with the rest,
+// starting at the bit after them
+static void RFID_CheckAnticollision(void) {
+    uint8_t bytes = check.known / 8;
+    uint8_t bits = check.known % 8;
+
+    check.buffer[1] = (uint8_t)(((2 + bytes) << 4) | bits);     // NVB
+    if (!RFID_StartTransceive(check.buffer, 2 + bytes + (bits ? 1 : 0), RFID_FRAMING(bits, bits),
+                              &check.buffer[2 + bytes], 5 - bytes, RFID_OnAnticollision)) {
+        RFID_FinishCardCheck();
+    }
+}
+
+static void RFID_OnRequest(rfid_xfer_status_t status) {
+    // Several ATQAs may collide; any answer means a card to read
+    if (status != RFID_XFER_OK || xfer.back_len != 2) {
+        RFID_FinishCardCheck();
+        return;
+    }
+    if (check_count == 0) check.answered = 1;
+
+    check.card.size = 0;
+    check.level = 0;
+    check.known = 0;
+    check.buffer[0] = PICC_CMD_SEL_CL1;
+    RFID_CheckAnticollision();
+}
+
+// REQA and WUPA are 7-bit short frames
+static uint8_t RFID_CheckRequest(uint8_t command) {
+    check.request = command;
+    return RFID_StartTransceive(&check.request, 1, RFID_FRAMING(0, 7),
+                                check.answer, 2, RFID_OnRequest);
+}
+
+// Start reading the cards in the field, with `wake` those halted by
+// earlier checks too; `done` runs from interrupt context with the result
+// ready for RFID_GetCardCheck. Returns 0 while the reader is busy.
+uint8_t RFID_StartCardCheck(rfid_check_cb_t done, uint8_t wake) {
+    if (check_state == RFID_CHECK_BUSY) return 0;
+
+    check_done = done;
+    check_count = 0;
+    check.answered = 0;
+    check_start_us = get_time_us();
+    check_state = RFID_CHECK_BUSY;
+    if (!RFID_CheckRequest(wake ? PICC_CMD_WUPA : PICC_CMD_REQA)) {
+        check_state = RFID_CHECK_IDLE;
+        return 0;
+    }
+    return 1;
+}
+
+// Result of the last card check; a finished result is handed out once.
+// `cards` has room for RFID_MAX_CARDS.
+rfid_check_t RFID_GetCardCheck(rfid_card_t *cards, uint8_t *count) {
+    rfid_check_t result = (rfid_check_t)check_state;
+
+    if (result == RFID_CHECK_CARD) {
+        if (cards != NULL) memcpy(cards, check_cards, check_count * sizeof(rfid_card_t));
+        if (count != NULL) *count = check_count;
+    }
+    if (result == RFID_CHECK_CARD || result == RFID_CHECK_NO_CARD) {
+        check_state = RFID_CHECK_IDLE;
+    }
+    return result;
+}
+
+// Blocking card check of every card in the field; RFID_CHECK_BUSY if the
+// reader was taken
+rfid_check_t RFID_WaitCardCheck(rfid_card_t *cards, uint8_t *count) {
+    if (!RFID_StartCardCheck(NULL, 1)) return RFID_CHECK_BUSY;
+
+    uint32_t primask = irq_save();
+    while (check_state == RFID_CHECK_BUSY) {
+        wait_for_interrupt();
+        irq_restore(primask);
+        primask = irq_save();
+    }
+    irq_restore(primask);
+
+    return RFID_GetCardCheck(cards, count);
 }
 
+// No transceive or card check in flight: blocking register access and
+// RFID_Recover are safe
+uint8_t RFID_IsIdle(void) {
+    return xfer.status != RFID_XFER_BUSY && check_state != RFID_CHECK_BUSY;
+}
+
+// Registers the set-up changes from their reset values, read back: wrong
+// after a brown-out reset of the chip, or once it stops answering on SPI
+uint8_t RFID_CheckRegisters(void) {
+    static const uint8_t regs[2] = {MFRC522_T_MODE_REG, MFRC522_COMIEN_REG};
+    uint8_t values[2];
+
+    RFID_ReadRegisters(regs, values, sizeof(regs));
+    return values[0] == RFID_T_MODE && values[1] == RFID_COM_IEN;
+}
+
+// RFID_Init's chip half again, with the MCU side and the antenna state
+// kept; only while RFID_IsIdle. 1 if the chip reads back right afterwards.
+uint8_t RFID_Recover(void) {
+    uint8_t antenna = RFID_IsAntennaOn();
+
+    RFID_ResetChip();
+    RFID_SetAntenna(antenna);
+    link_stats.consecutive = 0;
+    return RFID_CheckRegisters();
+}
+
+void RFID_GetReadStats(rfid_read_stats_t *stats) {
+    *stats = read_stats;
+}
+
+// Blocking card check: the first card read, uid needs RFID_UID_MAX_SIZE
+int RFID_CheckForCard(uint8_t *uid, uint8_t *uid_size) {
+    rfid_card_t cards[RFID_MAX_CARDS];
+    uint8_t count = 0;
+
+    if (RFID_WaitCardCheck(cards, &count) != RFID_CHECK_CARD) return 0;
+    if (uid != NULL) memcpy(uid, cards[0].uid, cards[0].size);
+    if (uid_size != NULL) *uid_size = cards[0].size;
+    return 1;
+}
+
+// HLTA carries a CRC_A and gets no answer
 void RFID_Halt(void) {
-    uint8_t buffer[4];
-    uint8_t back_len;
+    uint8_t buffer[2];
 
     buffer[0] = PICC_CMD_HLTA;
     buffer[1] = 0;
 
-    RFID_TransceiveData(buffer, 2, NULL, &back_len);
+    RFID_TransceiveFrame(buffer, 2, RFID_FRAMING_CRC, NULL, NULL);
 }
 
-uint8_t RFID_CalculateCRC(uint8_t *data, uint8_t length, uint8_t *result) {
+// The CRC coprocessor reports on the IRQ line too; the core sleeps until
+// it does. Kept for RFID_SOFTWARE_CRC 0 and to cross-check crc.c.
+uint8_t RFID_CalculateCRCChip(uint8_t *data, uint8_t length, uint8_t *result) {
     RFID_WriteRegister(MFRC522_COMMAND_REG, MFRC522_CMD_IDLE);
-    RFID_WriteRegister(MFRC522_DIVIEN_REG, 0x04);
+    RFID_WriteRegister(MFRC522_COMIRQ_REG, 0x7F);  // Release the line after a transceive
+    RFID_WriteRegister(MFRC522_DIVIRQ_REG, 0x7F);
     RFID_WriteRegister(MFRC522_FIFO_LEVEL_REG, 0x80);
 
-    for (uint8_t i = 0; i < length; i++) {
-        RFID_WriteRegister(MFRC522_FIFO_DATA_REG, data[i]);
-    }
+    RFID_WriteRegisterBurst(MFRC522_FIFO_DATA_REG, data, length);
 
+    irq_seen = 0;
     RFID_WriteRegister(MFRC522_COMMAND_REG, MFRC522_CMD_CALC_CRC);
 
-    // Wait for CRC calculation
-    uint16_t i = 0xFF;
-    while (i-- && !(RFID_ReadRegister(MFRC522_DIVIRQ_REG) & 0x04));
-
-    if (i == 0) {
-        return 0xFF; // Timeout
+    uint32_t start = get_tick_count();
+    uint32_t primask = irq_save();
+    while (!irq_seen && (get_tick_count() - start) <= RFID_CRC_TIMEOUT_MS) {
+        wait_for_interrupt();
+        irq_restore(primask);
+        primask = irq_save();
+    }
+    irq_restore(primask);
+
+    uint8_t status = 0xFF; // Timeout
+    if (RFID_ReadRegister(MFRC522_DIVIRQ_REG) & MFRC522_DIVIRQ_CRC) {
+        // Read CRC result
+        static const uint8_t crc_regs[2] = {MFRC522_CRC_RESULT_L_REG, MFRC522_CRC_RESULT_H_REG};
+        RFID_ReadRegisters(crc_regs, result, sizeof(crc_regs));
+        status = 0x00;
     }
 
-    // Read CRC result
-    result[0] = RFID_ReadRegister(MFRC522_CRC_RESULT_L_REG);
-    result[1] = RFID_ReadRegister(MFRC522_CRC_RESULT_H_REG);
+    RFID_WriteRegister(MFRC522_COMMAND_REG, MFRC522_CMD_IDLE);
+    RFID_WriteRegister(MFRC522_DIVIRQ_REG, MFRC522_DIVIRQ_CRC);
+    return status;
+}
 
+// CRC_A of `data` into result[0] (low) and result[1]; 0x00 on success
+uint8_t RFID_CalculateCRC(uint8_t *data, uint8_t length, uint8_t *result) {
+#if RFID_SOFTWARE_CRC
+    uint16_t crc = CRC_CalculateA(data, length);
+
+    result[0] = (uint8_t)crc;
+    result[1] = (uint8_t)(crc >> 8);
     return 0x00;
+#else
+    return RFID_CalculateCRCChip(data, length, result);
+#endif
 }
 
 int RFID_IsNewCardPresent(void) {
     uint8_t buffer[2];
-    uint8_t back_len;
+    uint8_t back_len = sizeof(buffer);
 
     buffer[0] = PICC_CMD_REQA;
-    buffer[1] = 0x20;
 
-    return (RFID_TransceiveData(buffer, 2, buffer, &back_len) == 0x00);
+    return (RFID_TransceiveFrame(buffer, 1, RFID_FRAMING(0, 7), buffer, &back_len) == 0x00);
 }
 
 int RFID_ReadCardSerial(uint8_t *uid, uint8_t *uid_size) {
     return RFID_CheckForCard(uid, uid_size);
 }
 
-// Simple RFID detection (polling mode)
+// Simple RFID detection
 int RFID_SimpleCheckForCard(uint8_t *uid) {
-    // Send request command
-    RFID_WriteRegister(MFRC522_BIT_FRAMING_REG, 0x07);
-    RFID_WriteRegister(MFRC522_COMMAND_REG, MFRC522_CMD_TRANSCEIVE);
-    RFID_WriteRegister(MFRC522_FIFO_DATA_REG, PICC_CMD_REQA);
-    RFID_WriteRegister(MFRC522_FIFO_DATA_REG, 0x20);
-
-    // Wait for response
-    uint16_t i = 1000;
-    while (i-- && !(RFID_ReadRegister(MFRC522_COMIRQ_REG) & 0x20));
-
-    if (i == 0) {
-        return 0; // Timeout
-    }
-
-    // Check for error
-    if (RFID_ReadRegister(MFRC522_ERROR_REG) & 0x13) {
-        return 0; // Error
-    }
-
-    // Check if card responded
-    if (RFID_ReadRegister(MFRC522_FIFO_LEVEL_REG) > 0) {
-        if (uid != NULL) {
-            // Read UID (simplified)
-            for (uint8_t i = 0; i < 4; i++) {
-                uid[i] = RFID_ReadRegister(MFRC522_FIFO_DATA_REG);
-            }
-        }
-        return 1;
-    }
-
-    return 0;
+    return RFID_CheckForCard(uid, NULL);
 }
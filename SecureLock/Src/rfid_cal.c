@@ -0,0 +1,266 @@
+#include "rfid_cal.h"
+#include "rfid_poll.h"
+#include "scheduler.h"
+#include "storage.h"
+#include "config.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+
+static const uint8_t cal_gains[] = {4, 5, 6, 7};           // RxGain 33-48 dB
+static const uint8_t cal_min_levels[] = {6, 8, 10};        // MinLevel, ascending
+
+#define RFID_CAL_LEVELS            sizeof(cal_min_levels)
+#define RFID_CAL_GAINS             sizeof(cal_gains)
+#define RFID_CAL_CANDIDATES        (2 * RFID_CAL_GAINS * RFID_CAL_LEVELS)
+#define RFID_CAL_DEFAULTS          1       // 33 dB, MinLevel 8: the reset values
+
+static rfid_cal_record_t cal;
+static uint8_t calibrated = 0;
+
+// Candidate `index` in sweep order: normal then strong drive, gain up,
+// then threshold up
+static void RfidCal_Candidate(uint8_t index, rfid_rf_config_t *config) {
+    static const rfid_rf_config_t defaults = RFID_RF_CONFIG_DEFAULT;
+    uint8_t min_level = cal_min_levels[index % RFID_CAL_LEVELS];
+    uint8_t gain = cal_gains[(index / RFID_CAL_LEVELS) % RFID_CAL_GAINS];
+    uint8_t strong = index / (RFID_CAL_LEVELS * RFID_CAL_GAINS);
+
+    *config = defaults;
+    config->rf_cfg = (uint8_t)((defaults.rf_cfg & 0x8F) | (gain << 4));
+    config->rx_threshold = (uint8_t)((defaults.rx_threshold & 0x0F) | (min_level << 4));
+    if (strong) {
+        config->cw_gs_p = RFID_CAL_GS_P_STRONG;
+        config->gs_n = RFID_CAL_GS_N_STRONG;
+    }
+}
+
+// Reads by the candidates one gain or MinLevel step away at the same
+// drive. A setting inside the region that reads the card well scores
+// high, one on its edge low.
+static uint16_t RfidCal_Margin(const uint8_t *scores, uint8_t index) {
+    uint8_t level = index % RFID_CAL_LEVELS;
+    uint8_t gain = (index / RFID_CAL_LEVELS) % RFID_CAL_GAINS;
+    uint16_t margin = 0;
+
+    if (level > 0) margin += scores[index - 1];
+    if (level + 1 < RFID_CAL_LEVELS) margin += scores[index + 1];
+    if (gain > 0) margin += scores[index - RFID_CAL_LEVELS];
+    if (gain + 1 < RFID_CAL_GAINS) margin += scores[index + RFID_CAL_LEVELS];
+    return margin;
+}
+
+// Sweep in progress, one step per run of the rfid task
+typedef enum {
+    CAL_IDLE = 0,
+    CAL_PROBE,                          // A poller probe in flight ends first
+    CAL_FIELD_OFF,                      // Cards lose power
+    CAL_FIELD_ON,                       // Cards power up
+    CAL_START,                          // Card check to start
+    CAL_CHECK                           // Card check in flight
+} cal_state_t;
+
+static uint8_t cal_task = SCHEDULER_INVALID_TASK;
+static cal_state_t state = CAL_IDLE;
+static rfid_rf_config_t previous;
+static rfid_card_t reference;
+static uint8_t scores[RFID_CAL_CANDIDATES];
+static uint8_t candidate;
+static uint8_t reads;
+
+// Interrupt context
+static void RfidCal_CheckDone(void) {
+    Scheduler_TriggerFromISR(cal_task);
+}
+
+static void RfidCal_Next(cal_state_t next, uint32_t delay_ms) {
+    state = next;
+    Scheduler_SetPeriod(cal_task, delay_ms);
+}
+
+// 1 if the reference card is among those read; the first card read
+// becomes the reference
+static uint8_t RfidCal_IsReference(const rfid_card_t *cards, uint8_t count) {
+    if (reference.size == 0) reference = cards[0];
+
+    for (uint8_t i = 0; i < count; i++) {
+        if (cards[i].size == reference.size &&
+            memcmp(cards[i].uid, reference.uid, reference.size) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Best candidate in use and stored; without a card in the field the
+// settings stay as they were
+static rfid_cal_status_t RfidCal_Finish(void) {
+    rfid_cal_record_t result = {0};
+    uint8_t chosen = RFID_CAL_DEFAULTS;
+
+    state = CAL_IDLE;
+    RFID_SetAntenna(0);
+    RfidPoll_Reset();
+
+    if (reference.size == 0) {
+        RFID_SetRfConfig(&previous);
+        return RFID_CAL_FAILED;
+    }
+
+    // Most reads first; among settings that tie, often all at 10/10, the
+    // one deepest inside the passing region, and the defaults over an equal
+    for (uint8_t i = 0; i < RFID_CAL_CANDIDATES; i++) {
+        if (scores[i] > scores[chosen] ||
+            (scores[i] == scores[chosen] &&
+             RfidCal_Margin(scores, i) > RfidCal_Margin(scores, chosen))) {
+            chosen = i;
+        }
+    }
+    RfidCal_Candidate(chosen, &result.config);
+    result.reads = RFID_CAL_READS;
+    result.candidates = RFID_CAL_CANDIDATES;
+    result.best = scores[chosen];
+    result.baseline = scores[RFID_CAL_DEFAULTS];
+
+    RFID_SetRfConfig(&result.config);
+    cal = result;
+    calibrated = 1;
+    if (!Storage_Save(STORAGE_ID_RFID_CAL, &cal, sizeof(cal))) {
+        LOG_WARNING("RF calibration not stored\n");
+    }
+    return RFID_CAL_DONE;
+}
+
+// A cold read is done; on to the next, or the next candidate
+static rfid_cal_status_t RfidCal_ReadDone(uint8_t hit) {
+    rfid_rf_config_t config;
+
+    scores[candidate] += hit;
+    if (++reads < RFID_CAL_READS) {
+        RfidCal_Next(CAL_FIELD_OFF, 1);
+        return RFID_CAL_RUNNING;
+    }
+
+    RFID_GetRfConfig(&config);
+    LOG_DEBUG("RF cal: gain %u dB, MinLevel %u, CWGsP 0x%02X: %u/%u\n",
+              RFID_RxGainDb(config.rf_cfg), RFID_MIN_LEVEL(config.rx_threshold),
+              config.cw_gs_p, scores[candidate], RFID_CAL_READS);
+
+    reads = 0;
+    if (++candidate >= RFID_CAL_CANDIDATES) {
+        return RfidCal_Finish();
+    }
+    RfidCal_Candidate(candidate, &config);
+    RFID_SetRfConfig(&config);
+    RfidCal_Next(CAL_FIELD_OFF, 1);
+    return RFID_CAL_RUNNING;
+}
+
+// Stored settings, if any, replace the reset values
+void RfidCal_Init(void) {
+    state = CAL_IDLE;
+    calibrated = Storage_Load(STORAGE_ID_RFID_CAL, &cal, sizeof(cal));
+    if (calibrated) {
+        RFID_SetRfConfig(&cal.config);
+    }
+}
+
+// The task that calls RfidCal_Service; a sweep sets its period
+void RfidCal_SetTask(uint8_t task_id) {
+    cal_task = task_id;
+}
+
+// Begin a sweep, which takes the reader over from the poller for a few
+// seconds; 0 if one is already running
+uint8_t RfidCal_Start(void) {
+    if (state != CAL_IDLE) return 0;
+
+    RFID_GetRfConfig(&previous);
+    memset(&reference, 0, sizeof(reference));
+    memset(scores, 0, sizeof(scores));
+    candidate = 0;
+    reads = 0;
+    state = CAL_PROBE;
+    Scheduler_Trigger(cal_task);
+    return 1;
+}
+
+uint8_t RfidCal_IsActive(void) {
+    return state != CAL_IDLE;
+}
+
+// One step of the sweep, run from the task in place of the poller. Each
+// cold read starts the way a tap does: field off for RFID_CAL_OFF_MS, on
+// for RFID_POLL_SETTLE_MS, then a card check. The other tasks run between
+// the steps.
+rfid_cal_status_t RfidCal_Service(void) {
+    rfid_card_t cards[RFID_MAX_CARDS];
+    rfid_rf_config_t config;
+    uint8_t count = 0;
+    rfid_check_t result;
+
+    switch (state) {
+        case CAL_PROBE:
+            // The probe's result is dropped
+            if (RFID_GetCardCheck(NULL, NULL) == RFID_CHECK_BUSY) {
+                RfidCal_Next(CAL_PROBE, 1);
+                break;
+            }
+            RfidCal_Candidate(candidate, &config);
+            RFID_SetRfConfig(&config);
+            RfidCal_Next(CAL_FIELD_OFF, 1);
+            break;
+
+        case CAL_FIELD_OFF:
+            RFID_SetAntenna(0);
+            RfidCal_Next(CAL_FIELD_ON, RFID_CAL_OFF_MS);
+            break;
+
+        case CAL_FIELD_ON:
+            RFID_SetAntenna(1);
+            RfidCal_Next(CAL_START, RFID_POLL_SETTLE_MS);
+            break;
+
+        case CAL_START:
+            if (!RFID_StartCardCheck(RfidCal_CheckDone, 1)) {
+                RfidCal_Next(CAL_START, 1);     // Reader busy; try again shortly
+                break;
+            }
+            RfidCal_Next(CAL_CHECK, RFID_SCAN_INTERVAL_MS);  // Backstop, completion triggers
+            break;
+
+        case CAL_CHECK:
+            result = RFID_GetCardCheck(cards, &count);
+            if (result == RFID_CHECK_BUSY) break;
+            return RfidCal_ReadDone(result == RFID_CHECK_CARD && RfidCal_IsReference(cards, count));
+
+        case CAL_IDLE:
+            break;
+    }
+    return RFID_CAL_RUNNING;
+}
+
+// Settings in use and the read success behind them, for the RFID command
+int RfidCal_Format(char *buffer, size_t size) {
+    rfid_rf_config_t config;
+    rfid_read_stats_t stats;
+
+    RFID_GetRfConfig(&config);
+    RFID_GetReadStats(&stats);
+
+    int len = snprintf(buffer, size, "RF: gain %udB, MinLevel %u, CWGsP 0x%02X, ",
+                       RFID_RxGainDb(config.rf_cfg), RFID_MIN_LEVEL(config.rx_threshold),
+                       config.cw_gs_p);
+    if (len < 0 || (size_t)len >= size) return len;
+
+    if (calibrated) {
+        len += snprintf(buffer + len, size - len, "Cal: %u/%u (defaults %u/%u), ",
+                        cal.best, cal.reads, cal.baseline, cal.reads);
+    } else {
+        len += snprintf(buffer + len, size - len, "Cal: none, ");
+    }
+    if (len < 0 || (size_t)len >= size) return len;
+
+    return len + snprintf(buffer + len, size - len, "Reads: %lu/%lu",
+                          (unsigned long)stats.read, (unsigned long)stats.answered);
+}
@@ -0,0 +1,66 @@
+#include "rfid_health.h"
+#include "config.h"
+#include "utils.h"
+
+static uint32_t next_check = 0;
+static uint32_t retry_ms = RFID_HEALTH_RETRY_MS;
+static uint32_t checked_faults = 0;     // Faults and errors at the last read-back
+static uint8_t down = 0;
+
+static uint32_t checks = 0;
+static uint32_t failures = 0;
+static uint32_t recoveries = 0;
+
+// Run from a task, outside card checks. Returns 1 when a failed chip was
+// found, whether or not the re-init brought it back; not again for the
+// retries while it stays down.
+uint8_t RfidHealth_Service(void) {
+    rfid_link_stats_t link;
+    uint32_t now = get_tick_count();
+
+    RFID_GetLinkStats(&link);
+    uint32_t total = link.faults + link.errors;
+    uint8_t suspect = link.consecutive >= RFID_HEALTH_FAULT_LIMIT &&
+                      total - checked_faults >= RFID_HEALTH_FAULT_LIMIT;
+
+    if (!deadline_reached(next_check) && (down || !suspect)) return 0;
+    if (!RFID_IsIdle()) return 0;   // Next time round
+
+    checks++;
+    checked_faults = total;
+    if (!down && RFID_CheckRegisters()) {
+        next_check = now + RFID_HEALTH_CHECK_MS;
+        return 0;
+    }
+
+    uint8_t found = !down;
+    if (found) {
+        failures++;
+        LOG_WARNING("RC522 not responding after %u failed transceives\n", link.consecutive);
+    }
+
+    if (RFID_Recover()) {
+        recoveries++;
+        down = 0;
+        retry_ms = RFID_HEALTH_RETRY_MS;
+        next_check = get_tick_count() + RFID_HEALTH_CHECK_MS;
+        LOG_INFO("RC522 re-initialized\n");
+    } else {
+        down = 1;
+        next_check = get_tick_count() + retry_ms;
+        retry_ms = (retry_ms * 2 < RFID_HEALTH_RETRY_MAX_MS) ? retry_ms * 2 : RFID_HEALTH_RETRY_MAX_MS;
+    }
+    return found;
+}
+
+void RfidHealth_GetStats(rfid_health_stats_t *stats) {
+    rfid_link_stats_t link;
+
+    RFID_GetLinkStats(&link);
+    stats->checks = checks;
+    stats->failures = failures;
+    stats->recoveries = recoveries;
+    stats->faults = link.faults;
+    stats->errors = link.errors;
+    stats->down = down;
+}
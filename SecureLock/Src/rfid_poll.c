@@ -0,0 +1,172 @@
+#include "rfid_poll.h"
+#include "config.h"
+#include "scheduler.h"
+#include "utils.h"
+
+typedef enum {
+    POLL_WAIT = 0,                      // For the next probe
+    POLL_SETTLE,                        // Field on, a card powering up
+    POLL_CHECK                          // Card check in flight
+} poll_phase_t;
+
+static uint8_t poll_task = SCHEDULER_INVALID_TASK;
+static uint8_t phase = POLL_WAIT;
+static uint32_t interval_ms = RFID_POLL_FAST_MS;
+static uint32_t cycle_start = 0;        // Tick the probe began, field-on included
+static uint32_t probe_start = 0;        // Tick its card check started
+static uint32_t last_empty = 0;         // Check start of the last probe that found nothing
+static uint32_t hold_until = 0;         // Field stays on until then
+static uint8_t pulsed = 0;              // Field switched on for this probe only
+
+static uint64_t field_on_us = 0;        // 0 while the field is off
+static uint64_t field_total_us = 0;
+static uint32_t pulse_avg_us = 0;       // Smoothed length of one probe pulse
+
+static uint32_t probes = 0;
+static uint32_t hits = 0;
+static uint64_t latency_total_ms = 0;
+
+static void RfidPoll_Schedule(uint32_t period_ms) {
+    Scheduler_SetPeriod(poll_task, period_ms);
+}
+
+static void RfidPoll_Field(uint8_t on) {
+    uint64_t now = get_time_us();
+
+    if (on && field_on_us == 0) {
+        RFID_SetAntenna(1);
+        field_on_us = now ? now : 1;
+    } else if (!on && field_on_us != 0) {
+        RFID_SetAntenna(0);
+        uint32_t length = (uint32_t)(now - field_on_us);
+        field_total_us += length;
+        field_on_us = 0;
+
+        // Only probe pulses tell what polling an empty field costs
+        if (pulsed) {
+            pulse_avg_us = pulse_avg_us ? (pulse_avg_us * 7 + length) / 8 : length;
+        }
+    }
+}
+
+// Shortest interval the duty budget allows, within the latency target
+static uint32_t RfidPoll_IdleInterval(void) {
+    uint32_t interval = pulse_avg_us / RFID_POLL_POWER_TARGET;     // us per mille = ms
+
+    if (interval < RFID_POLL_FAST_MS) interval = RFID_POLL_FAST_MS;
+    if (interval > RFID_SCAN_INTERVAL_MS) interval = RFID_SCAN_INTERVAL_MS;
+    return interval;
+}
+
+// `task_id` is the task that calls RfidPoll_Service; its period follows
+// the polling
+void RfidPoll_Init(uint8_t task_id) {
+    poll_task = task_id;
+    phase = POLL_WAIT;
+    interval_ms = RFID_POLL_FAST_MS;
+    hold_until = get_tick_count();
+    pulsed = 0;
+
+    RFID_SetAntenna(0);
+    field_on_us = 0;
+    field_total_us = 0;
+    pulse_avg_us = 0;
+
+    probes = 0;
+    hits = 0;
+    latency_total_ms = 0;
+}
+
+// Run from the polling task: switch the field on and come back once a card
+// could answer, then start the card check. `done` and `wake` are as for
+// RFID_StartCardCheck; the result goes to RfidPoll_CheckDone.
+void RfidPoll_Service(rfid_check_cb_t done, uint8_t wake) {
+    uint32_t now = get_tick_count();
+
+    if (phase == POLL_CHECK) return;
+
+    if (phase == POLL_WAIT) {
+        cycle_start = now;
+        if (field_on_us == 0) {
+            pulsed = 1;
+            RfidPoll_Field(1);
+            phase = POLL_SETTLE;
+            RfidPoll_Schedule(RFID_POLL_SETTLE_MS);
+            return;
+        }
+    }
+
+    if (!RFID_StartCardCheck(done, wake)) {
+        // Reader busy with a blocking check; try again shortly
+        RfidPoll_Schedule(RFID_POLL_FAST_MS);
+        return;
+    }
+    probes++;
+    probe_start = now;
+    phase = POLL_CHECK;
+    RfidPoll_Schedule(RFID_SCAN_INTERVAL_MS);  // Backstop, CheckDone sets the release
+}
+
+// Result of the card check started by RfidPoll_Service; `hit` when a card
+// new to the field was read
+void RfidPoll_CheckDone(uint8_t hit) {
+    uint32_t now = get_tick_count();
+
+    if (phase != POLL_CHECK) return;
+    phase = POLL_WAIT;
+
+    if (hit) {
+        // The card came some time after the last probe that missed it
+        uint32_t gap = last_empty ? probe_start - last_empty : interval_ms;
+        hits++;
+        latency_total_ms += gap / 2 + (now - probe_start);
+
+        interval_ms = RFID_POLL_FAST_MS;
+        hold_until = now + RFID_POLL_HOLD_MS;
+        pulsed = 0;
+    } else {
+        last_empty = probe_start;
+        if (deadline_reached(hold_until)) {
+            uint32_t idle = RfidPoll_IdleInterval();
+            RfidPoll_Field(0);
+            interval_ms = (interval_ms * 2 < idle) ? interval_ms * 2 : idle;
+        }
+    }
+
+    // The next probe begins one interval after this one did
+    uint32_t elapsed = now - cycle_start;
+    Scheduler_Delay(poll_task, (interval_ms > elapsed) ? interval_ms - elapsed : 0);
+}
+
+// No probes, field off, until RfidPoll_Service is called again
+void RfidPoll_Suspend(void) {
+    if (phase == POLL_CHECK) return;   // Its CheckDone comes first
+
+    pulsed = 0;
+    RfidPoll_Field(0);
+    phase = POLL_WAIT;
+    interval_ms = RfidPoll_IdleInterval();
+    RfidPoll_Schedule(RFID_SCAN_INTERVAL_MS);
+}
+
+// The reader was used past the poller and any probe result consumed (RF
+// calibration): start over from an empty field
+void RfidPoll_Reset(void) {
+    pulsed = 0;
+    RfidPoll_Field(0);
+    RFID_SetAntenna(0);
+    phase = POLL_WAIT;
+    interval_ms = RfidPoll_IdleInterval();
+    RfidPoll_Schedule(interval_ms);
+}
+
+void RfidPoll_GetStats(rfid_poll_stats_t *stats) {
+    uint64_t now = get_time_us();
+    uint64_t on_us = field_total_us + (field_on_us ? now - field_on_us : 0);
+
+    stats->probes = probes;
+    stats->hits = hits;
+    stats->latency_avg_ms = hits ? (uint32_t)(latency_total_ms / hits) : 0;
+    stats->interval_ms = interval_ms;
+    stats->duty_permille = now ? (uint32_t)(on_us * 1000ULL / now) : 0;
+}
@@ -0,0 +1,104 @@
+#include "rfid_presence.h"
+#include "trace.h"
+#include <string.h>
+
+typedef struct {
+    rfid_card_t card;
+    uint8_t misses;             // Checks in a row without it
+} presence_entry_t;
+
+static presence_entry_t present[RFID_MAX_CARDS];
+static uint8_t present_count = 0;
+static uint8_t since_wake = 0;          // Checks since the last waking one
+
+static rfid_event_t events[RFID_PRESENCE_QUEUE_SIZE];
+static uint8_t event_head = 0;
+static uint8_t event_tail = 0;
+
+// The oldest event makes room when nobody has been reading them
+static void RfidPresence_Post(uint8_t type, const rfid_card_t *card) {
+    uint8_t next = (event_head + 1) & (RFID_PRESENCE_QUEUE_SIZE - 1);
+
+    if (next == event_tail) {
+        event_tail = (event_tail + 1) & (RFID_PRESENCE_QUEUE_SIZE - 1);
+    }
+    events[event_head].type = type;
+    events[event_head].card = *card;
+    event_head = next;
+
+    TRACE(TRACE_EV_CARD, type == RFID_EVENT_ENTER, (card->uid[0] << 8) | card->uid[1]);
+}
+
+static uint8_t RfidPresence_SameCard(const rfid_card_t *a, const rfid_card_t *b) {
+    return a->size == b->size && memcmp(a->uid, b->uid, a->size) == 0;
+}
+
+void RfidPresence_Init(void) {
+    present_count = 0;
+    since_wake = 0;
+    event_head = event_tail = 0;
+}
+
+// 1 when the next card check has to wake halted cards
+uint8_t RfidPresence_WakeDue(void) {
+    if (present_count == 0) return 0;
+    if (since_wake + 1 >= RFID_PRESENCE_CONFIRM_CHECKS) return 1;
+
+    for (uint8_t i = 0; i < present_count; i++) {
+        if (present[i].misses) return 1;
+    }
+    return 0;
+}
+
+// Feed the cards read by one check, none when nothing answered. The check
+// was started as RfidPresence_WakeDue asked, and only this changes what it
+// says, so it still tells whether halted cards had to answer.
+void RfidPresence_Update(const rfid_card_t *cards, uint8_t count) {
+    uint8_t seen[RFID_MAX_CARDS] = {0};
+    uint8_t woke = RfidPresence_WakeDue();
+
+    since_wake = woke ? 0 : since_wake + 1;
+
+    for (uint8_t i = 0; i < present_count; ) {
+        uint8_t found = 0;
+
+        for (uint8_t j = 0; j < count; j++) {
+            if (RfidPresence_SameCard(&present[i].card, &cards[j])) {
+                seen[j] = 1;
+                found = 1;
+            }
+        }
+
+        if (found) {
+            present[i].misses = 0;
+        } else if (woke && ++present[i].misses >= RFID_PRESENCE_MISSES) {
+            RfidPresence_Post(RFID_EVENT_LEAVE, &present[i].card);
+            present[i] = present[--present_count];
+            continue;
+        }
+        i++;
+    }
+
+    for (uint8_t j = 0; j < count; j++) {
+        if (seen[j] || present_count >= RFID_MAX_CARDS) continue;
+
+        present[present_count].card = cards[j];
+        present[present_count].misses = 0;
+        present_count++;
+        RfidPresence_Post(RFID_EVENT_ENTER, &cards[j]);
+    }
+}
+
+// Next event, oldest first; 0 when there is none
+uint8_t RfidPresence_GetEvent(rfid_event_t *event) {
+    if (event_tail == event_head) return 0;
+
+    *event = events[event_tail];
+    event_tail = (event_tail + 1) & (RFID_PRESENCE_QUEUE_SIZE - 1);
+    return 1;
+}
+
+// Cards in the field as of the last check
+uint8_t RfidPresence_GetCount(void) {
+    return present_count;
+}
@@ -0,0 +1,174 @@
+#include "scheduler.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+
+static task_t tasks[SCHEDULER_MAX_TASKS];
+static uint8_t task_count = 0;
+static volatile uint32_t triggered = 0;    // Task bits set from interrupts
+
+void Scheduler_Init(void) {
+    memset(tasks, 0, sizeof(tasks));
+    task_count = 0;
+    triggered = 0;
+}
+
+uint8_t Scheduler_AddTask(const char *name, task_fn_t function, uint32_t period_ms,
+                          uint32_t deadline_ms, task_priority_t priority) {
+    if (task_count >= SCHEDULER_MAX_TASKS || function == NULL) {
+        return SCHEDULER_INVALID_TASK;
+    }
+
+    task_t *task = &tasks[task_count];
+    memset(task, 0, sizeof(*task));
+    task->name = name;
+    task->function = function;
+    task->period_ms = period_ms;
+    task->deadline_ms = deadline_ms ? deadline_ms : period_ms;
+    task->priority = priority;
+    task->enabled = 1;
+    task->next_release = period_ms ? get_tick_count64() : UINT64_MAX;
+
+    return task_count++;
+}
+
+// Pick the due task with the highest priority, then the earliest deadline
+static task_t *Scheduler_SelectTask(uint64_t now) {
+    task_t *best = NULL;
+
+    for (uint8_t i = 0; i < task_count; i++) {
+        task_t *task = &tasks[i];
+        if (!task->enabled || task->next_release > now) continue;
+
+        if (best == NULL || task->priority < best->priority ||
+            (task->priority == best->priority &&
+             task->next_release + task->deadline_ms < best->next_release + best->deadline_ms)) {
+            best = task;
+        }
+    }
+    return best;
+}
+
+static void Scheduler_Execute(task_t *task) {
+    uint64_t release_us = task->next_release * 1000ULL;
+    uint64_t start_us = get_time_us();
+
+    task->function();
+
+    uint64_t end_us = get_time_us();
+    uint32_t run_us = (uint32_t)(end_us - start_us);
+    uint32_t latency_us = (end_us > release_us) ? (uint32_t)(end_us - release_us) : 0;
+
+    task->run_count++;
+    task->last_run_us = run_us;
+    task->total_run_us += run_us;
+    if (run_us > task->max_run_us) task->max_run_us = run_us;
+    if (latency_us > task->max_latency_us) task->max_latency_us = latency_us;
+    if (task->deadline_ms && latency_us > task->deadline_ms * 1000UL) {
+        task->deadline_misses++;
+    }
+
+    // Schedule the next release; skip periods that were overrun entirely
+    if (task->period_ms) {
+        uint64_t now = end_us / 1000ULL;
+        task->next_release += task->period_ms;
+        if (task->next_release <= now) {
+            task->next_release = now + task->period_ms;
+        }
+    } else {
+        task->next_release = UINT64_MAX;
+    }
+}
+
+// Release the tasks triggered from interrupts since the last pass
+static void Scheduler_ApplyTriggers(void) {
+    uint32_t pending = __atomic_exchange_n(&triggered, 0, __ATOMIC_RELAXED);
+
+    for (uint8_t i = 0; pending != 0; i++, pending >>= 1) {
+        if (pending & 1) tasks[i].next_release = get_tick_count64();
+    }
+}
+
+void Scheduler_RunPending(void) {
+    task_t *task;
+
+    for (;;) {
+        Scheduler_ApplyTriggers();
+        if ((task = Scheduler_SelectTask(get_tick_count64())) == NULL) break;
+        Scheduler_Execute(task);
+    }
+}
+
+uint64_t Scheduler_NextRelease(void) {
+    uint64_t next = UINT64_MAX;
+
+    if (triggered) return get_tick_count64();
+
+    for (uint8_t i = 0; i < task_count; i++) {
+        if (tasks[i].enabled && tasks[i].next_release < next) {
+            next = tasks[i].next_release;
+        }
+    }
+    return next;
+}
+
+void Scheduler_SetEnabled(uint8_t task_id, uint8_t enabled) {
+    if (task_id >= task_count) return;
+
+    tasks[task_id].enabled = enabled;
+    if (enabled && tasks[task_id].period_ms) {
+        tasks[task_id].next_release = get_tick_count64();
+    }
+}
+
+void Scheduler_Trigger(uint8_t task_id) {
+    if (task_id >= task_count) return;
+    tasks[task_id].next_release = get_tick_count64();
+}
+
+// Interrupt-safe trigger; the task is released on the next scheduler pass
+void Scheduler_TriggerFromISR(uint8_t task_id) {
+    if (task_id >= task_count) return;
+    __atomic_fetch_or(&triggered, 1UL << task_id, __ATOMIC_RELAXED);
+}
+
+void Scheduler_Delay(uint8_t task_id, uint32_t delay_ms) {
+    if (task_id >= task_count) return;
+    tasks[task_id].next_release = get_tick_count64() + delay_ms;
+}
+
+// Takes effect from the next release on; a task may change its own period
+void Scheduler_SetPeriod(uint8_t task_id, uint32_t period_ms) {
+    if (task_id >= task_count) return;
+    tasks[task_id].period_ms = period_ms;
+}
+
+uint8_t Scheduler_GetTaskCount(void) {
+    return task_count;
+}
+
+const task_t *Scheduler_GetTask(uint8_t task_id) {
+    return (task_id < task_count) ? &tasks[task_id] : NULL;
+}
+
+void Scheduler_ResetStats(void) {
+    for (uint8_t i = 0; i < task_count; i++) {
+        tasks[i].run_count = 0;
+        tasks[i].last_run_us = 0;
+        tasks[i].max_run_us = 0;
+        tasks[i].total_run_us = 0;
+        tasks[i].max_latency_us = 0;
+        tasks[i].deadline_misses = 0;
+    }
+}
+
+int Scheduler_FormatStats(uint8_t task_id, char *buffer, size_t size) {
+    const task_t *task = Scheduler_GetTask(task_id);
+    if (task == NULL) return 0;
+
+    uint32_t avg_us = task->run_count ? (uint32_t)(task->total_run_us / task->run_count) : 0;
+    return snprintf(buffer, size, "%s: runs=%lu avg=%luus max=%luus lat=%luus miss=%lu",
+                    task->name, (unsigned long)task->run_count, (unsigned long)avg_us,
+                    (unsigned long)task->max_run_us, (unsigned long)task->max_latency_us,
+                    (unsigned long)task->deadline_misses);
+}
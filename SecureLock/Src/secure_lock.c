@@ -2,22 +2,41 @@
 #include "stm32f407xx_registers.h"
 #include "config.h"
 #include "keypad.h"
+#include "keypad_cal.h"
+#include "pin_entry.h"
 #include "rfid.h"
+#include "rfid_poll.h"
+#include "rfid_presence.h"
+#include "rfid_cal.h"
 #include "wifi.h"
 #include "aes.h"
 #include "sha256.h"
+#include "led.h"
+#include "scheduler.h"
+#include "clock.h"
+#include "profile.h"
+#include "trace.h"
 #include "utils.h"
 #include <stdio.h>
 #include <string.h>
 
 // Current security state
 static system_state_t current_state = STATE_IDLE;
-static uint8_t current_uid[4];
+static uint8_t current_uid[MAX_RFID_UID_LENGTH];
+static uint8_t current_uid_size = 0;
 static uint8_t current_user_id = 0xFF;
 static uint8_t failed_attempts = 0;
 static uint32_t last_activity_time = 0;
 static uint32_t lockout_end_time = 0;
 
+// Unlock window, closed by the relay task instead of blocking
+static uint8_t relay_task = SCHEDULER_INVALID_TASK;
+static uint64_t unlock_start_time = 0;
+static uint64_t unlock_end_time = 0;
+
+// One-shot task that takes a card check result from interrupt context
+static uint8_t card_task = SCHEDULER_INVALID_TASK;
+
 // AES encryption key
 static const uint8_t aes_key[16] = DEFAULT_AES_KEY;
 
@@ -26,86 +45,260 @@ static const user_t users[] = {
     // Admin user (UID: 12 34 56 78, PIN: 1234)
     {
         .uid = {0x12, 0x34, 0x56, 0x78},
-        .pin_hash = {0x5e, 0x88, 0x48, 0x98, 0xd6, 0xbd, 0x08, 0x84,
-                    0xe3, 0x03, 0xcb, 0xbc, 0x4c, 0x3f, 0x9a, 0x5b,
-                    0x1f, 0x3d, 0x5b, 0x8a, 0x9a, 0x2f, 0x4a, 0x7d,
-                    0x8f, 0x8f, 0x3c, 0x5c, 0x3d, 0x3a, 0x1c, 0xcc},
+        .uid_size = 4,
+        .pin_salt = {0x45, 0xfd, 0x90, 0x11, 0x90, 0x4e, 0x22, 0xcc,
+                    0x88, 0xed, 0x14, 0x4b, 0xce, 0x49, 0xd5, 0x6c,
+                    0x76, 0x2f, 0x6e, 0x68, 0x54, 0x86, 0xb0, 0x75,
+                    0x98, 0x71, 0xea, 0x82, 0xb7, 0x12, 0x9d, 0x21,
+                    0xff, 0xe8, 0x50, 0xef, 0xc1, 0xf4, 0xfe, 0x59,
+                    0xef, 0xdb, 0x21, 0xa5, 0x9c, 0x0b, 0x98, 0xe4,
+                    0xf4, 0x64, 0x49, 0x23, 0xca, 0x0b, 0xc8, 0x8d,
+                    0x6c, 0x9a, 0xf0, 0x45, 0x7e, 0xbc, 0x72, 0x2e},
+        .pin_hash = {0x0f, 0xa9, 0xa5, 0x74, 0x95, 0x7e, 0xd0, 0x5c,
+                    0x26, 0x73, 0xb1, 0x7b, 0x8b, 0x18, 0xfb, 0xc0,
+                    0xa2, 0xf6, 0x45, 0xae, 0x7b, 0x26, 0x91, 0x1e,
+                    0xec, 0x4f, 0xb3, 0x2e, 0xf0, 0x3f, 0x48, 0x5d},
         .privileges = 0xFF
     },
     // Regular user (UID: AB CD EF 01, PIN: 0000)
     {
         .uid = {0xAB, 0xCD, 0xEF, 0x01},
-        .pin_hash = {0x03, 0xac, 0x67, 0x42, 0x16, 0xf3, 0xe1, 0x5c,
-                    0x76, 0x1e, 0xe1, 0x88, 0x4b, 0xfd, 0x97, 0x7c,
-                    0x4c, 0x17, 0x73, 0xb3, 0xbb, 0x04, 0x3e, 0x8f,
-                    0x66, 0xcb, 0x7f, 0x8e, 0xfe, 0x1f, 0x7c, 0x8a},
+        .uid_size = 4,
+        .pin_salt = {0xda, 0xab, 0x82, 0x6e, 0xf8, 0xba, 0x0e, 0xf1,
+                    0x5b, 0x82, 0xaa, 0x2f, 0x3d, 0xe3, 0x39, 0x59,
+                    0x69, 0xcf, 0x5c, 0x24, 0x75, 0x5d, 0x21, 0x49,
+                    0xc3, 0x5a, 0x2d, 0xba, 0x34, 0xaf, 0x2b, 0x97,
+                    0x39, 0x49, 0x1a, 0x12, 0xfe, 0xd1, 0x9d, 0xc8,
+                    0xb5, 0x12, 0xd4, 0xfa, 0x6f, 0x1c, 0x10, 0xe0,
+                    0xad, 0x8b, 0xc2, 0xd1, 0x97, 0x94, 0x67, 0xc7,
+                    0x4b, 0x8a, 0xb6, 0xc9, 0xff, 0x1d, 0x91, 0xe5},
+        .pin_hash = {0xb8, 0x0a, 0xf4, 0x06, 0x43, 0x38, 0xf3, 0x52,
+                    0xdb, 0x54, 0x26, 0xea, 0x5b, 0x31, 0xda, 0xeb,
+                    0xa6, 0x8e, 0x87, 0x3b, 0x57, 0x53, 0x4c, 0x60,
+                    0xc5, 0x1c, 0x3c, 0x8a, 0xa6, 0xc5, 0x49, 0xda},
         .privileges = 0x0F
     }
 };
 
+static void SecureLock_SetState(system_state_t state) {
+    TRACE(TRACE_EV_STATE, state, current_state);
+    current_state = state;
+}
+
 void SecureLock_Init(void) {
-    current_state = STATE_IDLE;
+    SecureLock_SetState(STATE_IDLE);
     failed_attempts = 0;
     current_user_id = 0xFF;
     memset(current_uid, 0, sizeof(current_uid));
+    current_uid_size = 0;
+
+    // One-shot task that releases the relay when the unlock window closes
+    relay_task = Scheduler_AddTask("relay", SecureLock_ReleaseLock, 0, 0, TASK_PRIORITY_HIGH);
+    card_task = Scheduler_AddTask("card", SecureLock_ServiceCard, 0, 0, TASK_PRIORITY_HIGH);
+    RfidPresence_Init();
 
     // Initialize security peripherals
     RFID_Init();
+    RfidCal_Init();
     Keypad_Init();
+    KeypadCal_Init();
     WIFI_Init();
 
     SecureLock_LogAccess(0xFF, false, "System initialized");
 }
 
 void SecureLock_Run(void) {
+    SecureLock_ServiceTimeouts();
+    SecureLock_ServiceRFID();
+    SecureLock_ServiceCard();
+    SecureLock_ServiceKeypad();
+}
+
+void SecureLock_ServiceTimeouts(void) {
+    PROFILE_SCOPE(PROF_LOCK_SESSION);
     uint32_t current_time = get_tick_count();
 
     // Check for lockout state
     if (current_state == STATE_LOCKOUT) {
-        if (current_time >= lockout_end_time) {
-            current_state = STATE_IDLE;
+        if (deadline_reached(lockout_end_time)) {
+            SecureLock_SetState(STATE_IDLE);
             failed_attempts = 0;
             SecureLock_LogAccess(0xFF, false, "Lockout period ended");
         }
         return;
     }
 
-    // Check session timeout
-    if (current_state != STATE_IDLE &&
+    // Check PIN entry timeouts: per key and for the whole PIN
+    if (current_state == STATE_PIN_ENTRY && PinEntry_Expired()) {
+        uint8_t user_id = current_user_id;
+        SecureLock_ResetSession();
+        SecureLock_LogAccess(user_id, false, "PIN entry timeout");
+        return;
+    }
+
+    // Check session timeout (an open door is closed by the relay task)
+    if (current_state != STATE_IDLE && current_state != STATE_ACCESS_GRANTED &&
         (current_time - last_activity_time) > SESSION_TIMEOUT_MS) {
         SecureLock_ResetSession();
         SecureLock_LogAccess(current_user_id, false, "Session timeout");
+    }
+}
+
+// Presence probes; a card check runs on interrupts while the other tasks
+// run, and the card task picks up the result. An RF calibration takes the
+// reader over until it is done.
+void SecureLock_ServiceRFID(void) {
+    PROFILE_SCOPE(PROF_LOCK_RFID);
+    char line[144];
+    int len;
+
+    if (RfidCal_IsActive()) {
+        switch (RfidCal_Service()) {
+            case RFID_CAL_DONE:
+                len = snprintf(line, sizeof(line), "RF calibrated. ");
+                RfidCal_Format(line + len, sizeof(line) - len);
+                WIFI_SendLog(line);
+                break;
+            case RFID_CAL_FAILED:
+                WIFI_SendLog("RF calibration failed: no card");
+                break;
+            case RFID_CAL_RUNNING:
+                break;
+        }
         return;
     }
 
-    // Process RFID scanning
-    uint8_t uid[4];
-    uint8_t uid_size;
-    if (RFID_CheckForCard(uid, &uid_size)) {
-        SecureLock_ProcessRFID(uid);
-        last_activity_time = current_time;
+    if (current_state == STATE_LOCKOUT) {
+        RfidPoll_Suspend();
+        return;
     }
 
-    // Process keypad input
-    if (current_state == STATE_RFID_SCANNING) {
-        char pin[5];
-        if (Keypad_GetPIN(pin, 4, 5000)) { // 5 second timeout for PIN entry
-            SecureLock_ProcessPIN(pin);
-            last_activity_time = current_time;
+    RfidPoll_Service(SecureLock_CardCheckDone, RfidPresence_WakeDue());
+}
+
+// Interrupt context
+void SecureLock_CardCheckDone(void) {
+    Scheduler_TriggerFromISR(card_task);
+}
+
+void SecureLock_ServiceCard(void) {
+    rfid_card_t cards[RFID_MAX_CARDS];
+    rfid_card_t card;
+    rfid_event_t event;
+    uint8_t count = 0;
+    uint8_t entered = 0;
+
+    // A calibration drops the result of the probe it took the reader from
+    if (RfidCal_IsActive()) return;
+
+    rfid_check_t result = RFID_GetCardCheck(cards, &count);
+    if (result != RFID_CHECK_CARD && result != RFID_CHECK_NO_CARD) return;
+
+    // Only a card new to the field is taken; one held against the reader
+    // stays halted between confirmations and is handled once
+    RfidPresence_Update(cards, (result == RFID_CHECK_CARD) ? count : 0);
+    while (RfidPresence_GetEvent(&event)) {
+        if (event.type == RFID_EVENT_LEAVE) {
+            LOG_DEBUG("Card left the field\n");
+            continue;
+        }
+
+        // With several new cards a registered one wins
+        if (!entered || (SecureLock_ValidateRFID(card.uid, card.size) == 0xFF &&
+                         SecureLock_ValidateRFID(event.card.uid, event.card.size) != 0xFF)) {
+            card = event.card;
         }
+        entered++;
     }
+    RfidPoll_CheckDone(entered != 0);
+
+    if (!entered || current_state == STATE_LOCKOUT) return;
+
+    SecureLock_ProcessRFID(card.uid, card.size);
+    last_activity_time = get_tick_count();
 }
 
-void SecureLock_ProcessRFID(uint8_t *uid) {
-    uint8_t user_id = SecureLock_ValidateRFID(uid);
+// One key press of a PIN; never waits for the next one
+static void SecureLock_ProcessKey(char key) {
+    switch (PinEntry_Feed(key)) {
+        case PIN_ENTRY_DIGIT:
+            LED_Play(LED_BLUE, 50, 50, 1, LED_PRIORITY_FEEDBACK);
+            break;
+        case PIN_ENTRY_ERASED:
+            LED_Play(LED_RED, 100, 100, 1, LED_PRIORITY_FEEDBACK);
+            break;
+        case PIN_ENTRY_IGNORED:
+            LED_Play(LED_ORANGE, 100, 100, 1, LED_PRIORITY_FEEDBACK);
+            break;
+        case PIN_ENTRY_TOO_SHORT:
+            LED_Play(LED_RED, 100, 100, 2, LED_PRIORITY_FEEDBACK);
+            break;
+        case PIN_ENTRY_SUBMIT:
+            SecureLock_ProcessPIN();
+            PinEntry_Clear();
+            break;
+        case PIN_ENTRY_INACTIVE:
+            break;
+    }
+}
+
+// Keys belong to a keypad calibration until it ends
+static void SecureLock_ProcessCalibrationKey(const keypad_event_t *event) {
+    char line[160];
+    int len;
+
+    switch (KeypadCal_Event(event)) {
+        case KEYPAD_CAL_DONE:
+            len = snprintf(line, sizeof(line), "Keypad calibrated. ");
+            KeypadCal_Format(line + len, sizeof(line) - len);
+            WIFI_SendLog(line);
+            break;
+        case KEYPAD_CAL_FAILED:
+            WIFI_SendLog("Keypad calibration failed: too few presses");
+            break;
+        case KEYPAD_CAL_RUNNING:
+            break;
+    }
+}
+
+void SecureLock_ServiceKeypad(void) {
+    PROFILE_SCOPE(PROF_LOCK_KEYPAD);
+    keypad_event_t event;
+
+    // Process keypad input; keys are dropped unless a PIN is wanted
+    while (Keypad_GetEvent(&event)) {
+        if (KeypadCal_IsActive()) {
+            SecureLock_ProcessCalibrationKey(&event);
+            continue;
+        }
+        if (event.type != KEYPAD_EVENT_PRESS || current_state != STATE_PIN_ENTRY) continue;
+
+        SecureLock_ProcessKey(event.key);
+        last_activity_time = get_tick_count();
+    }
+}
+
+void SecureLock_ProcessRFID(const uint8_t *uid, uint8_t uid_size) {
+    uint8_t user_id = SecureLock_ValidateRFID(uid, uid_size);
+
+    // A valid card presented while the door is open keeps it open
+    if (current_state == STATE_ACCESS_GRANTED) {
+        if (user_id != 0xFF && UNLOCK_EXTEND_ENABLED) {
+            SecureLock_ExtendUnlock();
+            SecureLock_LogAccess(user_id, true, "Unlock extended");
+        }
+        return;
+    }
 
     if (user_id != 0xFF) {
-        memcpy(current_uid, uid, 4);
+        memcpy(current_uid, uid, uid_size);
+        current_uid_size = uid_size;
         current_user_id = user_id;
-        current_state = STATE_RFID_SCANNING;
+        SecureLock_SetState(STATE_PIN_ENTRY);
+        PinEntry_Start(users[user_id].pin_salt);
 
         // Visual feedback - blue LED for PIN entry mode
-        led_on(LED_BLUE);
+        LED_SetBase(LED_BLUE, 1);
         SecureLock_LogAccess(user_id, false, "RFID validated, awaiting PIN");
     } else {
         SecureLock_DenyAccess();
@@ -113,15 +306,16 @@ void SecureLock_ProcessRFID(uint8_t *uid) {
     }
 }
 
-void SecureLock_ProcessPIN(char *pin) {
-    if (current_state != STATE_RFID_SCANNING) return;
+// The PIN typed so far was submitted; its hash is all but done
+void SecureLock_ProcessPIN(void) {
+    if (current_state != STATE_PIN_ENTRY) return;
 
-    if (SecureLock_ValidatePIN(pin, (uint8_t *)users[current_user_id].pin_hash)) {
+    if (PinEntry_Verify(users[current_user_id].pin_hash)) {
         SecureLock_GrantAccess();
     } else {
         failed_attempts++;
         if (failed_attempts >= MAX_FAILED_ATTEMPTS) {
-            current_state = STATE_LOCKOUT;
+            SecureLock_SetState(STATE_LOCKOUT);
             lockout_end_time = get_tick_count() + LOCKOUT_TIME_MS;
             SecureLock_LogAccess(current_user_id, false, "Too many failed attempts - LOCKOUT");
         } else {
@@ -131,72 +325,119 @@ void SecureLock_ProcessPIN(char *pin) {
     }
 }
 
-uint8_t SecureLock_ValidateRFID(uint8_t *uid) {
+uint8_t SecureLock_ValidateRFID(const uint8_t *uid, uint8_t uid_size) {
+    if (!IS_VALID_UID_LENGTH(uid_size)) return 0xFF;
+
     for (uint8_t i = 0; i < sizeof(users)/sizeof(users[0]); i++) {
-        if (memcmp(uid, users[i].uid, 4) == 0) {
+        if (uid_size == users[i].uid_size && memcmp(uid, users[i].uid, uid_size) == 0) {
             return i;
         }
     }
     return 0xFF;
 }
 
-uint8_t SecureLock_ValidatePIN(char *pin, uint8_t *stored_hash) {
+// One-shot check of a whole PIN, the same hash as the one built key by key
+uint8_t SecureLock_ValidatePIN(const char *pin, uint8_t user_id) {
     uint8_t computed_hash[32];
     SHA256_CTX ctx;
+    uint8_t match;
+
+    if (user_id >= sizeof(users)/sizeof(users[0])) return 0;
 
-    // Compute SHA-256 hash of entered PIN
+    // Compute SHA-256 of the salted PIN
     sha256_init(&ctx);
-    sha256_update(&ctx, (uint8_t*)pin, strlen(pin));
+    sha256_update(&ctx, users[user_id].pin_salt, PIN_SALT_SIZE);
+    sha256_update(&ctx, (const uint8_t *)pin, strlen(pin));
     sha256_final(&ctx, computed_hash);
 
     // Compare with stored hash
-    return memcmp(computed_hash, stored_hash, 32) == 0;
+    match = secure_memeq(computed_hash, users[user_id].pin_hash, sizeof(computed_hash));
+    secure_wipe(&ctx, sizeof(ctx));
+    secure_wipe(computed_hash, sizeof(computed_hash));
+    return match;
 }
 
 void SecureLock_GrantAccess(void) {
-    current_state = STATE_ACCESS_GRANTED;
+    if (current_state == STATE_ACCESS_GRANTED) {
+        SecureLock_ExtendUnlock();
+        return;
+    }
+
+    SecureLock_SetState(STATE_ACCESS_GRANTED);
     failed_attempts = 0;
 
     // Activate lock relay
     LOCK_RELAY_PORT->BSRR = (1 << LOCK_RELAY_PIN);
 
     // Visual feedback - green LED
-    led_off(LED_BLUE);
-    led_on(LED_GREEN);
+    LED_SetBase(LED_BLUE, 0);
+    LED_SetBase(LED_GREEN, 1);
+
+    // Keep access granted for UNLOCK_DURATION_MS; the relay task closes it
+    unlock_start_time = get_tick_count64();
+    unlock_end_time = unlock_start_time + UNLOCK_DURATION_MS;
+    Scheduler_Delay(relay_task, UNLOCK_DURATION_MS);
 
     SecureLock_LogAccess(current_user_id, true, "Access granted");
+}
+
+void SecureLock_ExtendUnlock(void) {
+    if (current_state != STATE_ACCESS_GRANTED || !UNLOCK_EXTEND_ENABLED) return;
+
+    // Restart the window from now, bounded by the maximum open time
+    uint64_t new_end = get_tick_count64() + UNLOCK_DURATION_MS;
+    uint64_t max_end = unlock_start_time + UNLOCK_MAX_DURATION_MS;
+    if (new_end > max_end) new_end = max_end;
 
-    // Keep access granted for 3 seconds
-    delay_ms(3000);
+    if (new_end > unlock_end_time) {
+        unlock_end_time = new_end;
+        Scheduler_Delay(relay_task, (uint32_t)(unlock_end_time - get_tick_count64()));
+    }
+}
+
+void SecureLock_ReleaseLock(void) {
+    if (current_state != STATE_ACCESS_GRANTED) return;
 
     // Deactivate lock and reset
     LOCK_RELAY_PORT->BSRR = (1 << (LOCK_RELAY_PIN + 16));
-    led_off(LED_GREEN);
+    LED_SetBase(LED_GREEN, 0);
     SecureLock_ResetSession();
 }
 
+uint8_t SecureLock_IsUnlocked(void) {
+    return current_state == STATE_ACCESS_GRANTED;
+}
+
 void SecureLock_DenyAccess(void) {
-    current_state = STATE_ACCESS_DENIED;
+    SecureLock_SetState(STATE_ACCESS_DENIED);
 
     // Visual feedback - red LED blink
-    led_off(LED_BLUE);
-    led_blink(LED_RED, 200, 3);
+    LED_SetBase(LED_BLUE, 0);
+    LED_Play(LED_RED, 200, 200, 3, LED_PRIORITY_ERROR);
 
     SecureLock_ResetSession();
 }
 
 void SecureLock_ResetSession(void) {
-    current_state = STATE_IDLE;
+    SecureLock_SetState(STATE_IDLE);
+    PinEntry_Clear();
     current_user_id = 0xFF;
     memset(current_uid, 0, sizeof(current_uid));
-    led_off(LED_BLUE);
-    led_off(LED_GREEN);
+    current_uid_size = 0;
+    LED_SetBase(LED_BLUE, 0);
+    LED_SetBase(LED_GREEN, 0);
 }
 
 void SecureLock_LogAccess(uint8_t user_id, uint8_t granted, const char *reason) {
+    PROFILE_SCOPE(PROF_LOG_ACCESS);
     char log_message[128];
     char encrypted_message[128];
 
+    TRACE(TRACE_EV_ACCESS, user_id, granted);
+
+    // Format and encrypt at full speed; the UART transfer does not need it
+    Clock_BeginBurst();
+
     // Create log message
     if (user_id == 0xFF) {
         snprintf(log_message, sizeof(log_message), "System: %s", reason);
@@ -207,6 +448,7 @@ void SecureLock_LogAccess(uint8_t user_id, uint8_t granted, const char *reason)
 
     // Encrypt log message
     AES_Encrypt((uint8_t*)log_message, (uint8_t*)encrypted_message, strlen(log_message), (uint8_t*)aes_key);
+    Clock_EndBurst();
 
     // Send encrypted log via WiFi
     WIFI_SendEncryptedLog(encrypted_message, strlen(log_message));
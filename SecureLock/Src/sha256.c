@@ -1,4 +1,6 @@
 #include "sha256.h"
+#include "profile.h"
+#include <string.h>
 
 // SHA-256 implementation for embedded systems
 static const uint32_t k[64] = {
@@ -20,7 +22,8 @@ static const uint32_t k[64] = {
 #define SIG0(x) (ROTRIGHT(x,7) ^ ROTRIGHT(x,18) ^ ((x) >> 3))
 #define SIG1(x) (ROTRIGHT(x,17) ^ ROTRIGHT(x,19) ^ ((x) >> 10))
 
-void sha256_transform(SHA256_CTX *ctx, uint8_t *data) {
+void sha256_transform(SHA256_CTX *ctx, const uint8_t *data) {
+    PROFILE_SCOPE(PROF_SHA256_TRANSFORM);
     uint32_t a, b, c, d, e, f, g, h, i, j, t1, t2, m[64];
 
     for (i = 0, j = 0; i < 16; ++i, j += 4)
@@ -50,7 +53,7 @@ void sha256_init(SHA256_CTX *ctx) {
     ctx->state[6] = 0x1f83d9ab; ctx->state[7] = 0x5be0cd19;
 }
 
-void sha256_update(SHA256_CTX *ctx, uint8_t *data, uint32_t len) {
+void sha256_update(SHA256_CTX *ctx, const uint8_t *data, uint32_t len) {
     uint32_t left = (ctx->total[0] >> 3) & 0x3F;
     uint32_t fill = 64 - left;
     ctx->total[0] += len << 3;
@@ -74,8 +77,9 @@ void sha256_final(SHA256_CTX *ctx, uint8_t *digest) {
     uint32_t last, padn, high, low;
     uint8_t msglen[8];
 
-    high = (ctx->total[0] >> 29) | (ctx->total[1] << 3);
-    low = (ctx->total[0] << 3);
+    // total[] already counts bits
+    high = ctx->total[1];
+    low = ctx->total[0];
 
     msglen[0] = high >> 24; msglen[1] = high >> 16;
     msglen[2] = high >> 8; msglen[3] = high;
@@ -0,0 +1,183 @@
+#include "spi_dma.h"
+#include "stm32f407xx_registers.h"
+#include "config.h"
+#include "utils.h"
+
+#define SPI_DMA_RX_FLAGS           (DMA_FLAG_ALL << DMA_FLAG_SHIFT(SPI_DMA_RX_STREAM))
+#define SPI_DMA_TX_FLAGS           (DMA_FLAG_ALL << DMA_FLAG_SHIFT(SPI_DMA_TX_STREAM))
+
+// Pending frames; the one at queue_tail is on the wire while `active`
+static spi_frame_t *queue[SPI_DMA_QUEUE_SIZE];
+static volatile uint8_t queue_head = 0;
+static volatile uint8_t queue_tail = 0;
+static volatile uint8_t active = 0;
+static volatile uint8_t held = 0;           // No new frame on the wire
+
+static uint8_t rx_discard;                  // RX target for frames without rx
+static uint32_t frame_count = 0;
+
+void SpiDma_Init(void) {
+    RCC->AHB1ENR |= RCC_AHB1ENR_DMA2EN;
+
+    DMA2->STREAM[SPI_DMA_RX_STREAM].CR = 0;
+    DMA2->STREAM[SPI_DMA_TX_STREAM].CR = 0;
+    DMA2->LIFCR = SPI_DMA_RX_FLAGS | SPI_DMA_TX_FLAGS;
+    SPI1->CR2 &= ~(SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN);
+
+    queue_head = queue_tail = 0;
+    active = 0;
+    held = 0;
+    nvic_enable_irq(DMA2_Stream0_IRQn);
+}
+
+// Program both streams for one frame and pull the chip select low. RX is
+// enabled first so no received byte can overrun while TX starts.
+static void SpiDma_Start(spi_frame_t *frame) {
+    DMA_Stream_TypeDef *rx = &DMA2->STREAM[SPI_DMA_RX_STREAM];
+    DMA_Stream_TypeDef *tx = &DMA2->STREAM[SPI_DMA_TX_STREAM];
+    uint32_t channel = (uint32_t)SPI_DMA_CHANNEL << DMA_SxCR_CHSEL_POS;
+
+    // A stale byte in DR would otherwise be the first one the RX stream takes
+    REG_SYNC_READ(SPI1->DR);
+    (void)SPI1->DR;
+
+    DMA2->LIFCR = SPI_DMA_RX_FLAGS | SPI_DMA_TX_FLAGS;
+
+    rx->PAR = DMA_ADDRESS(&SPI1->DR);
+    rx->M0AR = DMA_ADDRESS(frame->rx ? frame->rx : &rx_discard);
+    rx->NDTR = frame->length;
+    rx->CR = channel | DMA_SxCR_DIR_P2M | (frame->rx ? DMA_SxCR_MINC : 0) |
+             DMA_SxCR_PL_HIGH | DMA_SxCR_TCIE | DMA_SxCR_TEIE;
+
+    tx->PAR = DMA_ADDRESS(&SPI1->DR);
+    tx->M0AR = DMA_ADDRESS(frame->tx);
+    tx->NDTR = frame->length;
+    tx->CR = channel | DMA_SxCR_DIR_M2P | DMA_SxCR_MINC | DMA_SxCR_PL_HIGH;
+
+    frame_count++;
+    RFID_SS_PORT->BSRR = (1 << (RFID_SS_PIN + 16)); // SS low
+    REG_SYNC_WRITE(RFID_SS_PORT->BSRR);
+
+    rx->CR |= DMA_SxCR_EN;
+    tx->CR |= DMA_SxCR_EN;
+    SPI1->CR2 |= SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN;
+    REG_SYNC_WRITE(SPI1->CR2);
+}
+
+// Queue a frame; 0 if the queue is full. Safe from interrupts.
+uint8_t SpiDma_Submit(spi_frame_t *frame) {
+    uint32_t primask = irq_save();
+    uint8_t next = (queue_head + 1) & (SPI_DMA_QUEUE_SIZE - 1);
+
+    if (next == queue_tail) {
+        irq_restore(primask);
+        return 0;
+    }
+
+    frame->status = SPI_FRAME_QUEUED;
+    queue[queue_head] = frame;
+    queue_head = next;
+
+    if (!active && !held) {
+        active = 1;
+        SpiDma_Start(frame);
+    }
+
+    irq_restore(primask);
+    return 1;
+}
+
+// The RX stream finishes last: once it has the final byte, the frame is
+// over on the wire too
+void DMA2_Stream0_IRQHandler(void) {
+    REG_SYNC_READ(DMA2->LISR);
+    uint32_t flags = DMA2->LISR >> DMA_FLAG_SHIFT(SPI_DMA_RX_STREAM);
+    if (!(flags & (DMA_FLAG_TCIF | DMA_FLAG_TEIF))) return;
+
+    DMA2->LIFCR = SPI_DMA_RX_FLAGS | SPI_DMA_TX_FLAGS;
+    DMA2->STREAM[SPI_DMA_RX_STREAM].CR &= ~DMA_SxCR_EN;
+    DMA2->STREAM[SPI_DMA_TX_STREAM].CR &= ~DMA_SxCR_EN;
+    SPI1->CR2 &= ~(SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN);
+    RFID_SS_PORT->BSRR = (1 << RFID_SS_PIN);        // SS high
+    REG_SYNC_WRITE(RFID_SS_PORT->BSRR);
+
+    spi_frame_t *frame = queue[queue_tail];
+    queue_tail = (queue_tail + 1) & (SPI_DMA_QUEUE_SIZE - 1);
+
+    // Keep the bus busy before handing the finished frame back
+    if (queue_tail != queue_head && !held) {
+        SpiDma_Start(queue[queue_tail]);
+    } else {
+        active = 0;
+    }
+
+    frame->status = (flags & DMA_FLAG_TEIF) ? SPI_FRAME_ERROR : SPI_FRAME_DONE;
+    if (frame->callback != NULL) {
+        frame->callback(frame);
+    }
+}
+
+// Sleep until the frame has completed. The flag is tested with interrupts
+// masked so a completion between test and WFI still wakes the core; not
+// for use from interrupts or with interrupts masked.
+void SpiDma_Wait(const spi_frame_t *frame) {
+    uint32_t primask = irq_save();
+
+    while (frame->status == SPI_FRAME_QUEUED) {
+        wait_for_interrupt();
+        irq_restore(primask);
+        primask = irq_save();
+    }
+    irq_restore(primask);
+}
+
+// Blocking transfer: waits for a queue slot, then for the frame itself
+uint8_t SpiDma_Transfer(spi_frame_t *frame) {
+    while (!SpiDma_Submit(frame)) {
+        uint32_t primask = irq_save();
+        if (queue_head != queue_tail) {
+            wait_for_interrupt();
+        }
+        irq_restore(primask);
+    }
+
+    SpiDma_Wait(frame);
+    return frame->status == SPI_FRAME_DONE;
+}
+
+uint8_t SpiDma_IsIdle(void) {
+    return !active;
+}
+
+// Wait for the frame on the wire, if any, to finish
+void SpiDma_Quiesce(void) {
+    REG_SYNC_READ(DMA2->STREAM[SPI_DMA_RX_STREAM].CR);
+    while (DMA2->STREAM[SPI_DMA_RX_STREAM].CR & DMA_SxCR_EN) {
+        REG_SYNC_READ(DMA2->STREAM[SPI_DMA_RX_STREAM].CR);
+    }
+    while (SPI1->SR & SPI_SR_BSY);
+}
+
+// Around a clock change: frames submitted from now on, and those chained
+// by the completion interrupt, stay queued until SpiDma_Release. Returns
+// once the frame on the wire has finished at the old clock.
+void SpiDma_Hold(void) {
+    held = 1;
+    SpiDma_Quiesce();
+}
+
+// Start the frames queued while held. Safe with interrupts masked.
+void SpiDma_Release(void) {
+    uint32_t primask = irq_save();
+
+    held = 0;
+    if (!active && queue_tail != queue_head) {
+        active = 1;
+        SpiDma_Start(queue[queue_tail]);
+    }
+    irq_restore(primask);
+}
+
+uint32_t SpiDma_GetFrameCount(void) {
+    return frame_count;
+}
@@ -0,0 +1,255 @@
+#include "storage.h"
+#include "stm32f407xx_registers.h"
+#include "crc.h"
+#include <string.h>
+
+#define STORAGE_MAGIC              0x54534C53UL    // "SLST", a sector's first word
+#define STORAGE_COMMIT             0xC0DE0000UL    // Upper half of a record's last word
+#define STORAGE_ERASED             0xFFFFFFFFUL
+#define STORAGE_HEADER_SIZE        8               // Magic, generation
+#define STORAGE_NO_SECTOR          0xFF
+
+// A record is a header word (length, id, ~id), the data padded to whole
+// words and a commit word carrying the data's CRC, programmed last
+#define STORAGE_RECORD_HEADER(id, length) \
+    ((uint32_t)(length) | ((uint32_t)(id) << 16) | ((uint32_t)(uint8_t)~(id) << 24))
+#define STORAGE_RECORD_SIZE(length) (4 + (((length) + 3) & ~3UL) + 4)
+
+static uint8_t active = STORAGE_NO_SECTOR;  // 0 or 1: sector 10 or 11
+static uint32_t generation = 0;             // Of the active sector, one up per move
+static uint32_t write_offset = 0;           // First free byte of the active sector
+
+static uint32_t Storage_Base(uint8_t sector) {
+    return STORAGE_SECTOR_BASE + sector * STORAGE_SECTOR_SIZE;
+}
+
+static void Storage_Read(uint32_t address, uint8_t *data, uint16_t length) {
+    for (uint16_t i = 0; i < length; i += 4) {
+        uint32_t word = FLASH_WORD(address + i);
+        memcpy(&data[i], &word, (length - i < 4) ? length - i : 4);
+    }
+}
+
+// ==================== Flash programming ====================
+
+static void Storage_Unlock(void) {
+    if (FLASH->CR & FLASH_CR_LOCK) {
+        FLASH->KEYR = FLASH_KEY1;
+        REG_SYNC_WRITE(FLASH->KEYR);
+        FLASH->KEYR = FLASH_KEY2;
+        REG_SYNC_WRITE(FLASH->KEYR);
+    }
+}
+
+static void Storage_Lock(void) {
+    FLASH->CR = FLASH_CR_LOCK;
+    REG_SYNC_WRITE(FLASH->CR);
+}
+
+// 1 when the operation went through; the error flags are write-1-to-clear
+static uint8_t Storage_Wait(void) {
+    REG_SYNC_READ(FLASH->SR);
+    while (FLASH->SR & FLASH_SR_BSY) {
+        REG_SYNC_READ(FLASH->SR);
+    }
+
+    uint32_t errors = FLASH->SR & FLASH_SR_ERRORS;
+    FLASH->SR = errors | FLASH_SR_EOP;
+    return errors == 0;
+}
+
+// The data cache may still hold words from before an erase
+static void Storage_FlushCache(void) {
+    uint32_t acr = FLASH->ACR;
+
+    if (acr & FLASH_ACR_DCEN) {
+        FLASH->ACR = acr & ~FLASH_ACR_DCEN;
+        FLASH->ACR = (acr & ~FLASH_ACR_DCEN) | FLASH_ACR_DCRST;
+        FLASH->ACR = acr;
+    }
+}
+
+static uint8_t Storage_Blank(uint8_t sector) {
+    uint32_t base = Storage_Base(sector);
+
+    for (uint32_t offset = 0; offset < STORAGE_SECTOR_SIZE; offset += 4) {
+        if (FLASH_WORD(base + offset) != STORAGE_ERASED) return 0;
+    }
+    return 1;
+}
+
+static uint8_t Storage_Erase(uint8_t sector) {
+    if (Storage_Blank(sector)) return 1;
+
+    Storage_Unlock();
+    FLASH->CR = FLASH_CR_PSIZE_X32 | FLASH_CR_SER |
+                ((uint32_t)(STORAGE_SECTOR_FIRST + sector) << FLASH_CR_SNB_POS);
+    FLASH->CR |= FLASH_CR_STRT;
+    REG_SYNC_WRITE(FLASH->CR);
+    uint8_t ok = Storage_Wait();
+    Storage_Lock();
+    Storage_FlushCache();
+
+    return ok && Storage_Blank(sector);
+}
+
+// Unlocked flash only
+static uint8_t Storage_Program(uint32_t address, uint32_t value) {
+    FLASH->CR = FLASH_CR_PSIZE_X32 | FLASH_CR_PG;
+    FLASH_WORD(address) = value;
+    REG_SYNC_WRITE(FLASH_WORD(address));
+
+    return Storage_Wait() && FLASH_WORD(address) == value;
+}
+
+// ==================== Records ====================
+
+static uint8_t Storage_Intact(uint32_t record) {
+    uint8_t data[STORAGE_RECORD_MAX];
+    uint16_t length = FLASH_WORD(record) & 0xFFFF;
+
+    Storage_Read(record + 4, data, length);
+    return FLASH_WORD(record + STORAGE_RECORD_SIZE(length) - 4) ==
+           (STORAGE_COMMIT | CRC_CalculateA(data, length));
+}
+
+// Newest intact record of `id` in a sector, 0 if none; *end gets the first
+// free offset. A damaged header ends the walk with the sector taken as full.
+static uint32_t Storage_Scan(uint8_t sector, uint8_t id, uint32_t *end) {
+    uint32_t base = Storage_Base(sector);
+    uint32_t offset = STORAGE_HEADER_SIZE;
+    uint32_t found = 0;
+
+    while (offset + STORAGE_RECORD_SIZE(0) <= STORAGE_SECTOR_SIZE) {
+        uint32_t header = FLASH_WORD(base + offset);
+        if (header == STORAGE_ERASED) break;
+
+        uint16_t length = header & 0xFFFF;
+        uint8_t record_id = (header >> 16) & 0xFF;
+        if ((uint8_t)(header >> 24) != (uint8_t)~record_id || length > STORAGE_RECORD_MAX ||
+            offset + STORAGE_RECORD_SIZE(length) > STORAGE_SECTOR_SIZE) {
+            offset = STORAGE_SECTOR_SIZE;
+            break;
+        }
+
+        if (record_id == id && Storage_Intact(base + offset)) {
+            found = base + offset;
+        }
+        offset += STORAGE_RECORD_SIZE(length);
+    }
+
+    if (end != NULL) *end = offset;
+    return found;
+}
+
+// Unlocked flash only; the space is used up even when programming fails
+static uint8_t Storage_Append(uint32_t address, uint8_t id, const uint8_t *data, uint16_t length) {
+    uint8_t ok = Storage_Program(address, STORAGE_RECORD_HEADER(id, length));
+
+    for (uint16_t i = 0; i < length && ok; i += 4) {
+        uint32_t word = STORAGE_ERASED;
+        memcpy(&word, &data[i], (length - i < 4) ? length - i : 4);
+        ok = Storage_Program(address + 4 + i, word);
+    }
+    return ok && Storage_Program(address + STORAGE_RECORD_SIZE(length) - 4,
+                                 STORAGE_COMMIT | CRC_CalculateA(data, length));
+}
+
+// Sector header: generation first, then the magic that makes it valid
+static uint8_t Storage_Format(uint8_t sector, uint32_t next_generation) {
+    uint32_t base = Storage_Base(sector);
+
+    return Storage_Program(base + 4, next_generation) && Storage_Program(base, STORAGE_MAGIC);
+}
+
+// Newest record of every id into the other sector, then that sector takes over
+static uint8_t Storage_Compact(void) {
+    uint8_t target = active ^ 1;
+    uint32_t offset = STORAGE_HEADER_SIZE;
+    uint8_t data[STORAGE_RECORD_MAX];
+    uint8_t ok;
+
+    if (!Storage_Erase(target)) return 0;
+
+    Storage_Unlock();
+    ok = 1;
+    for (uint8_t id = STORAGE_ID_NONE + 1; id < STORAGE_ID_COUNT && ok; id++) {
+        uint32_t record = Storage_Scan(active, id, NULL);
+        if (record == 0) continue;
+
+        uint16_t length = FLASH_WORD(record) & 0xFFFF;
+        Storage_Read(record + 4, data, length);
+        ok = Storage_Append(Storage_Base(target) + offset, id, data, length);
+        offset += STORAGE_RECORD_SIZE(length);
+    }
+    ok = ok && Storage_Format(target, generation + 1);
+    Storage_Lock();
+    if (!ok) return 0;
+
+    Storage_Erase(active);
+    active = target;
+    generation++;
+    write_offset = offset;
+    return 1;
+}
+
+// Find the active sector, or set one up on a blank device. 0 if flash
+// cannot be programmed; loads and saves then fail.
+uint8_t Storage_Init(void) {
+    uint32_t generations[2];
+    uint8_t valid[2];
+
+    for (uint8_t sector = 0; sector < 2; sector++) {
+        uint32_t base = Storage_Base(sector);
+        generations[sector] = FLASH_WORD(base + 4);
+        valid[sector] = FLASH_WORD(base) == STORAGE_MAGIC && generations[sector] != STORAGE_ERASED;
+    }
+
+    if (valid[0] && valid[1]) {
+        // A move was cut short before the old sector was erased
+        active = ((int32_t)(generations[1] - generations[0]) > 0) ? 1 : 0;
+    } else if (valid[0] || valid[1]) {
+        active = valid[1];
+    } else {
+        active = STORAGE_NO_SECTOR;
+        if (!Storage_Erase(0)) return 0;
+
+        Storage_Unlock();
+        uint8_t ok = Storage_Format(0, 1);
+        Storage_Lock();
+        if (!ok) return 0;
+        active = 0;
+        generations[0] = 1;
+    }
+
+    generation = generations[active];
+    Storage_Scan(active, STORAGE_ID_NONE, &write_offset);
+    return 1;
+}
+
+// 1 and `data` filled when a record of `id` with exactly `length` bytes exists
+uint8_t Storage_Load(uint8_t id, void *data, uint16_t length) {
+    if (active == STORAGE_NO_SECTOR) return 0;
+
+    uint32_t record = Storage_Scan(active, id, NULL);
+    if (record == 0 || (FLASH_WORD(record) & 0xFFFF) != length) return 0;
+
+    Storage_Read(record + 4, data, length);
+    return 1;
+}
+
+uint8_t Storage_Save(uint8_t id, const void *data, uint16_t length) {
+    if (active == STORAGE_NO_SECTOR || id == STORAGE_ID_NONE || id >= STORAGE_ID_COUNT ||
+        length > STORAGE_RECORD_MAX) {
+        return 0;
+    }
+    if (write_offset + STORAGE_RECORD_SIZE(length) > STORAGE_SECTOR_SIZE && !Storage_Compact()) {
+        return 0;
+    }
+
+    Storage_Unlock();
+    uint8_t ok = Storage_Append(Storage_Base(active) + write_offset, id, data, length);
+    Storage_Lock();
+    write_offset += STORAGE_RECORD_SIZE(length);
+    return ok;
+}
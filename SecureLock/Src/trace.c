@@ -0,0 +1,111 @@
+#include "trace.h"
+#include "clock.h"
+#include "profile.h"
+#include "wifi.h"
+#include "utils.h"
+#include <string.h>
+
+#if TRACE_ENABLED
+
+trace_record_t trace_buffer[TRACE_BUFFER_SIZE];
+volatile uint32_t trace_head = 0;      // Records written since boot; the slot is head % size
+volatile uint8_t trace_paused = 0;
+
+void Trace_Init(void) {
+    RCC->APB1ENR |= RCC_APB1ENR_TIM2EN;
+
+    // Free-running 32-bit microsecond counter
+    TRACE_TIMER->CR1 = 0;
+    TRACE_TIMER->ARR = 0xFFFFFFFFUL;
+    Clock_SetMicrosecondTimer(TRACE_TIMER);
+    TRACE_TIMER->SR = 0;
+    TRACE_TIMER->CR1 = TIM_CR1_CEN;
+
+    Clock_RegisterChangeCallback(Trace_ClockChanged);
+
+    trace_head = 0;
+    trace_paused = 0;
+    TRACE(TRACE_EV_BOOT, 0, TRACE_DUMP_VERSION);
+}
+
+// Loading the new prescaler clears the counter, so carry the count across
+// it. The timer runs at the old rate for the few
+// microseconds the switch itself takes.
+void Trace_ClockChanged(uint8_t phase) {
+    if (phase != CLOCK_CHANGE_POST) return;
+
+    REG_SYNC_READ(TRACE_TIMER->CNT);
+    uint32_t count = TRACE_TIMER->CNT;
+    Clock_SetMicrosecondTimer(TRACE_TIMER);
+    TRACE_TIMER->CNT = count;
+    TRACE_TIMER->SR = 0;
+
+    // The first record at the new clock measures what one costs there
+    uint32_t mhz = Clock_GetHCLK() / 1000000UL;
+    PROFILE_SCOPE(Clock_GetHCLK() > HSI_VALUE ? PROF_TRACE_RECORD_PLL : PROF_TRACE_RECORD_HSI);
+    TRACE(TRACE_EV_CLOCK, 0, mhz);
+}
+
+// Called once a second; an uptime marker every TRACE_SYNC_PERIOD_S keeps
+// the gap between records below the timer wrap even when the door is idle
+void Trace_Sync(uint32_t uptime_s) {
+    if (uptime_s % TRACE_SYNC_PERIOD_S != 0) return;
+    TRACE(TRACE_EV_SYNC, uptime_s >> 16, uptime_s);
+}
+
+// Dump in flight: the header, then the ring from `dump_first` on
+static trace_dump_header_t dump_header;
+static uint32_t dump_first;
+static uint16_t dump_length;
+
+// WIFI_SendStream source; the last range ends the dump
+static void Trace_WriteDump(uint16_t offset, uint16_t count) {
+    uint16_t end = offset + count;
+
+    for (; offset < end; offset++) {
+        uint8_t byte;
+        if (offset < sizeof(dump_header)) {
+            byte = ((const uint8_t *)&dump_header)[offset];
+        } else {
+            uint32_t index = offset - sizeof(dump_header);
+            const trace_record_t *record =
+                &trace_buffer[(dump_first + index / sizeof(trace_record_t)) & (TRACE_BUFFER_SIZE - 1)];
+            byte = ((const uint8_t *)record)[index % sizeof(trace_record_t)];
+        }
+        WIFI_SendBytes(&byte, 1);
+    }
+
+    if (end >= dump_length) {
+        trace_paused = 0;
+    }
+}
+
+// Send the ring as one binary payload: header, then the records oldest
+// first. Recording pauses until the wifi task has sent it, so the dump is
+// consistent; the events of the dump itself are not traced. A dump that
+// is still going out is left alone and the request dropped.
+void Trace_Dump(void) {
+    if (WIFI_IsStreaming()) return;
+
+    trace_paused = 1;
+
+    uint32_t written = trace_head;
+    uint32_t count = (written < TRACE_BUFFER_SIZE) ? written : TRACE_BUFFER_SIZE;
+    dump_first = (written - count) & (TRACE_BUFFER_SIZE - 1);
+
+    memcpy(dump_header.magic, TRACE_DUMP_MAGIC, sizeof(dump_header.magic));
+    dump_header.version = TRACE_DUMP_VERSION;
+    dump_header.record_size = sizeof(trace_record_t);
+    dump_header.count = (uint16_t)count;
+    dump_header.written = written;
+    REG_SYNC_READ(TRACE_TIMER->CNT);
+    dump_header.time_us = TRACE_TIMER->CNT;
+    dump_header.uptime_ms = get_tick_count();
+
+    dump_length = sizeof(dump_header) + count * sizeof(trace_record_t);
+    if (!WIFI_SendStream(dump_length, Trace_WriteDump)) {
+        trace_paused = 0;
+    }
+}
+
+#endif // TRACE_ENABLED
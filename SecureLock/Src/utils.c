@@ -1,48 +1,276 @@
 #include "utils.h"
+#include "config.h"
+#include "led.h"
 #include "stm32f407xx_registers.h"
 
-// Global tick counter
-volatile uint32_t tick_counter = 0;
+// Milliseconds since boot, advanced by SysTick_Handler (and by the tickless
+// idle path for the periods it suppresses)
+static volatile uint64_t tick_counter = 0;
+static uint32_t systick_reload = 0;    // SysTick cycles per tick
 uint32_t SystemCoreClock = 16000000; // Default 16MHz
 
+#define TICK_PERIOD_MS     (1000UL / SYSTICK_FREQ)
+#define SYSTICK_MAX_RELOAD 0x00FFFFFFUL
+
 // ==================== DELAY FUNCTIONS ====================
 
-void delay_ms(uint32_t milliseconds) {
-    for (volatile uint32_t i = 0; i < milliseconds * 1600; i++) {
-        __asm__("nop");
-    }
+// Busy-wait delays on the DWT cycle counter, scaled from SystemCoreClock so
+// they hold at any clock speed and optimisation level
+
+void DWT_Init(void) {
+    CoreDebug->DEMCR |= COREDEBUG_DEMCR_TRCENA;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA;
+}
+
+uint32_t get_cycle_count(void) {
+    REG_SYNC_READ(DWT->CYCCNT);
+    return DWT->CYCCNT;
+}
+
+void delay_cycles(uint32_t cycles) {
+    uint32_t start = get_cycle_count();
+    while ((get_cycle_count() - start) < cycles);
+}
+
+void delay_ns(uint32_t nanoseconds) {
+    // Round up so short settles are never cut short
+    uint32_t cycles = (uint32_t)(((uint64_t)nanoseconds * SystemCoreClock + 999999999ULL) / 1000000000ULL);
+    delay_cycles(cycles);
 }
 
 void delay_us(uint32_t microseconds) {
-    for (volatile uint32_t i = 0; i < microseconds * 16; i++) {
-        __asm__("nop");
+    delay_cycles(microseconds * (SystemCoreClock / 1000000UL));
+}
+
+void delay_ms(uint32_t milliseconds) {
+    // One millisecond at a time so CYCCNT wrap-around never matters
+    while (milliseconds--) {
+        delay_us(1000);
     }
 }
 
 void SysTick_Init(uint32_t ticks) {
+    systick_reload = ticks;
+
     SysTick->CTRL = 0;
     SysTick->LOAD = ticks - 1;
     SysTick->VAL = 0;
-    SysTick->CTRL = SYSTICK_CTRL_ENABLE | SYSTICK_CTRL_CLKSOURCE;
+    SysTick->CTRL = SYSTICK_CTRL_ENABLE | SYSTICK_CTRL_TICKINT | SYSTICK_CTRL_CLKSOURCE;
 }
 
-void delay_ms_precise(uint32_t milliseconds) {
-    uint32_t ticks = milliseconds * (SystemCoreClock / 1000);
-    SysTick->LOAD = ticks - 1;
+// Re-derive the SysTick reload after SystemCoreClock changed; called with
+// interrupts masked. The rest of the tick in progress is scaled to the new
+// clock, so get_time_us carries on from where it was.
+void SysTick_UpdateClock(void) {
+    uint32_t reload = SystemCoreClock / SYSTICK_FREQ;
+
+    if (systick_reload == 0) return;
+
+    // Stop with a plain write, as in tick_idle_until
+    SysTick->CTRL = SYSTICK_CTRL_TICKINT | SYSTICK_CTRL_CLKSOURCE;
+    REG_SYNC_WRITE(SysTick->CTRL);
+    REG_SYNC_READ(SysTick->VAL);
+    uint32_t val = (uint32_t)((uint64_t)SysTick->VAL * reload / systick_reload);
+
+    // A zero count has already raised its tick; the next one starts whole
+    SysTick->LOAD = (val != 0) ? val : reload - 1;
     SysTick->VAL = 0;
-    while (!(SysTick->CTRL & SYSTICK_CTRL_COUNTFLAG));
+    REG_SYNC_WRITE(SysTick->VAL);
+    SysTick->CTRL = SYSTICK_CTRL_ENABLE | SYSTICK_CTRL_TICKINT | SYSTICK_CTRL_CLKSOURCE;
+    REG_SYNC_WRITE(SysTick->CTRL);
+    SysTick->LOAD = reload - 1;
+    systick_reload = reload;
+}
+
+void delay_ms_precise(uint32_t milliseconds) {
+    // Sleep on the time base rather than reprogramming SysTick
+    uint64_t deadline = get_tick_count64() + milliseconds;
+    while (!deadline_reached64(deadline)) {
+        wait_for_interrupt();
+    }
 }
 
 // ==================== TIME FUNCTIONS ====================
 
+void SysTick_Handler(void) {
+    tick_counter += TICK_PERIOD_MS;
+    LED_Tick(tick_counter);
+}
+
 uint32_t get_tick_count(void) {
-    return tick_counter;
+    return (uint32_t)get_tick_count64();
+}
+
+uint64_t get_tick_count64(void) {
+    uint32_t primask = irq_save();
+    uint64_t ticks = tick_counter;
+    irq_restore(primask);
+    return ticks;
+}
+
+uint64_t get_time_us(void) {
+    uint64_t ms;
+    uint32_t val;
+
+    // Retry if a tick lands between reading the counter and SysTick->VAL
+    do {
+        ms = get_tick_count64();
+        REG_SYNC_READ(SysTick->VAL);
+        val = SysTick->VAL;
+    } while (ms != get_tick_count64());
+
+    // In an ISR the counter can wrap before SysTick_Handler has run; VAL
+    // is then re-read so that it is certainly from after the wrap
+    REG_SYNC_READ(SCB->ICSR);
+    if (SCB->ICSR & SCB_ICSR_PENDSTSET) {
+        REG_SYNC_READ(SysTick->VAL);
+        val = SysTick->VAL;
+        ms += TICK_PERIOD_MS;
+    }
+
+    uint32_t cycles_per_us = SystemCoreClock / 1000000UL;
+    uint32_t sub_us = (systick_reload - 1 - val) / cycles_per_us;
+    return ms * 1000ULL + sub_us;
 }
 
 uint8_t delay_elapsed(uint32_t start_time, uint32_t delay_ms) {
     return (get_tick_count() - start_time) >= delay_ms;
 }
 
+uint8_t deadline_reached(uint32_t deadline) {
+    return (int32_t)(get_tick_count() - deadline) >= 0;
+}
+
+uint8_t deadline_reached64(uint64_t deadline) {
+    return get_tick_count64() >= deadline;
+}
+
+// Compare the DWT delays against the SysTick time base. Returns 1 when
+// every measured delay is within DELAY_SELFTEST_TOLERANCE_PCT.
+uint8_t delay_selftest(void) {
+    static const uint32_t test_us[] = {100, 1000, 10000};
+    uint8_t passed = 1;
+
+    for (uint8_t i = 0; i < sizeof(test_us) / sizeof(test_us[0]); i++) {
+        uint64_t start = get_time_us();
+        delay_us(test_us[i]);
+        uint32_t measured = (uint32_t)(get_time_us() - start);
+
+        // SysTick resolution is one microsecond, so allow that on top
+        uint32_t tolerance = test_us[i] * DELAY_SELFTEST_TOLERANCE_PCT / 100 + 1;
+        if (measured + tolerance < test_us[i] || measured > test_us[i] + tolerance) {
+            LOG_WARNING("delay_us(%lu) measured %lu us\n", (unsigned long)test_us[i], (unsigned long)measured);
+            passed = 0;
+        }
+    }
+
+    // DWT cycles across whole SysTick ticks must match SystemCoreClock
+    uint64_t tick_start = get_tick_count64();
+    while (get_tick_count64() == tick_start);
+    uint32_t cycles_start = get_cycle_count();
+    uint64_t tick_end = get_tick_count64() + 10;
+    while (get_tick_count64() < tick_end);
+    uint32_t cycles = get_cycle_count() - cycles_start;
+    uint32_t expected = (SystemCoreClock / 1000UL) * 10;
+    uint32_t tolerance = expected * DELAY_SELFTEST_TOLERANCE_PCT / 100;
+    if (cycles + tolerance < expected || cycles > expected + tolerance) {
+        LOG_WARNING("DWT counted %lu cycles in 10 ms, expected %lu\n",
+                    (unsigned long)cycles, (unsigned long)expected);
+        passed = 0;
+    }
+
+    return passed;
+}
+
+// Tickless idle: stretch the SysTick period to cover the time until the next
+// deadline, sleep, then credit the suppressed ticks back to tick_counter.
+// Any other interrupt ends the sleep early; only whole elapsed ticks are
+// credited and the partial tick is carried into the next SysTick period.
+void tick_idle_until(uint64_t deadline) {
+#if TICKLESS_IDLE_ENABLED
+    uint32_t primask = irq_save();
+    uint64_t now = tick_counter;
+
+    if (systick_reload == 0 || deadline <= now + TICK_PERIOD_MS) {
+        irq_restore(primask);
+        wait_for_interrupt();
+        return;
+    }
+
+    // Stop the counter with a plain write: a read-modify-write of CTRL
+    // would clear a COUNTFLAG raised in between
+    SysTick->CTRL = SYSTICK_CTRL_TICKINT | SYSTICK_CTRL_CLKSOURCE;
+    REG_SYNC_WRITE(SysTick->CTRL);
+
+    // A tick that is already pending has to be serviced first
+    REG_SYNC_READ(SCB->ICSR);
+    if (SCB->ICSR & SCB_ICSR_PENDSTSET) {
+        SysTick->CTRL = SYSTICK_CTRL_ENABLE | SYSTICK_CTRL_TICKINT | SYSTICK_CTRL_CLKSOURCE;
+        REG_SYNC_WRITE(SysTick->CTRL);
+        irq_restore(primask);
+        return;
+    }
+
+    uint32_t max_ticks = SYSTICK_MAX_RELOAD / systick_reload;
+    uint32_t sleep_ticks = (uint32_t)((deadline - now) / TICK_PERIOD_MS);
+    if (sleep_ticks > max_ticks) sleep_ticks = max_ticks;
+
+    // Fold the rest of the current tick into the sleep
+    REG_SYNC_READ(SysTick->VAL);
+    uint32_t partial = SysTick->VAL;
+    uint32_t reload = partial + (sleep_ticks - 1) * systick_reload;
+    SysTick->LOAD = reload;
+    SysTick->VAL = 0;
+    REG_SYNC_WRITE(SysTick->VAL);
+    SysTick->CTRL = SYSTICK_CTRL_ENABLE | SYSTICK_CTRL_TICKINT | SYSTICK_CTRL_CLKSOURCE;
+    REG_SYNC_WRITE(SysTick->CTRL);
+
+    // PRIMASK is set, so the wake-up interrupt stays pending until we
+    // have accounted for the time slept
+    wait_for_interrupt();
+
+    // Stop first, then sample COUNTFLAG; reading CTRL clears it
+    SysTick->CTRL = SYSTICK_CTRL_TICKINT | SYSTICK_CTRL_CLKSOURCE;
+    REG_SYNC_WRITE(SysTick->CTRL);
+    REG_SYNC_READ(SysTick->CTRL);
+    uint32_t ctrl = SysTick->CTRL;
+    if (ctrl & SYSTICK_CTRL_COUNTFLAG) {
+        // Slept through the whole period; the pending SysTick credits the last tick
+        tick_counter += (uint64_t)(sleep_ticks - 1) * TICK_PERIOD_MS;
+        SysTick->LOAD = systick_reload - 1;
+        SysTick->VAL = 0;
+        REG_SYNC_WRITE(SysTick->VAL);
+    } else {
+        // Woken early by another interrupt. The first `partial` cycles
+        // finish the tick that was running at entry; whole ticks after it
+        // are credited and the rest carries over.
+        REG_SYNC_READ(SysTick->VAL);
+        uint32_t elapsed = reload - SysTick->VAL;
+        uint32_t whole_ticks = 0;
+        uint32_t remainder;
+        if (elapsed < partial) {
+            remainder = partial - elapsed;
+        } else {
+            whole_ticks = 1 + (elapsed - partial) / systick_reload;
+            remainder = systick_reload - (elapsed - partial) % systick_reload;
+        }
+        tick_counter += (uint64_t)whole_ticks * TICK_PERIOD_MS;
+        SysTick->LOAD = remainder - 1;
+        SysTick->VAL = 0;
+        REG_SYNC_WRITE(SysTick->VAL);
+    }
+    SysTick->CTRL = SYSTICK_CTRL_ENABLE | SYSTICK_CTRL_TICKINT | SYSTICK_CTRL_CLKSOURCE;
+    REG_SYNC_WRITE(SysTick->CTRL);
+    // Restore the nominal period once the partial tick has been loaded
+    SysTick->LOAD = systick_reload - 1;
+    irq_restore(primask);
+#else
+    (void)deadline;
+    wait_for_interrupt();
+#endif
+}
+
 // ==================== STRING FUNCTIONS ====================
 
 size_t strlen(const char *str) {
@@ -112,6 +340,20 @@ void *memmove(void *dest, const void *src, size_t n) {
     return dest;
 }
 
+// 1 when equal; the time taken does not depend on where they differ
+uint8_t secure_memeq(const void *s1, const void *s2, size_t n) {
+    const unsigned char *p1 = s1, *p2 = s2;
+    unsigned char diff = 0;
+    while (n--) diff |= *p1++ ^ *p2++;
+    return diff == 0;
+}
+
+// memset that the compiler cannot drop for a buffer about to go out of scope
+void secure_wipe(void *s, size_t n) {
+    volatile unsigned char *p = s;
+    while (n--) *p++ = 0;
+}
+
 // ==================== CONVERSION FUNCTIONS ====================
 
 char *itoa(int value, char *str, int base) {
@@ -163,6 +405,7 @@ void led_on(uint8_t led) {
         case LED_RED: GPIOD->BSRR = (1 << 14); break;
         case LED_BLUE: GPIOD->BSRR = (1 << 15); break;
     }
+    REG_SYNC_WRITE(GPIOD->BSRR);
 }
 
 void led_off(uint8_t led) {
@@ -172,6 +415,7 @@ void led_off(uint8_t led) {
         case LED_RED: GPIOD->BSRR = (1 << (14 + 16)); break;
         case LED_BLUE: GPIOD->BSRR = (1 << (15 + 16)); break;
     }
+    REG_SYNC_WRITE(GPIOD->BSRR);
 }
 
 void led_toggle(uint8_t led) {
@@ -181,19 +425,19 @@ void led_toggle(uint8_t led) {
         case LED_RED: GPIOD->ODR ^= (1 << 14); break;
         case LED_BLUE: GPIOD->ODR ^= (1 << 15); break;
     }
+    REG_SYNC_WRITE(GPIOD->ODR);
 }
 
+// Queues the blink on the LED pattern engine and returns immediately
 void led_blink(uint8_t led, uint32_t delay_time, uint8_t count) {
-    for (uint8_t i = 0; i < count; i++) {
-        led_on(led);
-        delay_ms(delay_time);
-        led_off(led);
-        if (i < count - 1) delay_ms(delay_time);
-    }
+    if (count == 0) return;
+    LED_Play(led, (uint16_t)delay_time, (uint16_t)delay_time, count, LED_PRIORITY_FEEDBACK);
 }
 
 // ==================== SYSTEM FUNCTIONS ====================
 
+// The host simulation provides its own PRIMASK, WFI and debug output
+#ifndef SECURELOCK_SIM
 void enable_irq(void) {
     __asm__ volatile ("cpsie i");
 }
@@ -206,6 +450,31 @@ void wait_for_interrupt(void) {
     __asm__ volatile ("wfi");
 }
 
+uint32_t irq_save(void) {
+    uint32_t primask;
+    __asm__ volatile ("mrs %0, primask\n\tcpsid i" : "=r" (primask) :: "memory");
+    return primask;
+}
+
+void irq_restore(uint32_t primask) {
+    __asm__ volatile ("msr primask, %0" :: "r" (primask) : "memory");
+}
+#endif // SECURELOCK_SIM
+
+void nvic_enable_irq(uint8_t irqn) {
+    NVIC->ISER[irqn >> 5] = (1UL << (irqn & 0x1F));
+    REG_SYNC_WRITE(NVIC->ISER[irqn >> 5]);
+}
+
+void nvic_disable_irq(uint8_t irqn) {
+    NVIC->ICER[irqn >> 5] = (1UL << (irqn & 0x1F));
+    REG_SYNC_WRITE(NVIC->ICER[irqn >> 5]);
+}
+
+void nvic_set_priority(uint8_t irqn, uint8_t priority) {
+    NVIC->IP[irqn] = (uint8_t)(priority << 4); // 4 priority bits on STM32F4
+}
+
 // ==================== OTHER FUNCTIONS ====================
 
 uint8_t count_bits(uint32_t num) {
@@ -248,13 +517,15 @@ uint8_t crc8(const uint8_t *data, size_t length) {
     return crc;
 }
 
+#ifndef SECURELOCK_SIM
 void debug_printf(const char *format, ...) {
     (void)format;
 }
+#endif
 
 void hex_dump(const uint8_t *data, size_t length) {
     for (size_t i = 0; i < length; i++) {
-        if (i % 16 == 0) debug_printf("\n%04X: ", i);
+        if (i % 16 == 0) debug_printf("\n%04X: ", (unsigned)i);
         debug_printf("%02X ", data[i]);
     }
     debug_printf("\n");
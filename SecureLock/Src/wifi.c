@@ -1,9 +1,176 @@
 #include "wifi.h"
 #include "stm32f407xx_registers.h"
+#include "config.h"
+#include "clock.h"
+#include "profile.h"
+#include "trace.h"
 #include "utils.h"
 #include <stdio.h>
 #include <string.h>
 
+// USART2 receive ring buffer, filled by USART2_IRQHandler so that bytes
+// arriving while the main loop is busy are not overrun
+#define WIFI_RX_BUFFER_SIZE 256
+
+static volatile uint8_t rx_buffer[WIFI_RX_BUFFER_SIZE];
+static volatile uint16_t rx_head = 0;
+static volatile uint16_t rx_tail = 0;
+static volatile uint32_t rx_overflows = 0;
+
+void USART2_IRQHandler(void) {
+    uint32_t sr = USART2->SR;
+
+    if (sr & (USART_SR_RXNE | USART_SR_ORE)) {
+        REG_SYNC_READ(USART2->DR);
+        uint8_t c = (uint8_t)USART2->DR; // Reading DR also clears ORE
+        uint16_t next = (rx_head + 1) % WIFI_RX_BUFFER_SIZE;
+
+        if (next != rx_tail) {
+            rx_buffer[rx_head] = c;
+            rx_head = next;
+        } else {
+            rx_overflows++;
+            TRACE(TRACE_EV_UART_OVERFLOW, 0, rx_overflows);
+        }
+    }
+}
+
+static uint8_t WIFI_ReadByte(char *c) {
+    if (rx_tail == rx_head) {
+        return 0;
+    }
+    *c = (char)rx_buffer[rx_tail];
+    rx_tail = (rx_tail + 1) % WIFI_RX_BUFFER_SIZE;
+    return 1;
+}
+
+uint32_t WIFI_GetRxOverflows(void) {
+    return rx_overflows;
+}
+
+// Lines from the module, without the line break. The CIPSEND prompt "> "
+// never gets one and is returned as the line ">".
+static char rx_line[WIFI_LINE_SIZE];
+static uint8_t rx_line_len = 0;
+
+static uint8_t WIFI_ReadLine(void) {
+    char c;
+
+    while (WIFI_ReadByte(&c)) {
+        if (c == '\r' || c == '\n' || (c == ' ' && rx_line_len == 1 && rx_line[0] == '>')) {
+            if (rx_line_len == 0) {
+                continue;
+            }
+            rx_line[rx_line_len] = '\0';
+            rx_line_len = 0;
+            return 1;
+        }
+        if (rx_line_len < sizeof(rx_line) - 1) {
+            rx_line[rx_line_len++] = c;
+        }
+    }
+    return 0;
+}
+
+typedef enum {
+    WIFI_RESP_NONE,
+    WIFI_RESP_OK,
+    WIFI_RESP_ERROR,            // ERROR, FAIL or SEND FAIL
+    WIFI_RESP_SEND_OK,
+    WIFI_RESP_PROMPT
+} wifi_response_t;
+
+// Final response lines only; the rest (CONNECT, Recv N bytes, echoes) is
+// skipped. Whole lines, so OK inside other text never matches.
+static wifi_response_t WIFI_ParseResponse(const char *text) {
+    if (strcmp(text, "OK") == 0) return WIFI_RESP_OK;
+    if (strcmp(text, "SEND OK") == 0) return WIFI_RESP_SEND_OK;
+    if (strcmp(text, ">") == 0) return WIFI_RESP_PROMPT;
+    if (strcmp(text, "ERROR") == 0 || strcmp(text, "FAIL") == 0 ||
+        strcmp(text, "SEND FAIL") == 0) return WIFI_RESP_ERROR;
+    return WIFI_RESP_NONE;
+}
+
+// Server commands: the lines that are neither responses nor other module
+// output, kept apart so a command arriving mid-send waits for the wifi
+// task instead of being read as a response
+static char commands[WIFI_CMD_QUEUE_SIZE][WIFI_LINE_SIZE];
+static uint8_t command_head = 0;
+static uint8_t command_tail = 0;
+
+static uint8_t WIFI_IsModuleLine(const char *text) {
+    static const char *const prefixes[] = {
+        "AT", "CONNECT", "CLOSED", "ALREADY", "Recv ", "STATUS:", "+CIP",
+        "busy", "WIFI ", "ready"
+    };
+
+    for (uint8_t i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); i++) {
+        if (strncmp(text, prefixes[i], strlen(prefixes[i])) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void WIFI_QueueCommand(const char *text) {
+    uint8_t next = (command_head + 1) % WIFI_CMD_QUEUE_SIZE;
+
+    // Server mode delivers "+IPD,<length>:<data>"
+    if (strncmp(text, "+IPD,", 5) == 0 && strchr(text, ':') != NULL) {
+        text = strchr(text, ':') + 1;
+    }
+    if (next == command_tail) {
+        rx_overflows++; // Lost like a byte the ring had no room for
+        return;
+    }
+    strcpy(commands[command_head], text);
+    command_head = next;
+}
+
+// Next response line; commands read on the way are queued
+static wifi_response_t WIFI_ReadResponse(void) {
+    while (WIFI_ReadLine()) {
+        wifi_response_t response = WIFI_ParseResponse(rx_line);
+        if (response != WIFI_RESP_NONE) {
+            return response;
+        }
+        if (!WIFI_IsModuleLine(rx_line)) {
+            WIFI_QueueCommand(rx_line);
+        }
+    }
+    return WIFI_RESP_NONE;
+}
+
+// Log send in progress, see WIFI_Service
+typedef enum {
+    WIFI_TX_IDLE,
+    WIFI_TX_CONNECT,            // AT+CIPSTART sent
+    WIFI_TX_PROMPT,             // AT+CIPSEND sent, waiting for "> "
+    WIFI_TX_DATA,               // Payload going out
+    WIFI_TX_SENT,               // Waiting for SEND OK
+    WIFI_TX_CLOSE               // AT+CIPCLOSE sent
+} wifi_tx_state_t;
+
+#define WIFI_HOST_LOG              0   // SERVER_HOST, plain-text GET
+#define WIFI_HOST_SECURE           1   // Encrypted log and trace server
+
+static uint8_t tx_queue[WIFI_TX_QUEUE_SIZE];
+static uint16_t tx_head = 0;
+static uint16_t tx_tail = 0;
+static uint32_t tx_dropped = 0;
+
+static wifi_tx_state_t tx_state = WIFI_TX_IDLE;
+static uint32_t tx_deadline;
+static uint8_t tx_host;
+static uint8_t tx_stream;
+static uint16_t tx_length;
+static uint16_t tx_sent;
+
+static wifi_stream_fn stream_write = NULL;
+static uint16_t stream_length;
+
+static uint8_t responsive = 0;  // The module answered the last command
+
 void WIFI_Init(void) {
     // Enable USART2 clock
     RCC->APB1ENR |= (1 << 17); // USART2EN
@@ -16,29 +183,55 @@ void WIFI_Init(void) {
     GPIOD->AFR[0] |= ((7 << 20) | (7 << 24));      // AF7 for USART2
 
     // Configure USART2
-    USART2->BRR = 0x111; // 115200 baud @ 16MHz
+    WIFI_UpdateBaudRate();
+    Clock_RegisterChangeCallback(WIFI_ClockChanged);
     USART2->CR1 = (1 << 13) | (1 << 3) | (1 << 2); // UE, TE, RE
 
+    // Receive through the interrupt-driven ring buffer
+    rx_head = rx_tail = 0;
+    USART2->CR1 |= USART_CR1_RXNEIE;
+    nvic_enable_irq(USART2_IRQn);
+
     // Send AT commands to initialize ESP8266
     WIFI_SendCommand("AT\r\n", 1000);
     WIFI_SendCommand("AT+CWMODE=1\r\n", 2000);
     WIFI_SendCommand("AT+CIPMUX=0\r\n", 1000);
 }
 
+// Derive BRR from the current APB1 clock (16x oversampling, rounded)
+void WIFI_UpdateBaudRate(void) {
+    uint32_t pclk1 = Clock_GetPCLK1();
+    USART2->BRR = (pclk1 + WIFI_BAUDRATE / 2) / WIFI_BAUDRATE;
+}
+
+// Let the byte in flight finish before the clock changes, then re-derive BRR
+void WIFI_ClockChanged(uint8_t phase) {
+    if (phase == CLOCK_CHANGE_PRE) {
+        for (uint32_t i = 0; i < 0x10000UL && !(USART2->SR & USART_SR_TC); i++) {
+            REG_SYNC_READ(USART2->SR);
+        }
+    } else {
+        WIFI_UpdateBaudRate();
+    }
+}
+
 void WIFI_SendChar(char c) {
     // Wait for TX buffer empty
     while (!(USART2->SR & (1 << 7))); // Wait for TXE
 
     // Send character
     USART2->DR = c;
+    REG_SYNC_WRITE(USART2->DR);
 }
 
 char WIFI_ReceiveChar(void) {
-    // Wait for RX buffer not empty
-    while (!(USART2->SR & (1 << 5))); // Wait for RXNE
+    char c;
 
-    // Return received character
-    return USART2->DR;
+    // Wait for a byte from the receive buffer
+    while (!WIFI_ReadByte(&c)) {
+        wait_for_interrupt();
+    }
+    return c;
 }
 
 void WIFI_SendString(const char *str) {
@@ -47,113 +240,232 @@ void WIFI_SendString(const char *str) {
     }
 }
 
+// Start-up commands only: waits for the final OK or ERROR line. Log sends
+// go through the queue below, which WIFI_Service works off without waiting.
 int WIFI_SendCommand(const char *cmd, uint32_t timeout) {
+    PROFILE_SCOPE(PROF_WIFI_SEND_COMMAND);
+    if (tx_state != WIFI_TX_IDLE) {
+        return 0; // Would interleave with a queued send
+    }
     WIFI_SendString(cmd);
 
     uint32_t start = get_tick_count();
-    char response[16] = {0};
-    uint8_t index = 0;
 
     while ((get_tick_count() - start) < timeout) {
-        if (USART2->SR & (1 << 5)) { // RXNE
-            char c = USART2->DR;
-            if (index < sizeof(response) - 1) {
-                response[index++] = c;
-            }
-
-            // Check for OK response
-            if (strstr(response, "OK") != NULL) {
-                return 1;
-            }
-
-            // Check for ERROR response
-            if (strstr(response, "ERROR") != NULL) {
-                return 0;
-            }
+        wifi_response_t response = WIFI_ReadResponse();
+        if (response != WIFI_RESP_NONE) {
+            responsive = 1;
+        }
+        if (response == WIFI_RESP_OK) {
+            return 1;
+        }
+        if (response == WIFI_RESP_ERROR) {
+            return 0;
         }
     }
 
+    responsive = 0;
     return 0;
 }
 
-void WIFI_SendLog(const char *message) {
-    char buffer[128];
+// Queue record: host, 16-bit length, then the payload bytes
+static uint8_t WIFI_Queue(uint8_t host, const uint8_t *data, uint16_t length) {
+    uint16_t used = (uint16_t)(tx_head + WIFI_TX_QUEUE_SIZE - tx_tail) % WIFI_TX_QUEUE_SIZE;
 
-    // Connect to server
-    snprintf(buffer, sizeof(buffer), "AT+CIPSTART=\"TCP\",\"api.thingspeak.com\",80\r\n");
-    WIFI_SendCommand(buffer, 2000);
-
-    // Prepare data
-    snprintf(buffer, sizeof(buffer), "GET /update?api_key=YOUR_API_KEY&field1=%s\r\n", message);
-    uint16_t length = strlen(buffer);
+    if (length == 0 || used + 3 + length >= WIFI_TX_QUEUE_SIZE) {
+        tx_dropped++;
+        return 0;
+    }
 
-    // Start sending data
-    char length_cmd[32];
-    snprintf(length_cmd, sizeof(length_cmd), "AT+CIPSEND=%d\r\n", length);
-    WIFI_SendCommand(length_cmd, 1000);
+    tx_queue[tx_head] = host;
+    tx_queue[(tx_head + 1) % WIFI_TX_QUEUE_SIZE] = (uint8_t)length;
+    tx_queue[(tx_head + 2) % WIFI_TX_QUEUE_SIZE] = (uint8_t)(length >> 8);
+    for (uint16_t i = 0; i < length; i++) {
+        tx_queue[(tx_head + 3 + i) % WIFI_TX_QUEUE_SIZE] = data[i];
+    }
+    tx_head = (tx_head + 3 + length) % WIFI_TX_QUEUE_SIZE;
+    return 1;
+}
 
-    // Send actual data
-    WIFI_SendString(buffer);
-    WIFI_SendChar(0x1A); // Ctrl+Z to send
+void WIFI_SendLog(const char *message) {
+    char buffer[256];               // Request line around a STATUS report
 
-    // Close connection
-    WIFI_SendCommand("AT+CIPCLOSE\r\n", 1000);
+    snprintf(buffer, sizeof(buffer), "GET /update?api_key=" SERVER_API_KEY "&field1=%s\r\n", message);
+    WIFI_Queue(WIFI_HOST_LOG, (const uint8_t *)buffer, strlen(buffer));
 }
 
 void WIFI_SendEncryptedLog(const char *encrypted_data, uint16_t length) {
-    char buffer[64];
+    WIFI_Queue(WIFI_HOST_SECURE, (const uint8_t *)encrypted_data, length);
+}
 
-    // Connect to server
-    snprintf(buffer, sizeof(buffer), "AT+CIPSTART=\"TCP\",\"your-server.com\",80\r\n");
-    WIFI_SendCommand(buffer, 2000);
+// Payload produced by the caller, e.g. a buffer too large to copy into the
+// queue: `write` is called with consecutive ranges until `length` bytes are
+// out and must send each with WIFI_SendBytes. One stream at a time.
+uint8_t WIFI_SendStream(uint16_t length, wifi_stream_fn write) {
+    if (stream_write != NULL || length == 0) {
+        return 0;
+    }
+    stream_length = length;
+    stream_write = write;
+    return 1;
+}
 
-    // Start sending data
-    snprintf(buffer, sizeof(buffer), "AT+CIPSEND=%d\r\n", length);
-    WIFI_SendCommand(buffer, 1000);
+// 1 while a stream is queued or going out
+uint8_t WIFI_IsStreaming(void) {
+    return stream_write != NULL;
+}
 
-    // Send encrypted data
+void WIFI_SendBytes(const uint8_t *data, uint16_t length) {
     for (uint16_t i = 0; i < length; i++) {
-        WIFI_SendChar(encrypted_data[i]);
+        WIFI_SendChar((char)data[i]);
     }
-    WIFI_SendChar(0x1A); // Ctrl+Z to send
+}
 
-    // Close connection
-    WIFI_SendCommand("AT+CIPCLOSE\r\n", 1000);
+static void WIFI_Step(const char *cmd, wifi_tx_state_t next, uint32_t timeout) {
+    WIFI_SendString(cmd);
+    tx_state = next;
+    tx_deadline = get_tick_count() + timeout;
 }
 
-uint8_t WIFI_HasCommand(void) {
-    return (USART2->SR & (1 << 5)); // Check if data available
+// Pick the next payload, the stream first since tracing pauses for it,
+// and connect to its server
+static uint8_t WIFI_BeginSend(void) {
+    char cmd[64];
+
+    if (stream_write != NULL) {
+        tx_host = WIFI_HOST_SECURE;
+        tx_length = stream_length;
+        tx_stream = 1;
+    } else if (tx_head != tx_tail) {
+        tx_host = tx_queue[tx_tail];
+        tx_length = tx_queue[(tx_tail + 1) % WIFI_TX_QUEUE_SIZE] |
+                    (tx_queue[(tx_tail + 2) % WIFI_TX_QUEUE_SIZE] << 8);
+        tx_stream = 0;
+    } else {
+        return 0;
+    }
+    tx_sent = 0;
+
+    snprintf(cmd, sizeof(cmd), "AT+CIPSTART=\"TCP\",\"%s\",%d\r\n",
+             (tx_host == WIFI_HOST_LOG) ? SERVER_HOST : "your-server.com", SERVER_PORT);
+    WIFI_Step(cmd, WIFI_TX_CONNECT, 2000);
+    return 1;
 }
 
-void WIFI_GetCommand(char *buffer, uint16_t max_length) {
-    uint16_t index = 0;
-    uint32_t start_time = get_tick_count();
+// Payload bytes for this run, WIFI_TX_CHUNK at most so the blocking
+// transmit stays short
+static void WIFI_SendChunk(void) {
+    uint16_t count = tx_length - tx_sent;
+    if (count > WIFI_TX_CHUNK) count = WIFI_TX_CHUNK;
+
+    if (tx_stream) {
+        stream_write(tx_sent, count);
+    } else {
+        for (uint16_t i = 0; i < count; i++) {
+            WIFI_SendChar((char)tx_queue[(tx_tail + 3 + tx_sent + i) % WIFI_TX_QUEUE_SIZE]);
+        }
+    }
+    tx_sent += count;
+}
 
-    while (index < max_length - 1) {
-        if (USART2->SR & (1 << 5)) { // RXNE
-            char c = USART2->DR;
-            buffer[index++] = c;
+static void WIFI_EndSend(void) {
+    if (tx_stream) {
+        stream_write = NULL;
+    } else {
+        tx_tail = (tx_tail + 3 + tx_length) % WIFI_TX_QUEUE_SIZE;
+    }
+    tx_state = WIFI_TX_IDLE;
+}
 
-            // Check for end of command (newline or carriage return)
-            if (c == '\n' || c == '\r') {
-                break;
-            }
+// One step of the send in progress; returns 1 if it moved on, so the
+// caller can take the next step in the same run
+static uint8_t WIFI_Advance(void) {
+    char cmd[32];
+    wifi_response_t response = WIFI_RESP_NONE;
+    uint8_t timed_out = 0;
 
-            start_time = get_tick_count(); // Reset timeout on each character
+    if (tx_state == WIFI_TX_IDLE) {
+        return WIFI_BeginSend();
+    }
+
+    if (tx_state == WIFI_TX_DATA) {
+        WIFI_SendChunk();
+        if (tx_sent < tx_length) {
+            return 0;
         }
+        tx_state = WIFI_TX_SENT;
+        tx_deadline = get_tick_count() + 1000;
+        return 1;
+    }
+
+    response = WIFI_ReadResponse();
+    if (response != WIFI_RESP_NONE) {
+        responsive = 1;
+    } else if ((int32_t)(get_tick_count() - tx_deadline) >= 0) {
+        timed_out = 1;
+        responsive = 0;
+    } else {
+        return 0;
+    }
 
-        // Timeout after 100ms of inactivity
-        if ((get_tick_count() - start_time) > 100) {
-            break;
+    switch (tx_state) {
+    case WIFI_TX_CONNECT:
+        // ERROR too: a link left open answers ALREADY CONNECTED, ERROR
+        snprintf(cmd, sizeof(cmd), "AT+CIPSEND=%d\r\n", tx_length);
+        WIFI_Step(cmd, WIFI_TX_PROMPT, 1000);
+        return 1;
+    case WIFI_TX_PROMPT:
+        if (response == WIFI_RESP_PROMPT) {
+            tx_state = WIFI_TX_DATA;
+        } else if (response == WIFI_RESP_ERROR || timed_out) {
+            WIFI_Step("AT+CIPCLOSE\r\n", WIFI_TX_CLOSE, 1000);
+        }
+        return 1;
+    case WIFI_TX_SENT:
+        if (response == WIFI_RESP_SEND_OK || response == WIFI_RESP_ERROR || timed_out) {
+            WIFI_Step("AT+CIPCLOSE\r\n", WIFI_TX_CLOSE, 1000);
+        }
+        return 1;
+    case WIFI_TX_CLOSE:
+        if (response == WIFI_RESP_OK || response == WIFI_RESP_ERROR || timed_out) {
+            WIFI_EndSend();
         }
+        return 1;
+    default:
+        WIFI_EndSend();
+        return 1;
     }
+}
 
-    buffer[index] = '\0'; // Null-terminate
+// Called from the wifi task: works the send queue as far as the module's
+// responses allow, then returns
+void WIFI_Service(void) {
+    for (uint8_t steps = 0; steps < 8 && WIFI_Advance(); steps++) {
+    }
+}
 
-    // Remove trailing whitespace
-    while (index > 0 && (buffer[index-1] == '\n' || buffer[index-1] == '\r' || buffer[index-1] == ' ')) {
-        buffer[--index] = '\0';
+uint32_t WIFI_GetTxDropped(void) {
+    return tx_dropped;
+}
+
+// Responses nobody waits for are dropped; a send in progress reads its
+// own in WIFI_Service
+uint8_t WIFI_HasCommand(void) {
+    if (tx_state == WIFI_TX_IDLE) {
+        while (WIFI_ReadResponse() != WIFI_RESP_NONE) {
+        }
     }
+    return command_head != command_tail;
+}
+
+void WIFI_GetCommand(char *buffer, uint16_t max_length) {
+    buffer[0] = '\0';
+    if (!WIFI_HasCommand()) {
+        return;
+    }
+    strncpy(buffer, commands[command_tail], max_length - 1);
+    buffer[max_length - 1] = '\0';
+    command_tail = (command_tail + 1) % WIFI_CMD_QUEUE_SIZE;
 }
 
 void WIFI_ConnectToAP(const char *ssid, const char *password) {
@@ -162,12 +474,10 @@ void WIFI_ConnectToAP(const char *ssid, const char *password) {
     WIFI_SendCommand(command, 10000); // 10 second timeout for connection
 }
 
+// Whether the module answered its last command; asking it again here
+// would have to wait for the answer
 uint8_t WIFI_IsConnected(void) {
-    WIFI_SendCommand("AT+CIPSTATUS\r\n", 1000);
-
-    // Would need to parse response to check connection status
-    // For simplicity, return true if we can get a response
-    return 1;
+    return responsive;
 }
 
 void WIFI_EnableServerMode(uint16_t port) {